@@ -0,0 +1,321 @@
+#include "Arduino.h"
+
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+
+static uint64_t monotonicMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static const uint64_t startMicros = monotonicMicros();
+
+unsigned long millis(void)
+{
+    return (unsigned long)((monotonicMicros() - startMicros) / 1000);
+}
+
+unsigned long micros(void)
+{
+    return (unsigned long)(monotonicMicros() - startMicros);
+}
+
+void delay(unsigned long ms)
+{
+    usleep(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    usleep(us);
+}
+
+void yield(void)
+{
+}
+
+// String, same growth rules as the Arduino core: malloc/realloc on demand
+
+String::String(const char *cstr) : buffer(0), capacity(0), len(0)
+{
+    if (cstr) {
+        copy(cstr, strlen(cstr));
+    }
+}
+
+String::String(const String &str) : buffer(0), capacity(0), len(0)
+{
+    copy(str.c_str(), str.len);
+}
+
+String::String(String &&rval) : buffer(rval.buffer), capacity(rval.capacity), len(rval.len)
+{
+    rval.buffer = 0;
+    rval.capacity = 0;
+    rval.len = 0;
+}
+
+String::String(char c) : buffer(0), capacity(0), len(0)
+{
+    copy(&c, 1);
+}
+
+String::String(unsigned char value, unsigned char base) : String((unsigned long)value, base) {}
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {}
+
+String::String(int value, unsigned char base) : String((long)value, base) {}
+
+String::String(long value, unsigned char base) : buffer(0), capacity(0), len(0)
+{
+    char buf[2 + 8 * sizeof(long)];
+    if (base == DEC) {
+        snprintf(buf, sizeof(buf), "%ld", value);
+        copy(buf, strlen(buf));
+    } else {
+        *this = String((unsigned long)value, base);
+    }
+}
+
+String::String(unsigned long value, unsigned char base) : buffer(0), capacity(0), len(0)
+{
+    char buf[1 + 8 * sizeof(unsigned long)];
+    char *p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    if (base < 2) {
+        base = DEC;
+    }
+    do {
+        uint8_t digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+    copy(p, strlen(p));
+}
+
+String::~String()
+{
+    free(buffer);
+}
+
+String &String::operator=(const String &rhs)
+{
+    if (this != &rhs) {
+        copy(rhs.c_str(), rhs.len);
+    }
+    return *this;
+}
+
+String &String::operator=(String &&rval)
+{
+    if (this != &rval) {
+        free(buffer);
+        buffer = rval.buffer;
+        capacity = rval.capacity;
+        len = rval.len;
+        rval.buffer = 0;
+        rval.capacity = 0;
+        rval.len = 0;
+    }
+    return *this;
+}
+
+String &String::operator=(const char *cstr)
+{
+    copy(cstr ? cstr : "", cstr ? strlen(cstr) : 0);
+    return *this;
+}
+
+bool String::reserve(unsigned int size)
+{
+    if (buffer && capacity >= size) {
+        return true;
+    }
+    char *grown = (char *)realloc(buffer, size + 1);
+    if (!grown) {
+        return false;
+    }
+    buffer = grown;
+    capacity = size;
+    return true;
+}
+
+void String::copy(const char *cstr, unsigned int length)
+{
+    if (!reserve(length)) {
+        return;
+    }
+    len = length;
+    memmove(buffer, cstr, length);
+    buffer[len] = '\0';
+}
+
+bool String::concat(const char *cstr, unsigned int length)
+{
+    if (length == 0) {
+        return true;
+    }
+    if (!reserve(len + length)) {
+        return false;
+    }
+    memmove(buffer + len, cstr, length);
+    len += length;
+    buffer[len] = '\0';
+    return true;
+}
+
+String operator+(const String &lhs, const String &rhs)
+{
+    String s(lhs);
+    s += rhs;
+    return s;
+}
+
+String operator+(const String &lhs, const char *rhs)
+{
+    String s(lhs);
+    s += rhs;
+    return s;
+}
+
+String operator+(const char *lhs, const String &rhs)
+{
+    String s(lhs);
+    s += rhs;
+    return s;
+}
+
+bool String::startsWith(const String &prefix) const
+{
+    return prefix.len <= len && strncmp(c_str(), prefix.c_str(), prefix.len) == 0;
+}
+
+void String::getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index) const
+{
+    if (!bufsize || !buf) {
+        return;
+    }
+    if (index >= len) {
+        buf[0] = 0;
+        return;
+    }
+    unsigned int n = bufsize - 1;
+    if (n > len - index) {
+        n = len - index;
+    }
+    memcpy(buf, buffer + index, n);
+    buf[n] = 0;
+}
+
+String String::substring(unsigned int left, unsigned int right) const
+{
+    if (left > right) {
+        unsigned int t = left;
+        left = right;
+        right = t;
+    }
+    if (left >= len) {
+        return String();
+    }
+    if (right > len) {
+        right = len;
+    }
+    String s;
+    s.copy(buffer + left, right - left);
+    return s;
+}
+
+void String::toUpperCase()
+{
+    for (unsigned int i = 0; i < len; i++) {
+        buffer[i] = toupper((unsigned char)buffer[i]);
+    }
+}
+
+void String::trim()
+{
+    if (!len) {
+        return;
+    }
+    unsigned int begin = 0;
+    while (begin < len && isspace((unsigned char)buffer[begin])) {
+        begin++;
+    }
+    unsigned int end = len;
+    while (end > begin && isspace((unsigned char)buffer[end - 1])) {
+        end--;
+    }
+    len = end - begin;
+    memmove(buffer, buffer + begin, len);
+    buffer[len] = '\0';
+}
+
+// Print
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base == DEC && n < 0) {
+        size_t t = print('-');
+        return t + print((unsigned long)-n, DEC);
+    }
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char buf[1 + 8 * sizeof(unsigned long)];
+    char *p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    if (base < 2) {
+        base = DEC;
+    }
+    do {
+        uint8_t digit = n % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        n /= base;
+    } while (n);
+    return write(p);
+}
+
+size_t Print::print(double n, int digits)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0) {
+        return 0;
+    }
+    return write((const uint8_t *)buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    return fwrite(buffer, 1, size, stdout);
+}
@@ -0,0 +1,154 @@
+#ifndef ARDUINO_NATIVE_H
+#define ARDUINO_NATIVE_H
+
+// Enough of the Arduino core to build the NDEF and PN532 libraries on a host
+// machine (pio test -e native). Serial prints to stdout, there is no hardware.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#define ARDUINO_ARCH_NATIVE 1
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+#define pgm_read_word_near(addr) pgm_read_word(addr)
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+class String
+{
+public:
+    String(const char *cstr = "");
+    String(const String &str);
+    String(String &&rval);
+    explicit String(char c);
+    explicit String(unsigned char value, unsigned char base = DEC);
+    explicit String(int value, unsigned char base = DEC);
+    explicit String(unsigned int value, unsigned char base = DEC);
+    explicit String(long value, unsigned char base = DEC);
+    explicit String(unsigned long value, unsigned char base = DEC);
+    ~String();
+
+    String &operator=(const String &rhs);
+    String &operator=(String &&rval);
+    String &operator=(const char *cstr);
+
+    bool concat(const char *cstr, unsigned int length);
+    String &operator+=(const String &rhs) { concat(rhs.buffer, rhs.len); return *this; }
+    String &operator+=(const char *cstr) { concat(cstr, strlen(cstr)); return *this; }
+    String &operator+=(char c) { concat(&c, 1); return *this; }
+
+    friend String operator+(const String &lhs, const String &rhs);
+    friend String operator+(const String &lhs, const char *rhs);
+    friend String operator+(const char *lhs, const String &rhs);
+
+    bool operator==(const String &rhs) const { return equals(rhs); }
+    bool operator==(const char *cstr) const { return strcmp(c_str(), cstr) == 0; }
+    bool operator!=(const String &rhs) const { return !equals(rhs); }
+    bool equals(const String &s) const { return len == s.len && strcmp(c_str(), s.c_str()) == 0; }
+    bool startsWith(const String &prefix) const;
+
+    char charAt(unsigned int index) const { return index < len ? buffer[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    void getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index = 0) const;
+    const char *c_str() const { return buffer ? buffer : ""; }
+    unsigned int length() const { return len; }
+
+    String substring(unsigned int left) const { return substring(left, len); }
+    String substring(unsigned int left, unsigned int right) const;
+    void toUpperCase();
+    void trim();
+    long toInt() const { return atol(c_str()); }
+
+private:
+    char *buffer;
+    unsigned int capacity;
+    unsigned int len;
+
+    bool reserve(unsigned int size);
+    void copy(const char *cstr, unsigned int length);
+};
+
+class Print;
+
+class Printable
+{
+public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+    size_t print(const Printable &p) { return p.printTo(*this); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T &value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(const T &value, int format) { size_t n = print(value, format); return n + println(); }
+
+    size_t printf(const char *format, ...);
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+};
+
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long) {}
+    void end() {}
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
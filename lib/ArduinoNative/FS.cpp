@@ -0,0 +1,132 @@
+#include "FS.h"
+
+#include <string.h>
+
+namespace fs
+{
+
+size_t File::size() const
+{
+    return fs ? fs->files[index].size : 0;
+}
+
+bool File::seek(uint32_t pos)
+{
+    if (!fs || pos > fs->files[index].size)
+    {
+        return false;
+    }
+    position = pos;
+    return true;
+}
+
+size_t File::read(uint8_t *buf, size_t size)
+{
+    if (!fs)
+    {
+        return 0;
+    }
+    uint32_t length = fs->files[index].size;
+    uint32_t available = position < length ? length - position : 0;
+    if (size > available)
+    {
+        size = available;
+    }
+    memcpy(buf, fs->files[index].data + position, size);
+    position += size;
+    return size;
+}
+
+// short when the file is full
+size_t File::write(const uint8_t *buf, size_t size)
+{
+    if (!fs)
+    {
+        return 0;
+    }
+    if (size > NATIVE_FS_FILE_SIZE - position)
+    {
+        size = NATIVE_FS_FILE_SIZE - position;
+    }
+    memcpy(fs->files[index].data + position, buf, size);
+    position += size;
+    if (position > fs->files[index].size)
+    {
+        fs->files[index].size = position;
+    }
+    return size;
+}
+
+FS::FS() : renameOver(true)
+{
+    memset(files, 0, sizeof(files));
+}
+
+int FS::find(const char *path)
+{
+    for (int i = 0; i < NATIVE_FS_FILES; i++)
+    {
+        if (files[i].used && strcmp(files[i].path, path) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+File FS::open(const char *path, const char *mode)
+{
+    int i = find(path);
+    if (mode[0] != 'w')
+    {
+        return i < 0 ? File() : File(this, i);
+    }
+    if (i < 0)
+    {
+        for (i = 0; i < NATIVE_FS_FILES && files[i].used; i++)
+        {
+        }
+        if (i == NATIVE_FS_FILES || strlen(path) >= NATIVE_FS_PATH)
+        {
+            return File();
+        }
+        files[i].used = true;
+        strcpy(files[i].path, path);
+    }
+    files[i].size = 0;
+    return File(this, i);
+}
+
+bool FS::exists(const char *path)
+{
+    return find(path) >= 0;
+}
+
+bool FS::remove(const char *path)
+{
+    int i = find(path);
+    if (i < 0)
+    {
+        return false;
+    }
+    files[i].used = false;
+    return true;
+}
+
+bool FS::rename(const char *pathFrom, const char *pathTo)
+{
+    int from = find(pathFrom);
+    int to = find(pathTo);
+    if (from < 0 || strlen(pathTo) >= NATIVE_FS_PATH || (to >= 0 && !renameOver))
+    {
+        return false;
+    }
+    if (to >= 0 && to != from)
+    {
+        files[to].used = false;
+    }
+    strcpy(files[from].path, pathTo);
+    return true;
+}
+
+}
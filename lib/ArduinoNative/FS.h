@@ -0,0 +1,72 @@
+#ifndef ARDUINO_NATIVE_FS_H
+#define ARDUINO_NATIVE_FS_H
+
+// The part of the ESP32 FS API (fs::FS, fs::File) the PN532 library uses,
+// for host builds. An FS keeps its files in RAM; renameOver = false makes
+// rename() fail on an existing file like SPIFFS does.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NATIVE_FS_FILES      4
+#define NATIVE_FS_PATH       32
+#define NATIVE_FS_FILE_SIZE  4096
+
+namespace fs
+{
+
+class FS;
+
+class File
+{
+public:
+    File() : fs(0), index(-1), position(0) { }
+
+    operator bool() const { return fs != 0; }
+
+    size_t size() const;
+    bool seek(uint32_t pos);
+    size_t read(uint8_t *buf, size_t size);
+    size_t write(const uint8_t *buf, size_t size);
+    void close() { fs = 0; }
+
+private:
+    friend class FS;
+    File(FS *owner, int file) : fs(owner), index(file), position(0) { }
+
+    FS *fs;
+    int index;
+    uint32_t position;
+};
+
+class FS
+{
+public:
+    FS();
+
+    // "r" opens an existing file, "w" creates or truncates one
+    File open(const char *path, const char *mode = "r");
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *pathFrom, const char *pathTo);
+
+    bool renameOver;
+
+private:
+    friend class File;
+
+    struct Entry
+    {
+        bool used;
+        char path[NATIVE_FS_PATH];
+        uint8_t data[NATIVE_FS_FILE_SIZE];
+        uint32_t size;
+    };
+    Entry files[NATIVE_FS_FILES];
+
+    int find(const char *path);
+};
+
+}
+
+#endif
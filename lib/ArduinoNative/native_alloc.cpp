@@ -0,0 +1,160 @@
+#include "native_alloc.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+}
+
+static NativeAllocStats stats;
+
+// Each block carries its requested size in front so free can account for it
+struct BlockHeader
+{
+    size_t size;
+    size_t padding; // keeps the user pointer 16 byte aligned
+};
+
+static void *track(BlockHeader *block, size_t size)
+{
+    if (!block) {
+        return 0;
+    }
+    block->size = size;
+    stats.allocations++;
+    stats.bytesAllocated += size;
+    stats.bytesInUse += size;
+    if (stats.bytesInUse > stats.peakBytesInUse) {
+        stats.peakBytesInUse = stats.bytesInUse;
+    }
+    return block + 1;
+}
+
+static BlockHeader *untrack(void *ptr)
+{
+    BlockHeader *block = (BlockHeader *)ptr - 1;
+    stats.frees++;
+    stats.bytesInUse -= block->size;
+    return block;
+}
+
+extern "C" void *__wrap_malloc(size_t size)
+{
+    return track((BlockHeader *)__real_malloc(sizeof(BlockHeader) + size), size);
+}
+
+extern "C" void *__wrap_calloc(size_t count, size_t size)
+{
+    if (size && count > (size_t)-1 / size) {
+        return 0;
+    }
+    return track((BlockHeader *)__real_calloc(1, sizeof(BlockHeader) + count * size), count * size);
+}
+
+extern "C" void __wrap_free(void *ptr)
+{
+    if (ptr) {
+        __real_free(untrack(ptr));
+    }
+}
+
+extern "C" void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return __wrap_malloc(size);
+    }
+    if (!size) {
+        __wrap_free(ptr);
+        return 0;
+    }
+
+    BlockHeader *old = (BlockHeader *)ptr - 1;
+    size_t oldSize = old->size;
+    BlockHeader *block = (BlockHeader *)__real_realloc(old, sizeof(BlockHeader) + size);
+    if (!block) {
+        return 0;
+    }
+
+    // a reallocation that grows the block counts as a new allocation
+    block->size = size;
+    stats.bytesInUse = stats.bytesInUse - oldSize + size;
+    if (size > oldSize) {
+        stats.allocations++;
+        stats.frees++;
+        stats.bytesAllocated += size;
+    }
+    if (stats.bytesInUse > stats.peakBytesInUse) {
+        stats.peakBytesInUse = stats.bytesInUse;
+    }
+    return block + 1;
+}
+
+NativeAllocStats nativeAllocStats(void)
+{
+    return stats;
+}
+
+void nativeAllocReset(void)
+{
+    size_t inUse = stats.bytesInUse;
+    memset(&stats, 0, sizeof(stats));
+    stats.bytesInUse = inUse;
+    stats.peakBytesInUse = inUse;
+}
+
+void nativeAllocResetPeak(void)
+{
+    stats.peakBytesInUse = stats.bytesInUse;
+}
+
+// libstdc++ calls the unwrapped malloc, so new and delete have to be
+// replaced for C++ allocations to be counted
+
+void *operator new(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
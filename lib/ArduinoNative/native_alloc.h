@@ -0,0 +1,30 @@
+#ifndef NATIVE_ALLOC_H
+#define NATIVE_ALLOC_H
+
+// Heap accounting for host builds. malloc, calloc, realloc and free are
+// wrapped at link time (-Wl,--wrap=..., see [env:native] in platformio.ini)
+// and operator new/delete are routed through them, so every allocation the
+// libraries make is counted. Needs a GNU compatible linker.
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct NativeAllocStats
+{
+    uint32_t allocations;   // malloc, calloc, new and growing reallocs
+    uint32_t frees;
+    size_t bytesAllocated;  // total requested, never decreases
+    size_t bytesInUse;
+    size_t peakBytesInUse;
+};
+
+// snapshot of the counters since start or the last reset
+NativeAllocStats nativeAllocStats(void);
+
+// zero the counters, bytesInUse is kept so the peak stays meaningful
+void nativeAllocReset(void);
+
+// restart peakBytesInUse from the current bytesInUse, counters are kept
+void nativeAllocResetPeak(void);
+
+#endif
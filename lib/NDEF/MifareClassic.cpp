@@ -1,14 +1,31 @@
 #include "MifareClassic.h"
 
-#define BLOCK_SIZE 16
 #define LONG_TLV_SIZE 4
 #define SHORT_TLV_SIZE 2
 
-#define MIFARE_CLASSIC ("Mifare Classic")
+#define NR_SHORTSECTOR          (32)    // Number of short sectors on Mifare 1K/4K
+#define NR_LONGSECTOR           (8)     // Number of long sectors on Mifare 4K
+#define NR_BLOCK_OF_SHORTSECTOR (4)     // Number of blocks in a short sector
+#define NR_BLOCK_OF_LONGSECTOR  (16)    // Number of blocks in a long sector
+
+#define MAD_DA      (0x80)  // general purpose byte: the tag has a MAD
+#define MAD_ADV     (0x03)  // general purpose byte: MAD version
+#define MAD2_SECTOR (16)
 
-MifareClassic::MifareClassic(PN532& nfcShield)
+#define TLV_NULL            (0x00)
+#define TLV_NDEF            (0x03)
+#define TLV_TERMINATOR      (0xFE)
+
+MifareClassic::MifareClassic(PN532Base& nfcShield)
 {
   _nfcShield = &nfcShield;
+  _skippedBlocks = 0;
+  _ndefSectors = 0;
+  _madUidLength = 0;
+  _bufferedBlock = -1;
+  _readOnly = false;
+  _locked = false;
+  _tlvStart = 0;
 }
 
 MifareClassic::~MifareClassic()
@@ -17,95 +34,47 @@ MifareClassic::~MifareClassic()
 
 NfcTag MifareClassic::read(byte *uid, unsigned int uidLength)
 {
-    uint8_t key[6] = { 0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
-    int currentBlock = 4;
-    int messageStartIndex = 0;
-    int messageLength = 0;
-    byte data[BLOCK_SIZE];
+    int messageStartIndex;
+    int messageLength;
+    int authenticatedSector = -1;
 
-    // read first block to get message length
-    int success = _nfcShield->mifareclassic_AuthenticateBlock(uid, uidLength, currentBlock, 0, key);
-    if (success)
-    {
-        success = _nfcShield->mifareclassic_ReadDataBlock(currentBlock, data);
-        if (success)
-        {
-            if (!decodeTlv(data, messageLength, messageStartIndex)) {
-                return NfcTag(uid, uidLength, "ERROR"); // TODO should the error message go in NfcTag?
-            }
-        }
-        else
-        {
-            Serial.print(F("Error. Failed read block "));Serial.println(currentBlock);
-            return NfcTag(uid, uidLength, MIFARE_CLASSIC);
-        }
-    }
-    else
+    if (!findNdefTlv(uid, uidLength, messageLength, messageStartIndex, authenticatedSector))
     {
         Serial.println(F("Tag is not NDEF formatted."));
         // TODO set tag.isFormatted = false
         return NfcTag(uid, uidLength, MIFARE_CLASSIC);
     }
 
-    // this should be nested in the message length loop
-    int index = 0;
-    int bufferSize = getBufferSize(messageLength);
-    uint8_t buffer[bufferSize];
-
     #ifdef MIFARE_CLASSIC_DEBUG
     Serial.print(F("Message Length "));Serial.println(messageLength);
-    Serial.print(F("Buffer Size "));Serial.println(bufferSize);
+    Serial.print(F("Message Start "));Serial.println(messageStartIndex);
     #endif
 
-    while (index < bufferSize)
+    if (messageLength == 0) // data is 0x03 0x00 0xFE
     {
+        NdefMessage message = NdefMessage();
+        message.addEmptyRecord();
+        NfcTag tag = NfcTag(uid, uidLength, MIFARE_CLASSIC, message);
+        describeTag(tag, messageLength, messageStartIndex);
+        return tag;
+    }
 
-        // authenticate on every sector
-        if (_nfcShield->mifareclassic_IsFirstBlock(currentBlock))
-        {
-            success = _nfcShield->mifareclassic_AuthenticateBlock(uid, uidLength, currentBlock, 0, key);
-            if (!success)
-            {
-                Serial.print(F("Error. Block Authentication failed for "));Serial.println(currentBlock);
-                // TODO error handling
-            }
-        }
-
-        // read the data
-        success = _nfcShield->mifareclassic_ReadDataBlock(currentBlock, &buffer[index]);
-        if (success)
-        {
-            #ifdef MIFARE_CLASSIC_DEBUG
-            Serial.print(F("Block "));Serial.print(currentBlock);Serial.print(" ");
-            _nfcShield->PrintHexChar(&buffer[index], BLOCK_SIZE);
-            #endif
-        }
-        else
-        {
-            Serial.print(F("Read failed "));Serial.println(currentBlock);
-            // TODO handle errors here
-        }
-
-        index += BLOCK_SIZE;
-        currentBlock++;
-
-        // skip the trailer block
-        if (_nfcShield->mifareclassic_IsTrailerBlock(currentBlock))
-        {
-            #ifdef MIFARE_CLASSIC_DEBUG
-            Serial.print(F("Skipping block "));Serial.println(currentBlock);
-            #endif
-            currentBlock++;
-        }
+    byte buffer[messageLength];
+    if (!readData(uid, uidLength, messageStartIndex, buffer, messageLength, authenticatedSector))
+    {
+        return NfcTag(uid, uidLength, MIFARE_CLASSIC);
     }
 
-    return NfcTag(uid, uidLength, MIFARE_CLASSIC, &buffer[messageStartIndex], messageLength);
+    NfcTag tag = NfcTag(uid, uidLength, MIFARE_CLASSIC, buffer, messageLength);
+    describeTag(tag, messageLength, messageStartIndex);
+    return tag;
 }
 
-int MifareClassic::getBufferSize(int messageLength)
+// the data bytes before the NDEF TLV (tlvStart), the TLV and its terminator
+int MifareClassic::getBufferSize(int tlvStart, int messageLength)
 {
 
-    int bufferSize = messageLength;
+    int bufferSize = tlvStart + messageLength;
 
     // TLV header is 2 or 4 bytes, TLV terminator is 1 byte.
     if (messageLength < 0xFF)
@@ -126,63 +95,287 @@ int MifareClassic::getBufferSize(int messageLength)
     return bufferSize;
 }
 
-// skip null tlvs (0x0) before the real message
-// technically unlimited null tlvs, but we assume
-// T & L of TLV in the first block we read
-int MifareClassic::getNdefStartIndex(byte *data)
+static int sectorOfBlock(int block)
 {
+    if (block < NR_SHORTSECTOR * NR_BLOCK_OF_SHORTSECTOR)
+    {
+        return block / NR_BLOCK_OF_SHORTSECTOR;
+    }
+    return NR_SHORTSECTOR + (block - NR_SHORTSECTOR * NR_BLOCK_OF_SHORTSECTOR) / NR_BLOCK_OF_LONGSECTOR;
+}
+
+static int firstBlockOfSector(int sector)
+{
+    if (sector < NR_SHORTSECTOR)
+    {
+        return sector * NR_BLOCK_OF_SHORTSECTOR;
+    }
+    return NR_SHORTSECTOR * NR_BLOCK_OF_SHORTSECTOR + (sector - NR_SHORTSECTOR) * NR_BLOCK_OF_LONGSECTOR;
+}
+
+// blocks of a sector that hold data, the trailer does not
+static int dataBlocksOfSector(int sector)
+{
+    return (sector < NR_SHORTSECTOR ? NR_BLOCK_OF_SHORTSECTOR : NR_BLOCK_OF_LONGSECTOR) - 1;
+}
+
+// the NDEF application, 0x03E1, as formatNDEF writes it to the MAD
+static bool isNdefAid(const byte *aid)
+{
+    return aid[0] == 0x03 && aid[1] == 0xE1;
+}
+
+// Finds the sectors of the NDEF application in the MAD. MAD1 in sector 0
+// covers sectors 1 - 15, MAD2 in sector 16 of a 4K tag covers 17 - 39.
+// Tags without a readable MAD are taken to be laid out like formatNDEF
+// does, sectors 1 - 15.
+boolean MifareClassic::readMad(byte *uid, unsigned int uidLength)
+{
+    uint8_t key[6] = { 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5 }; // MAD key A
+    byte mad[3 * BLOCK_SIZE];
+    byte gpb;
 
-    for (int i = 0; i < BLOCK_SIZE; i++)
+    if (_ndefSectors && uidLength == _madUidLength && memcmp(uid, _madUid, uidLength) == 0)
+    {
+        return true;
+    }
+    setNdefSectors(0, uid, uidLength);
+
+    boolean success = _nfcShield->mifareclassic_AuthenticateBlock(uid, uidLength, 0, 0, key);
+    if (success)
     {
-        if (data[i] == 0x0)
+        // the general purpose byte in the trailer says which MAD there is
+        success = _nfcShield->mifareclassic_ReadDataBlock(3, mad);
+        gpb = mad[9];
+        success = success && (gpb & MAD_DA) &&
+                  _nfcShield->mifareclassic_ReadDataBlock(1, &mad[0]) &&
+                  _nfcShield->mifareclassic_ReadDataBlock(2, &mad[BLOCK_SIZE]);
+    }
+    else
+    {
+        // a failed authentication halts the card, select it again
+        unsigned int iii = uidLength;
+        _nfcShield->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, (uint8_t*)&iii);
+    }
+
+    if (!success)
+    {
+        #ifdef MIFARE_CLASSIC_DEBUG
+        Serial.println(F("No MAD, using sectors 1 - 15"));
+        #endif
+        _ndefSectors = 0xFFFE;
+        return true;
+    }
+
+    // CRC and info byte, then one AID per sector
+    for (int sector = 1; sector < MAD2_SECTOR; sector++)
+    {
+        if (isNdefAid(&mad[2 * sector]))
         {
-            // do nothing, skip
+            _ndefSectors |= (uint64_t)1 << sector;
         }
-        else if (data[i] == 0x3)
+    }
+
+    if ((gpb & MAD_ADV) == 2)
+    {
+        int block = firstBlockOfSector(MAD2_SECTOR);
+        success = _nfcShield->mifareclassic_AuthenticateBlock(uid, uidLength, block, 0, key) &&
+                  _nfcShield->mifareclassic_ReadDataBlock(block, &mad[0]) &&
+                  _nfcShield->mifareclassic_ReadDataBlock(block + 1, &mad[BLOCK_SIZE]) &&
+                  _nfcShield->mifareclassic_ReadDataBlock(block + 2, &mad[2 * BLOCK_SIZE]);
+        if (!success)
         {
-            return i;
+            Serial.println(F("Error. Failed to read MAD2."));
+            unsigned int iii = uidLength;
+            _nfcShield->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, (uint8_t*)&iii);
         }
-        else
+        for (int sector = MAD2_SECTOR + 1; success && sector < NR_SHORTSECTOR + NR_LONGSECTOR; sector++)
         {
-            Serial.print("Unknown TLV ");Serial.println(data[i], HEX);
-            return -2;
+            if (isNdefAid(&mad[2 * (sector - MAD2_SECTOR)]))
+            {
+                _ndefSectors |= (uint64_t)1 << sector;
+            }
         }
     }
 
-    return -1;
+    #ifdef MIFARE_CLASSIC_DEBUG
+    Serial.print(F("NDEF sectors 0x"));Serial.println((unsigned long)_ndefSectors, HEX);
+    #endif
+
+    if (_ndefSectors == 0)
+    {
+        Serial.println(F("Error. No NDEF sectors in the MAD."));
+        return false;
+    }
+    return true;
+}
+
+uint64_t MifareClassic::getNdefSectors()
+{
+    return _ndefSectors;
+}
+
+void MifareClassic::setNdefSectors(uint64_t sectors, byte *uid, unsigned int uidLength)
+{
+    _ndefSectors = sectors;
+    _madUidLength = uidLength <= sizeof(_madUid) ? uidLength : 0;
+    memcpy(_madUid, uid, _madUidLength);
+}
+
+void MifareClassic::describeTag(NfcTag& tag, int messageLength, int messageStartIndex)
+{
+    tag.setCapacity(getDataBlockCount() * BLOCK_SIZE, messageStartIndex + messageLength + 1);
+    tag.setReadOnly(_readOnly, _locked);
 }
 
-// Decode the NDEF data length from the Mifare TLV
-// Leading null TLVs (0x0) are skipped
-// Assuming T & L of TLV will be in the first block
-// messageLength and messageStartIndex written to the parameters
-// success or failure status is returned
-//
-// { 0x3, LENGTH }
-// { 0x3, 0xFF, LENGTH, LENGTH }
-bool MifareClassic::decodeTlv(byte *data, int &messageLength, int &messageStartIndex)
+// Access to the data blocks, from the trailer of the first NDEF sector.
+// Key A can only write blocks with access bits C1 C2 C3 = 000, the general
+// purpose byte of an NDEF sector grants write access in its low two bits.
+boolean MifareClassic::readAccess(byte *uid, unsigned int uidLength, int &authenticatedSector)
 {
-    int i = getNdefStartIndex(data);
+    byte data[BLOCK_SIZE];
+    int trailer = getDataBlock(0);
+    while (!_nfcShield->mifareclassic_IsTrailerBlock(trailer))
+    {
+        trailer++;
+    }
 
-    if (i < 0 || data[i] != 0x3)
+    if (!authenticateSector(uid, uidLength, trailer, authenticatedSector) ||
+        !_nfcShield->mifareclassic_ReadDataBlock(trailer, data))
     {
-        Serial.println(F("Error. Can't decode message length."));
+        Serial.print(F("Error. Failed read block "));Serial.println(trailer);
         return false;
     }
-    else
+
+    _locked = false;
+    for (int i = 0; i < 3; i++)
     {
-        if (data[i+1] == 0xFF)
+        byte c1 = (data[7] >> (4 + i)) & 1;
+        byte c2 = (data[8] >> i) & 1;
+        byte c3 = (data[8] >> (4 + i)) & 1;
+        if (c1 | c2 | c3)
+        {
+            _locked = true;
+        }
+    }
+    _readOnly = _locked || (data[9] & 0x03) != 0;
+
+    #ifdef MIFARE_CLASSIC_DEBUG
+    Serial.print(F("Access bits "));_nfcShield->PrintHex(&data[6], 4);
+    #endif
+    return true;
+}
+
+// Walks the TLVs from the start of the NDEF sectors. NULL TLVs, lock and
+// memory control TLVs and proprietary TLVs before the NDEF TLV are skipped,
+// a TLV can span blocks. messageStartIndex counts data bytes, see readData.
+boolean MifareClassic::findNdefTlv(byte *uid, unsigned int uidLength, int &messageLength, int &messageStartIndex, int &authenticatedSector)
+{
+    _bufferedBlock = -1; // the tag may have changed since the last read
+    if (!readMad(uid, uidLength) || !readAccess(uid, uidLength, authenticatedSector))
+    {
+        return false;
+    }
+
+    int size = getDataBlockCount() * BLOCK_SIZE;
+    int index = 0;
+    byte tlv[4]; // T, then L as 1 or 3 bytes
+
+    while (index < size)
+    {
+        if (!readData(uid, uidLength, index, tlv, 1, authenticatedSector))
+        {
+            return false;
+        }
+        if (tlv[0] == TLV_NULL)
         {
-            messageLength = ((0xFF & data[i+2]) << 8) | (0xFF & data[i+3]);
-            messageStartIndex = i + LONG_TLV_SIZE;
+            index++;
+            continue;
+        }
+        if (tlv[0] == TLV_TERMINATOR)
+        {
+            break;
+        }
+
+        int length;
+        int headerSize;
+        if (!readData(uid, uidLength, index + 1, &tlv[1], 1, authenticatedSector))
+        {
+            return false;
+        }
+        if (tlv[1] == 0xFF)
+        {
+            if (!readData(uid, uidLength, index + 2, &tlv[2], 2, authenticatedSector))
+            {
+                return false;
+            }
+            length = ((0xFF & tlv[2]) << 8) | (0xFF & tlv[3]);
+            headerSize = LONG_TLV_SIZE;
         }
         else
         {
-            messageLength = data[i+1];
-            messageStartIndex = i + SHORT_TLV_SIZE;
+            length = tlv[1];
+            headerSize = SHORT_TLV_SIZE;
+        }
+
+        if (tlv[0] == TLV_NDEF)
+        {
+            if (index + headerSize + length > size)
+            {
+                break;
+            }
+            messageLength = length;
+            messageStartIndex = index + headerSize;
+            _tlvStart = index;
+            return true;
         }
+
+        #ifdef MIFARE_CLASSIC_DEBUG
+        Serial.print(F("Skipping TLV "));Serial.print(tlv[0], HEX);Serial.print(F(" at "));Serial.println(index);
+        #endif
+        index += headerSize + length;
     }
 
+    Serial.println(F("Error. Can't decode message length."));
+    return false;
+}
+
+// Where a write puts the NDEF TLV: where the tag has it, so the TLVs in
+// front of it stay, or at the first data byte of a tag without one
+int MifareClassic::findWriteStart(byte *uid, unsigned int uidLength, int &authenticatedSector)
+{
+    int messageLength;
+    int messageStartIndex;
+    if (!findNdefTlv(uid, uidLength, messageLength, messageStartIndex, authenticatedSector))
+    {
+        return 0;
+    }
+    return _tlvStart;
+}
+
+// copies length bytes of the NDEF sectors from index on
+boolean MifareClassic::readData(byte *uid, unsigned int uidLength, int index, byte *data, int length, int &authenticatedSector)
+{
+    while (length > 0)
+    {
+        int n = index / BLOCK_SIZE;
+        int offset = index % BLOCK_SIZE;
+        int count = BLOCK_SIZE - offset < length ? BLOCK_SIZE - offset : length;
+
+        if (n != _bufferedBlock)
+        {
+            if (!readDataBlock(uid, uidLength, n, _block, authenticatedSector))
+            {
+                return false;
+            }
+            _bufferedBlock = n;
+        }
+        memcpy(data, &_block[offset], count);
+
+        data += count;
+        index += count;
+        length -= count;
+    }
     return true;
 }
 
@@ -248,10 +441,6 @@ boolean MifareClassic::formatNDEF(byte * uid, unsigned int uidLength)
     return success;
 }
 
-#define NR_SHORTSECTOR          (32)    // Number of short sectors on Mifare 1K/4K
-#define NR_LONGSECTOR           (8)     // Number of long sectors on Mifare 4K
-#define NR_BLOCK_OF_SHORTSECTOR (4)     // Number of blocks in a short sector
-#define NR_BLOCK_OF_LONGSECTOR  (16)    // Number of blocks in a long sector
 
 // Determine the sector trailer block based on sector number
 #define BLOCK_NUMBER_OF_SECTOR_TRAILER(sector) (((sector)<NR_SHORTSECTOR)? \
@@ -325,81 +514,308 @@ boolean MifareClassic::formatMifare(byte * uid, unsigned int uidLength)
     return true;
 }
 
-boolean MifareClassic::write(NdefMessage& m, byte * uid, unsigned int uidLength)
+boolean MifareClassic::write(NdefMessageBase& m, byte * uid, unsigned int uidLength)
 {
-
-    uint8_t encoded[m.getEncodedSize()];
-    m.encode(encoded);
-
-    uint8_t buffer[getBufferSize(sizeof(encoded))];
+    int authenticatedSector = -1;
+    int start = findWriteStart(uid, uidLength, authenticatedSector);
+    uint8_t buffer[getBufferSize(start, m.getEncodedSize())];
     memset(buffer, 0, sizeof(buffer));
+    if (!readData(uid, uidLength, 0, buffer, start, authenticatedSector))
+    {
+        return false;
+    }
+    encodeNdefTlv(m, &buffer[start]);
 
     #ifdef MIFARE_CLASSIC_DEBUG
-    Serial.print(F("sizeof(encoded) "));Serial.println(sizeof(encoded));
+    Serial.print(F("sizeof(encoded) "));Serial.println(m.getEncodedSize());
     Serial.print(F("sizeof(buffer) "));Serial.println(sizeof(buffer));
     #endif
 
-    if (sizeof(encoded) < 0xFF)
+    int blocks = sizeof(buffer) / BLOCK_SIZE;
+    if (!prepareWrite(uid, uidLength, blocks, authenticatedSector))
     {
-        buffer[0] = 0x3;
-        buffer[1] = sizeof(encoded);
-        memcpy(&buffer[2], encoded, sizeof(encoded));
-        buffer[2+sizeof(encoded)] = 0xFE; // terminator
+        return false;
     }
-    else
+
+    // Write to tag
+    for (int i = 0; i < blocks; i++)
+    {
+        int block = getDataBlock(i);
+        if (!authenticateSector(uid, uidLength, block, authenticatedSector))
+        {
+            return false;
+        }
+
+        int write_success = _nfcShield->mifareclassic_WriteDataBlock (block, &buffer[i * BLOCK_SIZE]);
+        if (write_success)
+        {
+            #ifdef MIFARE_CLASSIC_DEBUG
+            Serial.print(F("Wrote block "));Serial.print(block);Serial.print(" - ");
+            _nfcShield->PrintHexChar(&buffer[i * BLOCK_SIZE], BLOCK_SIZE);
+            #endif
+        }
+        else
+        {
+            Serial.print(F("Write failed "));Serial.println(block);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// finds the NDEF sectors and checks blocks fit and may be written
+// before anything is written
+boolean MifareClassic::prepareWrite(byte *uid, unsigned int uidLength, int blocks, int &authenticatedSector)
+{
+    _bufferedBlock = -1;
+    if (!readMad(uid, uidLength) || !readAccess(uid, uidLength, authenticatedSector))
+    {
+        return false;
+    }
+    if (_readOnly)
     {
-        buffer[0] = 0x3;
-        buffer[1] = 0xFF;
-        buffer[2] = ((sizeof(encoded) >> 8) & 0xFF);
-        buffer[3] = (sizeof(encoded) & 0xFF);
-        memcpy(&buffer[4], encoded, sizeof(encoded));
-        buffer[4+sizeof(encoded)] = 0xFE; // terminator
+        Serial.println(F("Error. Tag is read only."));
+        return false;
+    }
+    if (blocks > getDataBlockCount())
+    {
+        Serial.print(F("Error. Message needs "));Serial.print(blocks);
+        Serial.print(F(" blocks, the tag has "));Serial.println(getDataBlockCount());
+        return false;
     }
+    return true;
+}
 
-    // Write to tag
-    int index = 0;
-    int currentBlock = 4;
+// n-th data block of the NDEF sectors, trailers skipped. -1 past the end.
+int MifareClassic::getDataBlock(int n)
+{
+    for (int sector = 1; sector < NR_SHORTSECTOR + NR_LONGSECTOR; sector++)
+    {
+        if (!(_ndefSectors & ((uint64_t)1 << sector)))
+        {
+            continue;
+        }
+        if (n < dataBlocksOfSector(sector))
+        {
+            return firstBlockOfSector(sector) + n;
+        }
+        n -= dataBlocksOfSector(sector);
+    }
+    return -1;
+}
+
+int MifareClassic::getDataBlockCount()
+{
+    int count = 0;
+    for (int sector = 1; sector < NR_SHORTSECTOR + NR_LONGSECTOR; sector++)
+    {
+        if (_ndefSectors & ((uint64_t)1 << sector))
+        {
+            count += dataBlocksOfSector(sector);
+        }
+    }
+    return count;
+}
+
+boolean MifareClassic::readDataBlock(byte *uid, unsigned int uidLength, int n, byte *data, int &authenticatedSector)
+{
+    if (n == _bufferedBlock)
+    {
+        memcpy(data, _block, BLOCK_SIZE);
+        return true;
+    }
+    if (!readMad(uid, uidLength))
+    {
+        return false;
+    }
+
+    int block = getDataBlock(n);
+    if (block < 0)
+    {
+        return false;
+    }
+    if (!authenticateSector(uid, uidLength, block, authenticatedSector))
+    {
+        return false;
+    }
+    if (!_nfcShield->mifareclassic_ReadDataBlock(block, data))
+    {
+        Serial.print(F("Read failed "));Serial.println(block);
+        return false;
+    }
+    return true;
+}
+
+boolean MifareClassic::authenticateSector(byte *uid, unsigned int uidLength, int block, int &authenticatedSector)
+{
     uint8_t key[6] = { 0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 }; // this is Sector 1 - 15 key
+    int sector = sectorOfBlock(block);
+
+    if (sector == authenticatedSector)
+    {
+        return true;
+    }
+    if (!_nfcShield->mifareclassic_AuthenticateBlock(uid, uidLength, block, 0, key))
+    {
+        Serial.print(F("Error. Block Authentication failed for "));Serial.println(block);
+        authenticatedSector = -1;
+        return false;
+    }
+    authenticatedSector = sector;
+    return true;
+}
+
+// Only blocks whose content changes are written. The block(s) with the
+// TLV length are written with a zero length before the other changed blocks
+// and with the new one after them, so a torn write leaves an empty message
+// instead of the old length over new data.
+boolean MifareClassic::writeChanged(NdefMessageBase& m, byte *uid, unsigned int uidLength, const byte *image, unsigned int imageLength)
+{
+    int authenticatedSector = -1;
+    int start = findWriteStart(uid, uidLength, authenticatedSector);
+    uint8_t buffer[getBufferSize(start, m.getEncodedSize())];
+    memset(buffer, 0, sizeof(buffer));
+    if (!readData(uid, uidLength, 0, buffer, start, authenticatedSector))
+    {
+        return false;
+    }
+    encodeNdefTlv(m, &buffer[start]);
+
+    return writeChangedBlocks(buffer, sizeof(buffer) / BLOCK_SIZE, start, uid, uidLength, image, imageLength, authenticatedSector);
+}
+
+boolean MifareClassic::writeChanged(const byte *message, int messageLength, byte *uid, unsigned int uidLength, const byte *image, unsigned int imageLength)
+{
+    int authenticatedSector = -1;
+    int start = findWriteStart(uid, uidLength, authenticatedSector);
+    uint8_t buffer[getBufferSize(start, messageLength)];
+    memset(buffer, 0, sizeof(buffer));
+    if (!readData(uid, uidLength, 0, buffer, start, authenticatedSector))
+    {
+        return false;
+    }
+    encodeNdefTlv(message, messageLength, &buffer[start]);
+
+    return writeChangedBlocks(buffer, sizeof(buffer) / BLOCK_SIZE, start, uid, uidLength, image, imageLength, authenticatedSector);
+}
+
+// buffer is what the data blocks should hold, blocks long, with the NDEF
+// TLV at tlvStart
+boolean MifareClassic::writeChangedBlocks(const byte *buffer, int blocks, int tlvStart, byte *uid, unsigned int uidLength, const byte *image, unsigned int imageLength, int &authenticatedSector)
+{
+    bool changed[blocks];
+    _skippedBlocks = 0;
+
+    if (!prepareWrite(uid, uidLength, blocks, authenticatedSector))
+    {
+        return false;
+    }
 
-    while (index < sizeof(buffer))
+    // compare with the cached image where it covers a block, read the rest
+    for (int i = 0; i < blocks; i++)
     {
+        const byte *current;
+        byte data[BLOCK_SIZE];
 
-        if (_nfcShield->mifareclassic_IsFirstBlock(currentBlock))
+        if (image && (unsigned int)(i + 1) * BLOCK_SIZE <= imageLength)
+        {
+            current = &image[i * BLOCK_SIZE];
+        }
+        else
         {
-            int success = _nfcShield->mifareclassic_AuthenticateBlock(uid, uidLength, currentBlock, 0, key);
-            if (!success)
+            int block = getDataBlock(i);
+            if (!authenticateSector(uid, uidLength, block, authenticatedSector))
             {
-                Serial.print(F("Error. Block Authentication failed for "));Serial.println(currentBlock);
                 return false;
             }
+            if (!_nfcShield->mifareclassic_ReadDataBlock(block, data))
+            {
+                Serial.print(F("Error. Failed read block "));Serial.println(block);
+                return false;
+            }
+            current = data;
         }
 
-        int write_success = _nfcShield->mifareclassic_WriteDataBlock (currentBlock, &buffer[index]);
-        if (write_success)
+        changed[i] = memcmp(current, &buffer[i * BLOCK_SIZE], BLOCK_SIZE) != 0;
+        if (!changed[i])
         {
-            #ifdef MIFARE_CLASSIC_DEBUG
-            Serial.print(F("Wrote block "));Serial.print(currentBlock);Serial.print(" - ");
-            _nfcShield->PrintHexChar(&buffer[index], BLOCK_SIZE);
-            #endif
+            _skippedBlocks++;
         }
-        else
+    }
+
+    // a long TLV header can run into the next block
+    int first = tlvStart / BLOCK_SIZE;
+    int headerSize = buffer[tlvStart + 1] == 0xFF ? LONG_TLV_SIZE : SHORT_TLV_SIZE;
+    int last = (tlvStart + headerSize - 1) / BLOCK_SIZE;
+
+    bool changedData = false;
+    for (int i = 0; i < blocks; i++)
+    {
+        changedData |= changed[i] && (i < first || i > last);
+    }
+    if (changedData)
+    {
+        byte empty[2 * BLOCK_SIZE];
+        memcpy(empty, &buffer[first * BLOCK_SIZE], (last - first + 1) * BLOCK_SIZE);
+        clearNdefTlvLength(&empty[tlvStart % BLOCK_SIZE]);
+        for (int i = first; i <= last; i++)
         {
-            Serial.print(F("Write failed "));Serial.println(currentBlock);
-            return false;
+            if (!writeDataBlock(uid, uidLength, i, &empty[(i - first) * BLOCK_SIZE], authenticatedSector))
+            {
+                return false;
+            }
+            if (!changed[i])
+            {
+                changed[i] = true;
+                _skippedBlocks--;
+            }
         }
-        index += BLOCK_SIZE;
-        currentBlock++;
+    }
 
-        if (_nfcShield->mifareclassic_IsTrailerBlock(currentBlock))
+    // the data, then the length
+    for (int i = 0; i < blocks; i++)
+    {
+        if (changed[i] && (i < first || i > last) && !writeDataBlock(uid, uidLength, i, &buffer[i * BLOCK_SIZE], authenticatedSector))
         {
-            // can't write to trailer block
-            #ifdef MIFARE_CLASSIC_DEBUG
-            Serial.print(F("Skipping block "));Serial.println(currentBlock);
-            #endif
-            currentBlock++;
+            return false;
+        }
+    }
+    for (int i = first; i <= last; i++)
+    {
+        if (changed[i] && !writeDataBlock(uid, uidLength, i, &buffer[i * BLOCK_SIZE], authenticatedSector))
+        {
+            return false;
         }
-
     }
 
+    #ifdef MIFARE_CLASSIC_DEBUG
+    Serial.print(F("Skipped "));Serial.print(_skippedBlocks);Serial.print(F(" of "));Serial.print(blocks);Serial.println(F(" blocks"));
+    #endif
+
     return true;
-}
\ No newline at end of file
+}
+
+boolean MifareClassic::writeDataBlock(byte *uid, unsigned int uidLength, int n, const byte *data, int &authenticatedSector)
+{
+    int block = getDataBlock(n);
+    if (!authenticateSector(uid, uidLength, block, authenticatedSector))
+    {
+        return false;
+    }
+    if (!_nfcShield->mifareclassic_WriteDataBlock(block, (uint8_t*)data))
+    {
+        Serial.print(F("Write failed "));Serial.println(block);
+        return false;
+    }
+    #ifdef MIFARE_CLASSIC_DEBUG
+    Serial.print(F("Wrote block "));Serial.print(block);Serial.print(" - ");
+    _nfcShield->PrintHexChar(data, BLOCK_SIZE);
+    #endif
+    return true;
+}
+
+unsigned int MifareClassic::getSkippedBlocks()
+{
+    return _skippedBlocks;
+}
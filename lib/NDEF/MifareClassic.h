@@ -6,20 +6,64 @@
 #include <Ndef.h>
 #include <NfcTag.h>
 
+#define MIFARE_CLASSIC ("Mifare Classic")
+#define BLOCK_SIZE 16
+
 class MifareClassic
 {
     public:
-        MifareClassic(PN532& nfcShield);
+        MifareClassic(PN532Base& nfcShield);
         ~MifareClassic();
         NfcTag read(byte *uid, unsigned int uidLength);
-        boolean write(NdefMessage& ndefMessage, byte *uid, unsigned int uidLength);
+        // The NDEF TLV is written where the tag has it, the NULL, control and
+        // proprietary TLVs in front of it are kept. A tag without one gets
+        // it at the first data byte.
+        boolean write(NdefMessageBase& ndefMessage, byte *uid, unsigned int uidLength);
+        // Writes only the blocks that differ from the tag. image is what the
+        // NDEF sectors hold, trailers skipped (e.g. the TLV of the last
+        // message written); blocks it doesn't cover are read from the tag.
+        boolean writeChanged(NdefMessageBase& ndefMessage, byte *uid, unsigned int uidLength, const byte *image = 0, unsigned int imageLength = 0);
+        // same for a message that is already encoded
+        boolean writeChanged(const byte *message, int messageLength, byte *uid, unsigned int uidLength, const byte *image = 0, unsigned int imageLength = 0);
+        // blocks the last writeChanged() left alone
+        unsigned int getSkippedBlocks();
+        // n-th data block of the NDEF sectors, trailers skipped. Authenticates
+        // when the block is outside authenticatedSector and updates it.
+        boolean readDataBlock(byte *uid, unsigned int uidLength, int n, byte *data, int &authenticatedSector);
+        // Locates the NDEF TLV, messageStartIndex counts data bytes of the
+        // NDEF sectors like readDataBlock counts blocks.
+        boolean findNdefTlv(byte *uid, unsigned int uidLength, int &messageLength, int &messageStartIndex, int &authenticatedSector);
+        // bit n set for every sector the MAD gives to NDEF, 0 until it is read.
+        // Set it with the tag's uid to skip reading the MAD again for that tag,
+        // another uid reads the MAD.
+        uint64_t getNdefSectors();
+        void setNdefSectors(uint64_t sectors, byte *uid, unsigned int uidLength);
+        // capacity, used bytes and access found by findNdefTlv
+        void describeTag(NfcTag& tag, int messageLength, int messageStartIndex);
         boolean formatNDEF(byte * uid, unsigned int uidLength);
         boolean formatMifare(byte * uid, unsigned int uidLength);
     private:
-        PN532* _nfcShield;
-        int getBufferSize(int messageLength);
-        int getNdefStartIndex(byte *data);
-        bool decodeTlv(byte *data, int &messageLength, int &messageStartIndex);
+        PN532Base* _nfcShield;
+        unsigned int _skippedBlocks;
+        uint64_t _ndefSectors;
+        byte _madUid[10]; // tag _ndefSectors was read from
+        unsigned int _madUidLength;
+        byte _block[BLOCK_SIZE];
+        int _bufferedBlock; // data block in _block, -1 if none
+        boolean _readOnly;
+        boolean _locked;
+        int _tlvStart; // where findNdefTlv found the NDEF TLV
+        int getBufferSize(int tlvStart, int messageLength);
+        int findWriteStart(byte *uid, unsigned int uidLength, int &authenticatedSector);
+        boolean readMad(byte *uid, unsigned int uidLength);
+        boolean readData(byte *uid, unsigned int uidLength, int index, byte *data, int length, int &authenticatedSector);
+        boolean readAccess(byte *uid, unsigned int uidLength, int &authenticatedSector);
+        boolean prepareWrite(byte *uid, unsigned int uidLength, int blocks, int &authenticatedSector);
+        boolean writeChangedBlocks(const byte *buffer, int blocks, int tlvStart, byte *uid, unsigned int uidLength, const byte *image, unsigned int imageLength, int &authenticatedSector);
+        boolean writeDataBlock(byte *uid, unsigned int uidLength, int n, const byte *data, int &authenticatedSector);
+        int getDataBlock(int n);
+        int getDataBlockCount();
+        boolean authenticateSector(byte *uid, unsigned int uidLength, int block, int &authenticatedSector);
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,5 @@
 #include <MifareUltralight.h>
 
-#define ULTRALIGHT_PAGE_SIZE 4
 #define ULTRALIGHT_READ_SIZE 4 // we should be able to read 16 bytes at a time
 
 #define ULTRALIGHT_DATA_START_PAGE 4
@@ -8,13 +7,16 @@
 #define ULTRALIGHT_DATA_START_INDEX 2
 #define ULTRALIGHT_MAX_PAGE 63
 
-#define NFC_FORUM_TAG_TYPE_2 ("NFC Forum Type 2")
-
-MifareUltralight::MifareUltralight(PN532& nfcShield)
+MifareUltralight::MifareUltralight(PN532Base& nfcShield)
 {
     nfc = &nfcShield;
     ndefStartIndex = 0;
     messageLength = 0;
+    skippedPages = 0;
+    tagCapacity = 0;
+    readOnly = false;
+    lockBytes[0] = 0;
+    lockBytes[1] = 0;
 }
 
 MifareUltralight::~MifareUltralight()
@@ -36,7 +38,9 @@ NfcTag MifareUltralight::read(byte * uid, unsigned int uidLength)
     if (messageLength == 0) { // data is 0x44 0x03 0x00 0xFE
         NdefMessage message = NdefMessage();
         message.addEmptyRecord();
-        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_2, message);
+        NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_2, message);
+        describeTag(tag);
+        return tag;
     }
 
     boolean success;
@@ -71,8 +75,58 @@ NfcTag MifareUltralight::read(byte * uid, unsigned int uidLength)
     }
 
     NdefMessage ndefMessage = NdefMessage(&buffer[ndefStartIndex], messageLength);
-    return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_2, ndefMessage);
+    NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_2, ndefMessage);
+    describeTag(tag);
+    return tag;
+
+}
+
+boolean MifareUltralight::readNdefHeader(unsigned int &messageStartIndex, unsigned int &length)
+{
+    if (isUnformatted())
+    {
+        Serial.println(F("WARNING: Tag is not formatted."));
+        return false;
+    }
+
+    readCapabilityContainer(); // meta info for tag
+    findNdefMessage();
+    messageStartIndex = ndefStartIndex;
+    length = messageLength;
+    return true;
+}
 
+boolean MifareUltralight::readDataPage(int n, byte *data)
+{
+    int page = ULTRALIGHT_DATA_START_PAGE + n;
+    if (page >= ULTRALIGHT_MAX_PAGE || !nfc->mifareultralight_ReadPage(page, data))
+    {
+        Serial.print(F("Read failed "));Serial.println(page);
+        return false;
+    }
+    return true;
+}
+
+void MifareUltralight::describeTag(NfcTag& tag)
+{
+    tag.setCapacity(tagCapacity, ndefStartIndex + messageLength + 1);
+    tag.setReadOnly(readOnly || isPageLocked(ULTRALIGHT_DATA_START_PAGE), lockBytes[0] || lockBytes[1]);
+}
+
+// Static lock bits in page 2: byte 2 bits 3 - 7 lock pages 3 - 7, byte 3
+// locks pages 8 - 15. Larger tags lock the rest with dynamic lock bits,
+// those are not read.
+boolean MifareUltralight::isPageLocked(int page)
+{
+    if (page >= 3 && page < 8)
+    {
+        return (lockBytes[0] >> page) & 1;
+    }
+    if (page >= 8 && page < 16)
+    {
+        return (lockBytes[1] >> (page - 8)) & 1;
+    }
+    return false;
 }
 
 boolean MifareUltralight::isUnformatted()
@@ -91,7 +145,7 @@ boolean MifareUltralight::isUnformatted()
     }
 }
 
-// page 3 has tag capabilities
+// page 3 has tag capabilities, page 2 the static lock bytes
 void MifareUltralight::readCapabilityContainer()
 {
     byte data[ULTRALIGHT_PAGE_SIZE];
@@ -100,11 +154,18 @@ void MifareUltralight::readCapabilityContainer()
     {
         // See AN1303 - different rules for Mifare Family byte2 = (additional data + 48)/8
         tagCapacity = data[2] * 8;
+        // byte 3: read access in the high nibble, write access in the low one
+        readOnly = (data[3] & 0x0F) != 0;
         #ifdef MIFARE_ULTRALIGHT_DEBUG
         Serial.print(F("Tag capacity "));Serial.print(tagCapacity);Serial.println(F(" bytes"));
         #endif
+    }
 
-        // TODO future versions should get lock information
+    success = nfc->mifareultralight_ReadPage (2, data);
+    if (success)
+    {
+        lockBytes[0] = data[2];
+        lockBytes[1] = data[3];
     }
 }
 
@@ -162,7 +223,9 @@ void MifareUltralight::calculateBufferSize()
     }
 }
 
-boolean MifareUltralight::write(NdefMessage& m, byte * uid, unsigned int uidLength)
+// reads the tag layout and sizes the TLV buffer for a message of length
+// bytes, false if it does not fit
+boolean MifareUltralight::prepareWrite(unsigned int length)
 {
     if (isUnformatted())
     {
@@ -170,41 +233,47 @@ boolean MifareUltralight::write(NdefMessage& m, byte * uid, unsigned int uidLeng
         return false;
     }
     readCapabilityContainer(); // meta info for tag
+    if (readOnly)
+    {
+        Serial.println(F("Error. Tag is read only."));
+        return false;
+    }
 
-    messageLength  = m.getEncodedSize();
+    messageLength  = length;
     ndefStartIndex = messageLength < 0xFF ? 2 : 4;
     calculateBufferSize();
 
     if(bufferSize>tagCapacity) {
-	    #ifdef MIFARE_ULTRALIGHT_DEBUG
-    	Serial.print(F("Encoded Message length exceeded tag Capacity "));Serial.println(tagCapacity);
-    	#endif
+    	Serial.print(F("Error. Encoded Message length exceeded tag Capacity "));Serial.println(tagCapacity);
     	return false;
     }
 
-    uint8_t encoded[bufferSize];
-    uint8_t *  src = encoded;
-    unsigned int position = 0;
-    uint8_t page = ULTRALIGHT_DATA_START_PAGE;
-
-    // Set message size. With ultralight should always be less than 0xFF but who knows?
-
-    encoded[0] = 0x3;
-    if (messageLength < 0xFF)
+    for (unsigned int page = ULTRALIGHT_DATA_START_PAGE; page < ULTRALIGHT_DATA_START_PAGE + bufferSize / ULTRALIGHT_PAGE_SIZE; page++)
     {
-        encoded[1] = messageLength;
+        if (isPageLocked(page))
+        {
+            Serial.print(F("Error. Page "));Serial.print(page);Serial.println(F(" is locked."));
+            return false;
+        }
     }
-    else
+    return true;
+}
+
+boolean MifareUltralight::write(NdefMessageBase& m, byte * uid, unsigned int uidLength)
+{
+    if (!prepareWrite(m.getEncodedSize()))
     {
-        encoded[1] = 0xFF;
-        encoded[2] = ((messageLength >> 8) & 0xFF);
-        encoded[3] = (messageLength & 0xFF);
+        return false;
     }
 
-    m.encode(encoded+ndefStartIndex);
-    // this is always at least 1 byte copy because of terminator.
-    memset(encoded+ndefStartIndex+messageLength,0,bufferSize-ndefStartIndex-messageLength);
-    encoded[ndefStartIndex+messageLength] = 0xFE; // terminator
+    uint8_t encoded[bufferSize];
+    uint8_t *  src = encoded;
+    unsigned int position = 0;
+    uint8_t page = ULTRALIGHT_DATA_START_PAGE;
+
+    // TLV, zero padded to the end of the last page
+    memset(encoded, 0, bufferSize);
+    encodeNdefTlv(m, encoded);
 
     #ifdef MIFARE_ULTRALIGHT_DEBUG
     Serial.print(F("messageLength "));Serial.println(messageLength);
@@ -227,6 +296,125 @@ boolean MifareUltralight::write(NdefMessage& m, byte * uid, unsigned int uidLeng
     return true;
 }
 
+// Only pages whose content changes are written. Page 4 holds the TLV length:
+// when other pages change it is written with a zero length before them and
+// with the new one after them, so a torn write leaves an empty message.
+boolean MifareUltralight::writeChanged(NdefMessageBase& m, byte * uid, unsigned int uidLength, const byte *image, unsigned int imageLength)
+{
+    (void)uid;
+    (void)uidLength;
+    if (!prepareWrite(m.getEncodedSize()))
+    {
+        return false;
+    }
+
+    uint8_t encoded[bufferSize];
+    memset(encoded, 0, bufferSize);
+    encodeNdefTlv(m, encoded);
+
+    return writeChangedPages(encoded, image, imageLength);
+}
+
+boolean MifareUltralight::writeChanged(const byte *message, int messageLength, byte * uid, unsigned int uidLength, const byte *image, unsigned int imageLength)
+{
+    (void)uid;
+    (void)uidLength;
+    if (!prepareWrite(messageLength))
+    {
+        return false;
+    }
+
+    uint8_t encoded[bufferSize];
+    memset(encoded, 0, bufferSize);
+    encodeNdefTlv(message, messageLength, encoded);
+
+    return writeChangedPages(encoded, image, imageLength);
+}
+
+// encoded is the zero padded TLV sized by prepareWrite
+boolean MifareUltralight::writeChangedPages(const byte *encoded, const byte *image, unsigned int imageLength)
+{
+    unsigned int pages = bufferSize / ULTRALIGHT_PAGE_SIZE;
+    bool changed[pages];
+    skippedPages = 0;
+
+    // compare with the cached image where it covers a page, read the rest
+    for (unsigned int i = 0; i < pages; i++)
+    {
+        const byte *current;
+        byte data[ULTRALIGHT_PAGE_SIZE];
+
+        if (image && (i + 1) * ULTRALIGHT_PAGE_SIZE <= imageLength)
+        {
+            current = &image[i * ULTRALIGHT_PAGE_SIZE];
+        }
+        else
+        {
+            if (!nfc->mifareultralight_ReadPage(ULTRALIGHT_DATA_START_PAGE + i, data))
+            {
+                Serial.print(F("Error. Failed read page "));Serial.println(ULTRALIGHT_DATA_START_PAGE + i);
+                return false;
+            }
+            current = data;
+        }
+
+        changed[i] = memcmp(current, &encoded[i * ULTRALIGHT_PAGE_SIZE], ULTRALIGHT_PAGE_SIZE) != 0;
+        if (!changed[i])
+        {
+            skippedPages++;
+        }
+    }
+
+    bool changedData = false;
+    for (unsigned int i = 1; i < pages; i++)
+    {
+        changedData |= changed[i];
+    }
+    if (changedData)
+    {
+        byte empty[ULTRALIGHT_PAGE_SIZE];
+        memcpy(empty, encoded, ULTRALIGHT_PAGE_SIZE);
+        clearNdefTlvLength(empty);
+        if (!nfc->mifareultralight_WritePage(ULTRALIGHT_DATA_START_PAGE, empty))
+        {
+            return false;
+        }
+        if (!changed[0])
+        {
+            changed[0] = true;
+            skippedPages--;
+        }
+    }
+
+    for (unsigned int n = 1; n <= pages; n++)
+    {
+        unsigned int i = n % pages; // 1, 2, ... pages - 1, then 0
+        if (!changed[i])
+        {
+            continue;
+        }
+        if (!nfc->mifareultralight_WritePage(ULTRALIGHT_DATA_START_PAGE + i, (uint8_t*)&encoded[i * ULTRALIGHT_PAGE_SIZE]))
+        {
+            return false;
+        }
+        #ifdef MIFARE_ULTRALIGHT_DEBUG
+        Serial.print(F("Wrote page "));Serial.print(ULTRALIGHT_DATA_START_PAGE + i);Serial.print(F(" - "));
+        nfc->PrintHex(&encoded[i * ULTRALIGHT_PAGE_SIZE], ULTRALIGHT_PAGE_SIZE);
+        #endif
+    }
+
+    #ifdef MIFARE_ULTRALIGHT_DEBUG
+    Serial.print(F("Skipped "));Serial.print(skippedPages);Serial.print(F(" of "));Serial.print(pages);Serial.println(F(" pages"));
+    #endif
+
+    return true;
+}
+
+unsigned int MifareUltralight::getSkippedPages()
+{
+    return skippedPages;
+}
+
 // Mifare Ultralight can't be reset to factory state
 // zero out tag data like the NXP Tag Write Android application
 boolean MifareUltralight::clean()
@@ -5,24 +5,48 @@
 #include <NfcTag.h>
 #include <Ndef.h>
 
+#define NFC_FORUM_TAG_TYPE_2 ("NFC Forum Type 2")
+#define ULTRALIGHT_PAGE_SIZE 4
+
 class MifareUltralight
 {
     public:
-        MifareUltralight(PN532& nfcShield);
+        MifareUltralight(PN532Base& nfcShield);
         ~MifareUltralight();
         NfcTag read(byte *uid, unsigned int uidLength);
-        boolean write(NdefMessage& ndefMessage, byte *uid, unsigned int uidLength);
+        boolean write(NdefMessageBase& ndefMessage, byte *uid, unsigned int uidLength);
+        // Writes only the pages that differ from the tag. image is what the
+        // tag holds from page 4 on (e.g. the TLV of the last message written);
+        // pages it doesn't cover are read from the tag.
+        boolean writeChanged(NdefMessageBase& ndefMessage, byte *uid, unsigned int uidLength, const byte *image = 0, unsigned int imageLength = 0);
+        // same for a message that is already encoded
+        boolean writeChanged(const byte *message, int messageLength, byte *uid, unsigned int uidLength, const byte *image = 0, unsigned int imageLength = 0);
+        // pages the last writeChanged() left alone
+        unsigned int getSkippedPages();
         boolean clean();
+        // Finds the NDEF TLV without reading the message. messageStartIndex
+        // counts from page 4. False if the tag is not formatted.
+        boolean readNdefHeader(unsigned int &messageStartIndex, unsigned int &length);
+        // n-th data page from page 4 on
+        boolean readDataPage(int n, byte *data);
+        // capacity, used bytes and lock state found by readNdefHeader
+        void describeTag(NfcTag& tag);
     private:
-        PN532* nfc;
+        PN532Base* nfc;
         unsigned int tagCapacity;
         unsigned int messageLength;
         unsigned int bufferSize;
         unsigned int ndefStartIndex;
+        unsigned int skippedPages;
+        boolean readOnly;
+        byte lockBytes[2];
         boolean isUnformatted();
         void readCapabilityContainer();
         void findNdefMessage();
         void calculateBufferSize();
+        boolean prepareWrite(unsigned int length);
+        boolean writeChangedPages(const byte *encoded, const byte *image, unsigned int imageLength);
+        boolean isPageLocked(int page);
 };
 
 #endif
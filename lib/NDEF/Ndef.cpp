@@ -1,4 +1,5 @@
 #include "Ndef.h"
+#include "NdefMessage.h"
 
 // Borrowed from Adafruit_NFCShield_I2C
 void PrintHex(const byte * data, const long numBytes)
@@ -55,3 +56,89 @@ void DumpHex(const byte * data, const long numBytes, const unsigned int blockSiz
         data += blockSize;
     }
 }
+
+int getNdefTlvSize(int messageLength)
+{
+    // type, length, value, terminator
+    return 1 + (messageLength < 0xFF ? 1 : 3) + messageLength + 1;
+}
+
+// 0x03 and the 1 or 3 byte length, returns the number of bytes written
+static int encodeNdefTlvHeader(int messageLength, byte *data)
+{
+    int index = 0;
+
+    data[index++] = 0x3;
+    if (messageLength < 0xFF)
+    {
+        data[index++] = messageLength;
+    }
+    else
+    {
+        data[index++] = 0xFF;
+        data[index++] = (messageLength >> 8) & 0xFF;
+        data[index++] = messageLength & 0xFF;
+    }
+    return index;
+}
+
+int encodeNdefTlv(NdefMessageBase& message, byte *data)
+{
+    int messageLength = message.getEncodedSize();
+    int index = encodeNdefTlvHeader(messageLength, data);
+
+    message.encode(&data[index]);
+    index += messageLength;
+    data[index++] = 0xFE; // terminator
+    return index;
+}
+
+int encodeNdefTlv(const byte *message, int messageLength, byte *data)
+{
+    int index = encodeNdefTlvHeader(messageLength, data);
+
+    memcpy(&data[index], message, messageLength);
+    index += messageLength;
+    data[index++] = 0xFE; // terminator
+    return index;
+}
+
+void clearNdefTlvLength(byte *tlv)
+{
+    if (tlv[1] == 0xFF)
+    {
+        tlv[2] = 0;
+        tlv[3] = 0;
+    }
+    else
+    {
+        tlv[1] = 0;
+    }
+}
+
+unsigned long getNdefRecordSize(const byte *record, unsigned int available)
+{
+    bool sr = (record[0] & 0x10) != 0;
+    bool il = (record[0] & 0x8) != 0;
+    unsigned int headerLength = 2 + (sr ? 1 : 4) + (il ? 1 : 0);
+
+    if (headerLength > available)
+    {
+        return 0;
+    }
+
+    unsigned long payloadLength;
+    if (sr)
+    {
+        payloadLength = record[2];
+    }
+    else
+    {
+        payloadLength = ((unsigned long)record[2] << 24) | ((unsigned long)record[3] << 16) |
+                        ((unsigned long)record[4] << 8) | record[5];
+    }
+    unsigned int idLength = il ? record[headerLength - 1] : 0;
+
+    unsigned long size = headerLength + record[1] + idLength + payloadLength;
+    return size > available ? 0 : size;
+}
@@ -13,4 +13,22 @@ void PrintHex(const byte *data, const long numBytes);
 void PrintHexChar(const byte *data, const long numBytes);
 void DumpHex(const byte *data, const long numBytes, const int blockSize);
 
+class NdefMessageBase;
+
+// NDEF message TLV as stored on Mifare Classic and NFC Forum Type 2 tags:
+// 0x03, a 1 or 3 byte length, the message, then the 0xFE terminator TLV
+int getNdefTlvSize(int messageLength);
+// returns the number of bytes written, getNdefTlvSize(message.getEncodedSize())
+int encodeNdefTlv(NdefMessageBase& message, byte *data);
+// same for a message that is already encoded
+int encodeNdefTlv(const byte *message, int messageLength, byte *data);
+// zeroes the 1 or 3 byte length of the NDEF TLV at tlv, it then holds an
+// empty message
+void clearNdefTlvLength(byte *tlv);
+
+// Size of the encoded record starting at record, 0 if it needs more than
+// available bytes. The header is at most 7 bytes: flags, type length,
+// payload length (1 or 4 bytes) and id length.
+unsigned long getNdefRecordSize(const byte *record, unsigned int available);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,184 @@
+#ifndef NdefBuilder_h
+#define NdefBuilder_h
+
+/* Compile time NDEF encoding for fixed payloads (requires C++17).
+
+   constexpr auto landing = ndef::message(
+       ndef::uri(NDEF_STR("https://www.example.com/wallet")),
+       ndef::text("en", "Tap to open"));
+
+   landing is a std::array<uint8_t, N> holding the encoded message, ready for
+   EmulateTag::setNdefFile or a TLV write. Nothing is encoded at runtime.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <NdefRecord.h>
+#include <uri_prefix.h>
+
+// Wraps a string literal so ndef::uri can inspect its contents at compile time
+#define NDEF_STR(s) ([]() { return s; })
+
+namespace ndef
+{
+
+namespace detail
+{
+
+constexpr size_t length(const char *s)
+{
+    size_t n = 0;
+    while (s[n] != '\0')
+    {
+        n++;
+    }
+    return n;
+}
+
+constexpr size_t uriPrefixLength(uint8_t code)
+{
+    return URI_PREFIX_OFFSET[code + 1] - URI_PREFIX_OFFSET[code];
+}
+
+constexpr bool hasUriPrefix(const char *uri, uint8_t code)
+{
+    for (size_t i = 0; i < uriPrefixLength(code); i++)
+    {
+        if (uri[i] != URI_PREFIX_TEXT[URI_PREFIX_OFFSET[code] + i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// identifier code of the longest prefix of uri, 0 when nothing matches
+constexpr uint8_t uriPrefixCode(const char *uri)
+{
+    uint8_t code = 0;
+    for (uint8_t i = 1; i < URI_PREFIX_COUNT; i++)
+    {
+        if (uriPrefixLength(i) > uriPrefixLength(code) && hasUriPrefix(uri, i))
+        {
+            code = i;
+        }
+    }
+    return code;
+}
+
+// tnf + type length + payload length, payload length is 1 byte for short records
+constexpr size_t headerSize(size_t payloadLength)
+{
+    return payloadLength <= 0xFF ? 3 : 6;
+}
+
+constexpr size_t recordSize(size_t typeLength, size_t payloadLength)
+{
+    return headerSize(payloadLength) + typeLength + payloadLength;
+}
+
+// Record with header and type filled in, MB and ME are left for message()
+template <size_t TypeLength, size_t PayloadLength>
+constexpr std::array<uint8_t, recordSize(TypeLength, PayloadLength)> record(uint8_t tnf, const char *type)
+{
+    static_assert(TypeLength <= 0xFF, "NDEF type is too long");
+
+    std::array<uint8_t, recordSize(TypeLength, PayloadLength)> r{};
+    size_t i = 0;
+
+    r[i++] = tnf | (PayloadLength <= 0xFF ? 0x10 : 0x0); // SR
+    r[i++] = TypeLength;
+    if (PayloadLength <= 0xFF)
+    {
+        r[i++] = PayloadLength;
+    }
+    else
+    {
+        r[i++] = (PayloadLength >> 24) & 0xFF;
+        r[i++] = (PayloadLength >> 16) & 0xFF;
+        r[i++] = (PayloadLength >> 8) & 0xFF;
+        r[i++] = PayloadLength & 0xFF;
+    }
+    for (size_t t = 0; t < TypeLength; t++)
+    {
+        r[i++] = type[t];
+    }
+    return r;
+}
+
+template <size_t M, size_t N>
+constexpr void append(std::array<uint8_t, M> &m, size_t &index, size_t &lastRecord, const std::array<uint8_t, N> &r)
+{
+    lastRecord = index;
+    for (size_t i = 0; i < N; i++)
+    {
+        m[index++] = r[i];
+    }
+}
+
+}
+
+// Well known Text record, UTF-8. Arguments must be string literals.
+template <size_t L, size_t T>
+constexpr auto text(const char (&language)[L], const char (&value)[T])
+{
+    static_assert(L - 1 <= 0x3F, "language code is too long");
+
+    constexpr size_t payloadLength = 1 + (L - 1) + (T - 1);
+    auto r = detail::record<1, payloadLength>(TNF_WELL_KNOWN, "T");
+    size_t i = detail::headerSize(payloadLength) + 1;
+
+    r[i++] = L - 1; // status byte, UTF-8 and length of the language code
+    for (size_t k = 0; k < L - 1; k++)
+    {
+        r[i++] = language[k];
+    }
+    for (size_t k = 0; k < T - 1; k++)
+    {
+        r[i++] = value[k];
+    }
+    return r;
+}
+
+// Well known URI record, the longest matching identifier code replaces the prefix.
+// Pass the uri through NDEF_STR so its contents are a constant expression.
+template <typename Literal>
+constexpr auto uri(Literal literal)
+{
+    constexpr const char *value = literal();
+    constexpr uint8_t code = detail::uriPrefixCode(value);
+    constexpr size_t prefixLength = detail::uriPrefixLength(code);
+    constexpr size_t payloadLength = 1 + detail::length(value) - prefixLength;
+
+    auto r = detail::record<1, payloadLength>(TNF_WELL_KNOWN, "U");
+    size_t i = detail::headerSize(payloadLength) + 1;
+
+    r[i++] = code;
+    for (size_t k = prefixLength; value[k] != '\0'; k++)
+    {
+        r[i++] = value[k];
+    }
+    return r;
+}
+
+// Concatenates records and sets MB on the first and ME on the last one
+template <size_t... N>
+constexpr std::array<uint8_t, (N + ...)> message(const std::array<uint8_t, N> &... records)
+{
+    static_assert(sizeof...(N) > 0, "NDEF message needs at least one record");
+
+    std::array<uint8_t, (N + ...)> m{};
+    size_t index = 0;
+    size_t lastRecord = 0;
+
+    (detail::append(m, index, lastRecord, records), ...);
+
+    m[0] |= 0x80; // MB
+    m[lastRecord] |= 0x40; // ME
+    return m;
+}
+
+}
+
+#endif
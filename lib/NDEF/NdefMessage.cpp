@@ -1,11 +1,14 @@
 #include <NdefMessage.h>
 
-NdefMessage::NdefMessage(void)
+NdefMessageBase::NdefMessageBase(NdefRecord *records, unsigned int maxRecords)
 {
+    // records are not constructed yet, only remember where they live
+    _records = records;
+    _maxRecords = maxRecords;
     _recordCount = 0;
 }
 
-NdefMessage::NdefMessage(const byte * data, const int numBytes)
+void NdefMessageBase::decode(const byte * data, const int numBytes)
 {
     #ifdef NDEF_DEBUG
     Serial.print(F("Decoding "));Serial.print(numBytes);Serial.println(F(" bytes"));
@@ -45,10 +48,11 @@ NdefMessage::NdefMessage(const byte * data, const int numBytes)
         else
         {
             payloadLength =
-		((0xFF & data[++index]) << 24)
-		| ((0xFF & data[++index]) << 16)
-		| ((0xFF & data[++index]) << 8)
-		| (0xFF & data[++index]);
+		((0xFF & data[index + 1]) << 24)
+		| ((0xFF & data[index + 2]) << 16)
+		| ((0xFF & data[index + 3]) << 8)
+		| (0xFF & data[index + 4]);
+            index += 4;
         }
 
         int idLength = 0;
@@ -78,22 +82,11 @@ NdefMessage::NdefMessage(const byte * data, const int numBytes)
 
 }
 
-NdefMessage::NdefMessage(const NdefMessage& rhs)
-{
-
-    _recordCount = rhs._recordCount;
-    for (int i = 0; i < _recordCount; i++)
-    {
-        _records[i] = rhs._records[i];
-    }
-
-}
-
-NdefMessage::~NdefMessage()
+NdefMessageBase::~NdefMessageBase()
 {
 }
 
-NdefMessage& NdefMessage::operator=(const NdefMessage& rhs)
+NdefMessageBase& NdefMessageBase::operator=(const NdefMessageBase& rhs)
 {
 
     if (this != &rhs)
@@ -107,6 +100,11 @@ NdefMessage& NdefMessage::operator=(const NdefMessage& rhs)
         }
 
         _recordCount = rhs._recordCount;
+        if (_recordCount > _maxRecords)
+        {
+            Serial.println(F("WARNING: Too many records. Use a larger BasicNdefMessage."));
+            _recordCount = _maxRecords;
+        }
         for (int i = 0; i < _recordCount; i++)
         {
             _records[i] = rhs._records[i];
@@ -115,12 +113,17 @@ NdefMessage& NdefMessage::operator=(const NdefMessage& rhs)
     return *this;
 }
 
-unsigned int NdefMessage::getRecordCount()
+unsigned int NdefMessageBase::getRecordCount()
 {
     return _recordCount;
 }
 
-int NdefMessage::getEncodedSize()
+unsigned int NdefMessageBase::getMaxRecordCount()
+{
+    return _maxRecords;
+}
+
+int NdefMessageBase::getEncodedSize()
 {
     int size = 0;
     for (int i = 0; i < _recordCount; i++)
@@ -131,7 +134,7 @@ int NdefMessage::getEncodedSize()
 }
 
 // TODO change this to return uint8_t*
-void NdefMessage::encode(uint8_t* data)
+void NdefMessageBase::encode(uint8_t* data)
 {
     // assert sizeof(data) >= getEncodedSize()
     uint8_t* data_ptr = &data[0];
@@ -145,10 +148,10 @@ void NdefMessage::encode(uint8_t* data)
 
 }
 
-boolean NdefMessage::addRecord(NdefRecord& record)
+boolean NdefMessageBase::addRecord(NdefRecord& record)
 {
 
-    if (_recordCount < MAX_NDEF_RECORDS)
+    if (_recordCount < _maxRecords)
     {
         _records[_recordCount] = record;
         _recordCount++;
@@ -156,12 +159,12 @@ boolean NdefMessage::addRecord(NdefRecord& record)
     }
     else
     {
-        Serial.println(F("WARNING: Too many records. Increase MAX_NDEF_RECORDS."));
+        Serial.println(F("WARNING: Too many records. Use a larger BasicNdefMessage."));
         return false;
     }
 }
 
-void NdefMessage::addMimeMediaRecord(String mimeType, String payload)
+void NdefMessageBase::addMimeMediaRecord(String mimeType, String payload)
 {
 
     byte payloadBytes[payload.length() + 1];
@@ -170,7 +173,7 @@ void NdefMessage::addMimeMediaRecord(String mimeType, String payload)
     addMimeMediaRecord(mimeType, payloadBytes, payload.length());
 }
 
-void NdefMessage::addMimeMediaRecord(String mimeType, uint8_t* payload, int payloadLength)
+void NdefMessageBase::addMimeMediaRecord(String mimeType, uint8_t* payload, int payloadLength)
 {
     NdefRecord r = NdefRecord();
     r.setTnf(TNF_MIME_MEDIA);
@@ -184,12 +187,12 @@ void NdefMessage::addMimeMediaRecord(String mimeType, uint8_t* payload, int payl
     addRecord(r);
 }
 
-void NdefMessage::addTextRecord(String text)
+void NdefMessageBase::addTextRecord(String text)
 {
     addTextRecord(text, "en");
 }
 
-void NdefMessage::addTextRecord(String text, String encoding)
+void NdefMessageBase::addTextRecord(String text, String encoding)
 {
     NdefRecord r = NdefRecord();
     r.setTnf(TNF_WELL_KNOWN);
@@ -212,7 +215,7 @@ void NdefMessage::addTextRecord(String text, String encoding)
     addRecord(r);
 }
 
-void NdefMessage::addUriRecord(String uri)
+void NdefMessageBase::addUriRecord(String uri)
 {
     NdefRecord* r = new NdefRecord();
     r->setTnf(TNF_WELL_KNOWN);
@@ -220,22 +223,21 @@ void NdefMessage::addUriRecord(String uri)
     uint8_t RTD_URI[1] = { 0x55 }; // TODO this should be a constant or preprocessor
     r->setType(RTD_URI, sizeof(RTD_URI));
 
-    // X is a placeholder for identifier code
-    String payloadString = "X" + uri;
-
-    byte payload[payloadString.length() + 1];
-    payloadString.getBytes(payload, sizeof(payload));
+    // replace the longest known prefix with its identifier code
+    uint8_t prefixLength;
+    uint8_t code = UriPrefix::match(uri.c_str(), &prefixLength);
 
-    // add identifier code 0x0, meaning no prefix substitution
-    payload[0] = 0x0;
+    byte payload[uri.length() - prefixLength + 1];
+    payload[0] = code;
+    memcpy(&payload[1], uri.c_str() + prefixLength, uri.length() - prefixLength);
 
-    r->setPayload(payload, payloadString.length());
+    r->setPayload(payload, sizeof(payload));
 
     addRecord(*r);
     delete(r);
 }
 
-void NdefMessage::addEmptyRecord()
+void NdefMessageBase::addEmptyRecord()
 {
     NdefRecord* r = new NdefRecord();
     r->setTnf(TNF_EMPTY);
@@ -243,7 +245,7 @@ void NdefMessage::addEmptyRecord()
     delete(r);
 }
 
-NdefRecord NdefMessage::getRecord(int index)
+NdefRecord NdefMessageBase::getRecord(int index)
 {
     if (index > -1 && index < _recordCount)
     {
@@ -255,12 +257,12 @@ NdefRecord NdefMessage::getRecord(int index)
     }
 }
 
-NdefRecord NdefMessage::operator[](int index)
+NdefRecord NdefMessageBase::operator[](int index)
 {
     return getRecord(index);
 }
 
-void NdefMessage::print()
+void NdefMessageBase::print()
 {
     Serial.print(F("\nNDEF Message "));Serial.print(_recordCount);Serial.print(F(" record"));
     _recordCount == 1 ? Serial.print(", ") : Serial.print("s, ");
@@ -4,17 +4,16 @@
 #include <Ndef.h>
 #include <NdefRecord.h>
 
+// default capacity of NdefMessage, use BasicNdefMessage<N> for other sizes
+#ifndef MAX_NDEF_RECORDS
 #define MAX_NDEF_RECORDS 4
+#endif
 
-class NdefMessage
+// Record handling shared by every BasicNdefMessage<N>.
+// The record array is owned by the derived class.
+class NdefMessageBase
 {
     public:
-        NdefMessage(void);
-        NdefMessage(const byte *data, const int numBytes);
-        NdefMessage(const NdefMessage& rhs);
-        ~NdefMessage();
-        NdefMessage& operator=(const NdefMessage& rhs);
-
         int getEncodedSize(); // need so we can pass array to encode
         void encode(byte *data);
 
@@ -27,13 +26,55 @@ class NdefMessage
         void addEmptyRecord();
 
         unsigned int getRecordCount();
+        unsigned int getMaxRecordCount();
         NdefRecord getRecord(int index);
         NdefRecord operator[](int index);
 
         void print();
+    protected:
+        NdefMessageBase(NdefRecord *records, unsigned int maxRecords);
+        ~NdefMessageBase();
+        NdefMessageBase& operator=(const NdefMessageBase& rhs);
+        void decode(const byte *data, const int numBytes);
     private:
-        NdefRecord _records[MAX_NDEF_RECORDS];
+        NdefMessageBase(const NdefMessageBase& rhs); // records would be aliased
+        NdefRecord *_records;
+        unsigned int _maxRecords;
         unsigned int _recordCount;
 };
 
-#endif
\ No newline at end of file
+template <unsigned int MaxRecords>
+class BasicNdefMessage : public NdefMessageBase
+{
+    public:
+        BasicNdefMessage(void) : NdefMessageBase(_storage, MaxRecords) {}
+        BasicNdefMessage(const byte *data, const int numBytes) : NdefMessageBase(_storage, MaxRecords)
+        {
+            decode(data, numBytes);
+        }
+        BasicNdefMessage(const BasicNdefMessage& rhs) : NdefMessageBase(_storage, MaxRecords)
+        {
+            NdefMessageBase::operator=(rhs);
+        }
+        // copy from a message of a different capacity, extra records are dropped
+        BasicNdefMessage(const NdefMessageBase& rhs) : NdefMessageBase(_storage, MaxRecords)
+        {
+            NdefMessageBase::operator=(rhs);
+        }
+        BasicNdefMessage& operator=(const BasicNdefMessage& rhs)
+        {
+            NdefMessageBase::operator=(rhs);
+            return *this;
+        }
+        BasicNdefMessage& operator=(const NdefMessageBase& rhs)
+        {
+            NdefMessageBase::operator=(rhs);
+            return *this;
+        }
+    private:
+        NdefRecord _storage[MaxRecords];
+};
+
+typedef BasicNdefMessage<MAX_NDEF_RECORDS> NdefMessage;
+
+#endif
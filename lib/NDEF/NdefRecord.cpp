@@ -285,6 +285,15 @@ String NdefRecord::getId()
     return String(id);
 }
 
+UriView NdefRecord::getUri()
+{
+    if (_tnf != TNF_WELL_KNOWN || _typeLength != 1 || _type[0] != 0x55) // 'U'
+    {
+        return UriView();
+    }
+    return UriView(_payload, _payloadLength);
+}
+
 void NdefRecord::getId(byte *id)
 {
     memcpy(id, _id, _idLength);
@@ -343,6 +352,11 @@ void NdefRecord::print()
     Serial.print(F("    Type "));PrintHexChar(_type, _typeLength);
     // TODO chunk large payloads so this is readable
     Serial.print(F("    Payload "));PrintHexChar(_payload, _payloadLength);
+    UriView uri = getUri();
+    if (uri.length())
+    {
+        Serial.print(F("    URI "));Serial.println(uri);
+    }
     if (_idLength)
     {
         Serial.print(F("    Id "));PrintHexChar(_id, _idLength);
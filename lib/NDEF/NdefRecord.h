@@ -4,6 +4,7 @@
 #include <Due.h>
 #include <Arduino.h>
 #include <Ndef.h>
+#include <uri_prefix.h>
 
 #define TNF_EMPTY 0x0
 #define TNF_WELL_KNOWN 0x01
@@ -37,6 +38,8 @@ class NdefRecord
         // convenience methods
         String getType();
         String getId();
+        // prefix and remainder of a URI record, valid while the record is unchanged
+        UriView getUri();
 
         void setTnf(byte tnf);
         void setType(const byte *type, const unsigned int numBytes);
@@ -0,0 +1,17 @@
+#ifndef NdefSource_h
+#define NdefSource_h
+
+#include <Arduino.h>
+
+// Where a lazily read NfcTag fetches its NDEF message from, see NfcAdapter::read
+class NdefSource
+{
+    public:
+        virtual ~NdefSource() {}
+        // Copies length bytes of the message starting at offset. session is
+        // the one the tag was read in, false once another tag was selected
+        // or the tag could not be read.
+        virtual boolean readMessage(unsigned int session, unsigned int offset, byte *data, unsigned int length) = 0;
+};
+
+#endif
@@ -1,17 +1,26 @@
 #include <NfcAdapter.h>
+#include <memprobe.h>
 
 NfcAdapter::NfcAdapter(PN532Interface &interface)
 {
     shield = new PN532(interface);
+    skippedBlocks = 0;
+    session = 0;
+    cache = (byte*)NULL;
+    messageLength = 0;
+    polls = NFC_POLL_ISO14443A;
+    polledType = TAG_TYPE_UNKNOWN;
 }
 
 NfcAdapter::~NfcAdapter(void)
 {
+    closeCache();
     delete shield;
 }
 
-void NfcAdapter::begin(boolean verbose)
+void NfcAdapter::begin(boolean verbose, uint8_t polls)
 {
+    this->polls = polls;
     shield->begin();
 
     uint32_t versiondata = shield->getFirmwareVersion();
@@ -34,16 +43,53 @@ void NfcAdapter::begin(boolean verbose)
 
 boolean NfcAdapter::tagPresent(unsigned long timeout)
 {
-    uint8_t success;
+    uint8_t success = false;
     uidLength = 0;
+    polledType = TAG_TYPE_UNKNOWN;
+    closeCache();
 
+    // each poll gets its share of timeout, the PN532 waits 1000 ms for 0
+    unsigned int count = 0;
+    for (uint8_t mask = polls & NFC_POLL_ALL; mask; mask >>= 1)
+    {
+        count += mask & 1;
+    }
     if (timeout == 0)
     {
-        success = shield->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, (uint8_t*)&uidLength);
+        timeout = 1000;
     }
-    else
+    unsigned long share = count > 1 ? timeout / count : timeout;
+    if (share == 0)
+    {
+        share = 1; // 0 would wait forever
+    }
+    if (share > 0xFFFF)
+    {
+        share = 0xFFFF;
+    }
+
+    if (polls & NFC_POLL_ISO14443A)
+    {
+        success = shield->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, (uint8_t*)&uidLength, share);
+    }
+    if (!success && (polls & NFC_POLL_ISO14443B))
     {
-        success = shield->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, (uint8_t*)&uidLength, timeout);
+        success = shield->readTypeBTargetID(0x00, uid, share);
+        uidLength = success ? 4 : 0; // PUPI
+        polledType = success ? TAG_TYPE_4 : TAG_TYPE_UNKNOWN;
+    }
+    if (!success && (polls & NFC_POLL_JEWEL))
+    {
+        success = shield->readJewelTargetID(uid, (uint8_t*)&uidLength, share);
+        polledType = success ? TAG_TYPE_1 : TAG_TYPE_UNKNOWN;
+    }
+    if (!success && (polls & NFC_POLL_FELICA))
+    {
+        byte pmm[8];
+        uint16_t systemCode;
+        success = shield->felica_Polling(FELICA_NDEF_SYSTEM_CODE, 0, uid, pmm, &systemCode, share) == 1;
+        uidLength = success ? 8 : 0;
+        polledType = success ? TAG_TYPE_3 : TAG_TYPE_UNKNOWN;
     }
     return success;
 }
@@ -59,7 +105,8 @@ boolean NfcAdapter::erase()
 boolean NfcAdapter::format()
 {
     boolean success;
-    if (uidLength == 4)
+    closeCache();
+    if (uidLength == 4 && guessTagType() == TAG_TYPE_MIFARE_CLASSIC)
     {
         MifareClassic mifareClassic = MifareClassic(*shield);
         success = mifareClassic.formatNDEF(uid, uidLength);
@@ -74,6 +121,7 @@ boolean NfcAdapter::format()
 
 boolean NfcAdapter::clean()
 {
+    closeCache();
     uint8_t type = guessTagType();
 
     if (type == TAG_TYPE_MIFARE_CLASSIC)
@@ -103,7 +151,9 @@ boolean NfcAdapter::clean()
 
 NfcTag NfcAdapter::read()
 {
+    MEMPROBE_SCOPE("NDEF read");
     uint8_t type = guessTagType();
+    closeCache();
 
     if (type == TAG_TYPE_MIFARE_CLASSIC)
     {
@@ -111,7 +161,35 @@ NfcTag NfcAdapter::read()
         Serial.println(F("Reading Mifare Classic"));
         #endif
         MifareClassic mifareClassic = MifareClassic(*shield);
-        return mifareClassic.read(uid, uidLength);
+        int start;
+        int length;
+        authenticatedSector = -1;
+
+        if (!mifareClassic.findNdefTlv(uid, uidLength, length, start, authenticatedSector))
+        {
+            Serial.println(F("Tag is not NDEF formatted."));
+            return NfcTag(uid, uidLength, MIFARE_CLASSIC);
+        }
+        if (length == 0)
+        {
+            NdefMessage message = NdefMessage();
+            message.addEmptyRecord();
+            NfcTag tag = NfcTag(uid, uidLength, MIFARE_CLASSIC, message);
+            mifareClassic.describeTag(tag, length, start);
+            return tag;
+        }
+
+        openCache(type, BLOCK_SIZE, start, length);
+        ndefSectors = mifareClassic.getNdefSectors();
+        // the block with the TLV header is already read, keep it
+        unsigned int unit = start / BLOCK_SIZE;
+        if (cache != NULL && mifareClassic.readDataBlock(uid, uidLength, unit, &cache[unit * BLOCK_SIZE], authenticatedSector))
+        {
+            cached[unit] = 1;
+        }
+        NfcTag tag = NfcTag(uid, uidLength, MIFARE_CLASSIC, this, session, length);
+        mifareClassic.describeTag(tag, length, start);
+        return tag;
     }
     else if (type == TAG_TYPE_2)
     {
@@ -119,7 +197,50 @@ NfcTag NfcAdapter::read()
         Serial.println(F("Reading Mifare Ultralight"));
         #endif
         MifareUltralight ultralight = MifareUltralight(*shield);
-        return ultralight.read(uid, uidLength);
+        unsigned int start;
+        unsigned int length;
+
+        if (!ultralight.readNdefHeader(start, length))
+        {
+            return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_2);
+        }
+        if (length == 0) // data is 0x44 0x03 0x00 0xFE
+        {
+            NdefMessage message = NdefMessage();
+            message.addEmptyRecord();
+            NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_2, message);
+            ultralight.describeTag(tag);
+            return tag;
+        }
+
+        openCache(type, ULTRALIGHT_PAGE_SIZE, start, length);
+        NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_2, this, session, length);
+        ultralight.describeTag(tag);
+        return tag;
+    }
+    else if (type == TAG_TYPE_1)
+    {
+        #ifdef NDEF_DEBUG
+        Serial.println(F("Reading Type 1 tag"));
+        #endif
+        Type1Tag type1 = Type1Tag(*shield);
+        return type1.read(uid, uidLength);
+    }
+    else if (type == TAG_TYPE_3)
+    {
+        #ifdef NDEF_DEBUG
+        Serial.println(F("Reading Type 3 tag"));
+        #endif
+        Type3Tag type3 = Type3Tag(*shield);
+        return type3.read(uid, uidLength);
+    }
+    else if (type == TAG_TYPE_4)
+    {
+        #ifdef NDEF_DEBUG
+        Serial.println(F("Reading Type 4 tag"));
+        #endif
+        Type4Tag type4 = Type4Tag(*shield);
+        return type4.read(uid, uidLength);
     }
     else if (type == TAG_TYPE_UNKNOWN)
     {
@@ -135,8 +256,84 @@ NfcTag NfcAdapter::read()
 
 }
 
-boolean NfcAdapter::write(NdefMessage& ndefMessage)
+boolean NfcAdapter::readMessage(unsigned int session, unsigned int offset, byte *data, unsigned int length)
+{
+    if (cache == NULL || session != this->session || offset + length > messageLength)
+    {
+        return false;
+    }
+
+    unsigned int position = messageStart + offset;
+    while (length > 0)
+    {
+        unsigned int unit = position / cacheUnitSize;
+        if (!cached[unit])
+        {
+            if (!fetchUnit(unit))
+            {
+                return false;
+            }
+            cached[unit] = 1;
+        }
+
+        unsigned int skip = position % cacheUnitSize;
+        unsigned int count = cacheUnitSize - skip < length ? cacheUnitSize - skip : length;
+        memcpy(data, &cache[unit * cacheUnitSize + skip], count);
+        data += count;
+        position += count;
+        length -= count;
+    }
+    return true;
+}
+
+// room for the data area up to the end of the message, nothing read yet
+void NfcAdapter::openCache(uint8_t type, unsigned int unitSize, unsigned int start, unsigned int length)
+{
+    unsigned int units = (start + length + unitSize - 1) / unitSize;
+
+    cacheTagType = type;
+    cacheUnitSize = unitSize;
+    messageStart = start;
+    messageLength = length;
+    cache = (byte*)malloc(units * unitSize + units);
+    if (cache == NULL)
+    {
+        return;
+    }
+    cached = &cache[units * unitSize];
+    memset(cached, 0, units);
+}
+
+// tags read before can't fetch anything after this
+void NfcAdapter::closeCache()
 {
+    free(cache);
+    cache = (byte*)NULL;
+    messageLength = 0;
+    session++;
+}
+
+boolean NfcAdapter::fetchUnit(unsigned int unit)
+{
+    byte *data = &cache[unit * cacheUnitSize];
+
+    if (cacheTagType == TAG_TYPE_MIFARE_CLASSIC)
+    {
+        MifareClassic mifareClassic = MifareClassic(*shield);
+        mifareClassic.setNdefSectors(ndefSectors, uid, uidLength);
+        return mifareClassic.readDataBlock(uid, uidLength, unit, data, authenticatedSector);
+    }
+    else
+    {
+        MifareUltralight ultralight = MifareUltralight(*shield);
+        return ultralight.readDataPage(unit, data);
+    }
+}
+
+boolean NfcAdapter::write(NdefMessageBase& ndefMessage)
+{
+    MEMPROBE_SCOPE("NDEF write");
+    closeCache();
     boolean success;
     uint8_t type = guessTagType();
 
@@ -156,6 +353,30 @@ boolean NfcAdapter::write(NdefMessage& ndefMessage)
         MifareUltralight mifareUltralight = MifareUltralight(*shield);
         success = mifareUltralight.write(ndefMessage, uid, uidLength);
     }
+    else if (type == TAG_TYPE_1)
+    {
+        #ifdef NDEF_DEBUG
+        Serial.println(F("Writing Type 1 tag"));
+        #endif
+        Type1Tag type1 = Type1Tag(*shield);
+        success = type1.write(ndefMessage, uid, uidLength);
+    }
+    else if (type == TAG_TYPE_3)
+    {
+        #ifdef NDEF_DEBUG
+        Serial.println(F("Writing Type 3 tag"));
+        #endif
+        Type3Tag type3 = Type3Tag(*shield);
+        success = type3.write(ndefMessage, uid, uidLength);
+    }
+    else if (type == TAG_TYPE_4)
+    {
+        #ifdef NDEF_DEBUG
+        Serial.println(F("Writing Type 4 tag"));
+        #endif
+        Type4Tag type4 = Type4Tag(*shield);
+        success = type4.write(ndefMessage, uid, uidLength);
+    }
     else if (type == TAG_TYPE_UNKNOWN)
     {
         Serial.print(F("Can not determine tag type"));
@@ -170,6 +391,167 @@ boolean NfcAdapter::write(NdefMessage& ndefMessage)
     return success;
 }
 
+boolean NfcAdapter::writeChanged(NdefMessageBase& ndefMessage, const byte *image, unsigned int imageLength)
+{
+    MEMPROBE_SCOPE("NDEF write");
+    closeCache();
+    boolean success;
+    uint8_t type = guessTagType();
+    skippedBlocks = 0;
+
+    if (type == TAG_TYPE_MIFARE_CLASSIC)
+    {
+        MifareClassic mifareClassic = MifareClassic(*shield);
+        success = mifareClassic.writeChanged(ndefMessage, uid, uidLength, image, imageLength);
+        skippedBlocks = mifareClassic.getSkippedBlocks();
+    }
+    else if (type == TAG_TYPE_2)
+    {
+        MifareUltralight mifareUltralight = MifareUltralight(*shield);
+        success = mifareUltralight.writeChanged(ndefMessage, uid, uidLength, image, imageLength);
+        skippedBlocks = mifareUltralight.getSkippedPages();
+    }
+    else
+    {
+        Serial.print(F("No driver for card type "));Serial.println(type);
+        success = false;
+    }
+
+    return success;
+}
+
+boolean NfcAdapter::appendRecord(NdefRecord& record)
+{
+    return updateRecord(-1, record);
+}
+
+boolean NfcAdapter::replaceRecord(int index, NdefRecord& record)
+{
+    if (index < 0)
+    {
+        return false;
+    }
+    return updateRecord(index, record);
+}
+
+// Splices record into the message on the tag and writes the blocks or pages
+// that differ, the message read is the image they are compared with. index
+// -1 appends.
+boolean NfcAdapter::updateRecord(int index, NdefRecord& record)
+{
+    MEMPROBE_SCOPE("NDEF update");
+    skippedBlocks = 0;
+    uint8_t type = guessTagType();
+    if (type != TAG_TYPE_MIFARE_CLASSIC && type != TAG_TYPE_2)
+    {
+        Serial.print(F("No driver for card type "));Serial.println(type);
+        return false;
+    }
+    NfcTag tag = read();
+
+    if (!tag.hasNdefMessage() || (cache == NULL && messageLength > 0))
+    {
+        closeCache();
+        return false;
+    }
+    if (cache == NULL)
+    {
+        // empty TLV, the tag holds no records yet
+        if (index > 0)
+        {
+            return false;
+        }
+        NdefMessage message = NdefMessage();
+        message.addRecord(record);
+        return writeChanged(message);
+    }
+
+    // the whole message, it is compared with the new one anyway
+    unsigned int units = (messageStart + messageLength + cacheUnitSize - 1) / cacheUnitSize;
+    for (unsigned int unit = 0; unit < units; unit++)
+    {
+        if (!cached[unit])
+        {
+            if (!fetchUnit(unit))
+            {
+                closeCache();
+                return false;
+            }
+            cached[unit] = 1;
+        }
+    }
+    byte *old = &cache[messageStart];
+
+    // find the record to replace, the end of the message to append
+    unsigned int recordStart = 0;
+    unsigned int lastStart = 0;
+    int i = 0;
+    while (recordStart < messageLength && (index < 0 || i < index))
+    {
+        unsigned long size = getNdefRecordSize(&old[recordStart], messageLength - recordStart);
+        if (size == 0)
+        {
+            Serial.println(F("Error. Bad NDEF record."));
+            closeCache();
+            return false;
+        }
+        lastStart = recordStart;
+        recordStart += size;
+        i++;
+    }
+    unsigned int recordEnd = recordStart;
+    if (index >= 0)
+    {
+        if (recordStart >= messageLength)
+        {
+            Serial.print(F("Error. No record "));Serial.println(index);
+            closeCache();
+            return false;
+        }
+        recordEnd += getNdefRecordSize(&old[recordStart], messageLength - recordStart);
+    }
+
+    int recordLength = record.getEncodedSize();
+    unsigned int length = messageLength - (recordEnd - recordStart) + recordLength;
+    byte *message = (byte*)malloc(length);
+    if (message == NULL)
+    {
+        closeCache();
+        return false;
+    }
+    memcpy(message, old, recordStart);
+    record.encode(&message[recordStart], recordStart == 0, recordEnd == messageLength);
+    memcpy(&message[recordStart + recordLength], &old[recordEnd], messageLength - recordEnd);
+    if (index < 0)
+    {
+        message[lastStart] &= ~0x40; // the old last record loses ME
+    }
+
+    boolean success;
+    if (cacheTagType == TAG_TYPE_MIFARE_CLASSIC)
+    {
+        MifareClassic mifareClassic = MifareClassic(*shield);
+        mifareClassic.setNdefSectors(ndefSectors, uid, uidLength);
+        success = mifareClassic.writeChanged(message, length, uid, uidLength, cache, units * cacheUnitSize);
+        skippedBlocks = mifareClassic.getSkippedBlocks();
+    }
+    else
+    {
+        MifareUltralight mifareUltralight = MifareUltralight(*shield);
+        success = mifareUltralight.writeChanged(message, length, uid, uidLength, cache, units * cacheUnitSize);
+        skippedBlocks = mifareUltralight.getSkippedPages();
+    }
+
+    free(message);
+    closeCache();
+    return success;
+}
+
+unsigned int NfcAdapter::getSkippedBlocks()
+{
+    return skippedBlocks;
+}
+
 // TODO this should return a Driver MifareClassic, MifareUltralight, Type 4, Unknown
 // Guess Tag Type by looking at the ATQA and SAK values
 // Need to follow spec for Card Identification. Maybe AN1303, AN1305 and ???
@@ -182,8 +564,18 @@ unsigned int NfcAdapter::guessTagType()
     //  - ATQA 0x44 && SAK 0x8 - Mifare Classic
     //  - ATQA 0x44 && SAK 0x0 - Mifare Ultralight NFC Forum Type 2
     //  - ATQA 0x344 && SAK 0x20 - NFC Forum Type 4
+    // ISO14443B NFC Forum Type 4, Jewel / Topaz NFC Forum Type 1 and FeliCa
+    // NFC Forum Type 3 are known from the polling that found them
 
-    if (uidLength == 4)
+    if (polledType != TAG_TYPE_UNKNOWN)
+    {
+        return polledType;
+    }
+    else if (shield->getSelRes() & 0x20) // ISO 14443-4
+    {
+        return TAG_TYPE_4;
+    }
+    else if (uidLength == 4)
     {
         return TAG_TYPE_MIFARE_CLASSIC;
     }
@@ -4,11 +4,15 @@
 #include <PN532Interface.h>
 #include <PN532.h>
 #include <NfcTag.h>
+#include <NdefSource.h>
 #include <Ndef.h>
 
 // Drivers
 #include <MifareClassic.h>
 #include <MifareUltralight.h>
+#include <Type1Tag.h>
+#include <Type3Tag.h>
+#include <Type4Tag.h>
 
 #define TAG_TYPE_MIFARE_CLASSIC (0)
 #define TAG_TYPE_1 (1)
@@ -17,18 +21,43 @@
 #define TAG_TYPE_4 (4)
 #define TAG_TYPE_UNKNOWN (99)
 
+// what tagPresent() polls for, see begin()
+#define NFC_POLL_ISO14443A (0x01)
+#define NFC_POLL_ISO14443B (0x02)
+#define NFC_POLL_JEWEL     (0x04)
+#define NFC_POLL_FELICA    (0x08)
+#define NFC_POLL_ALL       (0x0F)
+
 #define IRQ   (2)
 #define RESET (3)  // Not connected by default on the NFC Shield
 
-class NfcAdapter {
+class NfcAdapter : public NdefSource {
     public:
         NfcAdapter(PN532Interface &interface);
 
         ~NfcAdapter(void);
-        void begin(boolean verbose=true);
+        // polls is a mask of NFC_POLL_*, ISO14443B, Jewel and FeliCa tags
+        // are only found when asked for
+        void begin(boolean verbose=true, uint8_t polls=NFC_POLL_ISO14443A);
+        // ISO14443A first, then ISO14443B, Jewel / Topaz and FeliCa with the
+        // NDEF system code. timeout (0 for the PN532's 1000 ms) is shared by
+        // the polls begin() enabled, so no tag takes about timeout in all.
         boolean tagPresent(unsigned long timeout=0); // tagAvailable
+        // Reads the TLV header only, the tag fetches the blocks or pages of
+        // its message when they are first used and they are cached here until
+        // the next tagPresent() or write.
         NfcTag read();
-        boolean write(NdefMessage& ndefMessage);
+        boolean readMessage(unsigned int session, unsigned int offset, byte *data, unsigned int length);
+        boolean write(NdefMessageBase& ndefMessage);
+        // write only the blocks or pages that change, see MifareClassic::writeChanged
+        boolean writeChanged(NdefMessageBase& ndefMessage, const byte *image = 0, unsigned int imageLength = 0);
+        // Add a record after the last one or put record in place of the
+        // index-th one. The message on the tag is read and only the blocks
+        // or pages that change are written, see writeChanged.
+        boolean appendRecord(NdefRecord& record);
+        boolean replaceRecord(int index, NdefRecord& record);
+        // blocks or pages the last writeChanged() or record update left alone
+        unsigned int getSkippedBlocks();
         // erase tag by writing an empty NDEF record
         boolean erase();
         // format a tag as NDEF
@@ -37,9 +66,26 @@ class NfcAdapter {
         boolean clean();
     private:
         PN532* shield;
-        byte uid[7];  // Buffer to store the returned UID
-        unsigned int uidLength; // Length of the UID (4 or 7 bytes depending on ISO14443A card type)
+        byte uid[8];  // Buffer to store the returned UID
+        unsigned int uidLength; // Length of the UID (4 or 7 bytes depending on ISO14443A card type, 4 for the ISO14443B PUPI, 8 for the FeliCa IDm)
+        unsigned int skippedBlocks;
+        uint8_t polls; // NFC_POLL_*
+        uint8_t polledType; // TAG_TYPE_1, 3 or 4 (ISO14443B) when the polling tells, else TAG_TYPE_UNKNOWN
         unsigned int guessTagType();
+        // blocks or pages of the message read so far
+        unsigned int session;
+        uint8_t cacheTagType;
+        byte *cache;
+        byte *cached; // a flag per block or page
+        unsigned int cacheUnitSize;
+        unsigned int messageStart; // from block 4 or page 4
+        unsigned int messageLength;
+        int authenticatedSector;
+        uint64_t ndefSectors; // Mifare Classic MAD, see MifareClassic::getNdefSectors
+        void openCache(uint8_t type, unsigned int unitSize, unsigned int start, unsigned int length);
+        void closeCache();
+        boolean fetchUnit(unsigned int unit);
+        boolean updateRecord(int index, NdefRecord& record);
 };
 
 #endif
@@ -6,6 +6,10 @@ NfcTag::NfcTag()
     _uidLength = 0;
     _tagType = "Unknown";
     _ndefMessage = (NdefMessage*)NULL;
+    _source = (NdefSource*)NULL;
+    _session = 0;
+    _ndefLength = 0;
+    setFormatted(false);
 }
 
 NfcTag::NfcTag(byte *uid, unsigned int uidLength)
@@ -14,6 +18,10 @@ NfcTag::NfcTag(byte *uid, unsigned int uidLength)
     _uidLength = uidLength;
     _tagType = "Unknown";
     _ndefMessage = (NdefMessage*)NULL;
+    _source = (NdefSource*)NULL;
+    _session = 0;
+    _ndefLength = 0;
+    setFormatted(false);
 }
 
 NfcTag::NfcTag(byte *uid, unsigned int  uidLength, String tagType)
@@ -22,14 +30,31 @@ NfcTag::NfcTag(byte *uid, unsigned int  uidLength, String tagType)
     _uidLength = uidLength;
     _tagType = tagType;
     _ndefMessage = (NdefMessage*)NULL;
+    _source = (NdefSource*)NULL;
+    _session = 0;
+    _ndefLength = 0;
+    setFormatted(false);
 }
 
-NfcTag::NfcTag(byte *uid, unsigned int  uidLength, String tagType, NdefMessage& ndefMessage)
+NfcTag::NfcTag(byte *uid, unsigned int  uidLength, String tagType, NdefMessageBase& ndefMessage)
 {
     _uid = uid;
     _uidLength = uidLength;
     _tagType = tagType;
-    _ndefMessage = new NdefMessage(ndefMessage);
+    _ndefMessage = (NdefMessage*)NULL;
+    if (ndefMessage.getRecordCount() > MAX_NDEF_RECORDS)
+    {
+        // a copy would lose the records past MAX_NDEF_RECORDS
+        Serial.println(F("WARNING: Too many records for NfcTag, message refused."));
+    }
+    else
+    {
+        _ndefMessage = new NdefMessage(ndefMessage);
+    }
+    _source = (NdefSource*)NULL;
+    _session = 0;
+    _ndefLength = 0;
+    setFormatted(true);
 }
 
 // I don't like this version, but it will use less memory
@@ -39,8 +64,50 @@ NfcTag::NfcTag(byte *uid, unsigned int uidLength, String tagType, const byte *nd
     _uidLength = uidLength;
     _tagType = tagType;
     _ndefMessage = new NdefMessage(ndefData, ndefDataLength);
+    _source = (NdefSource*)NULL;
+    _session = 0;
+    _ndefLength = 0;
+    setFormatted(true);
+}
+
+NfcTag::NfcTag(byte *uid, unsigned int uidLength, String tagType, NdefSource *source, unsigned int session, unsigned int ndefLength)
+{
+    _uid = uid;
+    _uidLength = uidLength;
+    _tagType = tagType;
+    _ndefMessage = (NdefMessage*)NULL;
+    _source = source;
+    _session = session;
+    _ndefLength = ndefLength;
+    setFormatted(true);
 }
 
+NfcTag::NfcTag(const NfcTag& rhs)
+{
+    _uid = rhs._uid;
+    _uidLength = rhs._uidLength;
+    _tagType = rhs._tagType;
+    _ndefMessage = rhs._ndefMessage ? new NdefMessage(*rhs._ndefMessage) : (NdefMessage*)NULL;
+    _source = rhs._source;
+    _session = rhs._session;
+    _ndefLength = rhs._ndefLength;
+    copyLayout(rhs);
+}
+
+#ifdef NFCTAG_MOVE
+NfcTag::NfcTag(NfcTag&& rhs) : _tagType(std::move(rhs._tagType))
+{
+    _uid = rhs._uid;
+    _uidLength = rhs._uidLength;
+    _ndefMessage = rhs._ndefMessage;
+    rhs._ndefMessage = (NdefMessage*)NULL;
+    _source = rhs._source;
+    _session = rhs._session;
+    _ndefLength = rhs._ndefLength;
+    copyLayout(rhs);
+}
+#endif
+
 NfcTag::~NfcTag()
 {
     delete _ndefMessage;
@@ -54,11 +121,34 @@ NfcTag& NfcTag::operator=(const NfcTag& rhs)
         _uid = rhs._uid;
         _uidLength = rhs._uidLength;
         _tagType = rhs._tagType;
-        // TODO do I need a copy here?
+        _ndefMessage = rhs._ndefMessage ? new NdefMessage(*rhs._ndefMessage) : (NdefMessage*)NULL;
+        _source = rhs._source;
+        _session = rhs._session;
+        _ndefLength = rhs._ndefLength;
+        copyLayout(rhs);
+    }
+    return *this;
+}
+
+#ifdef NFCTAG_MOVE
+NfcTag& NfcTag::operator=(NfcTag&& rhs)
+{
+    if (this != &rhs)
+    {
+        delete _ndefMessage;
+        _uid = rhs._uid;
+        _uidLength = rhs._uidLength;
+        _tagType = std::move(rhs._tagType);
         _ndefMessage = rhs._ndefMessage;
+        rhs._ndefMessage = (NdefMessage*)NULL;
+        _source = rhs._source;
+        _session = rhs._session;
+        _ndefLength = rhs._ndefLength;
+        copyLayout(rhs);
     }
     return *this;
 }
+#endif
 
 uint8_t NfcTag::getUidLength()
 {
@@ -98,19 +188,179 @@ String NfcTag::getTagType()
 
 boolean NfcTag::hasNdefMessage()
 {
-    return (_ndefMessage != NULL);
+    return (_ndefMessage != NULL || _source != NULL);
 }
 
 NdefMessage NfcTag::getNdefMessage()
 {
+    if (!fetchNdefMessage())
+    {
+        return NdefMessage();
+    }
     return *_ndefMessage;
 }
 
+NdefRecord NfcTag::getNdefRecord(int index)
+{
+    if (_ndefMessage != NULL)
+    {
+        return _ndefMessage->getRecord(index);
+    }
+    if (_source == NULL || index < 0)
+    {
+        return NdefRecord();
+    }
+
+    // walk the record headers, only the record asked for is read in full
+    byte header[7]; // flags, type length, payload length (1 or 4 bytes), id length
+    unsigned int offset = 0;
+    for (int i = 0; offset < _ndefLength; i++)
+    {
+        unsigned int available = _ndefLength - offset;
+        unsigned int headerLength = available < sizeof(header) ? available : sizeof(header);
+        if (!_source->readMessage(_session, offset, header, headerLength))
+        {
+            break;
+        }
+
+        unsigned long size = getNdefRecordSize(header, available);
+        if (size == 0)
+        {
+            Serial.println(F("Error. NDEF record runs past the message."));
+            break;
+        }
+
+        if (i == index)
+        {
+            NdefRecord record = NdefRecord();
+            byte *data = (byte*)malloc(size);
+            if (data && _source->readMessage(_session, offset, data, size))
+            {
+                data[0] |= 0x40; // set ME so only this record is decoded
+                BasicNdefMessage<1> message = BasicNdefMessage<1>(data, size);
+                record = message.getRecord(0);
+            }
+            free(data);
+            return record;
+        }
+
+        if (header[0] & 0x40)
+        {
+            break; // ME, index is past the last record
+        }
+        offset += size;
+    }
+    return NdefRecord();
+}
+
+// reads the whole message of a lazy tag, it is kept from then on
+boolean NfcTag::fetchNdefMessage()
+{
+    if (_ndefMessage != NULL)
+    {
+        return true;
+    }
+    if (_source == NULL)
+    {
+        return false;
+    }
+
+    byte *data = (byte*)malloc(_ndefLength);
+    if (data == NULL)
+    {
+        return false;
+    }
+    boolean success = _source->readMessage(_session, 0, data, _ndefLength);
+    if (success)
+    {
+        _ndefMessage = new NdefMessage(data, _ndefLength);
+    }
+    else
+    {
+        Serial.println(F("Error. Failed to read the NDEF message."));
+    }
+    free(data);
+    return success;
+}
+
+boolean NfcTag::isFormatted()
+{
+    return _formatted;
+}
+
+unsigned int NfcTag::getCapacity()
+{
+    return _capacity;
+}
+
+unsigned int NfcTag::getUsedBytes()
+{
+    return _usedBytes;
+}
+
+boolean NfcTag::isReadOnly()
+{
+    return _readOnly;
+}
+
+boolean NfcTag::isLocked()
+{
+    return _locked;
+}
+
+// also forgets the rest of the layout, the drivers set it after this
+void NfcTag::setFormatted(boolean formatted)
+{
+    _formatted = formatted;
+    _readOnly = false;
+    _locked = false;
+    _capacity = 0;
+    _usedBytes = 0;
+}
+
+void NfcTag::setCapacity(unsigned int capacity, unsigned int usedBytes)
+{
+    _capacity = capacity;
+    _usedBytes = usedBytes;
+}
+
+void NfcTag::setReadOnly(boolean readOnly, boolean locked)
+{
+    _readOnly = readOnly;
+    _locked = locked;
+}
+
+void NfcTag::copyLayout(const NfcTag& rhs)
+{
+    _formatted = rhs._formatted;
+    _readOnly = rhs._readOnly;
+    _locked = rhs._locked;
+    _capacity = rhs._capacity;
+    _usedBytes = rhs._usedBytes;
+}
+
 void NfcTag::print()
 {
     Serial.print(F("NFC Tag - "));Serial.println(_tagType);
     Serial.print(F("UID "));Serial.println(getUidString());
-    if (_ndefMessage == NULL)
+    if (!_formatted)
+    {
+        Serial.println(F("Not NDEF formatted"));
+    }
+    else if (_capacity)
+    {
+        Serial.print(_usedBytes);Serial.print(F(" of "));Serial.print(_capacity);Serial.print(F(" bytes used"));
+        if (_readOnly)
+        {
+            Serial.print(F(", read only"));
+        }
+        if (_locked)
+        {
+            Serial.print(F(", locked"));
+        }
+        Serial.println();
+    }
+    if (!fetchNdefMessage())
     {
         Serial.println(F("\nNo NDEF Message"));
     }
@@ -3,7 +3,13 @@
 
 #include <inttypes.h>
 #include <Arduino.h>
+// AVR toolchains have no <utility>, tags are copied there
+#if !defined(__AVR__)
+#include <utility>
+#define NFCTAG_MOVE
+#endif
 #include <NdefMessage.h>
+#include <NdefSource.h>
 
 class NfcTag
 {
@@ -11,24 +17,56 @@ class NfcTag
         NfcTag();
         NfcTag(byte *uid, unsigned int uidLength);
         NfcTag(byte *uid, unsigned int uidLength, String tagType);
-        NfcTag(byte *uid, unsigned int uidLength, String tagType, NdefMessage& ndefMessage);
+        // the tag keeps a NdefMessage copy, a message with more than
+        // MAX_NDEF_RECORDS records is refused and the tag has none
+        NfcTag(byte *uid, unsigned int uidLength, String tagType, NdefMessageBase& ndefMessage);
         NfcTag(byte *uid, unsigned int uidLength, String tagType, const byte *ndefData, const int ndefDataLength);
+        // lazy tag, the message is fetched from source when it is first used
+        NfcTag(byte *uid, unsigned int uidLength, String tagType, NdefSource *source, unsigned int session, unsigned int ndefLength);
+        NfcTag(const NfcTag& rhs);
+#ifdef NFCTAG_MOVE
+        NfcTag(NfcTag&& rhs); // takes the message over instead of copying it
+#endif
         ~NfcTag(void);
         NfcTag& operator=(const NfcTag& rhs);
+#ifdef NFCTAG_MOVE
+        NfcTag& operator=(NfcTag&& rhs);
+#endif
         uint8_t getUidLength();
         void getUid(byte *uid, unsigned int uidLength);
         String getUidString();
         String getTagType();
         boolean hasNdefMessage();
         NdefMessage getNdefMessage();
+        // one record of the message, a lazy tag only fetches the records up to it
+        NdefRecord getNdefRecord(int index);
+        // Layout found while reading, so writers can refuse early. Capacity
+        // and used bytes count from block/page 4 (Classic: NDEF sectors,
+        // trailers skipped), used bytes up to the NDEF TLV terminator.
+        boolean isFormatted();
+        unsigned int getCapacity(); // 0 if unknown
+        unsigned int getUsedBytes();
+        boolean isReadOnly();       // writing NDEF is not allowed
+        boolean isLocked();         // lock or access bits are set, for good
+        void setFormatted(boolean formatted);
+        void setCapacity(unsigned int capacity, unsigned int usedBytes);
+        void setReadOnly(boolean readOnly, boolean locked);
         void print();
     private:
         byte *_uid;
         unsigned int _uidLength;
         String _tagType; // Mifare Classic, NFC Forum Type {1,2,3,4}, Unknown
         NdefMessage* _ndefMessage;
-        // TODO capacity
-        // TODO isFormatted
+        NdefSource* _source; // lazy tags only
+        unsigned int _session;
+        unsigned int _ndefLength;
+        boolean _formatted;
+        boolean _readOnly;
+        boolean _locked;
+        unsigned int _capacity;
+        unsigned int _usedBytes;
+        boolean fetchNdefMessage();
+        void copyLayout(const NfcTag& rhs);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,438 @@
+#include <Type1Tag.h>
+
+#define TYPE1_NMN               (8)     // CC byte 0, 0xE1 when the tag holds NDEF
+#define TYPE1_DATA_START        (12)
+#define TYPE1_RESERVED_START    (104)   // blocks 0x0D - 0x0F: reserved, lock and OTP bytes
+#define TYPE1_RESERVED_END      (128)
+#define TYPE1_LOCK_BYTES        (112)
+#define TYPE1_WRITE_E_LIMIT     (128)   // WRITE-E addresses blocks 0x00 - 0x0F only
+
+#define TLV_NULL                (0x00)
+#define TLV_LOCK_CONTROL        (0x01)
+#define TLV_MEMORY_CONTROL      (0x02)
+#define TLV_NDEF                (0x03)
+#define TLV_TERMINATOR          (0xFE)
+
+Type1Tag::Type1Tag(PN532Base& nfcShield)
+{
+    nfc = &nfcShield;
+    exchanges = 0;
+    image = (byte*)NULL;
+    memorySize = 0;
+    ndefTlv = TYPE1_DATA_START;
+    messageStart = 0;
+    messageLength = 0;
+    memset(uid, 0, sizeof(uid));
+    memset(header, 0, sizeof(header));
+    memset(loaded, 0, sizeof(loaded));
+    memset(reserved, 0, sizeof(reserved));
+}
+
+Type1Tag::~Type1Tag()
+{
+    release();
+}
+
+NfcTag Type1Tag::read(byte *uid, unsigned int uidLength)
+{
+    exchanges = 0;
+    if (!readAll(uid, uidLength))
+    {
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_1);
+    }
+    if (image[TYPE1_NMN] != 0xE1)
+    {
+        Serial.println(F("WARNING: Tag is not formatted."));
+        release();
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_1);
+    }
+    if (!findNdefTlv())
+    {
+        release();
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_1);
+    }
+
+    if (messageLength == 0)
+    {
+        NdefMessage message = NdefMessage();
+        message.addEmptyRecord();
+        NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_1, message);
+        describeTag(tag);
+        release();
+        return tag;
+    }
+
+    byte *message = (byte*)malloc(messageLength);
+    if (message == NULL || !readData(messageStart, message, messageLength))
+    {
+        Serial.println(F("Error. Failed to read NDEF message."));
+        free(message);
+        release();
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_1);
+    }
+
+    NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_1, message, messageLength);
+    free(message);
+    describeTag(tag);
+    release();
+    return tag;
+}
+
+// NMN is cleared first and set again once the TLV is written, so a torn
+// write leaves a tag readers ignore rather than a broken message
+boolean Type1Tag::write(NdefMessageBase& m, byte *uid, unsigned int uidLength)
+{
+    exchanges = 0;
+    if (!readAll(uid, uidLength))
+    {
+        return false;
+    }
+    if (image[TYPE1_NMN] != 0xE1)
+    {
+        Serial.println(F("WARNING: Tag is not formatted."));
+        release();
+        return false;
+    }
+    if ((image[TYPE1_NMN + 3] & 0xF0) != 0x00)
+    {
+        Serial.println(F("Error. Tag is read only."));
+        release();
+        return false;
+    }
+    if (!findNdefTlv())
+    {
+        release();
+        return false;
+    }
+
+    unsigned int tlvSize = getNdefTlvSize(m.getEncodedSize());
+    unsigned int room = 0;
+    for (unsigned int a = ndefTlv; a < memorySize; a = nextDataAddress(a))
+    {
+        room++;
+    }
+    if (room + 1 < tlvSize)
+    {
+        Serial.print(F("Error. Encoded Message length exceeded tag Capacity "));Serial.println(room);
+        release();
+        return false;
+    }
+    if (room < tlvSize)
+    {
+        tlvSize = room; // no room for the terminator, the TLV ends the data area
+    }
+
+    byte *tlv = (byte*)malloc(getNdefTlvSize(m.getEncodedSize()));
+    if (tlv == NULL)
+    {
+        release();
+        return false;
+    }
+    encodeNdefTlv(m, tlv);
+
+    boolean success = writeByte(TYPE1_NMN, 0x00);
+    byte changed[sizeof(loaded)];
+    memset(changed, 0, sizeof(changed));
+
+    unsigned int a = ndefTlv;
+    for (unsigned int i = 0; success && i < tlvSize; i++)
+    {
+        unsigned int block = a / TYPE1_BLOCK_SIZE;
+        success = loadBlock(block);
+        if (success && image[a] != tlv[i])
+        {
+            if (isDynamic())
+            {
+                image[a] = tlv[i];
+                changed[block / 8] |= 1 << (block % 8);
+            }
+            else
+            {
+                success = writeByte(a, tlv[i]);
+            }
+        }
+        a = nextDataAddress(a);
+    }
+    for (unsigned int block = 0; success && block < memorySize / TYPE1_BLOCK_SIZE; block++)
+    {
+        if (changed[block / 8] & (1 << (block % 8)))
+        {
+            success = writeBlock(block);
+        }
+    }
+    success = success && writeByte(TYPE1_NMN, 0xE1);
+
+    free(tlv);
+    release();
+    #ifdef TYPE1_DEBUG
+    Serial.print(F("Wrote "));Serial.print(tlvSize);Serial.print(F(" byte TLV in "));Serial.print(exchanges);Serial.println(F(" commands"));
+    #endif
+    return success;
+}
+
+unsigned int Type1Tag::getExchanges()
+{
+    return exchanges;
+}
+
+// RALL: header ROM and the whole static memory in one exchange
+boolean Type1Tag::readAll(byte *tagUid, unsigned int uidLength)
+{
+    release();
+    memset(reserved, 0, sizeof(reserved));
+    memcpy(uid, tagUid, uidLength < 4 ? uidLength : 4);
+
+    byte command[7] = { JEWEL_CMD_RALL, 0x00, 0x00, uid[0], uid[1], uid[2], uid[3] };
+    byte response[2 + TYPE1_STATIC_SIZE];
+    if (!exchange(command, sizeof(command), response, sizeof(response)))
+    {
+        Serial.println(F("Error. RALL failed."));
+        return false;
+    }
+    memcpy(header, response, 2);
+    if ((header[0] & 0xF0) != 0x10)
+    {
+        Serial.print(F("Error. Not an NDEF tag, HR0 "));Serial.println(header[0], HEX);
+        return false;
+    }
+
+    memorySize = TYPE1_STATIC_SIZE;
+    if (response[2 + TYPE1_NMN] == 0xE1)
+    {
+        memorySize = (response[2 + TYPE1_NMN + 2] + 1) * TYPE1_BLOCK_SIZE;
+    }
+    if (memorySize < TYPE1_STATIC_SIZE || !isDynamic())
+    {
+        memorySize = TYPE1_STATIC_SIZE;
+    }
+
+    image = (byte*)malloc(memorySize);
+    if (image == NULL)
+    {
+        return false;
+    }
+    memcpy(image, &response[2], TYPE1_STATIC_SIZE);
+    memset(loaded, 0, sizeof(loaded));
+    for (unsigned int block = 0; block < TYPE1_STATIC_SIZE / TYPE1_BLOCK_SIZE; block++)
+    {
+        loaded[block / 8] |= 1 << (block % 8);
+    }
+    return true;
+}
+
+// Walks the TLVs in front of the NDEF TLV. Lock and memory control TLVs
+// mark bytes the data area skips. Without an NDEF TLV the message is empty
+// and ndefTlv is where one would go.
+boolean Type1Tag::findNdefTlv()
+{
+    unsigned int a = TYPE1_DATA_START;
+    messageLength = 0;
+
+    while (a < memorySize)
+    {
+        byte type;
+        if (!readData(a, &type, 1))
+        {
+            return false;
+        }
+        if (type == TLV_NULL)
+        {
+            a = nextDataAddress(a);
+            continue;
+        }
+        if (type == TLV_TERMINATOR)
+        {
+            break;
+        }
+
+        unsigned int tlv = a;
+        byte length[3];
+        a = nextDataAddress(a);
+        if (!readData(a, length, 1))
+        {
+            return false;
+        }
+        unsigned int valueLength = length[0];
+        a = nextDataAddress(a);
+        if (length[0] == 0xFF)
+        {
+            if (!readData(a, &length[1], 2))
+            {
+                return false;
+            }
+            valueLength = (length[1] << 8) | length[2];
+            a = nextDataAddress(nextDataAddress(a));
+        }
+
+        if (type == TLV_NDEF)
+        {
+            ndefTlv = tlv;
+            messageStart = a;
+            messageLength = valueLength;
+            return true;
+        }
+        if ((type == TLV_LOCK_CONTROL || type == TLV_MEMORY_CONTROL) && valueLength == 3)
+        {
+            byte value[3];
+            if (!readData(a, value, 3))
+            {
+                return false;
+            }
+            // page address and byte offset, size, bytes per page as a power of 2
+            unsigned int start = (value[0] >> 4) * (1 << (value[2] & 0x0F)) + (value[0] & 0x0F);
+            unsigned int size = value[1] ? value[1] : 256;
+            if (type == TLV_LOCK_CONTROL)
+            {
+                size = (size + 7) / 8; // lock bits
+            }
+            reserved[type - TLV_LOCK_CONTROL][0] = start;
+            reserved[type - TLV_LOCK_CONTROL][1] = size;
+        }
+        for (unsigned int i = 0; i < valueLength; i++)
+        {
+            a = nextDataAddress(a);
+        }
+    }
+
+    ndefTlv = a;
+    messageStart = a;
+    return true;
+}
+
+// the data area skips blocks 0x0D - 0x0F and the control TLV areas
+unsigned int Type1Tag::nextDataAddress(unsigned int address)
+{
+    address++;
+    boolean moved = true;
+    while (moved && address < memorySize)
+    {
+        moved = false;
+        if (address >= TYPE1_RESERVED_START && address < TYPE1_RESERVED_END)
+        {
+            address = TYPE1_RESERVED_END;
+            moved = true;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            if (reserved[i][1] && address >= reserved[i][0] && address < reserved[i][0] + reserved[i][1])
+            {
+                address = reserved[i][0] + reserved[i][1];
+                moved = true;
+            }
+        }
+    }
+    return address < memorySize ? address : memorySize;
+}
+
+boolean Type1Tag::loadBlock(unsigned int block)
+{
+    if (loaded[block / 8] & (1 << (block % 8)))
+    {
+        return true;
+    }
+    if (!isDynamic() || block >= memorySize / TYPE1_BLOCK_SIZE)
+    {
+        return false;
+    }
+
+    byte command[14] = { JEWEL_CMD_READ8, (byte)block };
+    memset(&command[2], 0, TYPE1_BLOCK_SIZE);
+    memcpy(&command[10], uid, 4);
+    byte response[1 + TYPE1_BLOCK_SIZE]; // ADD8 and the block
+    if (!exchange(command, sizeof(command), response, sizeof(response)) || response[0] != block)
+    {
+        Serial.print(F("Read failed "));Serial.println(block);
+        return false;
+    }
+    memcpy(&image[block * TYPE1_BLOCK_SIZE], &response[1], TYPE1_BLOCK_SIZE);
+    loaded[block / 8] |= 1 << (block % 8);
+    return true;
+}
+
+boolean Type1Tag::readData(unsigned int address, byte *data, unsigned int length)
+{
+    for (unsigned int i = 0; i < length; i++)
+    {
+        if (address >= memorySize || !loadBlock(address / TYPE1_BLOCK_SIZE))
+        {
+            return false;
+        }
+        data[i] = image[address];
+        address = nextDataAddress(address);
+    }
+    return true;
+}
+
+boolean Type1Tag::writeByte(unsigned int address, byte value)
+{
+    if (address >= TYPE1_WRITE_E_LIMIT)
+    {
+        return false;
+    }
+    byte command[7] = { JEWEL_CMD_WRITE_E, (byte)address, value, uid[0], uid[1], uid[2], uid[3] };
+    byte response[2];
+    if (!exchange(command, sizeof(command), response, sizeof(response)) || response[1] != value)
+    {
+        Serial.print(F("Write failed "));Serial.println(address);
+        return false;
+    }
+    image[address] = value;
+    return true;
+}
+
+boolean Type1Tag::writeBlock(unsigned int block)
+{
+    byte command[14] = { JEWEL_CMD_WRITE_E8, (byte)block };
+    memcpy(&command[2], &image[block * TYPE1_BLOCK_SIZE], TYPE1_BLOCK_SIZE);
+    memcpy(&command[10], uid, 4);
+    byte response[1 + TYPE1_BLOCK_SIZE];
+    if (!exchange(command, sizeof(command), response, sizeof(response)) ||
+        memcmp(&response[1], &command[2], TYPE1_BLOCK_SIZE) != 0)
+    {
+        Serial.print(F("Write failed "));Serial.println(block);
+        return false;
+    }
+    return true;
+}
+
+// false unless the tag answers with exactly responseLength bytes
+boolean Type1Tag::exchange(byte *command, unsigned int commandLength, byte *response, unsigned int responseLength)
+{
+    byte buffer[3 + TYPE1_STATIC_SIZE]; // status, HR0 HR1 and RALL's memory
+    uint8_t length = sizeof(buffer);
+
+    exchanges++;
+    if (!nfc->inDataExchange(command, commandLength, buffer, &length) || length != responseLength)
+    {
+        return false;
+    }
+    memcpy(response, buffer, responseLength);
+    return true;
+}
+
+boolean Type1Tag::isDynamic()
+{
+    return (header[0] & 0x0F) != 0x01;
+}
+
+void Type1Tag::release()
+{
+    free(image);
+    image = (byte*)NULL;
+}
+
+void Type1Tag::describeTag(NfcTag& tag)
+{
+    unsigned int capacity = 0;
+    unsigned int used = 0;
+    for (unsigned int a = TYPE1_DATA_START; a < memorySize; a = nextDataAddress(a))
+    {
+        if (a < messageStart)
+        {
+            used++;
+        }
+        capacity++;
+    }
+    tag.setCapacity(capacity, used + messageLength + 1);
+    tag.setReadOnly((image[TYPE1_NMN + 3] & 0xF0) != 0x00, image[TYPE1_LOCK_BYTES] || image[TYPE1_LOCK_BYTES + 1]);
+}
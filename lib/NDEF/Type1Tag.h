@@ -0,0 +1,51 @@
+#ifndef Type1Tag_h
+#define Type1Tag_h
+
+#include <PN532.h>
+#include <NfcTag.h>
+#include <Ndef.h>
+
+#define NFC_FORUM_TAG_TYPE_1 ("NFC Forum Type 1")
+#define TYPE1_BLOCK_SIZE 8
+#define TYPE1_STATIC_SIZE 120  // blocks 0x00 - 0x0E, what RALL returns
+#define TYPE1_MAX_SIZE 2048    // TMS 0xFF
+
+// Innovision Jewel / Topaz tags. One RALL reads the static memory, dynamic
+// memory tags (Topaz 512) read the blocks past it with READ8 as the
+// message needs them. Writes only touch bytes (static tags, WRITE-E) or
+// blocks (dynamic tags, WRITE-E8) that change.
+class Type1Tag
+{
+    public:
+        Type1Tag(PN532Base& nfcShield);
+        ~Type1Tag();
+        NfcTag read(byte *uid, unsigned int uidLength);
+        boolean write(NdefMessageBase& ndefMessage, byte *uid, unsigned int uidLength);
+        // commands the last read() or write() exchanged
+        unsigned int getExchanges();
+    private:
+        PN532Base* nfc;
+        unsigned int exchanges;
+        byte uid[4];
+        byte header[2];             // HR0 HR1, HR0 0x11 static, 0x12 dynamic
+        byte *image;                // tag memory, memorySize bytes
+        byte loaded[TYPE1_MAX_SIZE / TYPE1_BLOCK_SIZE / 8]; // a bit per block in image
+        unsigned int memorySize;
+        unsigned int reserved[2][2]; // lock and memory control areas, start and size
+        unsigned int ndefTlv;       // address of the NDEF TLV, or where it goes
+        unsigned int messageStart;
+        unsigned int messageLength;
+        boolean readAll(byte *uid, unsigned int uidLength);
+        boolean findNdefTlv();
+        unsigned int nextDataAddress(unsigned int address);
+        boolean loadBlock(unsigned int block);
+        boolean readData(unsigned int address, byte *data, unsigned int length);
+        boolean writeByte(unsigned int address, byte value);
+        boolean writeBlock(unsigned int block);
+        boolean exchange(byte *command, unsigned int commandLength, byte *response, unsigned int responseLength);
+        boolean isDynamic();
+        void release();
+        void describeTag(NfcTag& tag);
+};
+
+#endif
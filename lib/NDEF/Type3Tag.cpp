@@ -0,0 +1,263 @@
+#include <Type3Tag.h>
+
+#define TYPE3_SERVICE_READ      (0x000B) // NDEF service, read only access
+#define TYPE3_SERVICE_WRITE     (0x0009) // NDEF service, read/write access
+#define TYPE3_VERSION_MAJOR     (0x10)
+#define TYPE3_WRITING           (0x0F)   // WriteF while a write is in progress
+#define TYPE3_DONE              (0x00)
+#define TYPE3_READ_WRITE        (0x01)   // RWFlag
+#define TYPE3_MAX_BLOCK         (0xFF)   // 2 byte block list elements
+
+// Attribute information block: Ver, Nbr, Nbw, Nmaxb (2), 4 unused,
+// WriteF, RWFlag, Ln (3), checksum of bytes 0 - 13 (2)
+static uint16_t attributeChecksum(const byte *attribute)
+{
+    uint16_t sum = 0;
+    for (int i = 0; i < 14; i++)
+    {
+        sum += attribute[i];
+    }
+    return sum;
+}
+
+Type3Tag::Type3Tag(PN532Base& nfcShield)
+{
+    nfc = &nfcShield;
+    exchanges = 0;
+    memset(attribute, 0, sizeof(attribute));
+    readBatch = 1;
+    writeBatch = 1;
+    maxBlocks = 0;
+    messageLength = 0;
+}
+
+Type3Tag::~Type3Tag()
+{
+}
+
+NfcTag Type3Tag::read(byte *uid, unsigned int uidLength)
+{
+    exchanges = 0;
+    if (!readAttribute())
+    {
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_3);
+    }
+    if (attribute[9] == TYPE3_WRITING)
+    {
+        Serial.println(F("Error. A write to the tag was interrupted."));
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_3);
+    }
+
+    if (messageLength == 0)
+    {
+        NdefMessage message = NdefMessage();
+        message.addEmptyRecord();
+        NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_3, message);
+        describeTag(tag);
+        return tag;
+    }
+
+    unsigned int blocks = (messageLength + TYPE3_BLOCK_SIZE - 1) / TYPE3_BLOCK_SIZE;
+    byte *data = (byte*)malloc(blocks * TYPE3_BLOCK_SIZE);
+    if (data == NULL)
+    {
+        Serial.println(F("Error. Not enough memory for the message."));
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_3);
+    }
+    if (!readBlocks(1, blocks, data))
+    {
+        Serial.println(F("Error. Failed to read NDEF message."));
+        free(data);
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_3);
+    }
+
+    NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_3, data, messageLength);
+    free(data);
+    describeTag(tag);
+    return tag;
+}
+
+// WriteF goes to 0x0F with the first blocks of the message and back to 0x00
+// with the new Ln once all of them are written
+boolean Type3Tag::write(NdefMessageBase& m, byte *uid, unsigned int uidLength)
+{
+    (void)uid;
+    (void)uidLength;
+    exchanges = 0;
+    if (!readAttribute())
+    {
+        return false;
+    }
+    if (attribute[10] != TYPE3_READ_WRITE)
+    {
+        Serial.println(F("Error. Tag is read only."));
+        return false;
+    }
+
+    unsigned long length = m.getEncodedSize();
+    unsigned int blocks = (length + TYPE3_BLOCK_SIZE - 1) / TYPE3_BLOCK_SIZE;
+    if (blocks > maxBlocks)
+    {
+        Serial.print(F("Error. Encoded Message length exceeded tag Capacity "));Serial.println(maxBlocks * TYPE3_BLOCK_SIZE);
+        return false;
+    }
+
+    // attribute block and message, zero padded to the end of the last block
+    byte *data = (byte*)malloc((1 + blocks) * TYPE3_BLOCK_SIZE);
+    if (data == NULL)
+    {
+        Serial.println(F("Error. Not enough memory for the message."));
+        return false;
+    }
+    memset(&data[TYPE3_BLOCK_SIZE + length], 0, blocks * TYPE3_BLOCK_SIZE - length);
+    m.encode(&data[TYPE3_BLOCK_SIZE]);
+    setAttribute(TYPE3_WRITING, messageLength);
+    memcpy(data, attribute, TYPE3_BLOCK_SIZE);
+
+    boolean success = writeBlocks(0, 1 + blocks, data);
+    if (success)
+    {
+        setAttribute(TYPE3_DONE, length);
+        success = writeBlocks(0, 1, attribute);
+    }
+
+    free(data);
+    #ifdef TYPE3_DEBUG
+    Serial.print(F("Wrote "));Serial.print(blocks);Serial.print(F(" blocks in "));Serial.print(exchanges);Serial.println(F(" commands"));
+    #endif
+    return success;
+}
+
+unsigned int Type3Tag::getExchanges()
+{
+    return exchanges;
+}
+
+boolean Type3Tag::readAttribute()
+{
+    readBatch = 1;
+    if (!readBlocks(0, 1, attribute))
+    {
+        Serial.println(F("Error. Failed to read attribute block."));
+        return false;
+    }
+    if (attributeChecksum(attribute) != ((attribute[14] << 8) | attribute[15]))
+    {
+        Serial.println(F("Error. Bad attribute block checksum."));
+        return false;
+    }
+    if ((attribute[0] & 0xF0) != TYPE3_VERSION_MAJOR)
+    {
+        Serial.print(F("Unsupported mapping version "));Serial.println(attribute[0], HEX);
+        return false;
+    }
+
+    // a Read Without Encryption response takes 14 bytes and 16 per block
+    uint8_t bufferLength;
+    nfc->getBuffer(&bufferLength);
+    unsigned int frameBlocks = (bufferLength + 4 - 14) / TYPE3_BLOCK_SIZE;
+
+    readBatch = attribute[1];
+    writeBatch = attribute[2];
+    if (readBatch > FELICA_READ_MAX_BLOCK_NUM)
+    {
+        readBatch = FELICA_READ_MAX_BLOCK_NUM;
+    }
+    if (readBatch > frameBlocks)
+    {
+        readBatch = frameBlocks;
+    }
+    if (writeBatch > FELICA_WRITE_MAX_BLOCK_NUM)
+    {
+        writeBatch = FELICA_WRITE_MAX_BLOCK_NUM;
+    }
+    if (readBatch == 0 || writeBatch == 0)
+    {
+        Serial.println(F("Error. Bad attribute block."));
+        return false;
+    }
+
+    maxBlocks = (attribute[3] << 8) | attribute[4];
+    if (maxBlocks > TYPE3_MAX_BLOCK)
+    {
+        maxBlocks = TYPE3_MAX_BLOCK;
+    }
+    messageLength = ((unsigned long)attribute[11] << 16) | (attribute[12] << 8) | attribute[13];
+    if (messageLength > maxBlocks * TYPE3_BLOCK_SIZE)
+    {
+        Serial.print(F("Error. Bad NDEF length "));Serial.println(messageLength);
+        return false;
+    }
+
+    #ifdef TYPE3_DEBUG
+    Serial.print(F("Nbr "));Serial.print(attribute[1]);Serial.print(F(" Nbw "));Serial.print(attribute[2]);
+    Serial.print(F(" Nmaxb "));Serial.print(maxBlocks);Serial.print(F(" Ln "));Serial.println(messageLength);
+    #endif
+    return true;
+}
+
+void Type3Tag::setAttribute(byte writeFlag, unsigned long length)
+{
+    attribute[9] = writeFlag;
+    attribute[11] = length >> 16;
+    attribute[12] = length >> 8;
+    attribute[13] = length;
+    uint16_t checksum = attributeChecksum(attribute);
+    attribute[14] = checksum >> 8;
+    attribute[15] = checksum;
+}
+
+boolean Type3Tag::readBlocks(unsigned int first, unsigned int count, byte *data)
+{
+    uint16_t service = TYPE3_SERVICE_READ;
+    uint16_t blockList[FELICA_READ_MAX_BLOCK_NUM];
+
+    while (count > 0)
+    {
+        unsigned int n = count < readBatch ? count : readBatch;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            blockList[i] = 0x8000 | (first + i);
+        }
+        exchanges++;
+        if (nfc->felica_ReadWithoutEncryption(1, &service, n, blockList, (uint8_t (*)[16])data) != 1)
+        {
+            return false;
+        }
+        first += n;
+        count -= n;
+        data += n * TYPE3_BLOCK_SIZE;
+    }
+    return true;
+}
+
+boolean Type3Tag::writeBlocks(unsigned int first, unsigned int count, byte *data)
+{
+    uint16_t service = TYPE3_SERVICE_WRITE;
+    uint16_t blockList[FELICA_WRITE_MAX_BLOCK_NUM];
+
+    while (count > 0)
+    {
+        unsigned int n = count < writeBatch ? count : writeBatch;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            blockList[i] = 0x8000 | (first + i);
+        }
+        exchanges++;
+        if (nfc->felica_WriteWithoutEncryption(1, &service, n, blockList, (uint8_t (*)[16])data) != 1)
+        {
+            Serial.print(F("Write failed "));Serial.println(first);
+            return false;
+        }
+        first += n;
+        count -= n;
+        data += n * TYPE3_BLOCK_SIZE;
+    }
+    return true;
+}
+
+void Type3Tag::describeTag(NfcTag& tag)
+{
+    tag.setCapacity(maxBlocks * TYPE3_BLOCK_SIZE, messageLength);
+    tag.setReadOnly(attribute[10] != TYPE3_READ_WRITE, false);
+}
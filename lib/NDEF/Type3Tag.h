@@ -0,0 +1,40 @@
+#ifndef Type3Tag_h
+#define Type3Tag_h
+
+#include <PN532.h>
+#include <NfcTag.h>
+#include <Ndef.h>
+
+#define NFC_FORUM_TAG_TYPE_3 ("NFC Forum Type 3")
+#define FELICA_NDEF_SYSTEM_CODE (0x12FC)
+#define TYPE3_BLOCK_SIZE 16
+
+// FeliCa tags with the NDEF system code. Block 0 is the attribute
+// information block, the message follows from block 1. Reads and writes
+// move as many blocks per command as the attribute block (Nbr, Nbw) and the
+// PN532 frame buffer allow. Only the first 255 blocks can be addressed.
+class Type3Tag
+{
+    public:
+        Type3Tag(PN532Base& nfcShield);
+        ~Type3Tag();
+        NfcTag read(byte *uid, unsigned int uidLength);
+        boolean write(NdefMessageBase& ndefMessage, byte *uid, unsigned int uidLength);
+        // commands the last read() or write() exchanged
+        unsigned int getExchanges();
+    private:
+        PN532Base* nfc;
+        unsigned int exchanges;
+        byte attribute[TYPE3_BLOCK_SIZE];
+        unsigned int readBatch;  // blocks per Read Without Encryption
+        unsigned int writeBatch; // blocks per Write Without Encryption
+        unsigned int maxBlocks;  // Nmaxb, data blocks after the attribute block
+        unsigned long messageLength;
+        boolean readAttribute();
+        void setAttribute(byte writeFlag, unsigned long length);
+        boolean readBlocks(unsigned int first, unsigned int count, byte *data);
+        boolean writeBlocks(unsigned int first, unsigned int count, byte *data);
+        void describeTag(NfcTag& tag);
+};
+
+#endif
@@ -0,0 +1,378 @@
+#include <Type4Tag.h>
+
+#define TYPE4_CC_FILE           (0xE103)
+#define TYPE4_MIN_LE            (0x0F)
+#define TYPE4_NDEF_FILE_TLV     (0x04)
+#define TYPE4_ENDEF_FILE_TLV    (0x06) // mapping 3.0, 4 byte file size and ENLEN
+#define TYPE4_ACCESS_GRANTED    (0x00)
+#define TYPE4_ACCESS_NEVER      (0xFF)
+#define TYPE4_MAX_SHORT_OFFSET  (0x7FFF)
+
+static const byte NDEF_APPLICATION[7] = { 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
+
+Type4Tag::Type4Tag(PN532Base& nfcShield)
+{
+    nfc = &nfcShield;
+    exchanges = 0;
+    mappingVersion = 0;
+    maxLe = TYPE4_MIN_LE;
+    maxLc = 1;
+    fileId = 0;
+    maxFileSize = 0;
+    readAccess = TYPE4_ACCESS_NEVER;
+    writeAccess = TYPE4_ACCESS_NEVER;
+    lengthSize = 2;
+}
+
+Type4Tag::~Type4Tag()
+{
+}
+
+NfcTag Type4Tag::read(byte *uid, unsigned int uidLength)
+{
+    exchanges = 0;
+    if (!selectNdefFile())
+    {
+        Serial.println(F("Tag has no NDEF application."));
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_4);
+    }
+    if (readAccess != TYPE4_ACCESS_GRANTED)
+    {
+        Serial.println(F("Error. NDEF file is not readable."));
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_4);
+    }
+
+    // the first READ BINARY gets the length and as much of the message as fits
+    byte head[TYPE4_MAX_READ];
+    unsigned int first = maxFileSize < maxLe ? maxFileSize : maxLe;
+    if (first < lengthSize || !readBinary(0, head, first))
+    {
+        Serial.println(F("Error. Failed to read NDEF length."));
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_4);
+    }
+
+    unsigned long messageLength = 0;
+    for (unsigned int i = 0; i < lengthSize; i++)
+    {
+        messageLength = (messageLength << 8) | head[i];
+    }
+
+    if (messageLength == 0)
+    {
+        NdefMessage message = NdefMessage();
+        message.addEmptyRecord();
+        NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_4, message);
+        describeTag(tag, messageLength);
+        return tag;
+    }
+    // ENDEF files may hold more than 0x7FFF bytes, readBinary() reaches
+    // past that with the offset data object
+    if (messageLength > maxFileSize - lengthSize || (unsigned int)messageLength != messageLength)
+    {
+        Serial.print(F("Error. Bad NDEF length "));Serial.println(messageLength);
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_4);
+    }
+
+    byte *message = (byte*)malloc(messageLength);
+    if (message == NULL)
+    {
+        Serial.println(F("Error. Not enough memory for the message."));
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_4);
+    }
+    unsigned int have = first - lengthSize < messageLength ? first - lengthSize : messageLength;
+    memcpy(message, &head[lengthSize], have);
+    if (!readBinary(lengthSize + have, &message[have], messageLength - have))
+    {
+        Serial.println(F("Error. Failed to read NDEF message."));
+        free(message);
+        return NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_4);
+    }
+
+    NfcTag tag = NfcTag(uid, uidLength, NFC_FORUM_TAG_TYPE_4, message, messageLength);
+    free(message);
+    describeTag(tag, messageLength);
+    return tag;
+}
+
+boolean Type4Tag::write(NdefMessageBase& m, byte *uid, unsigned int uidLength)
+{
+    (void)uid;
+    (void)uidLength;
+    exchanges = 0;
+    if (!selectNdefFile())
+    {
+        Serial.println(F("Tag has no NDEF application."));
+        return false;
+    }
+    if (writeAccess != TYPE4_ACCESS_GRANTED)
+    {
+        Serial.println(F("Error. Tag is read only."));
+        return false;
+    }
+
+    unsigned long messageLength = m.getEncodedSize();
+    unsigned long size = lengthSize + messageLength;
+    if (size > maxFileSize)
+    {
+        Serial.print(F("Error. Encoded Message length exceeded tag Capacity "));Serial.println(maxFileSize);
+        return false;
+    }
+
+    byte *buffer = (byte*)malloc(size);
+    if (buffer == NULL)
+    {
+        Serial.println(F("Error. Not enough memory for the message."));
+        return false;
+    }
+    memset(buffer, 0, lengthSize);
+    m.encode(&buffer[lengthSize]);
+
+    boolean success;
+    if (size <= maxLc)
+    {
+        // length and message in one UPDATE BINARY
+        for (unsigned int i = 0; i < lengthSize; i++)
+        {
+            buffer[i] = messageLength >> (8 * (lengthSize - 1 - i));
+        }
+        success = updateBinary(0, buffer, size);
+    }
+    else
+    {
+        // the length stays 0 while the message is written, the first chunk
+        // clears it, the last UPDATE BINARY sets it
+        success = updateBinary(0, buffer, size);
+        for (unsigned int i = 0; i < lengthSize; i++)
+        {
+            buffer[i] = messageLength >> (8 * (lengthSize - 1 - i));
+        }
+        success = success && updateBinary(0, buffer, lengthSize);
+    }
+
+    free(buffer);
+    #ifdef TYPE4_DEBUG
+    Serial.print(F("Wrote "));Serial.print(size);Serial.print(F(" bytes in "));Serial.print(exchanges);Serial.println(F(" APDUs"));
+    #endif
+    return success;
+}
+
+unsigned int Type4Tag::getExchanges()
+{
+    return exchanges;
+}
+
+// SELECT the NDEF application, read the CC, SELECT the NDEF file it names
+boolean Type4Tag::selectNdefFile()
+{
+    byte apdu[5 + sizeof(NDEF_APPLICATION) + 1] = { 0x00, 0xA4, 0x04, 0x00, sizeof(NDEF_APPLICATION) };
+    memcpy(&apdu[5], NDEF_APPLICATION, sizeof(NDEF_APPLICATION));
+    apdu[sizeof(apdu) - 1] = 0x00; // Le
+
+    byte response[64]; // room for FCI some tags send back
+    unsigned int responseLength = sizeof(response);
+    if (!transceive(apdu, sizeof(apdu), response, responseLength))
+    {
+        return false;
+    }
+    return readCapabilityContainer() && selectFile(fileId);
+}
+
+boolean Type4Tag::readCapabilityContainer()
+{
+    byte cc[17];
+
+    maxLe = TYPE4_MIN_LE; // until the CC tells
+    if (!selectFile(TYPE4_CC_FILE) || !readBinary(0, cc, 15))
+    {
+        Serial.println(F("Error. Failed to read CC."));
+        return false;
+    }
+
+    mappingVersion = cc[2];
+    unsigned int mle = (cc[3] << 8) | cc[4];
+    unsigned int mlc = (cc[5] << 8) | cc[6];
+    if (mle < TYPE4_MIN_LE || mlc == 0)
+    {
+        Serial.println(F("Error. Bad CC."));
+        return false;
+    }
+    maxLe = mle < TYPE4_MAX_READ ? mle : TYPE4_MAX_READ;
+    maxLc = mlc < TYPE4_MAX_WRITE ? mlc : TYPE4_MAX_WRITE;
+
+    // keep each C-APDU in one frame of the card, PCB, CID and CRC take 4 bytes
+    unsigned int frameSize = nfc->getTargetFrameSize();
+    if (frameSize > 4 + 5 + 1 && maxLc > frameSize - 4 - 5)
+    {
+        maxLc = frameSize - 4 - 5;
+    }
+
+    fileId = (cc[9] << 8) | cc[10];
+    if (cc[7] == TYPE4_NDEF_FILE_TLV)
+    {
+        maxFileSize = (cc[11] << 8) | cc[12];
+        readAccess = cc[13];
+        writeAccess = cc[14];
+        lengthSize = 2;
+    }
+    else if (cc[7] == TYPE4_ENDEF_FILE_TLV && readBinary(15, &cc[15], 2))
+    {
+        maxFileSize = ((unsigned long)cc[11] << 24) | ((unsigned long)cc[12] << 16) | (cc[13] << 8) | cc[14];
+        readAccess = cc[15];
+        writeAccess = cc[16];
+        lengthSize = 4;
+    }
+    else
+    {
+        Serial.println(F("Error. CC has no NDEF file control TLV."));
+        return false;
+    }
+
+    #ifdef TYPE4_DEBUG
+    Serial.print(F("Mapping version "));Serial.print(mappingVersion >> 4);Serial.print('.');Serial.println(mappingVersion & 0x0F);
+    Serial.print(F("MLe "));Serial.print(mle);Serial.print(F(" MLc "));Serial.println(mlc);
+    Serial.print(F("NDEF file "));Serial.print(fileId, HEX);Serial.print(F(" size "));Serial.println(maxFileSize);
+    #endif
+    return true;
+}
+
+boolean Type4Tag::selectFile(uint16_t id)
+{
+    byte apdu[7] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, (byte)(id >> 8), (byte)id };
+    byte response[4];
+    unsigned int responseLength = sizeof(response);
+    return transceive(apdu, sizeof(apdu), response, responseLength);
+}
+
+// Offsets past 0x7FFF (ENDEF files) need the offset data object form of
+// READ BINARY, its data comes back in a 0x53 TLV.
+boolean Type4Tag::readBinary(unsigned long offset, byte *data, unsigned int length)
+{
+    byte response[TYPE4_MAX_READ + 6];
+
+    while (length > 0)
+    {
+        unsigned int count = length < maxLe ? length : maxLe;
+        byte apdu[11];
+        unsigned int apduLength;
+        unsigned int responseLength = sizeof(response);
+        unsigned int skip = 0;
+
+        if (offset <= TYPE4_MAX_SHORT_OFFSET)
+        {
+            apdu[0] = 0x00; apdu[1] = 0xB0;
+            apdu[2] = offset >> 8; apdu[3] = offset;
+            apdu[4] = count;
+            apduLength = 5;
+        }
+        else
+        {
+            if (count > maxLe - 3)
+            {
+                count = maxLe - 3;
+            }
+            apdu[0] = 0x00; apdu[1] = 0xB1; apdu[2] = 0x00; apdu[3] = 0x00;
+            apdu[4] = 0x05;
+            apdu[5] = 0x54; apdu[6] = 0x03;
+            apdu[7] = offset >> 16; apdu[8] = offset >> 8; apdu[9] = offset;
+            apdu[10] = count + (count > 0x7F ? 3 : 2);
+            apduLength = 11;
+            skip = count > 0x7F ? 3 : 2;
+        }
+
+        if (!transceive(apdu, apduLength, response, responseLength) || responseLength != skip + count)
+        {
+            return false;
+        }
+        memcpy(data, &response[skip], count);
+        data += count;
+        offset += count;
+        length -= count;
+    }
+    return true;
+}
+
+boolean Type4Tag::updateBinary(unsigned long offset, const byte *data, unsigned int length)
+{
+    byte apdu[13 + TYPE4_MAX_WRITE];
+
+    while (length > 0)
+    {
+        unsigned int count = length < maxLc ? length : maxLc;
+        unsigned int apduLength;
+        byte response[4];
+        unsigned int responseLength = sizeof(response);
+
+        if (offset <= TYPE4_MAX_SHORT_OFFSET)
+        {
+            apdu[0] = 0x00; apdu[1] = 0xD6;
+            apdu[2] = offset >> 8; apdu[3] = offset;
+            apdu[4] = count;
+            memcpy(&apdu[5], data, count);
+            apduLength = 5 + count;
+        }
+        else
+        {
+            unsigned int header = count > 0x7F ? 3 : 2;
+            if (count + 5 + header > maxLc)
+            {
+                if (maxLc <= 5 + 3)
+                {
+                    return false;
+                }
+                count = maxLc - 5 - 3;
+                header = count > 0x7F ? 3 : 2;
+            }
+            apdu[0] = 0x00; apdu[1] = 0xD7; apdu[2] = 0x00; apdu[3] = 0x00;
+            apdu[4] = 5 + header + count;
+            apdu[5] = 0x54; apdu[6] = 0x03;
+            apdu[7] = offset >> 16; apdu[8] = offset >> 8; apdu[9] = offset;
+            apdu[10] = 0x53;
+            if (header == 3)
+            {
+                apdu[11] = 0x81;
+            }
+            apdu[header == 3 ? 12 : 11] = count;
+            memcpy(&apdu[5 + 5 + header], data, count);
+            apduLength = 5 + 5 + header + count;
+        }
+
+        if (!transceive(apdu, apduLength, response, responseLength))
+        {
+            return false;
+        }
+        data += count;
+        offset += count;
+        length -= count;
+    }
+    return true;
+}
+
+// one APDU, false unless the tag answers 90 00. responseLength is the size
+// of response on the way in, the data without SW1 SW2 on the way out.
+boolean Type4Tag::transceive(byte *apdu, unsigned int apduLength, byte *response, unsigned int &responseLength)
+{
+    uint8_t length = responseLength > 0xFF ? 0xFF : responseLength;
+
+    exchanges++;
+    if (!nfc->inDataExchange(apdu, apduLength, response, &length) || length < 2)
+    {
+        return false;
+    }
+
+    uint16_t sw = (response[length - 2] << 8) | response[length - 1];
+    if (sw != 0x9000)
+    {
+        #ifdef TYPE4_DEBUG
+        Serial.print(F("APDU "));Serial.print(apdu[1], HEX);Serial.print(F(" SW "));Serial.println(sw, HEX);
+        #endif
+        return false;
+    }
+    responseLength = length - 2;
+    return true;
+}
+
+void Type4Tag::describeTag(NfcTag& tag, unsigned long messageLength)
+{
+    tag.setCapacity(maxFileSize, lengthSize + messageLength);
+    tag.setReadOnly(writeAccess != TYPE4_ACCESS_GRANTED, writeAccess == TYPE4_ACCESS_NEVER);
+}
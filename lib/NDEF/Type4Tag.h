@@ -0,0 +1,48 @@
+#ifndef Type4Tag_h
+#define Type4Tag_h
+
+#include <PN532.h>
+#include <NfcTag.h>
+#include <Ndef.h>
+
+#define NFC_FORUM_TAG_TYPE_4 ("NFC Forum Type 4")
+
+// Most data one READ BINARY or UPDATE BINARY moves through a normal PN532
+// frame (255 bytes with the frame, APDU and status overhead)
+#define TYPE4_MAX_READ  (0xF6)
+#define TYPE4_MAX_WRITE (0xEE)
+
+// ISO-DEP tags with the NDEF application: DESFire, NTAG 4xx, phones in HCE
+// mode, ISO14443A or B. APDUs go through PN532::inDataExchange, READ BINARY
+// and UPDATE BINARY are as large as the CC (MLe, MLc) and the PN532 frame
+// allow. UPDATE BINARY also fits one frame of the card (ATS or ATQB).
+class Type4Tag
+{
+    public:
+        Type4Tag(PN532Base& nfcShield);
+        ~Type4Tag();
+        NfcTag read(byte *uid, unsigned int uidLength);
+        boolean write(NdefMessageBase& ndefMessage, byte *uid, unsigned int uidLength);
+        // APDUs the last read() or write() exchanged
+        unsigned int getExchanges();
+    private:
+        PN532Base* nfc;
+        unsigned int exchanges;
+        byte mappingVersion;
+        unsigned int maxLe;        // MLe from the CC, capped to TYPE4_MAX_READ
+        unsigned int maxLc;        // MLc from the CC, capped to TYPE4_MAX_WRITE and the card frame
+        uint16_t fileId;
+        unsigned long maxFileSize; // NDEF file, length field included
+        byte readAccess;
+        byte writeAccess;
+        byte lengthSize;           // NLEN is 2 bytes, ENLEN (T4T 3.0) is 4
+        boolean selectNdefFile();
+        boolean readCapabilityContainer();
+        boolean selectFile(uint16_t id);
+        boolean readBinary(unsigned long offset, byte *data, unsigned int length);
+        boolean updateBinary(unsigned long offset, const byte *data, unsigned int length);
+        boolean transceive(byte *apdu, unsigned int apduLength, byte *response, unsigned int &responseLength);
+        void describeTag(NfcTag& tag, unsigned long messageLength);
+};
+
+#endif
@@ -0,0 +1,127 @@
+/**************************************************************************/
+/*!
+    @file     uri_prefix.cpp
+    @license  BSD
+*/
+/**************************************************************************/
+
+#include "uri_prefix.h"
+#include <PN532.h>
+
+static uint16_t codeOffset(uint8_t code)
+{
+    return pgm_read_word(URI_PREFIX_OFFSET + code);
+}
+
+static uint8_t codeLength(uint8_t code)
+{
+    return codeOffset(code + 1) - codeOffset(code);
+}
+
+/**************************************************************************/
+/*!
+    Compares the prefix of a code with the start of a URI
+
+    @returns <0, 0 or >0 like strcmp, with 0 meaning the prefix matches
+*/
+/**************************************************************************/
+static int8_t comparePrefix(uint8_t code, const char *uri)
+{
+    const char *prefix = URI_PREFIX_TEXT + codeOffset(code);
+    uint8_t len = codeLength(code);
+
+    for (uint8_t i = 0; i < len; i++) {
+        char c = pgm_read_byte(prefix + i);
+        if (c != uri[i]) {
+            // uri[i] may be the NUL terminator, a shorter uri sorts first
+            return ((uint8_t)c < (uint8_t)uri[i]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+uint8_t UriPrefix::match(const char *uri, uint8_t *prefixLength)
+{
+    uint8_t code = NDEF_URIPREFIX_NONE;
+    *prefixLength = 0;
+
+    // find the first prefix sorting after the uri. Every prefix of the
+    // uri sorts before it, and they all share its first character.
+    uint8_t lo = 0;
+    uint8_t hi = URI_PREFIX_COUNT - 1;
+    while (lo < hi) {
+        uint8_t mid = (lo + hi) / 2;
+        if (comparePrefix(pgm_read_byte(URI_PREFIX_SORTED + mid), uri) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    while (lo > 0) {
+        uint8_t candidate = pgm_read_byte(URI_PREFIX_SORTED + --lo);
+        if (pgm_read_byte(URI_PREFIX_TEXT + codeOffset(candidate)) != uri[0]) {
+            break;
+        }
+        if (comparePrefix(candidate, uri) == 0 && codeLength(candidate) > *prefixLength) {
+            code = candidate;
+            *prefixLength = codeLength(candidate);
+        }
+    }
+
+    return code;
+}
+
+const char *UriPrefix::get(uint8_t code, uint8_t *length)
+{
+    if (code >= URI_PREFIX_COUNT) {
+        code = NDEF_URIPREFIX_NONE; // RFU codes carry no prefix
+    }
+    *length = codeLength(code);
+    return URI_PREFIX_TEXT + codeOffset(code);
+}
+
+UriView::UriView(const uint8_t *payload, uint16_t payloadLength)
+{
+    prefix = 0;
+    prefixLength = 0;
+    rest = 0;
+    restLength = 0;
+
+    if (payloadLength > 0) {
+        prefix = UriPrefix::get(payload[0], &prefixLength);
+        rest = payload + 1;
+        restLength = payloadLength - 1;
+    }
+}
+
+char UriView::charAt(uint16_t index) const
+{
+    if (index < prefixLength) {
+        return pgm_read_byte(prefix + index);
+    }
+    return rest[index - prefixLength];
+}
+
+uint16_t UriView::copyTo(char *buf, uint16_t len) const
+{
+    if (len == 0) {
+        return 0;
+    }
+
+    uint16_t n = length() < len - 1 ? length() : len - 1;
+    for (uint16_t i = 0; i < n; i++) {
+        buf[i] = charAt(i);
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+size_t UriView::printTo(Print &p) const
+{
+    for (uint8_t i = 0; i < prefixLength; i++) {
+        p.write(pgm_read_byte(prefix + i));
+    }
+    p.write(rest, restLength);
+    return length();
+}
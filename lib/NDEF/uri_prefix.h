@@ -0,0 +1,121 @@
+/**************************************************************************/
+/*!
+    @file     uri_prefix.h
+    @license  BSD
+
+    NFC Forum URI identifier codes (URI RTD, NDEF_URIPREFIX_* in PN532.h)
+*/
+/**************************************************************************/
+
+#ifndef __URI_PREFIX_H__
+#define __URI_PREFIX_H__
+
+#include "Arduino.h"
+
+#define URI_PREFIX_COUNT 36 // codes 0x00 (no prefix) .. 0x23
+
+// All prefixes concatenated in code order, code i spans
+// URI_PREFIX_OFFSET[i] .. URI_PREFIX_OFFSET[i + 1]
+constexpr char URI_PREFIX_TEXT[] PROGMEM =
+    "http://www."                   // 0x01
+    "https://www."                  // 0x02
+    "http://"                       // 0x03
+    "https://"                      // 0x04
+    "tel:"                          // 0x05
+    "mailto:"                       // 0x06
+    "ftp://anonymous:anonymous@"    // 0x07
+    "ftp://ftp."                    // 0x08
+    "ftps://"                       // 0x09
+    "sftp://"                       // 0x0A
+    "smb://"                        // 0x0B
+    "nfs://"                        // 0x0C
+    "ftp://"                        // 0x0D
+    "dav://"                        // 0x0E
+    "news:"                         // 0x0F
+    "telnet://"                     // 0x10
+    "imap:"                         // 0x11
+    "rtsp://"                       // 0x12
+    "urn:"                          // 0x13
+    "pop:"                          // 0x14
+    "sip:"                          // 0x15
+    "sips:"                         // 0x16
+    "tftp:"                         // 0x17
+    "btspp://"                      // 0x18
+    "btl2cap://"                    // 0x19
+    "btgoep://"                     // 0x1A
+    "tcpobex://"                    // 0x1B
+    "irdaobex://"                   // 0x1C
+    "file://"                       // 0x1D
+    "urn:epc:id:"                   // 0x1E
+    "urn:epc:tag:"                  // 0x1F
+    "urn:epc:pat:"                  // 0x20
+    "urn:epc:raw:"                  // 0x21
+    "urn:epc:"                      // 0x22
+    "urn:nfc:";                     // 0x23
+
+constexpr uint16_t URI_PREFIX_OFFSET[URI_PREFIX_COUNT + 1] PROGMEM = {
+    0, 0, 11, 23, 30, 38, 42, 49, 75, 85, 92, 99, 105, 111, 117, 123, 128, 137,
+    142, 149, 153, 157, 161, 166, 171, 179, 189, 198, 208, 219, 226, 237, 249,
+    261, 273, 281, 289
+};
+
+// Codes 0x01 .. 0x23 ordered by their prefix, for binary search
+constexpr uint8_t URI_PREFIX_SORTED[URI_PREFIX_COUNT - 1] PROGMEM = {
+    0x1A, 0x19, 0x18, 0x0E, 0x1D, 0x0D, 0x07, 0x08, 0x09, 0x03, 0x01, 0x04,
+    0x02, 0x11, 0x1C, 0x06, 0x0F, 0x0C, 0x14, 0x12, 0x0A, 0x15, 0x16, 0x0B,
+    0x1B, 0x05, 0x10, 0x17, 0x13, 0x22, 0x1E, 0x20, 0x21, 0x1F, 0x23
+};
+
+class UriPrefix
+{
+public:
+    /**
+    * @brief    find the longest prefix of a URI that has an identifier code
+    * @param    uri             NUL terminated URI
+    * @param    prefixLength    set to the number of characters the code replaces
+    * @return   identifier code, NDEF_URIPREFIX_NONE if no prefix matches
+    */
+    static uint8_t match(const char *uri, uint8_t *prefixLength);
+
+    /**
+    * @brief    prefix of an identifier code, unknown codes have an empty prefix
+    * @param    length  set to the prefix length, the prefix is not NUL terminated
+    * @return   pointer into program memory
+    */
+    static const char *get(uint8_t code, uint8_t *length);
+};
+
+/**
+ * Decoded URI record payload as two parts: the prefix in program memory
+ * and the rest of the URI in the payload. Nothing is copied, so the view
+ * is only valid while the payload it was made from is.
+ */
+class UriView : public Printable
+{
+public:
+    UriView() : prefix(0), prefixLength(0), rest(0), restLength(0) { }
+
+    // payload of a well known 'U' record: identifier code followed by the URI
+    UriView(const uint8_t *payload, uint16_t payloadLength);
+
+    uint16_t length() const { return prefixLength + restLength; }
+    char charAt(uint16_t index) const;
+
+    /**
+    * @brief    copy the full URI, NUL terminated
+    * @param    buf     destination
+    * @param    len     size of buf
+    * @return   number of characters copied without the NUL
+    */
+    uint16_t copyTo(char *buf, uint16_t len) const;
+
+    virtual size_t printTo(Print &p) const;
+
+private:
+    const char *prefix;         // program memory
+    uint8_t prefixLength;
+    const uint8_t *rest;
+    uint16_t restLength;
+};
+
+#endif
@@ -9,13 +9,28 @@
 #include "Arduino.h"
 #include "PN532.h"
 #include "PN532_debug.h"
+#include <uri_prefix.h> // lib/NDEF
 #include <string.h>
 
 #define HAL(func)   (_interface->func)
 
-PN532::PN532(PN532Interface &interface)
+// FSCI (ATS) and Max_Frame_Size (ATQB) codes, 9 and up are RFU or larger
+// than a PN532 frame
+static const uint16_t frameSizes[16] = {
+    16, 24, 32, 40, 48, 64, 96, 128, 256, 256, 256, 256, 256, 256, 256, 256
+};
+
+PN532Base::PN532Base(PN532Interface &interface, uint8_t *packetbuffer, uint8_t packetbufferLen)
 {
     _interface = &interface;
+    pn532_packetbuffer = packetbuffer;
+    pn532_packetbufferLen = packetbufferLen;
+    inListedTag = 1;
+    _sensRes = 0;
+    _selRes = 0;
+    memset(_atqb, 0, sizeof(_atqb));
+    _frameSize = 0;
+    _targetStatus = 0;
 }
 
 /**************************************************************************/
@@ -23,7 +38,7 @@ PN532::PN532(PN532Interface &interface)
     @brief  Setups the HW
 */
 /**************************************************************************/
-void PN532::begin()
+void PN532Base::begin()
 {
     HAL(begin)();
     HAL(wakeup)();
@@ -37,7 +52,7 @@ void PN532::begin()
     @param  numBytes  Data length in bytes
 */
 /**************************************************************************/
-void PN532::PrintHex(const uint8_t *data, const uint32_t numBytes)
+void PN532Base::PrintHex(const uint8_t *data, const uint32_t numBytes)
 {
 #ifdef ARDUINO
     for (uint8_t i = 0; i < numBytes; i++) {
@@ -68,7 +83,7 @@ void PN532::PrintHex(const uint8_t *data, const uint32_t numBytes)
     @param  numBytes  Data length in bytes
 */
 /**************************************************************************/
-void PN532::PrintHexChar(const uint8_t *data, const uint32_t numBytes)
+void PN532Base::PrintHexChar(const uint8_t *data, const uint32_t numBytes)
 {
 #ifdef ARDUINO
     for (uint8_t i = 0; i < numBytes; i++) {
@@ -113,7 +128,7 @@ void PN532::PrintHexChar(const uint8_t *data, const uint32_t numBytes)
     @returns  The chip's firmware version and ID
 */
 /**************************************************************************/
-uint32_t PN532::getFirmwareVersion(void)
+uint32_t PN532Base::getFirmwareVersion(void)
 {
     uint32_t response;
 
@@ -124,7 +139,7 @@ uint32_t PN532::getFirmwareVersion(void)
     }
 
     // read data packet
-    int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    int16_t status = HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
     if (0 > status) {
         return 0;
     }
@@ -150,7 +165,7 @@ uint32_t PN532::getFirmwareVersion(void)
     @returns  The register value.
 */
 /**************************************************************************/
-uint32_t PN532::readRegister(uint16_t reg)
+uint32_t PN532Base::readRegister(uint16_t reg)
 {
     uint32_t response;
 
@@ -163,7 +178,7 @@ uint32_t PN532::readRegister(uint16_t reg)
     }
 
     // read data packet
-    int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    int16_t status = HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
     if (0 > status) {
         return 0;
     }
@@ -183,7 +198,7 @@ uint32_t PN532::readRegister(uint16_t reg)
     @returns  0 for failure, 1 for success.
 */
 /**************************************************************************/
-uint32_t PN532::writeRegister(uint16_t reg, uint8_t val)
+uint32_t PN532Base::writeRegister(uint16_t reg, uint8_t val)
 {
     uint32_t response;
 
@@ -198,7 +213,7 @@ uint32_t PN532::writeRegister(uint16_t reg, uint8_t val)
     }
 
     // read data packet
-    int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    int16_t status = HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
     if (0 > status) {
         return 0;
     }
@@ -227,7 +242,7 @@ uint32_t PN532::writeRegister(uint16_t reg, uint8_t val)
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-bool PN532::writeGPIO(uint8_t pinstate)
+bool PN532Base::writeGPIO(uint8_t pinstate)
 {
     // Make sure pinstate does not try to toggle P32 or P34
     pinstate |= (1 << PN532_GPIO_P32) | (1 << PN532_GPIO_P34);
@@ -245,7 +260,7 @@ bool PN532::writeGPIO(uint8_t pinstate)
     if (HAL(writeCommand)(pn532_packetbuffer, 3))
         return 0;
 
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen));
 }
 
 /**************************************************************************/
@@ -262,7 +277,7 @@ bool PN532::writeGPIO(uint8_t pinstate)
              pinState[5]  = P35
 */
 /**************************************************************************/
-uint8_t PN532::readGPIO(void)
+uint8_t PN532Base::readGPIO(void)
 {
     pn532_packetbuffer[0] = PN532_COMMAND_READGPIO;
 
@@ -270,7 +285,7 @@ uint8_t PN532::readGPIO(void)
     if (HAL(writeCommand)(pn532_packetbuffer, 1))
         return 0x0;
 
-    HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
 
     /* READGPIO response without prefix and suffix should be in the following format:
 
@@ -295,7 +310,7 @@ uint8_t PN532::readGPIO(void)
     @brief  Configures the SAM (Secure Access Module)
 */
 /**************************************************************************/
-bool PN532::SAMConfig(void)
+bool PN532Base::SAMConfig(void)
 {
     pn532_packetbuffer[0] = PN532_COMMAND_SAMCONFIGURATION;
     pn532_packetbuffer[1] = 0x01; // normal mode;
@@ -308,7 +323,7 @@ bool PN532::SAMConfig(void)
     DMSG("\nSAMConfig: writeCommand -> "); DMSG_INT(wc); DMSG("\n");
     if (wc) return false;
 
-    int16_t rr = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    int16_t rr = HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
     DMSG("\nSAMConfig: readResponse -> "); DMSG_INT(rr); DMSG("\n");
 
     // Some firmwares return zero-length frames for SAMConfig; accept rr >= 0 as success
@@ -325,7 +340,7 @@ bool PN532::SAMConfig(void)
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-bool PN532::setPassiveActivationRetries(uint8_t maxRetries)
+bool PN532Base::setPassiveActivationRetries(uint8_t maxRetries)
 {
     pn532_packetbuffer[0] = PN532_COMMAND_RFCONFIGURATION;
     pn532_packetbuffer[1] = 5;    // Config item 5 (MaxRetries)
@@ -336,7 +351,7 @@ bool PN532::setPassiveActivationRetries(uint8_t maxRetries)
     if (HAL(writeCommand)(pn532_packetbuffer, 5))
         return 0x0;  // no ACK
 
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen));
 }
 
 /**************************************************************************/
@@ -356,7 +371,7 @@ bool PN532::setPassiveActivationRetries(uint8_t maxRetries)
 */
 /**************************************************************************/
 
-bool PN532::setRFField(uint8_t autoRFCA, uint8_t rFOnOff)
+bool PN532Base::setRFField(uint8_t autoRFCA, uint8_t rFOnOff)
 {
     pn532_packetbuffer[0] = PN532_COMMAND_RFCONFIGURATION;
     pn532_packetbuffer[1] = 1;
@@ -366,7 +381,7 @@ bool PN532::setRFField(uint8_t autoRFCA, uint8_t rFOnOff)
         return 0x0;  // command failed
     }
 
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen));
 }
 
 /***** ISO14443A Commands ******/
@@ -384,8 +399,11 @@ bool PN532::setRFField(uint8_t autoRFCA, uint8_t rFOnOff)
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uidLength, uint16_t timeout)
+bool PN532Base::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uidLength, uint16_t timeout)
 {
+    _sensRes = 0;
+    _selRes = 0;
+    _frameSize = 0;
     pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
     pn532_packetbuffer[1] = 1;  // max 1 cards at once (we can set this to 2 later)
     pn532_packetbuffer[2] = cardbaudrate;
@@ -395,7 +413,8 @@ bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uid
     }
 
     // read data packet
-    if (HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), timeout) < 0) {
+    int16_t length = readPollResponse(pn532_packetbufferLen, timeout);
+    if (length < 0) {
         return 0x0;
     }
 
@@ -410,6 +429,7 @@ bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uid
       b4              SEL_RES
       b5              NFCID Length
       b6..NFCIDLen    NFCID
+      ...             ATS (ISO 14443-4 targets)
     */
 
     if (pn532_packetbuffer[0] != 1)
@@ -423,6 +443,10 @@ bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uid
     DMSG("SAK: 0x");  DMSG_HEX(pn532_packetbuffer[4]);
     DMSG("\n");
 
+    inListedTag = pn532_packetbuffer[1];
+    _sensRes = sens_res;
+    _selRes = pn532_packetbuffer[4];
+
     /* Card appears to be Mifare Classic */
     *uidLength = pn532_packetbuffer[5];
 
@@ -430,9 +454,119 @@ bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uid
         uid[i] = pn532_packetbuffer[6 + i];
     }
 
+    // ATS: TL, T0 with FSCI in the low nibble, FSCI 2 when T0 is missing
+    uint8_t ats = 6 + pn532_packetbuffer[5];
+    if ((_selRes & 0x20) && length > ats) {
+        _frameSize = frameSizes[pn532_packetbuffer[ats] > 1 && length > ats + 1 ? pn532_packetbuffer[ats + 1] & 0x0F : 2];
+    }
+
     return 1;
 }
 
+/**************************************************************************/
+/*!
+    Waits for an ISO14443B target to enter the field
+
+    @param  afi           Application family identifier, 0x00 for all
+    @param  pupi          Pointer to the array that will be populated
+                          with the card's 4 byte PUPI
+
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+bool PN532Base::readTypeBTargetID(uint8_t afi, uint8_t *pupi, uint16_t timeout)
+{
+    _sensRes = 0;
+    _selRes = 0;
+    _frameSize = 0;
+
+    pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
+    pn532_packetbuffer[1] = 1;
+    pn532_packetbuffer[2] = PN532_ISO14443B;
+    pn532_packetbuffer[3] = afi;
+
+    if (HAL(writeCommand)(pn532_packetbuffer, 4)) {
+        return 0x0;
+    }
+
+    /* b0 Tags Found, b1 Tag Number, b2..13 ATQB: 0x50, PUPI (4),
+       application data (4), protocol info (3), then ATTRIB_RES length
+       and ATTRIB_RES */
+    if (readPollResponse(pn532_packetbufferLen, timeout) < 14) {
+        return 0x0;
+    }
+    if (pn532_packetbuffer[0] != 1 || pn532_packetbuffer[2] != 0x50)
+        return 0;
+
+    inListedTag = pn532_packetbuffer[1];
+    memcpy(_atqb, pn532_packetbuffer + 3, sizeof(_atqb));
+    _frameSize = frameSizes[_atqb[9] >> 4];
+    memcpy(pupi, _atqb, 4);
+
+    DMSG("ATQB max frame: ");  DMSG_INT(_frameSize);
+    DMSG("\n");
+
+    return 1;
+}
+
+/**************************************************************************/
+/*!
+    Waits for an Innovision Jewel / Topaz (NFC Forum Type 1) target
+
+    @param  uid           Pointer to the array that will be populated
+                          with the card's 4 byte UID
+    @param  uidLength     Pointer to the variable that will hold the
+                          length of the card's UID.
+
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+bool PN532Base::readJewelTargetID(uint8_t *uid, uint8_t *uidLength, uint16_t timeout)
+{
+    _sensRes = 0;
+    _selRes = 0;
+    _frameSize = 0;
+
+    pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
+    pn532_packetbuffer[1] = 1;
+    pn532_packetbuffer[2] = PN532_INNOVISION_JEWEL;
+
+    if (HAL(writeCommand)(pn532_packetbuffer, 3)) {
+        return 0x0;
+    }
+
+    // b0 Tags Found, b1 Tag Number, b2..3 SENS_RES, b4..7 JEWELID
+    if (readPollResponse(pn532_packetbufferLen, timeout) < 8) {
+        return 0x0;
+    }
+    if (pn532_packetbuffer[0] != 1)
+        return 0;
+
+    inListedTag = pn532_packetbuffer[1];
+    _sensRes = (pn532_packetbuffer[2] << 8) | pn532_packetbuffer[3];
+    memcpy(uid, pn532_packetbuffer + 4, 4);
+    *uidLength = 4;
+
+    return 1;
+}
+
+
+/**************************************************************************/
+/*!
+    Reads the answer to an InListPassiveTarget. A poll the host stops
+    waiting for goes on in the PN532 and would swallow the next command,
+    it is aborted.
+*/
+/**************************************************************************/
+int16_t PN532Base::readPollResponse(uint8_t len, uint16_t timeout)
+{
+    int16_t status = HAL(readResponse)(pn532_packetbuffer, len, timeout);
+    if (status < 0) {
+        HAL(abortCommand)();
+    }
+    return status;
+}
+
 
 /***** Mifare Classic Functions ******/
 
@@ -442,7 +576,7 @@ bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uid
       in the sector (block 0 relative to the current sector)
 */
 /**************************************************************************/
-bool PN532::mifareclassic_IsFirstBlock (uint32_t uiBlock)
+bool PN532Base::mifareclassic_IsFirstBlock (uint32_t uiBlock)
 {
     // Test if we are in the small or big sectors
     if (uiBlock < 128)
@@ -456,7 +590,7 @@ bool PN532::mifareclassic_IsFirstBlock (uint32_t uiBlock)
       Indicates whether the specified block number is the sector trailer
 */
 /**************************************************************************/
-bool PN532::mifareclassic_IsTrailerBlock (uint32_t uiBlock)
+bool PN532Base::mifareclassic_IsTrailerBlock (uint32_t uiBlock)
 {
     // Test if we are in the small or big sectors
     if (uiBlock < 128)
@@ -484,7 +618,7 @@ bool PN532::mifareclassic_IsTrailerBlock (uint32_t uiBlock)
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t PN532::mifareclassic_AuthenticateBlock (uint8_t *uid, uint8_t uidLen, uint32_t blockNumber, uint8_t keyNumber, uint8_t *keyData)
+uint8_t PN532Base::mifareclassic_AuthenticateBlock (uint8_t *uid, uint8_t uidLen, uint32_t blockNumber, uint8_t keyNumber, uint8_t *keyData)
 {
     uint8_t i;
 
@@ -507,7 +641,7 @@ uint8_t PN532::mifareclassic_AuthenticateBlock (uint8_t *uid, uint8_t uidLen, ui
         return 0;
 
     // Read the response packet
-    HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
 
     // Check if the response is valid and we are authenticated???
     // for an auth success it should be bytes 5-7: 0xD5 0x41 0x00
@@ -533,7 +667,7 @@ uint8_t PN532::mifareclassic_AuthenticateBlock (uint8_t *uid, uint8_t uidLen, ui
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t PN532::mifareclassic_ReadDataBlock (uint8_t blockNumber, uint8_t *data)
+uint8_t PN532Base::mifareclassic_ReadDataBlock (uint8_t blockNumber, uint8_t *data)
 {
     DMSG("Trying to read 16 bytes from block ");
     DMSG_INT(blockNumber);
@@ -550,7 +684,7 @@ uint8_t PN532::mifareclassic_ReadDataBlock (uint8_t blockNumber, uint8_t *data)
     }
 
     /* Read the response packet */
-    HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
 
     /* If byte 8 isn't 0x00 we probably have an error */
     if (pn532_packetbuffer[0] != 0x00) {
@@ -576,7 +710,7 @@ uint8_t PN532::mifareclassic_ReadDataBlock (uint8_t blockNumber, uint8_t *data)
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t PN532::mifareclassic_WriteDataBlock (uint8_t blockNumber, uint8_t *data)
+uint8_t PN532Base::mifareclassic_WriteDataBlock (uint8_t blockNumber, uint8_t *data)
 {
     /* Prepare the first command */
     pn532_packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
@@ -591,7 +725,7 @@ uint8_t PN532::mifareclassic_WriteDataBlock (uint8_t blockNumber, uint8_t *data)
     }
 
     /* Read the response packet */
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen));
 }
 
 /**************************************************************************/
@@ -601,7 +735,7 @@ uint8_t PN532::mifareclassic_WriteDataBlock (uint8_t blockNumber, uint8_t *data)
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t PN532::mifareclassic_FormatNDEF (void)
+uint8_t PN532Base::mifareclassic_FormatNDEF (void)
 {
     uint8_t sectorbuffer1[16] = {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
     uint8_t sectorbuffer2[16] = {0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
@@ -634,15 +768,23 @@ uint8_t PN532::mifareclassic_FormatNDEF (void)
 
     @param  sectorNumber  The sector that the URI record should be written
                           to (can be 1..15 for a 1K card)
-    @param  uriIdentifier The uri identifier code (0 = none, 0x01 =
-                          "http://www.", etc.)
-    @param  url           The uri text to write (max 38 characters).
+    @param  uriIdentifier The uri identifier code (0x01 = "http://www.",
+                          etc.), or NDEF_URIPREFIX_NONE to pick the
+                          longest matching prefix of url
+    @param  url           The uri text to write (max 38 characters
+                          after the prefix).
 
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t PN532::mifareclassic_WriteNDEFURI (uint8_t sectorNumber, uint8_t uriIdentifier, const char *url)
+uint8_t PN532Base::mifareclassic_WriteNDEFURI (uint8_t sectorNumber, uint8_t uriIdentifier, const char *url)
 {
+    if (uriIdentifier == NDEF_URIPREFIX_NONE) {
+        uint8_t prefixLength;
+        uriIdentifier = UriPrefix::match(url, &prefixLength);
+        url += prefixLength;
+    }
+
     // Figure out how long the string is
     uint8_t len = strlen(url);
 
@@ -658,8 +800,9 @@ uint8_t PN532::mifareclassic_WriteNDEFURI (uint8_t sectorNumber, uint8_t uriIden
     // in NDEF records
 
     // Setup the sector buffer (w/pre-formatted TLV wrapper and NDEF message)
-    uint8_t nlen = (uint8_t)(len + 5); // NDEF payload length (fits in 1 byte)
-    uint8_t sectorbuffer1[16] = {0x00, 0x00, 0x03, nlen, 0xD1, 0x01, nlen, 0x55, uriIdentifier, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    uint8_t nlen = (uint8_t)(len + 5); // NDEF message length (fits in 1 byte)
+    uint8_t plen = (uint8_t)(len + 1); // URI record payload: identifier code + url
+    uint8_t sectorbuffer1[16] = {0x00, 0x00, 0x03, nlen, 0xD1, 0x01, plen, 0x55, uriIdentifier, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     uint8_t sectorbuffer2[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     uint8_t sectorbuffer3[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     uint8_t sectorbuffer4[16] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7, 0x7F, 0x07, 0x88, 0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -714,7 +857,7 @@ uint8_t PN532::mifareclassic_WriteNDEFURI (uint8_t sectorNumber, uint8_t uriIden
                         retrieved data (if any)
 */
 /**************************************************************************/
-uint8_t PN532::mifareultralight_ReadPage (uint8_t page, uint8_t *buffer)
+uint8_t PN532Base::mifareultralight_ReadPage (uint8_t page, uint8_t *buffer)
 {
     if (page >= 64) {
         DMSG("Page value out of range\n");
@@ -733,7 +876,7 @@ uint8_t PN532::mifareultralight_ReadPage (uint8_t page, uint8_t *buffer)
     }
 
     /* Read the response packet */
-    HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
 
     /* If byte 8 isn't 0x00 we probably have an error */
     if (pn532_packetbuffer[0] == 0x00) {
@@ -762,7 +905,7 @@ uint8_t PN532::mifareultralight_ReadPage (uint8_t page, uint8_t *buffer)
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t PN532::mifareultralight_WritePage (uint8_t page, uint8_t *buffer)
+uint8_t PN532Base::mifareultralight_WritePage (uint8_t page, uint8_t *buffer)
 {
     /* Prepare the first command */
     pn532_packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
@@ -777,7 +920,7 @@ uint8_t PN532::mifareultralight_WritePage (uint8_t page, uint8_t *buffer)
     }
 
     /* Read the response packet */
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen));
 }
 
 /**************************************************************************/
@@ -790,7 +933,7 @@ uint8_t PN532::mifareultralight_WritePage (uint8_t page, uint8_t *buffer)
     @param  responseLength  Pointer to the response data length
 */
 /**************************************************************************/
-bool PN532::inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength)
+bool PN532Base::inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength)
 {
     uint8_t i;
 
@@ -832,7 +975,7 @@ bool PN532::inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response,
             peer acting as card/responder.
 */
 /**************************************************************************/
-bool PN532::inListPassiveTarget()
+bool PN532Base::inListPassiveTarget()
 {
     pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
     pn532_packetbuffer[1] = 1;
@@ -844,7 +987,7 @@ bool PN532::inListPassiveTarget()
         return false;
     }
 
-    int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), 30000);
+    int16_t status = HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen, 30000);
     if (status < 0) {
         return false;
     }
@@ -858,7 +1001,7 @@ bool PN532::inListPassiveTarget()
     return true;
 }
 
-int8_t PN532::tgInitAsTarget(const uint8_t* command, const uint8_t len, const uint16_t timeout){
+int8_t PN532Base::tgInitAsTarget(const uint8_t* command, const uint8_t len, const uint16_t timeout, uint8_t *activation, uint8_t *activationLength){
   
   int attempts = 0;
   int8_t status = 0;
@@ -878,12 +1021,21 @@ int8_t PN532::tgInitAsTarget(const uint8_t* command, const uint8_t len, const ui
     return -1;
   }
 
-    status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), timeout);
+    status = HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen, timeout);
     if (status > 0) {
         DMSG("tgInitAsTarget: success, response length: ");
         DMSG_HEX(status);
         DMSG("\nResponse: ");
+#ifdef DEBUG
         PrintHex(pn532_packetbuffer, status);
+#endif
+        if (activation != 0) {
+            if (status > *activationLength) {
+                status = *activationLength;
+            }
+            memcpy(activation, pn532_packetbuffer, status);
+            *activationLength = status;
+        }
         return 1;
     } else if (PN532_TIMEOUT == status) {
         DMSG("tgInitAsTarget: timeout waiting for target activation\n");
@@ -897,7 +1049,7 @@ int8_t PN532::tgInitAsTarget(const uint8_t* command, const uint8_t len, const ui
 /**
  * Peer to Peer
  */
-int8_t PN532::tgInitAsTarget(uint16_t timeout)
+int8_t PN532Base::tgInitAsTarget(uint16_t timeout)
 {
     /*
      * Default target initialization for peer-to-peer / tag emulation.
@@ -922,10 +1074,11 @@ int8_t PN532::tgInitAsTarget(uint16_t timeout)
     return tgInitAsTarget(command, sizeof(command), timeout);
 }
 
-int16_t PN532::tgGetData(uint8_t *buf, uint8_t len)
+int16_t PN532Base::tgGetData(uint8_t *buf, uint8_t len)
 {
     buf[0] = PN532_COMMAND_TGGETDATA;
 
+    _targetStatus = 0;
     if (HAL(writeCommand)(buf, 1)) {
         return -1;
     }
@@ -937,8 +1090,8 @@ int16_t PN532::tgGetData(uint8_t *buf, uint8_t len)
 
     uint16_t length = status - 1;
 
-
-    if (buf[0] != 0) {
+    _targetStatus = buf[0];
+    if (buf[0] & PN532_STATUS_ERROR_MASK) {
         DMSG("status is not ok: 0x"); DMSG_HEX(buf[0]); DMSG("\n");
         return -5;
     }
@@ -950,18 +1103,58 @@ int16_t PN532::tgGetData(uint8_t *buf, uint8_t len)
     return length;
 }
 
-bool PN532::tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
+int16_t PN532Base::tgGetInitiatorCommand(uint8_t *buf, uint8_t len)
 {
-    if (hlen > (sizeof(pn532_packetbuffer) - 1)) {
-        if ((body != 0) || (header == pn532_packetbuffer)) {
-            DMSG("tgSetData:buffer too small\n");
-            return false;
-        }
+    buf[0] = PN532_COMMAND_TGGETINITIATORCOMMAND;
 
-        pn532_packetbuffer[0] = PN532_COMMAND_TGSETDATA;
-        if (HAL(writeCommand)(pn532_packetbuffer, 1, header, hlen)) {
+    _targetStatus = 0;
+    if (HAL(writeCommand)(buf, 1)) {
+        return -1;
+    }
+
+    int16_t status = HAL(readResponse)(buf, len, 3000);
+    if (0 >= status) {
+        return status < 0 ? status : -1;
+    }
+
+    _targetStatus = buf[0];
+    if (_targetStatus != 0) {
+        DMSG("status is not ok: 0x"); DMSG_HEX(_targetStatus); DMSG("\n");
+        return -5;
+    }
+
+    memmove(buf, buf + 1, status - 1);
+    return status - 1;
+}
+
+bool PN532Base::tgResponseToInitiator(const uint8_t *data, uint8_t len)
+{
+    uint8_t header = PN532_COMMAND_TGRESPONSETOINITIATOR;
+
+    _targetStatus = 0;
+    if (HAL(writeCommand)(&header, 1, data, len)) {
+        return false;
+    }
+
+    if (0 >= HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen, 3000)) {
+        return false;
+    }
+
+    _targetStatus = pn532_packetbuffer[0];
+    return _targetStatus == 0;
+}
+
+bool PN532Base::tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
+{
+    if (body == 0) {
+        // header is the data of the frame as it is, nothing is copied
+        const uint8_t command = PN532_COMMAND_TGSETDATA;
+        if (HAL(writeCommand)(&command, 1, header, hlen)) {
             return false;
         }
+    } else if (hlen > (pn532_packetbufferLen - 1)) {
+        DMSG("tgSetData:buffer too small\n");
+        return false;
     } else {
         for (int8_t i = hlen - 1; i >= 0; i--){
             pn532_packetbuffer[i + 1] = header[i];
@@ -973,7 +1166,7 @@ bool PN532::tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body,
         }
     }
 
-    if (0 > HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), 3000)) {
+    if (0 > HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen, 3000)) {
         return false;
     }
 
@@ -984,7 +1177,21 @@ bool PN532::tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body,
     return true;
 }
 
-int16_t PN532::inRelease(const uint8_t relevantTarget){
+bool PN532Base::tgSetMetaData(const uint8_t *data, uint8_t len)
+{
+    const uint8_t command = PN532_COMMAND_TGSETMETADATA;
+    if (HAL(writeCommand)(&command, 1, data, len)) {
+        return false;
+    }
+
+    if (0 > HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen, 3000)) {
+        return false;
+    }
+
+    return 0 == pn532_packetbuffer[0];
+}
+
+int16_t PN532Base::inRelease(const uint8_t relevantTarget){
 
     pn532_packetbuffer[0] = PN532_COMMAND_INRELEASE;
     pn532_packetbuffer[1] = relevantTarget;
@@ -994,7 +1201,7 @@ int16_t PN532::inRelease(const uint8_t relevantTarget){
     }
 
     // read data packet
-    return HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    return HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen);
 }
 
 
@@ -1017,7 +1224,7 @@ int16_t PN532::inRelease(const uint8_t relevantTarget){
                                        < 0: error
 */
 /**************************************************************************/
-int8_t PN532::felica_Polling(uint16_t systemCode, uint8_t requestCode, uint8_t * idm, uint8_t * pmm, uint16_t *systemCodeResponse, uint16_t timeout)
+int8_t PN532Base::felica_Polling(uint16_t systemCode, uint8_t requestCode, uint8_t * idm, uint8_t * pmm, uint16_t *systemCodeResponse, uint16_t timeout)
 {
   pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
   pn532_packetbuffer[1] = 1;
@@ -1033,7 +1240,7 @@ int8_t PN532::felica_Polling(uint16_t systemCode, uint8_t requestCode, uint8_t *
     return -1;
   }
 
-  int16_t status = HAL(readResponse)(pn532_packetbuffer, 22, timeout);
+  int16_t status = readPollResponse(22, timeout);
   if (status < 0) {
     DMSG("Could not receive response\n");
     return -2;
@@ -1089,7 +1296,7 @@ int8_t PN532::felica_Polling(uint16_t systemCode, uint8_t requestCode, uint8_t *
                                      < 0: error
 */
 /**************************************************************************/
-int8_t PN532::felica_SendCommand (const uint8_t *command, uint8_t commandlength, uint8_t *response, uint8_t *responseLength)
+int8_t PN532Base::felica_SendCommand (const uint8_t *command, uint8_t commandlength, uint8_t *response, uint8_t *responseLength)
 {
   if (commandlength > 0xFE) {
     DMSG("Command length too long\n");
@@ -1106,7 +1313,7 @@ int8_t PN532::felica_SendCommand (const uint8_t *command, uint8_t commandlength,
   }
 
   // Wait card response
-  int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), 200);
+  int16_t status = HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen, 200);
   if (status < 0) {
     DMSG("Could not receive response\n");
     return -3;
@@ -1144,7 +1351,7 @@ int8_t PN532::felica_SendCommand (const uint8_t *command, uint8_t commandlength,
                                      < 0: error
 */
 /**************************************************************************/
-int8_t PN532::felica_RequestService(uint8_t numNode, uint16_t *nodeCodeList, uint16_t *keyVersions)
+int8_t PN532Base::felica_RequestService(uint8_t numNode, uint16_t *nodeCodeList, uint16_t *keyVersions)
 {
   if (numNode > FELICA_REQ_SERVICE_MAX_NODE_NUM) {
     DMSG("numNode is too large\n");
@@ -1194,7 +1401,7 @@ int8_t PN532::felica_RequestService(uint8_t numNode, uint16_t *nodeCodeList, uin
                               < 0: error
 */
 /**************************************************************************/
-int8_t PN532::felica_RequestResponse(uint8_t * mode)
+int8_t PN532Base::felica_RequestResponse(uint8_t * mode)
 {
   uint8_t cmd[9];
   cmd[0] = FELICA_CMD_REQUEST_RESPONSE;
@@ -1230,7 +1437,7 @@ int8_t PN532::felica_RequestResponse(uint8_t * mode)
                                    < 0: error
 */
 /**************************************************************************/
-int8_t PN532::felica_ReadWithoutEncryption (uint8_t numService, const uint16_t *serviceCodeList, uint8_t numBlock, const uint16_t *blockList, uint8_t blockData[][16])
+int8_t PN532Base::felica_ReadWithoutEncryption (uint8_t numService, const uint16_t *serviceCodeList, uint8_t numBlock, const uint16_t *blockList, uint8_t blockData[][16])
 {
   if (numService > FELICA_READ_MAX_SERVICE_NUM) {
     DMSG("numService is too large\n");
@@ -1305,7 +1512,7 @@ int8_t PN532::felica_ReadWithoutEncryption (uint8_t numService, const uint16_t *
                                    < 0: error
 */
 /**************************************************************************/
-int8_t PN532::felica_WriteWithoutEncryption (uint8_t numService, const uint16_t *serviceCodeList, uint8_t numBlock, const uint16_t *blockList, uint8_t blockData[][16])
+int8_t PN532Base::felica_WriteWithoutEncryption (uint8_t numService, const uint16_t *serviceCodeList, uint8_t numBlock, const uint16_t *blockList, uint8_t blockData[][16])
 {
   if (numService > FELICA_WRITE_MAX_SERVICE_NUM) {
     DMSG("numService is too large\n");
@@ -1374,7 +1581,7 @@ int8_t PN532::felica_WriteWithoutEncryption (uint8_t numService, const uint16_t
                                      < 0: error
 */
 /**************************************************************************/
-int8_t PN532::felica_RequestSystemCode(uint8_t * numSystemCode, uint16_t *systemCodeList)
+int8_t PN532Base::felica_RequestSystemCode(uint8_t * numSystemCode, uint16_t *systemCodeList)
 {
   uint8_t cmd[9];
   cmd[0] = FELICA_CMD_REQUEST_SYSTEM_CODE;
@@ -1410,7 +1617,7 @@ int8_t PN532::felica_RequestSystemCode(uint8_t * numSystemCode, uint16_t *system
                                      < 0: error
 */
 /**************************************************************************/
-int8_t PN532::felica_Release()
+int8_t PN532Base::felica_Release()
 {
   // InRelease
   pn532_packetbuffer[0] = PN532_COMMAND_INRELEASE;
@@ -1423,7 +1630,7 @@ int8_t PN532::felica_Release()
   }
 
   // Wait card response
-  int16_t frameLength = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), 1000);
+  int16_t frameLength = HAL(readResponse)(pn532_packetbuffer, pn532_packetbufferLen, 1000);
   if (frameLength < 0) {
     DMSG("Could not receive response\n");
     return -2;
@@ -51,6 +51,13 @@
 
 
 #define PN532_MIFARE_ISO14443A              (0x00)
+#define PN532_ISO14443B                     (0x03)
+#define PN532_INNOVISION_JEWEL              (0x04)
+
+// status byte of target commands: error code in bits 0-5, MI when the
+// initiator chained blocks and more of its data follows
+#define PN532_STATUS_ERROR_MASK             (0x3F)
+#define PN532_STATUS_MI                     (0x40)
 
 // Mifare Commands
 #define MIFARE_CMD_AUTH_A                   (0x60)
@@ -63,6 +70,17 @@
 #define MIFARE_CMD_INCREMENT                (0xC1)
 #define MIFARE_CMD_STORE                    (0xC2)
 
+// Jewel / Topaz Commands
+#define JEWEL_CMD_RID                       (0x78)
+#define JEWEL_CMD_RALL                      (0x00)
+#define JEWEL_CMD_READ                      (0x01)
+#define JEWEL_CMD_WRITE_E                   (0x53)
+#define JEWEL_CMD_WRITE_NE                  (0x1A)
+#define JEWEL_CMD_RSEG                      (0x10)
+#define JEWEL_CMD_READ8                     (0x02)
+#define JEWEL_CMD_WRITE_E8                  (0x54)
+#define JEWEL_CMD_WRITE_NE8                 (0x1B)
+
 // FeliCa Commands
 #define FELICA_CMD_POLLING                  (0x00)
 #define FELICA_CMD_REQUEST_SERVICE          (0x02)
@@ -124,10 +142,20 @@
 #define FELICA_WRITE_MAX_BLOCK_NUM          10 // for typical FeliCa card
 #define FELICA_REQ_SERVICE_MAX_NODE_NUM     32
 
-class PN532
+// Default size of the frame buffer shared by all commands; override with
+// -DPN532_PACKBUFFSIZ=... or use BasicPN532<N> directly
+#ifndef PN532_PACKBUFFSIZ
+#define PN532_PACKBUFFSIZ                   64
+#endif
+
+/**
+ * Command implementation shared by every BasicPN532<N>. The frame buffer
+ * is owned by the derived class so the driver code exists only once in
+ * flash no matter how many buffer sizes a firmware uses.
+ */
+class PN532Base
 {
 public:
-    PN532(PN532Interface &interface);
 
     void begin(void);
 
@@ -149,16 +177,48 @@ public:
     *           < 0     failed
     */
     int8_t tgInitAsTarget(uint16_t timeout = 0);
-    int8_t tgInitAsTarget(const uint8_t* command, const uint8_t len, const uint16_t timeout = 0);
+    // activation gets the mode byte and the first command of the initiator,
+    // activationLength is its size and then the bytes stored
+    int8_t tgInitAsTarget(const uint8_t* command, const uint8_t len, const uint16_t timeout = 0, uint8_t *activation = 0, uint8_t *activationLength = 0);
 
+    // getTargetStatus() has PN532_STATUS_MI set when the data goes on in the next tgGetData()
     int16_t tgGetData(uint8_t *buf, uint8_t len);
+    // Without body header is sent from where it is, whatever its length.
+    // With one, header is copied to the packet buffer and must fit it.
     bool tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
+    // the first blocks of an answer longer than a frame, tgSetData() sends the last
+    bool tgSetMetaData(const uint8_t *data, uint8_t len);
+
+    /**
+    * @brief    next raw command of the initiator, for PICC emulation without ISO-DEP
+    * @return   >= 0    bytes of the command in buf, CRC removed
+    *           < 0     failed, getTargetStatus() has the PN532 status
+    */
+    int16_t tgGetInitiatorCommand(uint8_t *buf, uint8_t len);
+    // answer the last initiator command, the PN532 adds the CRC
+    bool tgResponseToInitiator(const uint8_t *data, uint8_t len);
+    // status byte of the last target command: 0x00 ok, 0x01 timeout, 0x29 released by the initiator,
+    // PN532_STATUS_MI from tgGetData() when more data follows
+    uint8_t getTargetStatus() { return _targetStatus; }
 
     int16_t inRelease(const uint8_t relevantTarget = 0);
 
     // ISO14443A functions
     bool inListPassiveTarget();
     bool readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uidLength, uint16_t timeout = 1000);
+    // Innovision Jewel / Topaz (NFC Forum Type 1), 106 kbps
+    bool readJewelTargetID(uint8_t *uid, uint8_t *uidLength, uint16_t timeout = 1000);
+    // ISO14443B, 106 kbps. afi 0x00 asks every application family, the 4 byte PUPI goes to pupi
+    bool readTypeBTargetID(uint8_t afi, uint8_t *pupi, uint16_t timeout = 1000);
+    // SENS_RES (ATQA) and SEL_RES (SAK) of the target the last readPassiveTargetID found
+    uint16_t getSensRes() { return _sensRes; }
+    uint8_t getSelRes() { return _selRes; }
+    // ATQB of the target the last readTypeBTargetID found: PUPI (4),
+    // application data (4), protocol info (3)
+    const uint8_t *getAtqb() { return _atqb; }
+    // Largest frame the inlisted ISO-DEP target accepts (FSC), from the ATS
+    // FSCI or the ATQB Max_Frame_Size. 0 when the target did not tell.
+    uint16_t getTargetFrameSize() { return _frameSize; }
     bool inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength);
 
     // Mifare Classic functions
@@ -189,21 +249,50 @@ public:
     static void PrintHexChar(const uint8_t *pbtData, const uint32_t numBytes);
 
     uint8_t *getBuffer(uint8_t *len) {
-        *len = sizeof(pn532_packetbuffer) - 4;
+        *len = pn532_packetbufferLen - 4;
         return pn532_packetbuffer;
     };
 
+protected:
+    PN532Base(PN532Interface &interface, uint8_t *packetbuffer, uint8_t packetbufferLen);
+
 private:
+    // the buffer belongs to the derived object, a copy would alias it
+    PN532Base(const PN532Base &);
+    PN532Base &operator=(const PN532Base &);
+
+    int16_t readPollResponse(uint8_t len, uint16_t timeout);
+
     uint8_t _uid[7];  // ISO14443A uid
     uint8_t _uidLen;  // uid len
     uint8_t _key[6];  // Mifare Classic key
     uint8_t inListedTag; // Tg number of inlisted tag.
+    uint16_t _sensRes;
+    uint8_t _selRes;
+    uint8_t _atqb[11];
+    uint16_t _frameSize;
+    uint8_t _targetStatus;
     uint8_t _felicaIDm[8]; // FeliCa IDm (NFCID2)
     uint8_t _felicaPMm[8]; // FeliCa PMm (PAD)
 
-    uint8_t pn532_packetbuffer[64];
+    uint8_t *pn532_packetbuffer;
+    uint8_t pn532_packetbufferLen;
 
     PN532Interface *_interface;
 };
 
+template <uint8_t PacketBufSize>
+class BasicPN532 : public PN532Base
+{
+public:
+    BasicPN532(PN532Interface &interface) : PN532Base(interface, packetbuffer, PacketBufSize) { }
+
+private:
+    static_assert(PacketBufSize >= 32, "PN532 packet buffer must hold at least 32 bytes");
+
+    uint8_t packetbuffer[PacketBufSize];
+};
+
+typedef BasicPN532<PN532_PACKBUFFSIZ> PN532;
+
 #endif
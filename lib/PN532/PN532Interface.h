@@ -50,6 +50,12 @@ public:
     *           <0      failed to read response
     */
     virtual int16_t readResponse(uint8_t buf[], uint8_t len, uint16_t timeout = 1000) = 0;
+
+    /**
+    * @brief    send an ACK frame, which makes the PN532 drop the command it
+    *           is still running, e.g. a poll readResponse gave up on
+    */
+    virtual void abortCommand() { }
 };
 
 #endif
@@ -0,0 +1,220 @@
+#include "apdu_router.h"
+#include "PN532_debug.h"
+
+#include <string.h>
+
+#define C_APDU_INS   1
+#define C_APDU_P1    2
+#define C_APDU_LC    4
+
+// orders AIDs by their bytes, a prefix before the longer AID
+static int compareAid(const uint8_t *a, uint8_t aLength, const uint8_t *b, uint8_t bLength)
+{
+    int order = memcmp(a, b, aLength < bLength ? aLength : bLength);
+    if (order != 0) {
+        return order;
+    }
+    return (int)aLength - (int)bLength;
+}
+
+bool parseApdu(const uint8_t *apdu, uint16_t apduLength, ApduBody *body)
+{
+    body->data = 0;
+    body->lc = 0;
+    body->le = 0;
+    if (apduLength < 4) {
+        return false;
+    }
+
+    uint16_t rest = apduLength - 4;
+    const uint8_t *p = apdu + C_APDU_LC;
+    if (rest == 0) {
+        return true;
+    }
+    if (rest == 1) {
+        body->le = p[0] ? p[0] : 256;
+        return true;
+    }
+    if (p[0] != 0) {
+        body->lc = p[0];
+        body->data = p + 1;
+        if (rest == 1 + body->lc) {
+            return true;
+        }
+        if (rest == 2 + body->lc) {
+            body->le = p[rest - 1] ? p[rest - 1] : 256;
+            return true;
+        }
+        return false;
+    }
+
+    // extended, Lc or Le of two bytes after the 00
+    if (rest < 3) {
+        return false;
+    }
+    uint16_t length = (p[1] << 8) | p[2];
+    if (rest == 3) {
+        body->le = length ? length : 65536;
+        return true;
+    }
+    body->lc = length;
+    body->data = p + 3;
+    if (length == 0) {
+        return false;
+    }
+    if (rest == 3 + (uint32_t)length) {
+        return true;
+    }
+    if (rest == 5 + (uint32_t)length) {
+        uint16_t le = (p[rest - 2] << 8) | p[rest - 1];
+        body->le = le ? le : 65536;
+        return true;
+    }
+    return false;
+}
+
+ApduRouter::ApduRouter() : applicationCount(0), handlerCount(0), selected(-1)
+{
+}
+
+bool ApduRouter::addApplication(const uint8_t *aid, uint8_t aidLength)
+{
+    bool found;
+    int16_t index = findApplication(aid, aidLength, &found);
+    if (found || applicationCount == APDU_ROUTER_MAX_APPLICATIONS) {
+        return false;
+    }
+
+    memmove(applications + index + 1, applications + index, (applicationCount - index) * sizeof(Application));
+    applications[index].aid = aid;
+    applications[index].aidLength = aidLength;
+    applications[index].id = applicationCount;
+    applicationCount++;
+    if (selected < 0) {
+        selected = 0;
+    }
+    return true;
+}
+
+bool ApduRouter::addHandler(const uint8_t *aid, uint8_t aidLength, uint8_t ins, ApduHandler handler, void *context)
+{
+    bool found;
+    int16_t application = findApplication(aid, aidLength, &found);
+    if (!found) {
+        return false;
+    }
+
+    uint16_t key = (applications[application].id << 8) | ins;
+    int16_t index = findHandler(key, &found);
+    if (!found) {
+        if (handlerCount == APDU_ROUTER_MAX_HANDLERS) {
+            return false;
+        }
+        memmove(handlers + index + 1, handlers + index, (handlerCount - index) * sizeof(Handler));
+        handlerCount++;
+    }
+    handlers[index].key = key;
+    handlers[index].handler = handler;
+    handlers[index].context = context;
+    return true;
+}
+
+void ApduRouter::reset()
+{
+    selected = applicationCount > 0 ? 0 : -1;
+}
+
+uint16_t ApduRouter::dispatch(const uint8_t *apdu, uint16_t apduLength, ApduResponse *response)
+{
+    void *context;
+    uint16_t sw;
+    response->length = 0;
+    response->prepared = 0;
+    response->frame = 0;
+    response->leading = 0;
+    response->leadingLength = 0;
+    ApduHandler handler = route(apdu, apduLength, &context, &sw);
+    return handler ? handler(context, apdu, apduLength, response) : sw;
+}
+
+ApduHandler ApduRouter::route(const uint8_t *apdu, uint16_t apduLength, void **context, uint16_t *sw)
+{
+    if (apduLength < 4) {
+        *sw = APDU_SW_WRONG_LENGTH;
+        return 0;
+    }
+
+    bool found = false;
+    if (apdu[C_APDU_INS] == APDU_INS_SELECT && apdu[C_APDU_P1] == APDU_P1_SELECT_BY_NAME) {
+        int16_t application = -1;
+        ApduBody body;
+        if (parseApdu(apdu, apduLength, &body) && body.lc > 0 && body.lc <= 0xFF) {
+            application = findApplication(body.data, body.lc, &found);
+        }
+        if (!found) {
+            DMSG("AID not found\n");
+            *sw = APDU_SW_FILE_NOT_FOUND;
+            return 0;
+        }
+        selected = applications[application].id;
+
+        // the application may answer with its FCI
+        int16_t index = findHandler((selected << 8) | APDU_INS_SELECT, &found);
+        *sw = APDU_SW_OK;
+        *context = found ? handlers[index].context : 0;
+        return found ? handlers[index].handler : 0;
+    }
+
+    int16_t index = selected < 0 ? -1 : findHandler((selected << 8) | apdu[C_APDU_INS], &found);
+    if (!found) {
+        DMSG("Command not supported!");
+        DMSG_HEX(apdu[C_APDU_INS]);
+        DMSG("\n");
+        *sw = APDU_SW_FUNCTION_NOT_SUPPORTED;
+        return 0;
+    }
+    *context = handlers[index].context;
+    return handlers[index].handler;
+}
+
+// index of the application, or where it would go when found is false
+int16_t ApduRouter::findApplication(const uint8_t *aid, uint8_t aidLength, bool *found)
+{
+    int16_t low = 0;
+    int16_t high = applicationCount;
+    while (low < high) {
+        int16_t middle = (low + high) / 2;
+        int order = compareAid(applications[middle].aid, applications[middle].aidLength, aid, aidLength);
+        if (order == 0) {
+            *found = true;
+            return middle;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *found = false;
+    return low;
+}
+
+int16_t ApduRouter::findHandler(uint16_t key, bool *found)
+{
+    int16_t low = 0;
+    int16_t high = handlerCount;
+    while (low < high) {
+        int16_t middle = (low + high) / 2;
+        if (handlers[middle].key == key) {
+            *found = true;
+            return middle;
+        }
+        if (handlers[middle].key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *found = false;
+    return low;
+}
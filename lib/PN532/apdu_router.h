@@ -0,0 +1,130 @@
+#ifndef __APDU_ROUTER_H__
+#define __APDU_ROUTER_H__
+
+#include <stdint.h>
+
+#ifndef APDU_ROUTER_MAX_APPLICATIONS
+#define APDU_ROUTER_MAX_APPLICATIONS    4
+#endif
+#ifndef APDU_ROUTER_MAX_HANDLERS
+#define APDU_ROUTER_MAX_HANDLERS        16
+#endif
+
+// ISO 7816-4 status words
+#define APDU_SW_OK                      0x9000
+#define APDU_SW_END_OF_FILE             0x6282  // end of file reached before Le bytes
+#define APDU_SW_MEMORY_FAILURE          0x6581
+#define APDU_SW_WRONG_LENGTH            0x6700
+#define APDU_SW_CHAINING_NOT_SUPPORTED  0x6884
+#define APDU_SW_FUNCTION_NOT_SUPPORTED  0x6A81
+#define APDU_SW_FILE_NOT_FOUND          0x6A82
+
+#define APDU_CLA_CHAINING               0x10    // more commands of the chain follow
+#define APDU_INS_SELECT                 0xA4
+#define APDU_P1_SELECT_BY_NAME          0x04
+
+/**
+ * What follows the 4 header bytes of a C-APDU, short (Lc and Le one byte)
+ * or extended (Lc 00 XX XX, Le two bytes after it or 00 XX XX alone).
+ */
+struct ApduBody {
+    const uint8_t *data;
+    uint16_t lc;
+    uint32_t le;        // 0 when there is none, Le 00 is 256 or 65536
+};
+
+// false when apdu is no well formed command of any of the cases
+bool parseApdu(const uint8_t *apdu, uint16_t apduLength, ApduBody *body);
+
+/**
+ * Where a handler puts its response data. data is the buffer the R-APDU is
+ * sent from, the status word goes after the length bytes written.
+ * A handler that has the whole R-APDU ready elsewhere, status word
+ * included, points prepared at it and sets length to its size instead.
+ * When prepared is laid out in slices of frame bytes, each followed by two
+ * bytes that are not sent, the R-APDU goes out in frames from there.
+ * Data longer than room can start with leading, which is sent in frames of
+ * room bytes before data.
+ */
+struct ApduResponse {
+    uint8_t *data;
+    uint16_t room;      // bytes data holds, one frame
+    uint16_t length;    // bytes written
+    const uint8_t *prepared;
+    uint16_t frame;     // slice size of prepared, 0 if it is contiguous
+    const uint8_t *leading;
+    uint16_t leadingLength; // a multiple of room
+};
+
+/**
+ * Answers one C-APDU of an application and returns the status word.
+ * context is what the handler was added with.
+ */
+typedef uint16_t (*ApduHandler)(void *context, const uint8_t *apdu, uint16_t apduLength, ApduResponse *response);
+
+/**
+ * Dispatches the C-APDUs of an emulated card to the applications on it.
+ * SELECT by name (P1 0x04) picks the application, any other command goes
+ * to the handler the selected application has for its INS, a SELECT by
+ * name included when there is one. Until the first SELECT by name the
+ * application added first gets the commands.
+ *
+ * Applications are kept sorted by AID and handlers by application and INS,
+ * both are found by binary search. AIDs are not copied, they must outlive
+ * the router.
+ */
+class ApduRouter {
+public:
+    ApduRouter();
+
+    /**
+    * @brief    add an application, AIDs are matched in full
+    * @return   false if the AID is there already or the table is full
+    */
+    bool addApplication(const uint8_t *aid, uint8_t aidLength);
+
+    /**
+    * @brief    answer ins of the application aid with handler, replacing the handler it had
+    * @return   false if there is no such application or the table is full
+    */
+    bool addHandler(const uint8_t *aid, uint8_t aidLength, uint8_t ins, ApduHandler handler, void *context = 0);
+
+    // back to the application added first, at the start of an activation
+    void reset();
+
+    /**
+    * @brief    answer apdu, data and status word go to response
+    * @return   the status word
+    */
+    uint16_t dispatch(const uint8_t *apdu, uint16_t apduLength, ApduResponse *response);
+
+    /**
+    * @brief    the first half of dispatch(): select the application and find the handler
+    * @return   the handler to call with context, 0 when the router answers
+    *           apdu itself with the status word in sw
+    */
+    ApduHandler route(const uint8_t *apdu, uint16_t apduLength, void **context, uint16_t *sw);
+
+private:
+    struct Application {
+        const uint8_t *aid;
+        uint8_t aidLength;
+        uint8_t id;     // order of addApplication, handlers refer to it
+    };
+    struct Handler {
+        uint16_t key;   // application id and INS
+        ApduHandler handler;
+        void *context;
+    };
+
+    Application applications[APDU_ROUTER_MAX_APPLICATIONS];
+    uint8_t applicationCount;
+    Handler handlers[APDU_ROUTER_MAX_HANDLERS];
+    uint8_t handlerCount;
+    int16_t selected;   // application id, -1 when there is none
+
+    int16_t findApplication(const uint8_t *aid, uint8_t aidLength, bool *found);
+    int16_t findHandler(uint16_t key, bool *found);
+};
+
+#endif // __APDU_ROUTER_H__
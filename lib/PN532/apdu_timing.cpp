@@ -0,0 +1,116 @@
+#include "apdu_timing.h"
+
+#include <string.h>
+
+static const char *const stageNames[APDU_STAGES] = {
+    "wait", "dispatch", "build", "send", "turnaround"
+};
+
+ApduTimings::ApduTimings()
+{
+    reset();
+}
+
+void ApduTimings::reset()
+{
+    memset(histograms, 0, sizeof(histograms));
+    count = 0;
+    dropped = 0;
+}
+
+void ApduTimings::record(uint8_t ins, const uint32_t micros[APDU_STAGE_TURNAROUND])
+{
+    ApduHistogram *histogram = (ApduHistogram *)find(ins);
+    if (histogram == 0) {
+        if (count == APDU_TIMING_MAX_INS) {
+            dropped++;
+            return;
+        }
+        histogram = &histograms[count++];
+        histogram->ins = ins;
+    }
+
+    uint32_t times[APDU_STAGES];
+    memcpy(times, micros, APDU_STAGE_TURNAROUND * sizeof(uint32_t));
+    times[APDU_STAGE_TURNAROUND] = micros[APDU_STAGE_DISPATCH] + micros[APDU_STAGE_BUILD] + micros[APDU_STAGE_SEND];
+
+    histogram->count++;
+    for (uint8_t stage = 0; stage < APDU_STAGES; stage++) {
+        uint16_t &bucketCount = histogram->buckets[stage][bucket(times[stage])];
+        if (bucketCount < 0xFFFF) {
+            bucketCount++;
+        }
+        histogram->totalMicros[stage] += times[stage];
+        if (times[stage] > histogram->maxMicros[stage]) {
+            histogram->maxMicros[stage] = times[stage];
+        }
+    }
+}
+
+const ApduHistogram *ApduTimings::find(uint8_t ins)
+{
+    for (uint8_t i = 0; i < count; i++) {
+        if (histograms[i].ins == ins) {
+            return &histograms[i];
+        }
+    }
+    return 0;
+}
+
+uint8_t ApduTimings::bucket(uint32_t micros)
+{
+    uint8_t b = 0;
+    for (uint32_t limit = APDU_TIMING_FIRST_LIMIT; micros >= limit && b < APDU_TIMING_BUCKETS - 1; limit <<= 1) {
+        b++;
+    }
+    return b;
+}
+
+uint32_t ApduTimings::bucketLimit(uint8_t bucket)
+{
+    return bucket < APDU_TIMING_BUCKETS - 1 ? (uint32_t)APDU_TIMING_FIRST_LIMIT << bucket : 0;
+}
+
+void ApduTimings::print(Print &out)
+{
+    for (uint8_t i = 0; i < count; i++) {
+        const ApduHistogram &h = histograms[i];
+        out.print(F("[APDU] INS "));
+        if (h.ins < 0x10) {
+            out.print('0');
+        }
+        out.print(h.ins, HEX);
+        out.print(F(": "));
+        out.print(h.count);
+        out.println(F(" x, avg / max us, buckets <us:count"));
+
+        for (uint8_t stage = 0; stage < APDU_STAGES; stage++) {
+            out.print(F("  "));
+            out.print(stageNames[stage]);
+            out.print(F(" "));
+            out.print(h.totalMicros[stage] / h.count);
+            out.print(F(" / "));
+            out.print(h.maxMicros[stage]);
+            for (uint8_t b = 0; b < APDU_TIMING_BUCKETS; b++) {
+                if (h.buckets[stage][b] == 0) {
+                    continue;
+                }
+                if (bucketLimit(b)) {
+                    out.print(F(" <"));
+                    out.print(bucketLimit(b));
+                } else {
+                    out.print(F(" >="));
+                    out.print(bucketLimit(b - 1));
+                }
+                out.print(':');
+                out.print(h.buckets[stage][b]);
+            }
+            out.println();
+        }
+    }
+    if (dropped) {
+        out.print(F("[APDU] "));
+        out.print(dropped);
+        out.println(F(" commands not counted, no histogram left"));
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef __APDU_TIMING_H__
+#define __APDU_TIMING_H__
+
+#include "Arduino.h"
+
+#ifndef APDU_TIMING_MAX_INS
+#define APDU_TIMING_MAX_INS     8
+#endif
+
+// bucket b counts times below 128 us << b, the last one everything longer
+#define APDU_TIMING_BUCKETS     10
+#define APDU_TIMING_FIRST_LIMIT 128
+
+// the parts of one C-APDU to R-APDU exchange while emulating
+enum ApduStage {
+    APDU_STAGE_WAIT,        // TgGetData: the reader's think time between commands,
+                            // the air and the host transport; not the tag's doing
+    APDU_STAGE_DISPATCH,    // finding the application and handler
+    APDU_STAGE_BUILD,       // the handler and the status word
+    APDU_STAGE_SEND,        // TgSetData until the PN532 acknowledged it
+    APDU_STAGE_TURNAROUND,  // dispatch, build and send: what the reader waits for
+    APDU_STAGES
+};
+
+struct ApduHistogram {
+    uint8_t ins;
+    uint32_t count;
+    uint16_t buckets[APDU_STAGES][APDU_TIMING_BUCKETS];
+    uint32_t totalMicros[APDU_STAGES];
+    uint32_t maxMicros[APDU_STAGES];
+};
+
+/**
+ * Per INS histograms of how long emulated APDUs take, see
+ * EmulateTagBase::setTimings(). The turnaround has to stay below the frame
+ * waiting time the reader allows, otherwise it gives up on the tag.
+ * Commands with an INS past the first APDU_TIMING_MAX_INS are counted as
+ * dropped.
+ */
+class ApduTimings {
+public:
+    ApduTimings();
+
+    void reset();
+
+    /**
+    * @brief    add one exchange
+    * @param    micros  wait, dispatch, build and send time, the turnaround is their sum without wait
+    */
+    void record(uint8_t ins, const uint32_t micros[APDU_STAGE_TURNAROUND]);
+
+    uint8_t getCount() { return count; }
+    const ApduHistogram *get(uint8_t index) { return index < count ? &histograms[index] : 0; }
+    // the histogram of ins, 0 if there was no such command
+    const ApduHistogram *find(uint8_t ins);
+    uint32_t getDropped() { return dropped; }
+
+    static uint8_t bucket(uint32_t micros);
+    // times in bucket are below this, 0 for the last one
+    static uint32_t bucketLimit(uint8_t bucket);
+
+    void print(Print &out);
+
+private:
+    ApduHistogram histograms[APDU_TIMING_MAX_INS];
+    uint8_t count;
+    uint32_t dropped;
+};
+
+#endif // __APDU_TIMING_H__
@@ -0,0 +1,181 @@
+#include "desfire.h"
+#include "PN532_debug.h"
+#include <string.h>
+
+#define DESFIRE_SW1         (0x91)
+#define DESFIRE_NO_ANSWER   (0xFF)
+
+bool DesfireReader::getVersion(DesfireVersion *version)
+{
+    uint8_t response[28];
+    if (command(DESFIRE_CMD_GET_VERSION, 0, 0, response, sizeof(response)) != sizeof(response)) {
+        return false;
+    }
+
+    memcpy(version->hardware, response, 7);
+    memcpy(version->software, response + 7, 7);
+    memcpy(version->uid, response + 14, 7);
+    memcpy(version->batch, response + 21, 5);
+    version->week = response[26];
+    version->year = response[27];
+    return true;
+}
+
+int16_t DesfireReader::getApplicationIds(uint32_t *aids, uint8_t maxAids)
+{
+    uint8_t response[3 * DESFIRE_MAX_APPLICATIONS];
+
+    if (!selectApplication(0)) {
+        return -1;
+    }
+    int32_t length = command(DESFIRE_CMD_GET_APPLICATION_IDS, 0, 0, response, sizeof(response));
+    _exchanges++;   // the select
+    if (length < 0 || length % 3) {
+        return -1;
+    }
+
+    // 3 bytes each, LSB first
+    int16_t count = length / 3;
+    for (int16_t i = 0; i < count && i < maxAids && i < DESFIRE_MAX_APPLICATIONS; i++) {
+        aids[i] = response[3 * i] | ((uint32_t)response[3 * i + 1] << 8) | ((uint32_t)response[3 * i + 2] << 16);
+    }
+    return count;
+}
+
+bool DesfireReader::selectApplication(uint32_t aid)
+{
+    uint8_t data[3] = { (uint8_t)aid, (uint8_t)(aid >> 8), (uint8_t)(aid >> 16) };
+    return command(DESFIRE_CMD_SELECT_APPLICATION, data, sizeof(data), 0, 0) == 0;
+}
+
+int16_t DesfireReader::getFileIds(uint8_t *fileIds, uint8_t maxFiles)
+{
+    int32_t length = command(DESFIRE_CMD_GET_FILE_IDS, 0, 0, fileIds, maxFiles);
+    return length < 0 ? -1 : length;
+}
+
+bool DesfireReader::getFileSettings(uint8_t fileNo, DesfireFileSettings *settings)
+{
+    // type, communication, access rights (2) and, for data files, size (3)
+    uint8_t response[32];
+    int32_t length = command(DESFIRE_CMD_GET_FILE_SETTINGS, &fileNo, 1, response, sizeof(response));
+    if (length < 4) {
+        return false;
+    }
+
+    settings->type = response[0];
+    settings->communication = response[1] & 0x03;
+    settings->accessRights = response[2] | (response[3] << 8);
+    settings->size = 0;
+    if (length >= 7 && (settings->type == DESFIRE_FILE_STANDARD_DATA || settings->type == DESFIRE_FILE_BACKUP_DATA)) {
+        settings->size = response[4] | ((uint32_t)response[5] << 8) | ((uint32_t)response[6] << 16);
+    }
+    return true;
+}
+
+int32_t DesfireReader::readData(uint8_t fileNo, uint32_t offset, uint8_t *buf, uint32_t len, uint32_t length)
+{
+    // a ReadData of length 0 would be the whole file
+    if (len == 0) {
+        return 0;
+    }
+
+    DesfireFileSettings settings;
+    if (!getFileSettings(fileNo, &settings)) {
+        return -1;
+    }
+
+    uint8_t readAccess = settings.accessRights >> 12;
+    uint8_t readWriteAccess = (settings.accessRights >> 4) & 0x0F;
+    if ((settings.type != DESFIRE_FILE_STANDARD_DATA && settings.type != DESFIRE_FILE_BACKUP_DATA) ||
+        settings.communication != DESFIRE_COMM_PLAIN ||
+        (readAccess != DESFIRE_ACCESS_FREE && readWriteAccess != DESFIRE_ACCESS_FREE)) {
+        DMSG("DESFire file needs authentication or is no data file\n");
+        _status = DESFIRE_PERMISSION_DENIED;
+        return -1;
+    }
+    if (offset >= settings.size) {
+        _status = DESFIRE_BOUNDARY_ERROR;
+        return -1;
+    }
+
+    // one ReadData for all of it, the card sends as many frames as it needs
+    if (length == 0 || length > settings.size - offset) {
+        length = settings.size - offset;
+    }
+    if (length > len) {
+        length = len;
+    }
+
+    uint8_t data[7] = {
+        fileNo,
+        (uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)(offset >> 16),
+        (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16)
+    };
+    uint16_t exchanges = _exchanges;
+    int32_t received = command(DESFIRE_CMD_READ_DATA, data, sizeof(data), buf, length);
+    _exchanges += exchanges;
+    return received;
+}
+
+/**
+ * Sends a wrapped native command and requests additional frames until the
+ * card reports OK. Answers go into response as they arrive, anything past
+ * responseLength is dropped.
+ * @return  >=0     bytes stored in response, never more than responseLength
+ *          <0      failed, see _status
+ */
+int32_t DesfireReader::command(uint8_t code, const uint8_t *data, uint8_t dataLength, uint8_t *response, uint32_t responseLength)
+{
+    uint8_t apdu[5 + 16 + 1];
+    uint8_t apduLength = 0;
+    uint8_t frame[0xFF];    // PN532 status, data, SW1 SW2
+    uint32_t received = 0;
+
+    if (dataLength > 16) {
+        return -1;
+    }
+
+    apdu[apduLength++] = 0x90;
+    apdu[apduLength++] = code;
+    apdu[apduLength++] = 0x00;
+    apdu[apduLength++] = 0x00;
+    if (dataLength) {
+        apdu[apduLength++] = dataLength;
+        memcpy(apdu + apduLength, data, dataLength);
+        apduLength += dataLength;
+    }
+    apdu[apduLength++] = 0x00;  // Le, as much as the card sends in one frame
+
+    _exchanges = 0;
+    while (1) {
+        uint8_t frameLength = sizeof(frame);
+        _exchanges++;
+        if (!_nfc->inDataExchange(apdu, apduLength, frame, &frameLength) ||
+            frameLength < 2 || frame[frameLength - 2] != DESFIRE_SW1) {
+            _status = DESFIRE_NO_ANSWER;
+            return -1;
+        }
+
+        _status = frame[frameLength - 1];
+        if (_status != DESFIRE_OPERATION_OK && _status != DESFIRE_ADDITIONAL_FRAME) {
+            DMSG("DESFire status"); DMSG_HEX(_status); DMSG("\n");
+            return -1;
+        }
+
+        uint8_t length = frameLength - 2;
+        if (received < responseLength) {
+            uint32_t room = responseLength - received;
+            memcpy(response + received, frame, length < room ? length : room);
+        }
+        received += length;
+
+        if (_status == DESFIRE_OPERATION_OK) {
+            return received < responseLength ? received : responseLength;
+        }
+
+        apdu[1] = DESFIRE_CMD_ADDITIONAL_FRAME;
+        apdu[4] = 0x00;
+        apduLength = 5;
+    }
+}
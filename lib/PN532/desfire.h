@@ -0,0 +1,100 @@
+#ifndef __DESFIRE_H__
+#define __DESFIRE_H__
+
+#include "PN532.h"
+
+// DESFire native commands, sent ISO 7816-4 wrapped (CLA 0x90)
+#define DESFIRE_CMD_GET_VERSION             (0x60)
+#define DESFIRE_CMD_GET_APPLICATION_IDS     (0x6A)
+#define DESFIRE_CMD_SELECT_APPLICATION      (0x5A)
+#define DESFIRE_CMD_GET_FILE_IDS            (0x6F)
+#define DESFIRE_CMD_GET_FILE_SETTINGS       (0xF5)
+#define DESFIRE_CMD_READ_DATA               (0xBD)
+#define DESFIRE_CMD_ADDITIONAL_FRAME        (0xAF)
+
+// status codes, SW2 after SW1 0x91
+#define DESFIRE_OPERATION_OK                (0x00)
+#define DESFIRE_ADDITIONAL_FRAME            (0xAF)
+#define DESFIRE_PERMISSION_DENIED           (0x9D)
+#define DESFIRE_APPLICATION_NOT_FOUND       (0xA0)
+#define DESFIRE_BOUNDARY_ERROR              (0xBE)
+#define DESFIRE_FILE_NOT_FOUND              (0xF0)
+
+#define DESFIRE_FILE_STANDARD_DATA          (0x00)
+#define DESFIRE_FILE_BACKUP_DATA            (0x01)
+#define DESFIRE_COMM_PLAIN                  (0x00)
+#define DESFIRE_ACCESS_FREE                 (0x0E)
+
+#define DESFIRE_MAX_APPLICATIONS            (28)
+#define DESFIRE_MAX_FILES                   (32)
+
+struct DesfireVersion {
+    uint8_t hardware[7];    // vendor, type, subtype, major, minor, storage size, protocol
+    uint8_t software[7];
+    uint8_t uid[7];
+    uint8_t batch[5];
+    uint8_t week;
+    uint8_t year;
+};
+
+struct DesfireFileSettings {
+    uint8_t type;           // DESFIRE_FILE_STANDARD_DATA, DESFIRE_FILE_BACKUP_DATA, ...
+    uint8_t communication;  // 0 plain, 1 MACed, 3 enciphered
+    uint16_t accessRights;  // read, write, read & write, change; 0x0E is free
+    uint32_t size;          // data files only
+};
+
+/**
+ * MIFARE DESFire reader on an inlisted ISO14443-4 target. Additional frames
+ * (0xAF) are requested until the card is done and their data goes straight
+ * into the caller's buffer. Every command asks for the longest answer the
+ * card will give (Le 0x00, ReadData for everything that is left), so the
+ * number of round trips is what the card's frame size forces. Only
+ * plain communication and free access are supported, there is no
+ * authentication.
+ */
+class DesfireReader {
+public:
+    DesfireReader(PN532Base &nfc) : _nfc(&nfc), _status(0), _exchanges(0) { }
+
+    bool getVersion(DesfireVersion *version);
+
+    /**
+    * @brief    AIDs of the applications on the card, the PICC level is selected first
+    * @return   >=0     number of AIDs, at most maxAids are stored
+    *           <0      failed
+    */
+    int16_t getApplicationIds(uint32_t *aids, uint8_t maxAids);
+    bool selectApplication(uint32_t aid);
+
+    /**
+    * @brief    file numbers of the selected application
+    * @return   >=0     number of files stored, at most maxFiles
+    *           <0      failed
+    */
+    int16_t getFileIds(uint8_t *fileIds, uint8_t maxFiles);
+    bool getFileSettings(uint8_t fileNo, DesfireFileSettings *settings);
+
+    /**
+    * @brief    read a standard or backup data file with plain communication and free read access
+    * @param    offset  first byte to read
+    * @param    length  bytes to read, the rest of the file when 0
+    * @return   >=0     bytes read into buf, never more than len
+    *           <0      failed, see getStatus()
+    */
+    int32_t readData(uint8_t fileNo, uint32_t offset, uint8_t *buf, uint32_t len, uint32_t length = 0);
+
+    // DESFire status of the last command, 0xFF when the card did not answer
+    uint8_t getStatus() { return _status; }
+    // frames the last command exchanged, additional frames included
+    uint16_t getExchanges() { return _exchanges; }
+
+private:
+    PN532Base *_nfc;
+    uint8_t _status;
+    uint16_t _exchanges;
+
+    int32_t command(uint8_t code, const uint8_t *data, uint8_t dataLength, uint8_t *response, uint32_t responseLength);
+};
+
+#endif // __DESFIRE_H__
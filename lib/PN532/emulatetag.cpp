@@ -11,6 +11,16 @@
 
 #include <string.h>
 
+// updateBinary() runs in emulate(), NdefWriteBack may copy the file from
+// another task
+#if defined(ESP32)
+#define FILE_LOCK(tag)    portENTER_CRITICAL(&(tag)->fileMux)
+#define FILE_UNLOCK(tag)  portEXIT_CRITICAL(&(tag)->fileMux)
+#else
+#define FILE_LOCK(tag)
+#define FILE_UNLOCK(tag)
+#endif
+
 #define MAX_TGREAD
 
 
@@ -22,25 +32,11 @@
 #define C_APDU_LC    4 // length command
 #define C_APDU_DATA  5 // data
 
+static_assert(EMULATETAG_MAX_APDU >= 0xFF, "one frame must fit the APDU buffer");
+
 #define C_APDU_P1_SELECT_BY_ID   0x00
 #define C_APDU_P1_SELECT_BY_NAME 0x04
 
-// Response APDU
-#define R_APDU_SW1_COMMAND_COMPLETE 0x90 
-#define R_APDU_SW2_COMMAND_COMPLETE 0x00 
-
-#define R_APDU_SW1_NDEF_TAG_NOT_FOUND 0x6a
-#define R_APDU_SW2_NDEF_TAG_NOT_FOUND 0x82
-
-#define R_APDU_SW1_FUNCTION_NOT_SUPPORTED 0x6A
-#define R_APDU_SW2_FUNCTION_NOT_SUPPORTED 0x81
-
-#define R_APDU_SW1_MEMORY_FAILURE 0x65
-#define R_APDU_SW2_MEMORY_FAILURE 0x81
-
-#define R_APDU_SW1_END_OF_FILE_BEFORE_REACHED_LE_BYTES 0x62
-#define R_APDU_SW2_END_OF_FILE_BEFORE_REACHED_LE_BYTES 0x82
-
 // ISO7816-4 commands
 #define ISO7816_SELECT_FILE 0xA4
 #define ISO7816_READ_BINARY 0xB0
@@ -48,27 +44,204 @@
 
 typedef enum { NONE, CC, NDEF } tag_file;   // CC ... Compatibility Container
 
-bool EmulateTag::init(){
+static const uint8_t ndef_tag_application_name_v2[] = { 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
+static const uint8_t command_complete[] = { 0x90, 0x00 };
+
+bool EmulateTagBase::init(){
   pn532.begin();
   return pn532.SAMConfig();
 }
 
-void EmulateTag::setNdefFile(const uint8_t* ndef, const int16_t ndefLength){
-  if(ndefLength >  (NDEF_MAX_LENGTH -2)){
+void EmulateTagBase::setNdefFile(const uint8_t* ndef, const int16_t ndefLength){
+  if(ndefLength >  (ndefMaxLength -2)){
 	DMSG("ndef file too large (> NDEF_MAX_LENGHT -2) - aborting");
 	return;
   }
 
+  FILE_LOCK(this);
   ndef_file[0] = ndefLength >> 8;
   ndef_file[1] = ndefLength & 0xFF;
   memcpy(ndef_file+2, ndef, ndefLength);
+  dirtyStart = dirtyEnd = 0;
+  FILE_UNLOCK(this);
+  markStale(0, 2 + ndefLength);
+  prepareTemplates();
+}
+
+// NLEN and the message in MLe slices, each followed by its SW, so that a
+// reader going through the file in MLe steps gets them without a copy
+void EmulateTagBase::prepareTemplates(){
+  uint16_t nlen = (ndef_file[0] << 8) + ndef_file[1];
+  uint8_t maxLe = EMULATETAG_MLE(ndefMaxLength);
+  templatesValid = false;
+  if(nlen > ndefMaxLength - 2){
+    return;
+  }
+
+  uint8_t* out = responseTemplates;
+  memcpy(out, ndef_file, 2);
+  memcpy(out + 2, command_complete, 2);
+  out += 4;
+  for(uint16_t offset = 2; offset < 2 + nlen; offset += maxLe){
+    uint16_t le = 2 + nlen - offset < maxLe ? 2 + nlen - offset : maxLe;
+    memcpy(out, ndef_file + offset, le);
+    memcpy(out + le, command_complete, 2);
+    out += le + 2;
+  }
+  templatesValid = true;
+}
+
+// the bytes [start, end) of the file, start >= 2, into the slices they are in
+void EmulateTagBase::patchTemplates(uint16_t start, uint16_t end){
+  uint16_t nlen = (ndef_file[0] << 8) + ndef_file[1];
+  uint8_t maxLe = EMULATETAG_MLE(ndefMaxLength);
+  if(end > 2 + nlen){
+    end = 2 + nlen;
+  }
+  while(start < end){
+    uint16_t slice = (start - 2) / maxLe;
+    uint32_t sliceEnd = 2 + (uint32_t)(slice + 1) * maxLe;
+    uint16_t stop = end < sliceEnd ? end : sliceEnd;
+    memcpy(responseTemplates + 4 + (start - 2) + 2 * slice, ndef_file + start, stop - start);
+    start = stop;
+  }
+}
+
+// the back file gets what changed in ndef_file, the generator writes it and
+// the bytes it changed go to ndef_file, which is never moved
+void EmulateTagBase::generateNdefFile(){
+  if(ndefGenerator == 0 || ndefBackFile == 0 || ndefSource != 0){
+    return;
+  }
+  if(staleStart < staleEnd){
+    memcpy(ndefBackFile + staleStart, ndef_file + staleStart, staleEnd - staleStart);
+  }
+
+  staleStart = staleEnd = 0;
+
+  NdefFileUpdate update(ndefBackFile, ndefMaxLength);
+  ndefGenerator(generatorContext, update);
+  uint16_t start = update.changedStart;
+  uint16_t end = update.changedEnd;
+  if(start == end){
+    return;
+  }
+
+  memcpy(ndef_file + start, ndefBackFile + start, end - start);
+  if(start < 2){
+    // NLEN changed, the slices are others
+    prepareTemplates();
+  } else if(templatesValid){
+    patchTemplates(start, end);
+  }
+}
+
+void EmulateTagBase::markStale(uint16_t start, uint16_t end){
+  if(staleStart == staleEnd){
+    staleStart = start;
+    staleEnd = end;
+    return;
+  }
+  if(start < staleStart){
+    staleStart = start;
+  }
+  if(end > staleEnd){
+    staleEnd = end;
+  }
+}
+
+bool NdefFileUpdate::patch(uint16_t offset, const uint8_t* data, uint16_t length){
+  if((uint32_t)offset + length > getLength()){
+    return false;
+  }
+  memcpy(file + 2 + offset, data, length);
+  changed(2 + offset, 2 + offset + length);
+  return true;
+}
+
+bool NdefFileUpdate::setMessage(const uint8_t* message, uint16_t length){
+  if(length > capacity - 2){
+    return false;
+  }
+  file[0] = length >> 8;
+  file[1] = length & 0xFF;
+  memcpy(file + 2, message, length);
+  changed(0, 2 + length);
+  return true;
+}
+
+void NdefFileUpdate::changed(uint16_t start, uint16_t end){
+  if(changedStart == changedEnd){
+    changedStart = start;
+    changedEnd = end;
+    return;
+  }
+  if(start < changedStart){
+    changedStart = start;
+  }
+  if(end > changedEnd){
+    changedEnd = end;
+  }
+}
+
+// the prepared R-APDU for READ BINARY at offset, 0 if there is none; an
+// extended read may take several slices, it has to start and end on them
+const uint8_t* EmulateTagBase::findTemplate(uint16_t offset, uint16_t le){
+  uint16_t nlen = (ndef_file[0] << 8) + ndef_file[1];
+  uint8_t maxLe = EMULATETAG_MLE(ndefMaxLength);
+  if(!templatesValid || ndefSource != 0){
+    return 0;
+  }
+  if(offset == 0){
+    return le == 2 ? responseTemplates : 0;
+  }
+  uint32_t end = (uint32_t)offset + le;
+  if(offset < 2 || end > (uint32_t)(2 + nlen) || (offset - 2) % maxLe != 0){
+    return 0;
+  }
+  if(end != (uint32_t)(2 + nlen) && (end - 2) % maxLe != 0){
+    return 0;
+  }
+  uint16_t slice = (offset - 2) / maxLe;
+  return responseTemplates + 4 + (offset - 2) + 2 * slice;
+}
+
+bool EmulateTagBase::getDirtyRange(uint16_t* start, uint16_t* end, uint32_t* writes){
+  FILE_LOCK(this);
+  *writes = writeCount;
+  *start = dirtyStart;
+  *end = dirtyEnd;
+  FILE_UNLOCK(this);
+  return *start < *end;
+}
+
+bool EmulateTagBase::copyDirtyFile(uint8_t* file, uint16_t* start, uint16_t* end, uint32_t* writes){
+  FILE_LOCK(this);
+  *writes = writeCount;
+  *start = dirtyStart;
+  *end = dirtyEnd;
+  if(*start < *end){
+    uint32_t length = 2 + ((ndef_file[0] << 8) + ndef_file[1]);
+    memcpy(file, ndef_file, length < ndefMaxLength ? length : ndefMaxLength);
+  }
+  FILE_UNLOCK(this);
+  return *start < *end;
+}
+
+void EmulateTagBase::markClean(uint32_t writes){
+  // an UPDATE BINARY since getDirtyRange() keeps the range dirty
+  FILE_LOCK(this);
+  if(writes == writeCount){
+    dirtyStart = dirtyEnd = 0;
+  }
+  FILE_UNLOCK(this);
 }
 
-void EmulateTag::setUid(uint8_t* uid){
+void EmulateTagBase::setUid(uint8_t* uid){
   uidPtr = uid;
 }
 
-bool EmulateTag::emulate(const uint16_t tgInitAsTargetTimeout){
+bool EmulateTagBase::emulate(const uint16_t tgInitAsTargetTimeout){
 
   uint8_t command[] = {
         PN532_COMMAND_TGINITASTARGET,
@@ -92,170 +265,330 @@ bool EmulateTag::emulate(const uint16_t tgInitAsTargetTimeout){
     memcpy(command + 4, uidPtr, 3);
   }
 
-  // Make PN532 more tolerant: force RF on and set passive activation retries before initiating target.
-  pn532.setPassiveActivationRetries(0xFF);
-  // Turn RF on, check external field before activation (autoRFCA=0x02, RF on=0x01)
-  pn532.setRFField(0x02, 0x01);
-  delay(100);
+  if(!sessionReady){
+    // Make PN532 more tolerant: force RF on and set passive activation retries before initiating target.
+    pn532.setPassiveActivationRetries(0xFF);
+    // Turn RF on, check external field before activation (autoRFCA=0x02, RF on=0x01)
+    pn532.setRFField(0x02, 0x01);
+    delay(100);
+    sessionReady = sessionActive;
+  }
 
-  if(1 != pn532.tgInitAsTarget(command,sizeof(command), tgInitAsTargetTimeout)){
+  if(released){
+    rearmMicros = micros() - releasedAt;
+  }
+  int8_t activation = pn532.tgInitAsTarget(command,sizeof(command), tgInitAsTargetTimeout);
+  if(1 != activation){
     DMSG("tgInitAsTarget failed or timed out!");
-    return false;
+    if(activation < 0){
+      sessionReady = false;
+    }
+    return release(false);
   }
 
-  uint8_t compatibility_container[] = {
+  // a source serves its message as it is, NLEN included, in slices that fit
+  // txbuf; the RAM file goes out in one read, chained from the templates or
+  // the file itself
+  fileSize = ndefSource != 0 ? ndefSource->size() + 2 : ndefMaxLength;
+  uint16_t maxLe = ndefSource != 0 ? EMULATETAG_MLE(fileSize) : fileSize;
+
+  const uint8_t compatibility_container[] = {
     0, 0x0F,
     0x20,
-    0, 0x54,
-    0, 0xFF,
+    (uint8_t)(maxLe >> 8), (uint8_t)(maxLe & 0xFF), // MLe
+    (uint8_t)(EMULATETAG_MAX_LC >> 8), (uint8_t)(EMULATETAG_MAX_LC & 0xFF), // MLc
     0x04,       // T
     0x06,       // L
     0xE1, 0x04, // File identifier
-    ((NDEF_MAX_LENGTH & 0xFF00) >> 8), (NDEF_MAX_LENGTH & 0xFF), // maximum NDEF file size
+    (uint8_t)((fileSize & 0xFF00) >> 8), (uint8_t)(fileSize & 0xFF), // maximum NDEF file size
     0x00,       // read access 0x0 = granted
     0x00        // write access 0x0 = granted | 0xFF = deny
   };
+  memcpy(ccResponse, compatibility_container, sizeof(compatibility_container));
+  memcpy(ccResponse + sizeof(compatibility_container), command_complete, 2);
 
-  if(tagWriteable == false){
-    compatibility_container[14] = 0xFF;
+  writeable = tagWriteable && ndefSource == 0;
+  if(writeable == false){
+    ccResponse[14] = 0xFF;
+  }
+  if(!templatesValid && ndefSource == 0){
+    prepareTemplates();
   }
 
   tagWrittenByInitiator = false;
-
-  uint8_t rwbuf[128];
-  uint8_t sendlen;
+  inField = true;
+  currentFile = NONE;
+  chainedIns = 0;
+  generated = false;
+  router.reset();
+
+  uint8_t rwbuf[EMULATETAG_MAX_APDU];
+  uint8_t txbuf[0xFF];
   int16_t status;
-  tag_file currentFile = NONE;
-  uint16_t cc_size = sizeof(compatibility_container);
-  bool runLoop = true;
 
-  while(runLoop){
-    status = pn532.tgGetData(rwbuf, sizeof(rwbuf));
+  while(true){
+    uint32_t start = micros();
+    status = pn532.tgGetData(rwbuf, 0xFF);
+    uint16_t apduLength = status;
+
+    // a C-APDU longer than a frame comes in blocks, the PN532 sets MI on
+    // all but the last; one that does not fit rwbuf is answered 67 00
+    bool overflow = false;
+    while(status >= 0 && (pn532.getTargetStatus() & PN532_STATUS_MI)){
+      status = pn532.tgGetData(txbuf, sizeof(txbuf));
+      if(status < 0){
+        break;
+      }
+      if(overflow || (size_t)(apduLength + status) > sizeof(rwbuf)){
+        overflow = true;
+      } else {
+        memcpy(rwbuf + apduLength, txbuf, status);
+        apduLength += status;
+      }
+    }
     if(status < 0){
       DMSG("tgGetData failed!\n");
       pn532.inRelease();
-      return true;
+      return release(true);
     }
+    uint32_t received = micros(); // start to here includes the reader's think time
 
-    uint8_t p1 = rwbuf[C_APDU_P1];
-    uint8_t p2 = rwbuf[C_APDU_P2];
-    uint8_t lc = rwbuf[C_APDU_LC];
-    uint16_t p1p2_length = ((int16_t) p1 << 8) + p2;
-
-    switch(rwbuf[C_APDU_INS]){
-    case ISO7816_SELECT_FILE:
-      switch(p1){
-      case C_APDU_P1_SELECT_BY_ID:
-	if(p2 != 0x0c){
-	  DMSG("C_APDU_P2 != 0x0c\n");
-	  setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
-	} else if(lc == 2 && rwbuf[C_APDU_DATA] == 0xE1 && (rwbuf[C_APDU_DATA+1] == 0x03 || rwbuf[C_APDU_DATA+1] == 0x04)){
-	  setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
-	  if(rwbuf[C_APDU_DATA+1] == 0x03){
-	    currentFile = CC;
-	  } else if(rwbuf[C_APDU_DATA+1] == 0x04){
-	    currentFile = NDEF;
-	  }
-	} else {
-	  setResponse(TAG_NOT_FOUND, rwbuf, &sendlen);
-	}
-	break;
-      case C_APDU_P1_SELECT_BY_NAME: 
-        const uint8_t ndef_tag_application_name_v2[] = {0, 0x7, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
-	if(0 == memcmp(ndef_tag_application_name_v2, rwbuf + C_APDU_P2, sizeof(ndef_tag_application_name_v2))){
-	  setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
-	} else{
-	  DMSG("function not supported\n");
-	  setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
-	} 
-	break;
-      }
-      break;
-    case ISO7816_READ_BINARY:
-      switch(currentFile){
-      case NONE:
-	setResponse(TAG_NOT_FOUND, rwbuf, &sendlen);
-	break;
-      case CC:
-	if( p1p2_length > NDEF_MAX_LENGTH){
-	  setResponse(END_OF_FILE_BEFORE_REACHED_LE_BYTES, rwbuf, &sendlen);
-	}else {
-	  memcpy(rwbuf,compatibility_container + p1p2_length, lc);
-	  setResponse(COMMAND_COMPLETE, rwbuf + lc, &sendlen, lc);
-	}
-	break;
-      case NDEF:
-	if( p1p2_length > NDEF_MAX_LENGTH){
-	  setResponse(END_OF_FILE_BEFORE_REACHED_LE_BYTES, rwbuf, &sendlen);
-	}else {
-	  memcpy(rwbuf, ndef_file + p1p2_length, lc);
-	  setResponse(COMMAND_COMPLETE, rwbuf + lc, &sendlen, lc);
-	}
-	break;
-      }
-      break;    
-    case ISO7816_UPDATE_BINARY:
-      if(!tagWriteable){
-	  setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
-      } else{      
-	if( p1p2_length > NDEF_MAX_LENGTH){
-	  setResponse(MEMORY_FAILURE, rwbuf, &sendlen);
-	}
-	else{
-	  memcpy(ndef_file + p1p2_length, rwbuf + C_APDU_DATA, lc);
-	  setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
-	  tagWrittenByInitiator = true;
-      
-      uint16_t ndef_length = (ndef_file[0] << 8) + ndef_file[1];
-      if ((ndef_length > 0) && (updateNdefCallback != 0)) {
-        updateNdefCallback(ndef_file + 2, ndef_length);
-      }
-	}
-      }
-      break;
-    default:
-      DMSG("Command not supported!");
-      DMSG_HEX(rwbuf[C_APDU_INS]);
-      DMSG("\n");
-      setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
+    // any other command ends an unfinished chain
+    if(chainedIns != 0 && (apduLength <= C_APDU_INS || rwbuf[C_APDU_INS] != chainedIns)){
+      chainedIns = 0;
     }
-    status = pn532.tgSetData(rwbuf, sendlen);
-    if(status < 0){
+
+    void* context;
+    uint16_t sw = APDU_SW_WRONG_LENGTH;
+    ApduHandler handler = overflow ? 0 : router.route(rwbuf, apduLength, &context, &sw);
+    uint32_t routed = micros();
+
+    // one frame, the status word behind the data
+    ApduResponse response = { txbuf, EMULATETAG_MAX_LE, 0, 0, 0, 0, 0 };
+    if(handler != 0){
+      sw = handler(context, rwbuf, apduLength, &response);
+    }
+    const uint8_t* send = response.prepared;
+    uint16_t sendlen = response.length;
+    uint16_t frame = response.frame;
+    if(send == 0){
+      txbuf[response.length] = sw >> 8;
+      txbuf[response.length + 1] = sw & 0xFF;
+      send = txbuf;
+      sendlen += 2;
+      frame = 0;
+    }
+    uint32_t built = micros();
+
+    // an R-APDU longer than a frame goes out in slices, the last one with its SW
+    bool sent = true;
+    for(uint16_t lead = 0; sent && lead < response.leadingLength; lead += response.room){
+      sent = pn532.tgSetMetaData(response.leading + lead, response.room);
+    }
+    while(sent && frame != 0 && sendlen - 2 > frame){
+      sent = pn532.tgSetMetaData(send, frame);
+      send += frame + 2;
+      sendlen -= frame;
+    }
+    if(!sent || !pn532.tgSetData(send, sendlen)){
       DMSG("tgSetData failed\n!");
+      sessionReady = false;
       pn532.inRelease();
-      return true;
+      return release(true);
+    }
+
+    if(timings != 0){
+      uint32_t done = micros();
+      uint32_t stages[APDU_STAGE_TURNAROUND] = { received - start, routed - received, built - routed, done - built };
+      timings->record(apduLength > C_APDU_INS ? rwbuf[C_APDU_INS] : 0, stages);
     }
   }
-  pn532.inRelease();
-  return true;
 }
 
-void EmulateTag::setResponse(responseCommand cmd, uint8_t* buf, uint8_t* sendlen, uint8_t sendlenOffset){
-  switch(cmd){
-  case COMMAND_COMPLETE:
-    buf[0] = R_APDU_SW1_COMMAND_COMPLETE;
-    buf[1] = R_APDU_SW2_COMMAND_COMPLETE;
-    *sendlen = 2 + sendlenOffset;
-    break;
-  case TAG_NOT_FOUND:
-    buf[0] = R_APDU_SW1_NDEF_TAG_NOT_FOUND;
-    buf[1] = R_APDU_SW2_NDEF_TAG_NOT_FOUND;
-    *sendlen = 2;    
-    break;
-  case FUNCTION_NOT_SUPPORTED:
-    buf[0] = R_APDU_SW1_FUNCTION_NOT_SUPPORTED;
-    buf[1] = R_APDU_SW2_FUNCTION_NOT_SUPPORTED;
-    *sendlen = 2; 
-    break;
-  case MEMORY_FAILURE:
-    buf[0] = R_APDU_SW1_MEMORY_FAILURE;
-    buf[1] = R_APDU_SW2_MEMORY_FAILURE;
-    *sendlen = 2;
-    break;
-  case END_OF_FILE_BEFORE_REACHED_LE_BYTES:
-    buf[0] = R_APDU_SW1_END_OF_FILE_BEFORE_REACHED_LE_BYTES;
-    buf[1] = R_APDU_SW2_END_OF_FILE_BEFORE_REACHED_LE_BYTES;
-    *sendlen= 2;
-    break;
+// the NFC Forum Type 4 Tag application, registered first so that it also
+// answers before any SELECT by name
+void EmulateTagBase::addNdefApplication(){
+  router.addApplication(ndef_tag_application_name_v2, sizeof(ndef_tag_application_name_v2));
+  router.addHandler(ndef_tag_application_name_v2, sizeof(ndef_tag_application_name_v2), ISO7816_SELECT_FILE, selectFile, this);
+  router.addHandler(ndef_tag_application_name_v2, sizeof(ndef_tag_application_name_v2), ISO7816_READ_BINARY, readBinary, this);
+  router.addHandler(ndef_tag_application_name_v2, sizeof(ndef_tag_application_name_v2), ISO7816_UPDATE_BINARY, updateBinary, this);
+}
+
+uint16_t EmulateTagBase::selectFile(void* context, const uint8_t* apdu, uint16_t apduLength, ApduResponse* response){
+  EmulateTagBase* tag = (EmulateTagBase*)context;
+  uint8_t p2 = apdu[C_APDU_P2];
+  ApduBody body;
+  if(!parseApdu(apdu, apduLength, &body)){
+    return APDU_SW_WRONG_LENGTH;
+  }
+  if(apdu[C_APDU_CLA] & APDU_CLA_CHAINING){
+    return APDU_SW_CHAINING_NOT_SUPPORTED;
+  }
+
+  switch(apdu[C_APDU_P1]){
+  case C_APDU_P1_SELECT_BY_NAME:
+    // the router matched the AID
+    response->prepared = command_complete;
+    response->length = sizeof(command_complete);
+    return APDU_SW_OK;
+  case C_APDU_P1_SELECT_BY_ID:
+    if(p2 != 0x0c){
+      DMSG("C_APDU_P2 != 0x0c\n");
+      return APDU_SW_OK;
+    }
+    if(body.lc == 2 && body.data[0] == 0xE1){
+      if(body.data[1] == 0x03 || body.data[1] == 0x04){
+        tag->currentFile = body.data[1] == 0x03 ? CC : NDEF;
+        if(tag->currentFile == NDEF && !tag->generated){
+          tag->generated = true;
+          tag->generateNdefFile();
+        }
+        response->prepared = command_complete;
+        response->length = sizeof(command_complete);
+        return APDU_SW_OK;
+      }
+    }
+    return APDU_SW_FILE_NOT_FOUND;
+  }
+  return APDU_SW_FUNCTION_NOT_SUPPORTED;
+}
+
+uint16_t EmulateTagBase::readBinary(void* context, const uint8_t* apdu, uint16_t apduLength, ApduResponse* response){
+  EmulateTagBase* tag = (EmulateTagBase*)context;
+  const uint16_t ccFileSize = sizeof(tag->ccResponse) - 2;
+  uint16_t offset = ((uint16_t)apdu[C_APDU_P1] << 8) + apdu[C_APDU_P2];
+  ApduBody body;
+  if(!parseApdu(apdu, apduLength, &body)){
+    return APDU_SW_WRONG_LENGTH;
+  }
+  if(apdu[C_APDU_CLA] & APDU_CLA_CHAINING){
+    return APDU_SW_CHAINING_NOT_SUPPORTED;
+  }
+  uint32_t le = body.le;
+
+  switch(tag->currentFile){
+  case CC:
+    if(offset > ccFileSize){
+      return APDU_SW_END_OF_FILE;
+    }
+    if(le > (uint32_t)(ccFileSize - offset)){
+      le = ccFileSize - offset;
+    }
+    if(offset == 0 && le == ccFileSize){
+      response->prepared = tag->ccResponse;
+      response->length = sizeof(tag->ccResponse);
+      return APDU_SW_OK;
+    }
+    memcpy(response->data, tag->ccResponse + offset, le);
+    response->length = le;
+    return APDU_SW_OK;
+  case NDEF:
+    if(offset > tag->fileSize){
+      return APDU_SW_END_OF_FILE;
+    }
+    if(le > (uint32_t)(tag->fileSize - offset)){
+      le = tag->fileSize - offset;
+    }
+    response->prepared = tag->findTemplate(offset, le);
+    if(response->prepared != 0){
+      response->length = le + 2;
+      response->frame = EMULATETAG_MLE(tag->ndefMaxLength);
+      return APDU_SW_OK;
+    }
+    if(le > response->room && tag->ndefSource == 0){
+      // frames straight from the file, only the last one is copied
+      response->leadingLength = (le - 1) / response->room * response->room;
+      response->leading = tag->ndef_file + offset;
+      offset += response->leadingLength;
+      le -= response->leadingLength;
+    }
+    if(le > response->room){
+      le = response->room;
+    }
+    if(!tag->readNdefFile(offset, response->data, le)){
+      return APDU_SW_MEMORY_FAILURE;
+    }
+    response->length = le;
+    return APDU_SW_OK;
+  }
+  return APDU_SW_FILE_NOT_FOUND;
+}
+
+uint16_t EmulateTagBase::updateBinary(void* context, const uint8_t* apdu, uint16_t apduLength, ApduResponse* response){
+  (void)response; // the answer is the status word only
+  EmulateTagBase* tag = (EmulateTagBase*)context;
+  // a command of a chain goes on where the one before it ended
+  bool chained = tag->chainedIns == ISO7816_UPDATE_BINARY;
+  uint16_t offset = chained ? tag->chainOffset : ((uint16_t)apdu[C_APDU_P1] << 8) + apdu[C_APDU_P2];
+  tag->chainedIns = 0;
+  ApduBody body;
+
+  if(!tag->writeable){
+    return APDU_SW_FUNCTION_NOT_SUPPORTED;
+  }
+  if(!parseApdu(apdu, apduLength, &body)){
+    return APDU_SW_WRONG_LENGTH;
+  }
+  uint16_t lc = body.lc;
+  if((uint32_t)offset + lc > tag->ndefMaxLength){
+    return APDU_SW_MEMORY_FAILURE;
+  }
+
+  // RAM only, NdefWriteBack takes the dirty range to flash later
+  FILE_LOCK(tag);
+  memcpy(tag->ndef_file + offset, body.data, lc);
+  if(tag->dirtyStart == tag->dirtyEnd){
+    tag->dirtyStart = offset;
+    tag->dirtyEnd = offset + lc;
+  } else {
+    if(offset < tag->dirtyStart){
+      tag->dirtyStart = offset;
+    }
+    if(offset + lc > tag->dirtyEnd){
+      tag->dirtyEnd = offset + lc;
+    }
+  }
+  tag->writeCount++;
+  FILE_UNLOCK(tag);
+  tag->lastWriteMillis = millis();
+  tag->tagWrittenByInitiator = true;
+  tag->templatesValid = false;
+  tag->markStale(offset, offset + lc);
+
+  // the callback sees the file once the chain is complete
+  if(apdu[C_APDU_CLA] & APDU_CLA_CHAINING){
+    tag->chainedIns = ISO7816_UPDATE_BINARY;
+    tag->chainOffset = offset + lc;
+    return APDU_SW_OK;
+  }
+
+  uint16_t ndef_length = (tag->ndef_file[0] << 8) + tag->ndef_file[1];
+  if ((ndef_length > 0) && (tag->updateNdefCallback != 0)) {
+    tag->updateNdefCallback(tag->ndef_file + 2, ndef_length);
+  }
+  return APDU_SW_OK;
+}
+
+// the time re-arming starts from
+bool EmulateTagBase::release(bool success){
+  inField = false;
+  released = true;
+  releasedAt = micros();
+  return success;
+}
+
+// NLEN and the message of the source, or the NDEF file in RAM
+bool EmulateTagBase::readNdefFile(uint16_t offset, uint8_t* buf, uint16_t length){
+  if(ndefSource == 0){
+    memcpy(buf, ndef_file + offset, length);
+    return true;
+  }
+
+  uint16_t nlen = ndefSource->size();
+  while(length > 0 && offset < 2){
+    *buf++ = offset == 0 ? nlen >> 8 : nlen & 0xFF;
+    offset++;
+    length--;
   }
+  return length == 0 || ndefSource->read(offset - 2, buf, length);
 }
@@ -12,19 +12,102 @@
 #define __EMULATETAG_H__
 
 #include "PN532.h"
+#include "ndef_file.h"
+#include "apdu_router.h"
+#include "apdu_timing.h"
 
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#endif
+
+// default NDEF file size of EmulateTag, use BasicEmulateTag<N> for other sizes
+// or setNdefSource() to serve a larger message from flash
+#ifndef NDEF_MAX_LENGTH
 #define NDEF_MAX_LENGTH 128  // altough ndef can handle up to 0xfffe in size, arduino cannot.
-typedef enum {COMMAND_COMPLETE, TAG_NOT_FOUND, FUNCTION_NOT_SUPPORTED, MEMORY_FAILURE, END_OF_FILE_BEFORE_REACHED_LE_BYTES} responseCommand;
+#endif
+
+// one READ BINARY answer and its SW fit a PN532 frame; the MLe of a
+// message from a source, whose slices are read into a frame buffer
+#define EMULATETAG_MAX_LE 0xF6
+#define EMULATETAG_MLE(fileSize) ((fileSize) < EMULATETAG_MAX_LE ? (fileSize) : EMULATETAG_MAX_LE)
+
+// C-APDUs longer than a frame arrive in chained blocks and are put together
+// in a buffer of this size on the stack of emulate(); MLc is what fits in
+// it behind an extended header
+#ifndef EMULATETAG_MAX_APDU
+#if defined(__AVR__)
+#define EMULATETAG_MAX_APDU 0xFF
+#else
+#define EMULATETAG_MAX_APDU 0x400
+#endif
+#endif
+#define EMULATETAG_MAX_LC (EMULATETAG_MAX_APDU - 7)
+
+// the R-APDUs prepared for a file of fileSize bytes: NLEN and the message in
+// MLe slices, each with 90 00 behind it
+#define EMULATETAG_TEMPLATES_SIZE(fileSize) \
+  ((fileSize) + 2 * (1 + ((fileSize) - 2 + EMULATETAG_MLE(fileSize) - 1) / EMULATETAG_MLE(fileSize)))
+
+/*
+ * What an NdefGenerator changes for the next read. It works on the second
+ * buffer of the NDEF file, which holds the message the reader saw last;
+ * patch() changes bytes of it in place, setMessage() replaces it.
+ */
+class NdefFileUpdate{
+
+public:
+  const uint8_t* getMessage(){
+    return file + 2;
+  }
+
+  uint16_t getLength(){
+    return (file[0] << 8) + file[1];
+  }
+
+  // length bytes of the message at offset, which must be inside it
+  bool patch(uint16_t offset, const uint8_t* data, uint16_t length);
+  bool setMessage(const uint8_t* message, uint16_t length);
+
+private:
+  friend class EmulateTagBase;
+  NdefFileUpdate(uint8_t* ndefFile, uint16_t fileCapacity) : file(ndefFile), capacity(fileCapacity), changedStart(0), changedEnd(0) { }
+
+  uint8_t* file;
+  uint16_t capacity;
+  uint16_t changedStart;  // bytes of the file changed, [start, end)
+  uint16_t changedEnd;
 
-class EmulateTag{
+  void changed(uint16_t start, uint16_t end);
+};
+
+typedef void (*NdefGenerator)(void* context, NdefFileUpdate& update);
+
+class EmulateTagBase{
 
 public:
-EmulateTag(PN532Interface &interface) : pn532(interface), uidPtr(0), tagWrittenByInitiator(false), tagWriteable(true), updateNdefCallback(0) { }
-  
   bool init();
 
   bool emulate(const uint16_t tgInitAsTargetTimeout = 0);
 
+  /*
+   * Session mode: the RF setup before tgInitAsTarget (passive activation
+   * retries, RF field, 100 ms settle time) runs on the first emulate() only,
+   * later calls re-arm the target right away. An error redoes the setup.
+   */
+  void beginSession(){
+    sessionActive = true;
+    sessionReady = false;
+  }
+
+  void endSession(){
+    sessionActive = false;
+  }
+
+  // micros from the end of the last emulate() to the TgInitAsTarget of the next one
+  uint32_t getRearmMicros(){
+    return rearmMicros;
+  }
+
   /*
    * @param uid pointer to byte array of length 3 (uid is 4 bytes - first byte is fixed) or zero for uid 
    */
@@ -32,6 +115,15 @@ EmulateTag(PN532Interface &interface) : pn532(interface), uidPtr(0), tagWrittenB
 
   void setNdefFile(const uint8_t* ndef, const int16_t ndefLength);
 
+  /*
+   * Serve the NDEF message from source instead of the NDEF file in RAM, 0
+   * goes back to the RAM file. The CC follows the size of the message and
+   * the tag is read only while a source is set.
+   */
+  void setNdefSource(NdefFileSource* source){
+    ndefSource = source;
+  }
+
   void getContent(uint8_t** buf, uint16_t* length){
     *buf = ndef_file + 2; // first 2 bytes = length
     *length = (ndef_file[0] << 8) + ndef_file[1];
@@ -45,27 +137,171 @@ EmulateTag(PN532Interface &interface) : pn532(interface), uidPtr(0), tagWrittenB
     tagWriteable = setWriteable;
   }
 
+  // after changing the file through it call invalidateTemplates()
   uint8_t* getNdefFilePtr(){
     return ndef_file;
   }
 
-  uint8_t getNdefMaxLength(){
-    return NDEF_MAX_LENGTH;
+  // the file changed behind the tag's back: it is read from the file itself
+  // until the next activation prepares the responses again
+  void invalidateTemplates(){
+    templatesValid = false;
+    staleStart = 0;
+    staleEnd = ndefMaxLength;
+  }
+
+  uint16_t getNdefMaxLength(){
+    return ndefMaxLength;
   }
 
   void attach(void (*func)(uint8_t *buf, uint16_t length)) {
     updateNdefCallback = func;
   };
 
+  /*
+   * Call generator with context when a reader first selects the NDEF file
+   * after the tag is activated, to give every tap its own counter or token.
+   * Selecting it again in the same activation serves the same file. It writes to backFile, a
+   * second NDEF file of getNdefMaxLength() bytes, and the file being read
+   * is not touched until it returns. Then only the bytes it changed are
+   * copied into the NDEF file and the prepared responses; the file stays
+   * where it is, pointers from getNdefFilePtr() and getContent() remain
+   * good. 0 turns it off, it is not called while a source is set.
+   */
+  void setNdefGenerator(NdefGenerator generator, void* context, uint8_t* backFile){
+    ndefGenerator = generator;
+    generatorContext = context;
+    ndefBackFile = backFile;
+    staleStart = 0;
+    staleEnd = ndefMaxLength;
+  }
+
+  /*
+   * Bytes of the NDEF file (NLEN included) UPDATE BINARY changed since
+   * setNdefFile() or the last markClean(), [start, end). writes is the
+   * count to hand to markClean() once the range is stored.
+   * @return false if nothing changed
+   */
+  bool getDirtyRange(uint16_t* start, uint16_t* end, uint32_t* writes);
+  void markClean(uint32_t writes);
+
+  /*
+   * Copy NLEN and the message to file, getNdefMaxLength() bytes, together
+   * with the dirty range they belong to. UPDATE BINARY from another task
+   * waits until both are copied.
+   * @return false if nothing changed, file is not touched then
+   */
+  bool copyDirtyFile(uint8_t* file, uint16_t* start, uint16_t* end, uint32_t* writes);
+
+  // millis() of the last UPDATE BINARY
+  uint32_t getLastWriteMillis(){
+    return lastWriteMillis;
+  }
+
+  // a reader has the tag activated, emulate() is exchanging APDUs
+  bool isInField(){
+    return inField;
+  }
+
+  /*
+   * The applications of the emulated card. The NDEF application
+   * (D2760000850101) is on it from the start, add other AIDs and their
+   * commands here before emulate().
+   */
+  ApduRouter& getRouter(){
+    return router;
+  }
+
+  /*
+   * Time every APDU of emulate() into timings, per INS. 0, the default,
+   * turns timing off.
+   */
+  void setTimings(ApduTimings* apduTimings){
+    timings = apduTimings;
+  }
+
+protected:
+  // nfc, ndef (the NDEF file, 2 byte length + message) and templates
+  // (EMULATETAG_TEMPLATES_SIZE(ndefLength) bytes for the READ BINARY
+  // answers setNdefFile() prepares) are owned by the derived class
+  EmulateTagBase(PN532Base &nfc, uint8_t *ndef, uint16_t ndefLength, uint8_t *templates) : pn532(nfc), ndef_file(ndef), ndefMaxLength(ndefLength), responseTemplates(templates), templatesValid(false), ndefSource(0), uidPtr(0), tagWrittenByInitiator(false), tagWriteable(true), sessionActive(false), sessionReady(false), released(false), releasedAt(0), rearmMicros(0), updateNdefCallback(0), timings(0), chainedIns(0), chainOffset(0), ndefGenerator(0), generatorContext(0), ndefBackFile(0), staleStart(0), staleEnd(0), generated(false), inField(false), dirtyStart(0), dirtyEnd(0), writeCount(0), lastWriteMillis(0) {
+    addNdefApplication();
+  }
+
 private:
-  PN532 pn532;
-  uint8_t ndef_file[NDEF_MAX_LENGTH];
+  EmulateTagBase(const EmulateTagBase &);
+  EmulateTagBase &operator=(const EmulateTagBase &);
+
+  PN532Base& pn532;
+  uint8_t* ndef_file;
+  uint16_t ndefMaxLength;
+  uint8_t* responseTemplates;
+  bool templatesValid;
+  NdefFileSource* ndefSource;
   uint8_t* uidPtr;
   bool tagWrittenByInitiator;
   bool tagWriteable;
+  bool sessionActive;
+  bool sessionReady;    // the RF setup is done and still good
+  bool released;        // releasedAt is valid
+  uint32_t releasedAt;
+  uint32_t rearmMicros;
   void (*updateNdefCallback)(uint8_t *ndef, uint16_t length);
+  ApduRouter router;
+  ApduTimings* timings;
+  uint8_t chainedIns;   // INS of an unfinished command chain, 0 if there is none
+  uint16_t chainOffset; // where the next UPDATE BINARY of the chain writes
+  NdefGenerator ndefGenerator;
+  void* generatorContext;
+  uint8_t* ndefBackFile;
+  uint16_t staleStart;  // bytes of the back file that differ from ndef_file, [start, end)
+  uint16_t staleEnd;
+  bool generated;       // the generator ran in this activation
+
+  // may be read from another task, see NdefWriteBack
+  volatile bool inField;
+  volatile uint16_t dirtyStart;
+  volatile uint16_t dirtyEnd;
+  volatile uint32_t writeCount;
+  volatile uint32_t lastWriteMillis;
+#if defined(ESP32)
+  // the NDEF file and its dirty range change together under it
+  portMUX_TYPE fileMux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+  // state of the NDEF application during an activation
+  uint8_t ccResponse[15 + 2];   // the CC file and 90 00
+  uint16_t fileSize;
+  uint8_t currentFile;
+  bool writeable;
 
-  void setResponse(responseCommand cmd, uint8_t* buf, uint8_t* sendlen, uint8_t sendlenOffset = 0);
+  bool release(bool success);
+  bool readNdefFile(uint16_t offset, uint8_t* buf, uint16_t length);
+  void prepareTemplates();
+  const uint8_t* findTemplate(uint16_t offset, uint16_t le);
+  void patchTemplates(uint16_t start, uint16_t end);
+  void generateNdefFile();
+  void markStale(uint16_t start, uint16_t end);
+  void addNdefApplication();
+  static uint16_t selectFile(void* context, const uint8_t* apdu, uint16_t apduLength, ApduResponse* response);
+  static uint16_t readBinary(void* context, const uint8_t* apdu, uint16_t apduLength, ApduResponse* response);
+  static uint16_t updateBinary(void* context, const uint8_t* apdu, uint16_t apduLength, ApduResponse* response);
 };
 
+template <uint16_t NdefCapacity, uint8_t PacketBufSize = PN532_PACKBUFFSIZ>
+class BasicEmulateTag : public EmulateTagBase{
+
+public:
+  BasicEmulateTag(PN532Interface &interface) : EmulateTagBase(nfc, ndefFile, NdefCapacity, templates), nfc(interface) { }
+
+private:
+  static_assert(NdefCapacity > 2 && NdefCapacity <= 0xFFFE, "NDEF file must hold the 2 byte length and fit the CC");
+
+  BasicPN532<PacketBufSize> nfc;
+  uint8_t ndefFile[NdefCapacity];
+  uint8_t templates[EMULATETAG_TEMPLATES_SIZE(NdefCapacity)];
+};
+
+typedef BasicEmulateTag<NDEF_MAX_LENGTH> EmulateTag;
+
 #endif
@@ -0,0 +1,361 @@
+
+#include "memprobe.h"
+
+#if defined(ESP32)
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#elif defined(ARDUINO_ARCH_NATIVE)
+#include <native_alloc.h>
+#endif
+
+struct HeapCounters {
+    uint32_t allocations;
+    uint32_t frees;
+    int32_t inUse;
+    int32_t peak;
+};
+
+static volatile bool enabled = false;
+
+#if defined(ESP32) && defined(MEMPROBE_WRAP_MALLOC)
+
+// Allocations from every task are counted while probing is enabled. The
+// blocks counted are remembered so a free of a block from before enable()
+// doesn't lower inUse, blocks past MEMPROBE_MAX_BLOCKS live ones count as
+// allocations but not as bytes.
+static HeapCounters counters;
+static portMUX_TYPE countersMux = portMUX_INITIALIZER_UNLOCKED;
+
+struct CountedBlock {
+    void *ptr;
+    int32_t size;
+};
+
+static CountedBlock blocks[MEMPROBE_MAX_BLOCKS];
+
+// size the block was counted with and forgets it, -1 if it wasn't counted
+static int32_t IRAM_ATTR forget(void *ptr)
+{
+    for (int i = 0; i < MEMPROBE_MAX_BLOCKS; i++) {
+        if (blocks[i].ptr == ptr) {
+            blocks[i].ptr = NULL;
+            return blocks[i].size;
+        }
+    }
+    return -1;
+}
+
+static void IRAM_ATTR remember(void *ptr, int32_t size)
+{
+    for (int i = 0; i < MEMPROBE_MAX_BLOCKS; i++) {
+        if (!blocks[i].ptr) {
+            blocks[i].ptr = ptr;
+            blocks[i].size = size;
+            counters.inUse += size;
+            if (counters.inUse > counters.peak) {
+                counters.peak = counters.inUse;
+            }
+            return;
+        }
+    }
+}
+
+static void IRAM_ATTR countAlloc(void *ptr)
+{
+    int32_t size = heap_caps_get_allocated_size(ptr);
+    portENTER_CRITICAL_SAFE(&countersMux);
+    counters.allocations++;
+    remember(ptr, size);
+    portEXIT_CRITICAL_SAFE(&countersMux);
+}
+
+static void IRAM_ATTR countFree(void *ptr)
+{
+    portENTER_CRITICAL_SAFE(&countersMux);
+    int32_t size = forget(ptr);
+    if (size >= 0) {
+        counters.frees++;
+        counters.inUse -= size;
+    }
+    portEXIT_CRITICAL_SAFE(&countersMux);
+}
+
+// a moved or resized block is freed and allocated again, only growing
+// counts as an allocation
+static void IRAM_ATTR countRealloc(void *ptr, void *p)
+{
+    int32_t after = p ? heap_caps_get_allocated_size(p) : 0;
+    portENTER_CRITICAL_SAFE(&countersMux);
+    int32_t before = ptr ? forget(ptr) : -1;
+    if (before >= 0) {
+        counters.inUse -= before;
+    }
+    if (p) {
+        if (after > before) {
+            counters.allocations++;
+        }
+        remember(p, after);
+    } else if (before >= 0) {
+        counters.frees++;   // realloc(ptr, 0)
+    }
+    portEXIT_CRITICAL_SAFE(&countersMux);
+}
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *IRAM_ATTR __wrap_malloc(size_t size)
+{
+    void *p = __real_malloc(size);
+    if (p && enabled) {
+        countAlloc(p);
+    }
+    return p;
+}
+
+void *IRAM_ATTR __wrap_calloc(size_t count, size_t size)
+{
+    void *p = __real_calloc(count, size);
+    if (p && enabled) {
+        countAlloc(p);
+    }
+    return p;
+}
+
+void *IRAM_ATTR __wrap_realloc(void *ptr, size_t size)
+{
+    void *p = __real_realloc(ptr, size);
+    // a failed realloc leaves ptr as it was
+    if (enabled && (p || (ptr && size == 0))) {
+        countRealloc(ptr, p);
+    }
+    return p;
+}
+
+void IRAM_ATTR __wrap_free(void *ptr)
+{
+    if (ptr && enabled) {
+        countFree(ptr);
+    }
+    __real_free(ptr);
+}
+}
+
+static void readCounters(HeapCounters *c)
+{
+    portENTER_CRITICAL(&countersMux);
+    *c = counters;
+    portEXIT_CRITICAL(&countersMux);
+}
+
+static void resetPeak()
+{
+    portENTER_CRITICAL(&countersMux);
+    counters.peak = counters.inUse;
+    portEXIT_CRITICAL(&countersMux);
+}
+
+// blocks counted before probing was last turned off may have been freed
+// unseen since, start from nothing
+static void resetCounters()
+{
+    portENTER_CRITICAL(&countersMux);
+    memset(&counters, 0, sizeof(counters));
+    memset(blocks, 0, sizeof(blocks));
+    portEXIT_CRITICAL(&countersMux);
+}
+
+#elif defined(ARDUINO_ARCH_NATIVE)
+
+static void readCounters(HeapCounters *c)
+{
+    NativeAllocStats stats = nativeAllocStats();
+    c->allocations = stats.allocations;
+    c->frees = stats.frees;
+    c->inUse = stats.bytesInUse;
+    c->peak = stats.peakBytesInUse;
+}
+
+static void resetPeak()
+{
+    nativeAllocResetPeak();
+}
+
+static void resetCounters()
+{
+}
+
+#else
+
+static void readCounters(HeapCounters *c)
+{
+    memset(c, 0, sizeof(*c));
+}
+
+static void resetPeak()
+{
+}
+
+static void resetCounters()
+{
+}
+
+#endif
+
+static uint32_t freeHeap()
+{
+#if defined(ESP32)
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#else
+    return 0;
+#endif
+}
+
+static uint32_t largestFreeBlock()
+{
+#if defined(ESP32)
+    return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#else
+    return 0;
+#endif
+}
+
+static uint32_t stackHighWater()
+{
+#if defined(ESP32)
+    return uxTaskGetStackHighWaterMark(NULL); // bytes on ESP-IDF
+#else
+    return 0;
+#endif
+}
+
+struct ProbeLevel {
+    const char *operation;
+    unsigned long startMs;
+    HeapCounters start;
+    int32_t peakSeen;       // highest peak of the operations nested in this one
+    uint32_t stackAtStart;
+};
+
+static ProbeLevel levels[MEMPROBE_MAX_DEPTH];
+static uint8_t depth = 0;   // can exceed MEMPROBE_MAX_DEPTH, deeper levels are not measured
+static Print *output = &Serial;
+
+void MemProbe::enable(bool on)
+{
+    if (on && !enabled) {
+        depth = 0;
+        resetCounters();
+    }
+    enabled = on;
+}
+
+bool MemProbe::isEnabled()
+{
+    return enabled;
+}
+
+void MemProbe::setOutput(Print *out)
+{
+    output = out;
+}
+
+void MemProbe::begin(const char *operation)
+{
+    if (!enabled) {
+        return;
+    }
+    if (depth >= MEMPROBE_MAX_DEPTH) {
+        depth++;
+        return;
+    }
+
+    HeapCounters now;
+    readCounters(&now);
+    if (depth > 0 && now.peak > levels[depth - 1].peakSeen) {
+        levels[depth - 1].peakSeen = now.peak;
+    }
+
+    ProbeLevel &level = levels[depth++];
+    level.operation = operation;
+    level.startMs = millis();
+    level.stackAtStart = stackHighWater();
+    resetPeak();
+    readCounters(&level.start);
+    level.peakSeen = level.start.peak;
+}
+
+bool MemProbe::end(MemProbeReport *report)
+{
+    if (!enabled || depth == 0) {
+        return false;
+    }
+    if (depth-- > MEMPROBE_MAX_DEPTH) {
+        return false;
+    }
+
+    ProbeLevel &level = levels[depth];
+    HeapCounters now;
+    readCounters(&now);
+    int32_t peak = now.peak > level.peakSeen ? now.peak : level.peakSeen;
+
+    if (depth > 0 && peak > levels[depth - 1].peakSeen) {
+        levels[depth - 1].peakSeen = peak;
+    }
+
+    MemProbeReport r;
+    r.operation = level.operation;
+    r.durationMs = millis() - level.startMs;
+    r.allocations = now.allocations - level.start.allocations;
+    r.frees = now.frees - level.start.frees;
+    r.peakHeap = peak - level.start.inUse;
+    r.freeHeap = freeHeap();
+    r.largestFreeBlock = largestFreeBlock();
+    r.stackHighWater = stackHighWater();
+    r.stackUsedBelow = level.stackAtStart > r.stackHighWater ? level.stackAtStart - r.stackHighWater : 0;
+
+    if (output) {
+        print(r, *output);
+    }
+    if (report) {
+        *report = r;
+    }
+    return true;
+}
+
+void MemProbe::print(const MemProbeReport &r, Print &out)
+{
+    out.print(F("[MEM] "));
+    out.print(r.operation);
+    out.print(F(": "));
+    out.print(r.durationMs);
+    out.print(F(" ms, "));
+    out.print(r.allocations);
+    out.print(F(" alloc / "));
+    out.print(r.frees);
+    out.print(F(" free, heap peak +"));
+    out.print(r.peakHeap);
+    out.print(F(" B"));
+    if (r.freeHeap) {
+        out.print(F(", free "));
+        out.print(r.freeHeap);
+        out.print(F(" B, largest block "));
+        out.print(r.largestFreeBlock);
+        out.print(F(" B"));
+    }
+    if (r.stackHighWater) {
+        out.print(F(", stack min "));
+        out.print(r.stackHighWater);
+        out.print(F(" B"));
+        if (r.stackUsedBelow) {
+            out.print(F(" (-"));
+            out.print(r.stackUsedBelow);
+            out.print(F(")"));
+        }
+    }
+    out.println();
+}
@@ -0,0 +1,69 @@
+
+#ifndef __MEMPROBE_H__
+#define __MEMPROBE_H__
+
+#include "Arduino.h"
+
+#define MEMPROBE_MAX_DEPTH    4
+#define MEMPROBE_MAX_BLOCKS   64    // live blocks the ESP32 wrappers keep track of
+
+/*
+ * Per operation heap and stack report, printed by MemProbe::end().
+ *
+ * Heap counting needs the allocator to be wrapped: on ESP32 build with
+ *   -DMEMPROBE_WRAP_MALLOC -Wl,--wrap=malloc -Wl,--wrap=calloc
+ *   -Wl,--wrap=realloc -Wl,--wrap=free
+ * and the native environment always counts. Elsewhere allocations read 0.
+ * On ESP32 only blocks allocated while probing is enabled are counted, the
+ * counters start over at every enable(true).
+ */
+struct MemProbeReport {
+    const char *operation;
+    uint32_t durationMs;
+    uint32_t allocations;       // malloc, calloc, new and growing reallocs
+    uint32_t frees;
+    int32_t peakHeap;           // most bytes in use above the level at begin()
+    uint32_t freeHeap;          // at end(), 0 where the platform can't tell
+    uint32_t largestFreeBlock;  // at end(), 0 where the platform can't tell
+    uint32_t stackHighWater;    // least free stack of the task so far, 0 if unknown
+    uint32_t stackUsedBelow;    // how far the operation lowered stackHighWater
+};
+
+class MemProbe {
+public:
+    /**
+    * @brief    turn probing on or off, off by default. While off begin() and
+    *           end() return at once and allocations are not counted.
+    */
+    static void enable(bool on);
+    static bool isEnabled();
+
+    // where summaries go, Serial by default. NULL keeps them quiet.
+    static void setOutput(Print *out);
+
+    /**
+    * @brief    start measuring an operation, operations can nest
+    * @param    operation   name for the summary, must outlive end()
+    */
+    static void begin(const char *operation);
+
+    /**
+    * @brief    stop measuring the innermost operation and print its summary
+    * @param    report  filled in when not NULL
+    * @return   true if a report was made
+    */
+    static bool end(MemProbeReport *report = 0);
+
+    static void print(const MemProbeReport &report, Print &out);
+};
+
+// Measures the enclosing block: MEMPROBE_SCOPE("NDEF read");
+class MemProbeScope {
+public:
+    MemProbeScope(const char *operation) { MemProbe::begin(operation); }
+    ~MemProbeScope() { MemProbe::end(); }
+};
+
+#define MEMPROBE_SCOPE(operation)   MemProbeScope memProbeScope(operation)
+
+#endif // __MEMPROBE_H__
@@ -0,0 +1,123 @@
+#ifndef __NDEF_FILE_H__
+#define __NDEF_FILE_H__
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+
+// most NDEF message an NDEF file holds, the file is at most 0xFFFE bytes
+// with the 2 byte NLEN in front
+#define NDEF_FILE_MAX_MESSAGE   (0xFFFC)
+
+/**
+ * Where EmulateTag takes the NDEF message it serves from. READ BINARY asks
+ * for slices by offset and length, so the message is never held in RAM as
+ * a whole.
+ */
+class NdefFileSource {
+public:
+    virtual ~NdefFileSource() { }
+
+    // length of the NDEF message, NLEN is not part of it
+    virtual uint16_t size() = 0;
+
+    // copy length bytes of the message, starting at offset, to buf
+    virtual bool read(uint16_t offset, uint8_t *buf, uint16_t length) = 0;
+};
+
+/**
+ * A message in addressable memory: a const array in flash or, on ESP32, a
+ * data partition mapped with esp_partition_mmap().
+ */
+class MemoryNdefFile : public NdefFileSource {
+public:
+    MemoryNdefFile(const uint8_t *message, uint16_t length) : _message(message), _length(length) {
+        if (_length > NDEF_FILE_MAX_MESSAGE) {
+            _length = NDEF_FILE_MAX_MESSAGE;
+        }
+    }
+
+    uint16_t size() { return _length; }
+
+    bool read(uint16_t offset, uint8_t *buf, uint16_t length) {
+        if ((uint32_t)offset + length > _length) {
+            return false;
+        }
+        memcpy(buf, _message + offset, length);
+        return true;
+    }
+
+private:
+    const uint8_t *_message;
+    uint16_t _length;
+};
+
+/**
+ * Where NdefWriteBack stores what a reader wrote to the emulated tag. A sink
+ * that updates in place only has to take the dirty bytes from message;
+ * either the old or the new message must survive a reset.
+ */
+class NdefFileSink {
+public:
+    virtual ~NdefFileSink() { }
+
+    /**
+    * @brief    store message, which is length bytes long now
+    * @param    dirtyStart  first byte that changed since the last commit
+    * @param    dirtyEnd    byte after the last one that changed
+    */
+    virtual bool commit(const uint8_t *message, uint16_t length, uint16_t dirtyStart, uint16_t dirtyEnd) = 0;
+};
+
+#if defined(ESP32) || defined(ARDUINO_ARCH_NATIVE)
+#include <FS.h>
+
+/**
+ * A message in a SPIFFS or LittleFS file. The file stays open while it is
+ * emulated, every READ BINARY is a seek and a read.
+ */
+class FsNdefFile : public NdefFileSource {
+public:
+    FsNdefFile(fs::File file) : _file(file) { }
+
+    uint16_t size() {
+        size_t length = _file.size();
+        return length > NDEF_FILE_MAX_MESSAGE ? NDEF_FILE_MAX_MESSAGE : length;
+    }
+
+    bool read(uint16_t offset, uint8_t *buf, uint16_t length) {
+        return _file.seek(offset) && _file.read(buf, length) == length;
+    }
+
+private:
+    fs::File _file;
+};
+
+/**
+ * Stores the message in a SPIFFS or LittleFS file, readable again with
+ * FsNdefFile. A commit writes the whole message to tempPath and renames it
+ * over path. SPIFFS can't rename over a file, path is
+ * removed first; call recover() at boot before opening path so a reset
+ * between the two leaves the new message there.
+ */
+class FsNdefFileSink : public NdefFileSink {
+public:
+    FsNdefFileSink(fs::FS &fs, const char *path, const char *tempPath) : _fs(fs), _path(path), _tempPath(tempPath) { }
+
+    bool commit(const uint8_t *message, uint16_t length, uint16_t dirtyStart, uint16_t dirtyEnd);
+
+    /**
+    * @brief    finish a commit a reset interrupted: a complete tempPath
+    *           becomes path, a partial one is removed
+    * @return   false if there is no message at path
+    */
+    bool recover();
+
+private:
+    fs::FS &_fs;
+    const char *_path;
+    const char *_tempPath;
+};
+#endif
+
+#endif // __NDEF_FILE_H__
@@ -0,0 +1,104 @@
+#include "ndef_write_back.h"
+#include "PN532_debug.h"
+
+bool NdefWriteBack::poll()
+{
+    uint16_t start, end;
+    uint32_t writes;
+    if (!_tag.getDirtyRange(&start, &end, &writes)) {
+        return false;
+    }
+    if (_tag.isInField() && millis() - _tag.getLastWriteMillis() < _quietMillis) {
+        return false;
+    }
+    return flush();
+}
+
+bool NdefWriteBack::flush()
+{
+    uint16_t start, end;
+    uint32_t writes;
+    if (!_tag.copyDirtyFile(_file, &start, &end, &writes)) {
+        return false;
+    }
+
+    // the NDEF file is NLEN and the message, the sink only gets the message
+    uint16_t length = (_file[0] << 8) + _file[1];
+    if (length == 0) {
+        // a reader clears NLEN before it writes and sets it last
+        return false;
+    }
+    if (length > _tag.getNdefMaxLength() - 2) {
+        DMSG("NLEN past the NDEF file\n");
+        return false;
+    }
+    start = start < 2 ? 0 : start - 2;
+    end = end < 2 ? 0 : end - 2;
+    if (end > length) {
+        end = length;
+    }
+    if (start > end) {
+        start = end;
+    }
+
+    if (!_sink.commit(_file + 2, length, start, end)) {
+        DMSG("NDEF write back failed\n");
+        return false;
+    }
+    _tag.markClean(writes);
+    _commits++;
+    return true;
+}
+
+#if defined(ESP32)
+bool NdefWriteBack::startTask(uint32_t periodMillis, uint32_t stackSize)
+{
+    _periodMillis = periodMillis;
+    return xTaskCreate(task, "ndefWriteBack", stackSize, this, 1, 0) == pdPASS;
+}
+
+void NdefWriteBack::task(void *writeBack)
+{
+    NdefWriteBack *self = (NdefWriteBack *)writeBack;
+    while (1) {
+        self->poll();
+        vTaskDelay(pdMS_TO_TICKS(self->_periodMillis));
+    }
+}
+#endif
+
+#if defined(ESP32) || defined(ARDUINO_ARCH_NATIVE)
+// tempPath is only complete once path has been removed for it
+bool FsNdefFileSink::recover()
+{
+    if (!_fs.exists(_tempPath)) {
+        return _fs.exists(_path);
+    }
+    if (_fs.exists(_path)) {
+        _fs.remove(_tempPath);
+        return true;
+    }
+    return _fs.rename(_tempPath, _path);
+}
+
+// message is a copy of the whole message, the dirty range is of no use here
+bool FsNdefFileSink::commit(const uint8_t *message, uint16_t length, uint16_t dirtyStart, uint16_t dirtyEnd)
+{
+    (void)dirtyStart;
+    (void)dirtyEnd;
+    recover();
+    fs::File temp = _fs.open(_tempPath, "w");
+    if (!temp) {
+        return false;
+    }
+    bool ok = temp.write(message, length) == length;
+    temp.close();
+    if (!ok) {
+        _fs.remove(_tempPath);
+        return false;
+    }
+
+    // LittleFS replaces path, SPIFFS wants it gone first
+    return _fs.rename(_tempPath, _path) || (_fs.remove(_path) && _fs.rename(_tempPath, _path));
+}
+#endif
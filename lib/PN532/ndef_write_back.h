@@ -0,0 +1,54 @@
+#ifndef __NDEF_WRITE_BACK_H__
+#define __NDEF_WRITE_BACK_H__
+
+#include "emulatetag.h"
+#include "ndef_file.h"
+
+/**
+ * Write-back cache for an emulated tag. UPDATE BINARY only changes the NDEF
+ * file in RAM and widens its dirty range, so APDUs never wait for flash.
+ * poll() hands the dirty range to the sink once the reader has left or no
+ * write came for quietMillis, and not while a reader left NLEN at 0 in the
+ * middle of writing a message.
+ *
+ * poll() can run in loop() between emulate() calls or, on ESP32, in its own
+ * task (startTask()). A commit works on a copy of the NDEF file in file,
+ * getNdefMaxLength() bytes; writes that land during a commit keep the range
+ * dirty and the next poll() commits again.
+ */
+class NdefWriteBack {
+public:
+    NdefWriteBack(EmulateTagBase &tag, NdefFileSink &sink, uint8_t *file, uint32_t quietMillis = 500) :
+        _tag(tag), _sink(sink), _file(file), _quietMillis(quietMillis), _commits(0), _periodMillis(0) { }
+
+    /**
+    * @brief    commit the dirty range if it is time to
+    * @return   true if something was committed
+    */
+    bool poll();
+
+    // commit whatever is dirty now, false if that failed or there was nothing
+    bool flush();
+
+    // successful commits so far
+    uint32_t getCommits() { return _commits; }
+
+#if defined(ESP32)
+    // run poll() every periodMillis in a FreeRTOS task
+    bool startTask(uint32_t periodMillis = 50, uint32_t stackSize = 4096);
+#endif
+
+private:
+    EmulateTagBase &_tag;
+    NdefFileSink &_sink;
+    uint8_t *_file;
+    uint32_t _quietMillis;
+    uint32_t _commits;
+    uint32_t _periodMillis;
+
+#if defined(ESP32)
+    static void task(void *writeBack);
+#endif
+};
+
+#endif // __NDEF_WRITE_BACK_H__
@@ -1,9 +1,12 @@
 
 #include "snep.h"
 #include "PN532_debug.h"
+#include "memprobe.h"
 
 int8_t SNEP::write(const uint8_t *buf, uint8_t len, uint16_t timeout)
 {
+	MEMPROBE_SCOPE("SNEP write");
+
 	if (0 >= llcp.activate(timeout)) {
 		DMSG("failed to activate PN532 as a target\n");
 		return -1;
@@ -60,6 +63,8 @@ int8_t SNEP::write(const uint8_t *buf, uint8_t len, uint16_t timeout)
 
 int16_t SNEP::read(uint8_t *buf, uint8_t len, uint16_t timeout)
 {
+	MEMPROBE_SCOPE("SNEP read");
+
 	if (0 >= llcp.activate(timeout)) {
 		DMSG("failed to activate PN532 as a target\n");
 		return -1;
@@ -0,0 +1,223 @@
+#include "type2_emulator.h"
+#include "PN532_debug.h"
+
+#include <string.h>
+
+// TgInitAsTarget mode byte: DEP (bit 2) and ISO/IEC 14443-4 PICC (bit 3)
+#define TARGET_MODE_ISO_DEP     (0x0C)
+
+static const uint8_t ntag213Version[8] = { 0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x0F, 0x03 };
+static const uint8_t ack = TYPE2_ACK;
+static const uint8_t nak = TYPE2_NAK;
+
+Type2TagEmulatorBase::Type2TagEmulatorBase(PN532Base &nfc) :
+    pn532(nfc), writeable(true), tagWrittenByInitiator(false), status(TYPE2_OK), fallback(0), usingFallback(false)
+{
+    memset(uid, 0, sizeof(uid));
+    memset(pages, 0, sizeof(pages));
+    setHeader();
+    setNdefMessage(0, 0);
+}
+
+bool Type2TagEmulatorBase::init()
+{
+    pn532.begin();
+    return pn532.SAMConfig();
+}
+
+void Type2TagEmulatorBase::setUid(const uint8_t newUid[3])
+{
+    memcpy(uid, newUid, sizeof(uid));
+    setHeader();
+}
+
+bool Type2TagEmulatorBase::setNdefMessage(const uint8_t *message, uint16_t length)
+{
+    if (length > TYPE2_EMULATOR_MAX_MESSAGE) {
+        DMSG("NDEF message does not fit the Type 2 tag\n");
+        return false;
+    }
+
+    uint8_t *data = pages + TYPE2_EMULATOR_FIRST_DATA * 4;
+    memset(data, 0, TYPE2_EMULATOR_DATA_PAGES * 4);
+    data[0] = 0x03;
+    data[1] = length;
+    if (length) {
+        memcpy(data + 2, message, length);
+    }
+    data[2 + length] = 0xFE;
+    return true;
+}
+
+bool Type2TagEmulatorBase::getNdefMessage(const uint8_t **message, uint16_t *length)
+{
+    const uint8_t *data = pages + TYPE2_EMULATOR_FIRST_DATA * 4;
+    if (data[0] != 0x03 || data[1] > TYPE2_EMULATOR_MAX_MESSAGE) {
+        return false;
+    }
+    *message = data + 2;
+    *length = data[1];
+    return true;
+}
+
+void Type2TagEmulatorBase::setTagWriteable(bool setWriteable)
+{
+    writeable = setWriteable;
+    setHeader();
+}
+
+// UID, lock bytes, CC and the NTAG213 configuration pages
+void Type2TagEmulatorBase::setHeader()
+{
+    // the PN532 puts 0x08 in front of the 3 UID bytes it is given
+    pages[0] = 0x08;
+    pages[1] = uid[0];
+    pages[2] = uid[1];
+    pages[3] = 0x88 ^ 0x08 ^ uid[0] ^ uid[1];
+    pages[4] = uid[2];
+    pages[5] = 0;
+    pages[6] = 0;
+    pages[7] = 0;
+    pages[8] = uid[2];          // BCC1
+    pages[9] = 0x48;            // internal
+    pages[10] = 0x00;           // static lock bytes
+    pages[11] = 0x00;
+
+    pages[12] = 0xE1;           // CC: NDEF, version 1.0, 144 bytes
+    pages[13] = 0x10;
+    pages[14] = TYPE2_EMULATOR_DATA_PAGES * 4 / 8;
+    pages[15] = writeable ? 0x00 : 0x0F;
+
+    uint8_t *config = pages + 40 * 4;
+    const uint8_t configPages[5 * 4] = {
+        0x00, 0x00, 0x00, 0xBD,     // dynamic lock bytes
+        0x04, 0x00, 0x00, 0xFF,     // CFG0: AUTH0 0xFF, no password
+        0x00, 0x05, 0x00, 0x00,     // CFG1
+        0x00, 0x00, 0x00, 0x00,     // PWD reads as 0
+        0x00, 0x00, 0x00, 0x00      // PACK
+    };
+    memcpy(config, configPages, sizeof(configPages));
+
+    // pages 0-2 again behind the last page, WRITE never changes them
+    memcpy(pages + TYPE2_EMULATOR_PAGES * 4, pages, 3 * 4);
+}
+
+bool Type2TagEmulatorBase::emulate(uint16_t tgInitAsTargetTimeout)
+{
+    if (usingFallback) {
+        return fallback->emulate(tgInitAsTargetTimeout);
+    }
+
+    uint8_t command[] = {
+        PN532_COMMAND_TGINITASTARGET,
+        5,                  // MODE: PICC only, Passive only
+
+        0x44, 0x00,         // SENS_RES of an NTAG
+        uid[0], uid[1], uid[2], // NFCID1
+        0x00,               // SEL_RES: no ISO-DEP
+
+        0,0,0,0,0,0,0,0,
+        0,0,0,0,0,0,0,0,   // FeliCaParams
+        0,0,
+
+        0,0,0,0,0,0,0,0,0,0, // NFCID3t
+
+        0, // length of general bytes
+        0  // length of historical bytes
+    };
+
+    // the activation carries the first command of the reader
+    uint8_t buf[64];
+    uint8_t length = sizeof(buf);
+    int8_t activation = pn532.tgInitAsTarget(command, sizeof(command), tgInitAsTargetTimeout, buf, &length);
+    if (activation != 1) {
+        status = TYPE2_NO_READER;
+        return false;
+    }
+
+    if (length < 1 || (buf[0] & TARGET_MODE_ISO_DEP)) {
+        DMSG("Type 2: the PN532 activated ISO-DEP\n");
+        status = TYPE2_UNSUPPORTED;
+        pn532.inRelease();
+        if (fallback == 0) {
+            return false;
+        }
+        usingFallback = true;
+        return fallback->emulate(tgInitAsTargetTimeout);
+    }
+
+    status = TYPE2_OK;
+    tagWrittenByInitiator = false;
+    int16_t received = length - 1;
+    memmove(buf, buf + 1, received);
+
+    while (1) {
+        if (received == 0) {
+            received = pn532.tgGetInitiatorCommand(buf, sizeof(buf));
+            if (received < 0) {
+                break;
+            }
+            continue;
+        }
+
+        const uint8_t *reply;
+        uint8_t replyLength;
+        if (!answer(buf, received, &reply, &replyLength)) {
+            break;  // HALT
+        }
+        if (!pn532.tgResponseToInitiator(reply, replyLength)) {
+            if (pn532.getTargetStatus() == 0x01) {
+                DMSG("Type 2: the reader timed out\n");
+                status = TYPE2_TOO_SLOW;
+                usingFallback = fallback != 0;
+            }
+            break;
+        }
+        received = 0;
+    }
+
+    pn532.inRelease();
+    return true;
+}
+
+// the answer to command, false for a HALT, which has none
+bool Type2TagEmulatorBase::answer(const uint8_t *command, uint8_t length, const uint8_t **reply, uint8_t *replyLength)
+{
+    *reply = &nak;
+    *replyLength = 1;
+
+    switch (command[0]) {
+    case TYPE2_CMD_GET_VERSION:
+        *reply = ntag213Version;
+        *replyLength = sizeof(ntag213Version);
+        break;
+    case TYPE2_CMD_READ:
+        if (length >= 2 && command[1] < TYPE2_EMULATOR_PAGES) {
+            *reply = pages + command[1] * 4;
+            *replyLength = 16;
+        }
+        break;
+    case TYPE2_CMD_FAST_READ:
+        if (length >= 3 && command[1] <= command[2] && command[2] < TYPE2_EMULATOR_PAGES) {
+            *reply = pages + command[1] * 4;
+            *replyLength = (command[2] - command[1] + 1) * 4;
+        }
+        break;
+    case TYPE2_CMD_WRITE:
+        if (writeable && length >= 6 && command[1] >= TYPE2_EMULATOR_FIRST_DATA &&
+            command[1] < TYPE2_EMULATOR_FIRST_DATA + TYPE2_EMULATOR_DATA_PAGES) {
+            memcpy(pages + command[1] * 4, command + 2, 4);
+            tagWrittenByInitiator = true;
+            *reply = &ack;
+        }
+        break;
+    case TYPE2_CMD_HALT:
+        return false;
+    default:
+        DMSG("Type 2 command not supported: ");
+        DMSG_HEX(command[0]);
+        DMSG("\n");
+        break;
+    }
+    return true;
+}
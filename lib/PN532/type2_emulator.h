@@ -0,0 +1,114 @@
+#ifndef __TYPE2_EMULATOR_H__
+#define __TYPE2_EMULATOR_H__
+
+#include "PN532.h"
+#include "emulatetag.h"
+
+// NTAG213: 45 pages, pages 4-39 (144 bytes) hold the NDEF TLV
+#define TYPE2_EMULATOR_PAGES        45
+#define TYPE2_EMULATOR_FIRST_DATA   4
+#define TYPE2_EMULATOR_DATA_PAGES   36
+// the NDEF TLV with a 1 byte length and the terminator TLV fill the data pages
+#define TYPE2_EMULATOR_MAX_MESSAGE  (TYPE2_EMULATOR_DATA_PAGES * 4 - 3)
+
+// NFC Forum Type 2 commands
+#define TYPE2_CMD_GET_VERSION   (0x60)
+#define TYPE2_CMD_READ          (0x30)
+#define TYPE2_CMD_FAST_READ     (0x3A)
+#define TYPE2_CMD_WRITE         (0xA2)
+#define TYPE2_CMD_HALT          (0x50)
+
+#define TYPE2_ACK               (0x0A)
+#define TYPE2_NAK               (0x00)
+
+enum Type2EmulatorStatus {
+    TYPE2_OK,
+    TYPE2_NO_READER,        // nobody activated the target in time
+    TYPE2_UNSUPPORTED,      // the PN532 activated ISO-DEP instead of handing over raw commands
+    TYPE2_TOO_SLOW          // the reader gave up waiting for an answer
+};
+
+/**
+ * Emulates an NTAG213 holding an NDEF message, for readers that do not
+ * speak ISO-DEP. The PN532 is a target with SEL_RES 0x00 and passes the
+ * raw Type 2 commands on through TgGetInitiatorCommand: READ, FAST_READ,
+ * WRITE, GET_VERSION and HALT are answered, anything else with a NAK.
+ *
+ * The page image carries a copy of pages 0-2 behind the last page, so the
+ * answer to every READ, the roll over included, is 16 bytes of the image
+ * as they are and goes out without copying.
+ *
+ * The PN532 sends the 4 bit ACK and NAK as full bytes and its firmware
+ * may not answer in the time some readers allow. When it reports that the
+ * reader gave up, or activates ISO-DEP anyway, emulate() turns to the
+ * fallback tag, an EmulateTag with the same message, if one is set.
+ */
+class Type2TagEmulatorBase {
+public:
+    bool init();
+
+    // pages 0-2 (UID, lock bytes) take uid, the PN532 answers anticollision with 08 uid[0..2]
+    void setUid(const uint8_t uid[3]);
+
+    // false if message is longer than TYPE2_EMULATOR_MAX_MESSAGE
+    bool setNdefMessage(const uint8_t *message, uint16_t length);
+
+    // the message in the NDEF TLV, after the reader's writes; false if the TLV is broken
+    bool getNdefMessage(const uint8_t **message, uint16_t *length);
+
+    void setTagWriteable(bool writeable);
+
+    bool writeOccured() { return tagWrittenByInitiator; }
+
+    /**
+    * @brief    wait for a reader and answer its commands until it leaves
+    * @return   true if a reader talked to the tag, the fallback's result once that is in use
+    */
+    bool emulate(uint16_t tgInitAsTargetTimeout = 0);
+
+    Type2EmulatorStatus getStatus() { return status; }
+
+    // answer with tag when the PN532 can't emulate Type 2, 0 for none
+    void setFallback(EmulateTagBase *tag) {
+        fallback = tag;
+        usingFallback = false;
+    }
+
+    bool isUsingFallback() { return usingFallback; }
+
+    const uint8_t *getPages() { return pages; }
+
+protected:
+    // nfc is owned by the derived class
+    Type2TagEmulatorBase(PN532Base &nfc);
+
+private:
+    Type2TagEmulatorBase(const Type2TagEmulatorBase &);
+    Type2TagEmulatorBase &operator=(const Type2TagEmulatorBase &);
+
+    PN532Base &pn532;
+    // the tag and pages 0-2 again, for READ roll over
+    uint8_t pages[(TYPE2_EMULATOR_PAGES + 3) * 4];
+    uint8_t uid[3];
+    bool writeable;
+    bool tagWrittenByInitiator;
+    Type2EmulatorStatus status;
+    EmulateTagBase *fallback;
+    bool usingFallback;
+
+    void setHeader();
+    bool answer(const uint8_t *command, uint8_t length, const uint8_t **reply, uint8_t *replyLength);
+};
+
+template <uint8_t PacketBufSize>
+class BasicType2TagEmulator : public Type2TagEmulatorBase {
+public:
+    BasicType2TagEmulator(PN532Interface &interface) : Type2TagEmulatorBase(nfc), nfc(interface) { }
+
+private:
+    BasicPN532<PacketBufSize> nfc;
+};
+
+typedef BasicType2TagEmulator<PN532_PACKBUFFSIZ> Type2TagEmulator;
+
+#endif // __TYPE2_EMULATOR_H__
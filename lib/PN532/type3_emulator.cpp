@@ -0,0 +1,298 @@
+#include "type3_emulator.h"
+#include "PN532_debug.h"
+
+#include <string.h>
+
+#define TYPE3_SERVICE_READ      (0x000B) // NDEF service, read only access
+#define TYPE3_SERVICE_WRITE     (0x0009) // NDEF service, read/write access
+#define TYPE3_VERSION           (0x10)
+#define TYPE3_WRITING           (0x0F)   // WriteF while a write is in progress
+#define TYPE3_READ_WRITE        (0x01)   // RWFlag
+
+// TgInitAsTarget mode byte, framing in bits 0-1
+#define TARGET_MODE_FRAMING     (0x03)
+#define TARGET_MODE_FELICA      (0x02)
+
+// FeliCa frame: LEN, command code, IDm
+#define FELICA_FRAME_HEADER     (10)
+
+// PAD of a FeliCa Lite-S, the timing bytes readers use for their timeouts
+static const uint8_t pmm[8] = { 0x00, 0xF1, 0x00, 0x00, 0x00, 0x01, 0x43, 0x00 };
+
+// Attribute information block: Ver, Nbr, Nbw, Nmaxb (2), 4 unused,
+// WriteF, RWFlag, Ln (3), checksum of bytes 0 - 13 (2)
+static uint16_t attributeChecksum(const uint8_t *attribute)
+{
+    uint16_t sum = 0;
+    for (uint8_t i = 0; i < 14; i++) {
+        sum += attribute[i];
+    }
+    return sum;
+}
+
+Type3TagEmulatorBase::Type3TagEmulatorBase(PN532Base &nfc) :
+    pn532(nfc), messageLength(0), ndefSource(0), writeable(true), tagWrittenByInitiator(false), status(TYPE3_OK)
+{
+    // manufacturer code 0x02FE marks a random IDm
+    const uint8_t defaultIdm[8] = { 0x02, 0xFE, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    memcpy(idm, defaultIdm, sizeof(idm));
+    memset(data, 0, sizeof(data));
+}
+
+bool Type3TagEmulatorBase::init()
+{
+    pn532.begin();
+    return pn532.SAMConfig();
+}
+
+void Type3TagEmulatorBase::setIdm(const uint8_t newIdm[8])
+{
+    memcpy(idm, newIdm, sizeof(idm));
+}
+
+bool Type3TagEmulatorBase::setNdefMessage(const uint8_t *message, uint16_t length)
+{
+    if (length > sizeof(data)) {
+        DMSG("NDEF message does not fit the Type 3 tag\n");
+        return false;
+    }
+    memset(data, 0, sizeof(data));
+    memcpy(data, message, length);
+    messageLength = length;
+    return true;
+}
+
+void Type3TagEmulatorBase::buildAttribute()
+{
+    uint32_t length = ndefSource != 0 ? ndefSource->size() : messageLength;
+    uint16_t blocks = ndefSource != 0 ? (length + TYPE3_EMULATOR_BLOCK_SIZE - 1) / TYPE3_EMULATOR_BLOCK_SIZE : TYPE3_EMULATOR_MAX_BLOCKS;
+
+    memset(attribute, 0, sizeof(attribute));
+    attribute[0] = TYPE3_VERSION;
+    attribute[1] = TYPE3_EMULATOR_READ_BLOCKS;
+    attribute[2] = TYPE3_EMULATOR_WRITE_BLOCKS;
+    attribute[3] = blocks >> 8;
+    attribute[4] = blocks & 0xFF;
+    attribute[10] = writeable && ndefSource == 0 ? TYPE3_READ_WRITE : 0x00;
+    attribute[11] = length >> 16;
+    attribute[12] = length >> 8;
+    attribute[13] = length & 0xFF;
+    uint16_t sum = attributeChecksum(attribute);
+    attribute[14] = sum >> 8;
+    attribute[15] = sum & 0xFF;
+}
+
+bool Type3TagEmulatorBase::emulate(uint16_t tgInitAsTargetTimeout)
+{
+    uint8_t command[] = {
+        PN532_COMMAND_TGINITASTARGET,
+        1,                  // MODE: Passive only
+
+        0x00, 0x00,         // SENS_RES
+        0x00, 0x00, 0x00,   // NFCID1
+        0x00,               // SEL_RES
+
+        idm[0], idm[1], idm[2], idm[3], idm[4], idm[5], idm[6], idm[7],
+        pmm[0], pmm[1], pmm[2], pmm[3], pmm[4], pmm[5], pmm[6], pmm[7],
+        TYPE3_SYSTEM_CODE_NDEF >> 8, TYPE3_SYSTEM_CODE_NDEF & 0xFF,
+
+        0,0,0,0,0,0,0,0,0,0, // NFCID3t
+
+        0, // length of general bytes
+        0  // length of historical bytes
+    };
+
+    buildAttribute();
+
+    // the activation carries the first command of the reader
+    uint8_t buf[0xFF];
+    uint8_t length = sizeof(buf);
+    int8_t activation = pn532.tgInitAsTarget(command, sizeof(command), tgInitAsTargetTimeout, buf, &length);
+    if (activation != 1) {
+        status = TYPE3_NO_READER;
+        return false;
+    }
+    if (length < 1 || (buf[0] & TARGET_MODE_FRAMING) != TARGET_MODE_FELICA) {
+        DMSG("Type 3: not activated as FeliCa\n");
+        status = TYPE3_UNSUPPORTED;
+        pn532.inRelease();
+        return false;
+    }
+
+    status = TYPE3_OK;
+    tagWrittenByInitiator = false;
+    int16_t received = length - 1;
+    memmove(buf, buf + 1, received);
+
+    uint8_t reply[0xFF];
+    while (1) {
+        if (received > 0) {
+            uint8_t replyLength = answer(buf, received, reply);
+            if (replyLength > 0 && !pn532.tgResponseToInitiator(reply, replyLength)) {
+                break;
+            }
+        }
+        received = pn532.tgGetInitiatorCommand(buf, sizeof(buf));
+        if (received < 0) {
+            break;
+        }
+    }
+
+    pn532.inRelease();
+    return true;
+}
+
+bool Type3TagEmulatorBase::readBlock(uint16_t block, uint8_t *buf)
+{
+    if (block == 0) {
+        memcpy(buf, attribute, TYPE3_EMULATOR_BLOCK_SIZE);
+        return true;
+    }
+
+    uint32_t offset = (uint32_t)(block - 1) * TYPE3_EMULATOR_BLOCK_SIZE;
+    if (ndefSource == 0) {
+        if (block > TYPE3_EMULATOR_MAX_BLOCKS) {
+            return false;
+        }
+        memcpy(buf, data + offset, TYPE3_EMULATOR_BLOCK_SIZE);
+        return true;
+    }
+
+    // the last block of a source is padded with zeros
+    uint16_t size = ndefSource->size();
+    if (offset >= size) {
+        return false;
+    }
+    uint16_t count = size - offset < TYPE3_EMULATOR_BLOCK_SIZE ? size - offset : TYPE3_EMULATOR_BLOCK_SIZE;
+    memset(buf + count, 0, TYPE3_EMULATOR_BLOCK_SIZE - count);
+    return ndefSource->read(offset, buf, count);
+}
+
+bool Type3TagEmulatorBase::writeBlock(uint16_t block, const uint8_t *buf)
+{
+    if (!writeable || ndefSource != 0 || block > TYPE3_EMULATOR_MAX_BLOCKS) {
+        return false;
+    }
+
+    if (block > 0) {
+        memcpy(data + (block - 1) * TYPE3_EMULATOR_BLOCK_SIZE, buf, TYPE3_EMULATOR_BLOCK_SIZE);
+        tagWrittenByInitiator = true;
+        return true;
+    }
+
+    // the attribute block: WriteF and Ln change, the rest is ours
+    uint16_t sum = attributeChecksum(buf);
+    if (buf[14] != (sum >> 8) || buf[15] != (sum & 0xFF)) {
+        return false;
+    }
+    uint32_t length = ((uint32_t)buf[11] << 16) | (buf[12] << 8) | buf[13];
+    if (length > sizeof(data)) {
+        return false;
+    }
+    attribute[9] = buf[9];
+    memcpy(attribute + 11, buf + 11, 3);
+    sum = attributeChecksum(attribute);
+    attribute[14] = sum >> 8;
+    attribute[15] = sum & 0xFF;
+    if (buf[9] != TYPE3_WRITING) {
+        messageLength = length;
+    }
+    tagWrittenByInitiator = true;
+    return true;
+}
+
+// the answer to command in reply, 0 when there is none
+uint8_t Type3TagEmulatorBase::answer(const uint8_t *command, uint8_t length, uint8_t *reply)
+{
+    if (length < 2 || command[0] != length) {
+        return 0;
+    }
+
+    uint8_t n = 1;
+    if (command[1] == FELICA_CMD_POLLING) {
+        // LEN 00 system code (2) request code TSN
+        uint16_t systemCode = length >= 6 ? (command[2] << 8) | command[3] : 0;
+        if (systemCode != TYPE3_SYSTEM_CODE_NDEF && systemCode != 0xFFFF) {
+            return 0;
+        }
+        reply[n++] = FELICA_CMD_POLLING + 1;
+        memcpy(reply + n, idm, 8);
+        n += 8;
+        memcpy(reply + n, pmm, 8);
+        n += 8;
+        if (command[4] == 0x01) {
+            reply[n++] = TYPE3_SYSTEM_CODE_NDEF >> 8;
+            reply[n++] = TYPE3_SYSTEM_CODE_NDEF & 0xFF;
+        }
+        reply[0] = n;
+        return n;
+    }
+
+    if ((command[1] != FELICA_CMD_READ_WITHOUT_ENCRYPTION && command[1] != FELICA_CMD_WRITE_WITHOUT_ENCRYPTION) ||
+        length < FELICA_FRAME_HEADER + 1 || memcmp(command + 2, idm, 8) != 0) {
+        return 0;
+    }
+
+    bool read = command[1] == FELICA_CMD_READ_WITHOUT_ENCRYPTION;
+    reply[n++] = command[1] + 1;
+    memcpy(reply + n, idm, 8);
+    n += 8;
+    uint8_t blockData = 0;
+    uint8_t error = blocks(command, length, read, reply + n + 3, &blockData);
+    reply[n++] = error ? 0xFF : 0x00;   // status flag 1 and 2
+    reply[n++] = error;
+    if (read && !error) {
+        reply[n++] = blockData;
+        n += blockData * TYPE3_EMULATOR_BLOCK_SIZE;
+    }
+    reply[0] = n;
+    return n;
+}
+
+/**
+ * Reads the blocks a Check asks for to buf, or writes those of an Update.
+ * @return  0 or status flag 2: 0xA1 service count or list, 0xA2 block
+ *          count, 0xA8 block number
+ */
+uint8_t Type3TagEmulatorBase::blocks(const uint8_t *command, uint8_t length, bool read, uint8_t *buf, uint8_t *count)
+{
+    // the NDEF service only, written through its read/write service code
+    uint8_t p = FELICA_FRAME_HEADER;
+    if (command[p++] != 1 || p + 3 > length) {
+        return 0xA1;
+    }
+    uint16_t service = command[p] | (command[p + 1] << 8);
+    p += 2;
+    if (service != TYPE3_SERVICE_WRITE && (service != TYPE3_SERVICE_READ || !read)) {
+        return 0xA1;
+    }
+
+    uint8_t blocks = command[p++];
+    if (blocks == 0 || blocks > (read ? TYPE3_EMULATOR_READ_BLOCKS : TYPE3_EMULATOR_WRITE_BLOCKS)) {
+        return 0xA2;
+    }
+
+    // block list elements: 0x80 and the block, or 0x00 and 2 bytes LSB first
+    uint16_t blockList[TYPE3_EMULATOR_READ_BLOCKS];
+    for (uint8_t i = 0; i < blocks; i++) {
+        uint8_t size = command[p] & 0x80 ? 2 : 3;
+        if (p + size > length) {
+            return 0xA1;
+        }
+        blockList[i] = size == 2 ? command[p + 1] : command[p + 1] | (command[p + 2] << 8);
+        p += size;
+    }
+
+    if (!read && p + blocks * TYPE3_EMULATOR_BLOCK_SIZE > length) {
+        return 0xA2;
+    }
+    for (uint8_t i = 0; i < blocks; i++) {
+        bool ok = read ? readBlock(blockList[i], buf + i * TYPE3_EMULATOR_BLOCK_SIZE)
+                       : writeBlock(blockList[i], command + p + i * TYPE3_EMULATOR_BLOCK_SIZE);
+        if (!ok) {
+            return 0xA8;
+        }
+    }
+    *count = blocks;
+    return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef __TYPE3_EMULATOR_H__
+#define __TYPE3_EMULATOR_H__
+
+#include "PN532.h"
+#include "ndef_file.h"
+
+#define TYPE3_EMULATOR_BLOCK_SIZE   16
+
+// data blocks of the RAM message, a source may have more
+#ifndef TYPE3_EMULATOR_MAX_BLOCKS
+#define TYPE3_EMULATOR_MAX_BLOCKS   16
+#endif
+
+// Nbr and Nbw: the most blocks a Check answer or an Update command carries
+// in one FeliCa frame of at most 253 bytes through the PN532 (LEN 255 minus
+// the two PN532 bytes)
+#define TYPE3_EMULATOR_READ_BLOCKS  15  // 13 byte header + 15 * 16
+#define TYPE3_EMULATOR_WRITE_BLOCKS 13  // 14 byte header + 13 * (2 + 16)
+
+#define TYPE3_SYSTEM_CODE_NDEF      (0x12FC)
+
+enum Type3EmulatorStatus {
+    TYPE3_OK,
+    TYPE3_NO_READER,        // nobody activated the target in time
+    TYPE3_UNSUPPORTED       // the reader activated the PN532 as something else than FeliCa
+};
+
+/**
+ * Emulates an NFC Forum Type 3 tag (FeliCa, system code 12FC). The PN532
+ * is a FeliCa target and passes the raw commands on through
+ * TgGetInitiatorCommand: Polling, Check (Read Without Encryption) and
+ * Update (Write Without Encryption) of the NDEF service are answered.
+ *
+ * Block 0 is the attribute information block, built from the message. The
+ * Nbr it tells the reader is as many blocks as fit one frame, so a reader
+ * that follows it reads the message in the fewest Checks.
+ *
+ * The message is a copy in RAM of up to TYPE3_EMULATOR_MAX_BLOCKS blocks,
+ * or an NdefFileSource (a message in flash or a file, read only) the same
+ * as EmulateTag serves.
+ */
+class Type3TagEmulatorBase {
+public:
+    bool init();
+
+    // IDm (NFCID2) the reader sees, PMm is fixed
+    void setIdm(const uint8_t idm[8]);
+
+    // false if message is longer than TYPE3_EMULATOR_MAX_BLOCKS blocks
+    bool setNdefMessage(const uint8_t *message, uint16_t length);
+
+    // serve source instead of the RAM message, read only; 0 goes back to RAM
+    void setNdefSource(NdefFileSource *source) { ndefSource = source; }
+
+    // the RAM message, after the reader's writes
+    void getNdefMessage(const uint8_t **message, uint16_t *length) {
+        *message = data;
+        *length = messageLength;
+    }
+
+    void setTagWriteable(bool setWriteable) { writeable = setWriteable; }
+
+    bool writeOccured() { return tagWrittenByInitiator; }
+
+    /**
+    * @brief    wait for a reader and answer its commands until it leaves
+    * @return   true if a reader talked to the tag
+    */
+    bool emulate(uint16_t tgInitAsTargetTimeout = 0);
+
+    Type3EmulatorStatus getStatus() { return status; }
+
+protected:
+    // nfc is owned by the derived class
+    Type3TagEmulatorBase(PN532Base &nfc);
+
+private:
+    Type3TagEmulatorBase(const Type3TagEmulatorBase &);
+    Type3TagEmulatorBase &operator=(const Type3TagEmulatorBase &);
+
+    PN532Base &pn532;
+    uint8_t idm[8];
+    uint8_t attribute[TYPE3_EMULATOR_BLOCK_SIZE];
+    uint8_t data[TYPE3_EMULATOR_MAX_BLOCKS * TYPE3_EMULATOR_BLOCK_SIZE];
+    uint16_t messageLength;
+    NdefFileSource *ndefSource;
+    bool writeable;
+    bool tagWrittenByInitiator;
+    Type3EmulatorStatus status;
+
+    void buildAttribute();
+    bool readBlock(uint16_t block, uint8_t *buf);
+    bool writeBlock(uint16_t block, const uint8_t *buf);
+    uint8_t answer(const uint8_t *command, uint8_t length, uint8_t *reply);
+    uint8_t blocks(const uint8_t *command, uint8_t length, bool read, uint8_t *buf, uint8_t *count);
+};
+
+template <uint8_t PacketBufSize>
+class BasicType3TagEmulator : public Type3TagEmulatorBase {
+public:
+    BasicType3TagEmulator(PN532Interface &interface) : Type3TagEmulatorBase(nfc), nfc(interface) { }
+
+private:
+    BasicPN532<PacketBufSize> nfc;
+};
+
+typedef BasicType3TagEmulator<PN532_PACKBUFFSIZ> Type3TagEmulator;
+
+#endif // __TYPE3_EMULATOR_H__
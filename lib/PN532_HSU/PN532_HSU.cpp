@@ -148,6 +148,13 @@ int16_t PN532_HSU::readResponse(uint8_t buf[], uint8_t len, uint16_t timeout)
     return length[0];
 }
 
+void PN532_HSU::abortCommand()
+{
+    const uint8_t PN532_ACK[] = {0, 0, 0xFF, 0, 0xFF, 0};
+    _serial->write(PN532_ACK, sizeof(PN532_ACK));
+    _serial->flush();
+}
+
 int8_t PN532_HSU::readAckFrame()
 {
     const uint8_t PN532_ACK[] = {0, 0, 0xFF, 0, 0xFF, 0};
@@ -76,6 +76,16 @@ int8_t PN532_I2C::writeCommand(const uint8_t *header, uint8_t hlen, const uint8_
     return readAckFrame();
 }
 
+void PN532_I2C::abortCommand()
+{
+    const uint8_t PN532_ACK[] = {0, 0, 0xFF, 0, 0xFF, 0};
+    _wire->beginTransmission(PN532_I2C_ADDRESS);
+    for (uint16_t i = 0; i < sizeof(PN532_ACK); ++i) {
+        write(PN532_ACK[i]);
+    }
+    _wire->endTransmission();
+}
+
 int16_t PN532_I2C::getResponseLength(uint8_t buf[], uint8_t len, uint16_t timeout) {
     const uint8_t PN532_NACK[] = {0, 0, 0xFF, 0xFF, 0, 0};
     uint16_t time = 0;
@@ -0,0 +1,1049 @@
+
+#include "PN532_SIM.h"
+#include "PN532.h"
+#include "PN532_debug.h"
+
+#define SIM_STATUS_OK           (0x00)
+#define SIM_STATUS_TIMEOUT      (0x01)  // target did not answer
+#define SIM_STATUS_AUTH_ERROR   (0x14)  // Mifare authentication failed
+#define SIM_STATUS_RELEASED     (0x29)  // the initiator released the target
+#define SIM_STATUS_MI           (0x40)  // more blocks of the initiator follow
+
+#define CLASSIC_BLOCK_SIZE      (16)
+#define CLASSIC_1K_BLOCKS       (64)
+#define CLASSIC_4K_BLOCKS       (256)
+#define ULTRALIGHT_PAGE_SIZE    (4)
+#define ULTRALIGHT_PAGES        (45)
+#define TYPE1_BLOCK_SIZE        (8)
+#define TYPE1_STATIC_SIZE       (120)   // blocks 0x00 - 0x0E, what RALL returns
+#define TYPE1_DYNAMIC_SIZE      (512)
+#define FELICA_BLOCK_SIZE       (16)
+#define FELICA_NDEF_SYSTEM_CODE (0x12FC)
+#define TYPE4_CC_FILE           (0xE103)
+#define TYPE4_NDEF_FILE         (0xE104)
+#define TYPE4_NDEF_OFFSET       (64)    // the CC file takes the start of memory
+#define DESFIRE_FIRST_AID       (0x010000)
+#define DESFIRE_FRAME           (59)
+
+// ISO14443B Max_Frame_Size codes 0 - 8
+static const uint16_t TYPE_B_FRAME_SIZES[9] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+static const uint8_t MAD_KEY_A[6] = { 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5 };
+static const uint8_t NDEF_KEY_A[6] = { 0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
+
+PN532_SIM::PN532_SIM()
+{
+    tagType = TAG_NONE;
+    uidLength = 0;
+    classicBlocks = 0;
+    authenticatedSector = -1;
+    type1Header = 0;
+    selectedFile = 0;
+    type4MaxLe = 0;
+    type4MaxLc = 0;
+    typeB = false;
+    typeBFrameCode = 0;
+    desfireApplications = 0;
+    desfireAid = 0;
+    desfirePending = 0;
+    desfirePendingLength = 0;
+    desfireFrame = 0;
+    responseLength = PN532_TIMEOUT;
+    commandCount = 0;
+    byteMicros = 0;
+    writesLeft = -1;
+    endlessPolls = false;
+    pollRunning = false;
+    abortCount = 0;
+    rawTarget = true;
+    readerFelica = false;
+    readerTimeoutMicros = 0;
+    readerCommandMicros = 0;
+    memset(memory, 0, sizeof(memory));
+    readerReset();
+}
+
+void PN532_SIM::begin()
+{
+}
+
+void PN532_SIM::wakeup()
+{
+}
+
+void PN532_SIM::insertMifareClassic(const uint8_t tagUid[4])
+{
+    formatMifareClassic(tagUid, CLASSIC_1K_BLOCKS);
+}
+
+void PN532_SIM::insertMifareClassic4K(const uint8_t tagUid[4])
+{
+    formatMifareClassic(tagUid, CLASSIC_4K_BLOCKS);
+}
+
+// sectors 0 - 31 have 4 blocks, 32 - 39 of a 4K tag have 16
+static uint16_t sectorOfBlock(uint16_t block)
+{
+    return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+}
+
+static uint16_t trailerOfSector(uint16_t sector)
+{
+    return sector < 32 ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+}
+
+void PN532_SIM::formatMifareClassic(const uint8_t tagUid[4], uint16_t blocks)
+{
+    bool mad2 = blocks == CLASSIC_4K_BLOCKS;
+
+    tagType = TAG_MIFARE_CLASSIC;
+    classicBlocks = blocks;
+    memcpy(uid, tagUid, 4);
+    uidLength = 4;
+    authenticatedSector = -1;
+    memset(memory, 0, sizeof(memory));
+
+    // manufacturer block: UID, BCC, SAK, ATQA
+    memcpy(memory, uid, 4);
+    memory[4] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+    memory[5] = mad2 ? 0x18 : 0x08;
+    memory[6] = mad2 ? 0x02 : 0x04;
+    memory[7] = 0x00;
+
+    // MAD: every sector holds the NDEF application 0x03E1
+    memory[16] = 0x00;  // CRC, not checked
+    memory[17] = 0x01;  // info byte
+    for (uint8_t i = 18; i < 48; i += 2) {
+        memory[i] = 0x03;
+        memory[i + 1] = 0xE1;
+    }
+    if (mad2) {
+        uint8_t *mad = memory + 64 * CLASSIC_BLOCK_SIZE;
+        for (uint8_t i = 2; i < 48; i += 2) {
+            mad[i] = 0x03;
+            mad[i + 1] = 0xE1;
+        }
+    }
+
+    uint16_t sectors = sectorOfBlock(blocks - 1) + 1;
+    for (uint16_t sector = 0; sector < sectors; sector++) {
+        bool madSector = sector == 0 || (mad2 && sector == 16);
+        uint8_t *trailer = memory + trailerOfSector(sector) * CLASSIC_BLOCK_SIZE;
+        memcpy(trailer, madSector ? MAD_KEY_A : NDEF_KEY_A, 6);
+        trailer[6] = 0x7F;
+        trailer[7] = 0x07;
+        trailer[8] = 0x88;
+        trailer[9] = sector == 0 ? (mad2 ? 0xC2 : 0xC1) : 0x40; // GPB: MAD version
+        memset(trailer + 10, 0xFF, 6);
+    }
+
+    // empty NDEF TLV and terminator in block 4
+    memory[64] = 0x03;
+    memory[65] = 0x00;
+    memory[66] = 0xFE;
+}
+
+void PN532_SIM::insertUltralight(const uint8_t tagUid[7])
+{
+    tagType = TAG_MIFARE_ULTRALIGHT;
+    memcpy(uid, tagUid, 7);
+    uidLength = 7;
+    memset(memory, 0, sizeof(memory));
+
+    memcpy(memory, uid, 3);
+    memory[3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+    memcpy(memory + 4, uid + 3, 4);
+    memory[8] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+    memory[9] = 0x48;
+
+    // capability container: NDEF 1.0, 144 bytes, read/write
+    memory[12] = 0xE1;
+    memory[13] = 0x10;
+    memory[14] = 0x12;
+    memory[15] = 0x00;
+
+    memory[16] = 0x03;
+    memory[17] = 0x00;
+    memory[18] = 0xFE;
+}
+
+void PN532_SIM::insertType1(const uint8_t tagUid[4], bool dynamic)
+{
+    // lock control (bytes 122 - 127), memory control (120 - 121), empty NDEF
+    static const uint8_t factoryTlvs[13] = {
+        0x01, 0x03, 0xF2, 0x30, 0x33, 0x02, 0x03, 0xF0, 0x02, 0x03, 0x03, 0x00, 0xFE
+    };
+
+    tagType = TAG_TYPE_1;
+    type1Header = dynamic ? 0x12 : 0x11;
+    memcpy(uid, tagUid, 4);
+    uidLength = 4;
+    memset(memory, 0, sizeof(memory));
+
+    memcpy(memory, uid, 4);
+
+    // capability container: NDEF 1.0, memory size, read/write
+    memory[8] = 0xE1;
+    memory[9] = 0x10;
+    memory[10] = dynamic ? TYPE1_DYNAMIC_SIZE / TYPE1_BLOCK_SIZE - 1 : 0x0E;
+    memory[11] = 0x00;
+
+    if (dynamic) {
+        memcpy(memory + 12, factoryTlvs, sizeof(factoryTlvs));
+    } else {
+        memory[12] = 0x03;
+        memory[13] = 0x00;
+        memory[14] = 0xFE;
+    }
+}
+
+void PN532_SIM::insertType3(const uint8_t idm[8], uint8_t readBlocks, uint8_t writeBlocks, uint16_t maxBlocks)
+{
+    tagType = TAG_TYPE_3;
+    memcpy(uid, idm, 8);
+    uidLength = 8;
+    memset(memory, 0, sizeof(memory));
+
+    if (maxBlocks > PN532_SIM_MEMORY_SIZE / FELICA_BLOCK_SIZE - 1) {
+        maxBlocks = PN532_SIM_MEMORY_SIZE / FELICA_BLOCK_SIZE - 1;
+    }
+
+    // attribute information block: version 1.0, Nbr, Nbw, Nmaxb, WriteF,
+    // RW flag, Ln and checksum
+    memory[0] = 0x10;
+    memory[1] = readBlocks;
+    memory[2] = writeBlocks;
+    memory[3] = maxBlocks >> 8;
+    memory[4] = maxBlocks & 0xFF;
+    memory[9] = 0x00;
+    memory[10] = 0x01;
+    uint16_t sum = 0;
+    for (uint8_t i = 0; i < 14; i++) {
+        sum += memory[i];
+    }
+    memory[14] = sum >> 8;
+    memory[15] = sum & 0xFF;
+}
+
+void PN532_SIM::insertType4(const uint8_t tagUid[7], uint16_t maxLe, uint16_t maxLc, uint16_t fileSize)
+{
+    tagType = TAG_TYPE_4;
+    memcpy(uid, tagUid, 7);
+    uidLength = 7;
+    typeB = false;
+    selectedFile = 0;
+    type4MaxLe = maxLe;
+    type4MaxLc = maxLc;
+    memset(memory, 0, sizeof(memory));
+
+    if (fileSize > PN532_SIM_MEMORY_SIZE - TYPE4_NDEF_OFFSET) {
+        fileSize = PN532_SIM_MEMORY_SIZE - TYPE4_NDEF_OFFSET;
+    }
+
+    // CC: length, mapping version 2.0, MLe, MLc, NDEF file control TLV
+    const uint8_t cc[15] = {
+        0x00, 0x0F, 0x20,
+        (uint8_t)(maxLe >> 8), (uint8_t)maxLe,
+        (uint8_t)(maxLc >> 8), (uint8_t)maxLc,
+        0x04, 0x06,
+        (uint8_t)(TYPE4_NDEF_FILE >> 8), (uint8_t)TYPE4_NDEF_FILE,
+        (uint8_t)(fileSize >> 8), (uint8_t)fileSize,
+        0x00, 0x00 // read and write access granted
+    };
+    memcpy(memory, cc, sizeof(cc));
+}
+
+void PN532_SIM::insertType4B(const uint8_t pupi[4], uint8_t frameSizeCode, uint16_t maxLe, uint16_t maxLc, uint16_t fileSize)
+{
+    uint8_t tagUid[7] = { pupi[0], pupi[1], pupi[2], pupi[3] };
+    insertType4(tagUid, maxLe, maxLc, fileSize);
+    uidLength = 4;
+    typeB = true;
+    typeBFrameCode = frameSizeCode < 8 ? frameSizeCode : 8;
+}
+
+void PN532_SIM::insertDesfire(const uint8_t tagUid[7], uint8_t applications)
+{
+    tagType = TAG_DESFIRE;
+    memcpy(uid, tagUid, 7);
+    uidLength = 7;
+    typeB = false;
+    desfireApplications = applications < 28 ? applications : 28;
+    desfireAid = 0;
+    desfirePendingLength = 0;
+    memset(memory, 0, sizeof(memory));
+
+    // file contents of the first application: 0 at 0, 1 at 256, 2 at 512
+    for (uint16_t i = 0; i < 200; i++) {
+        memory[i] = i;
+    }
+    for (uint16_t i = 0; i < 32; i++) {
+        memory[256 + i] = 0xB0 + i;
+    }
+    memset(memory + 512, 0x5E, 16);
+}
+
+void PN532_SIM::readerReset()
+{
+    readerScriptLength = 0;
+    readerPosition = 0;
+    readerBlock = 0;
+    readerRepliesLength = 0;
+    readerPending = 0;
+    readerResponses = 0;
+    targetActivations = 0;
+}
+
+bool PN532_SIM::readerQueue(const uint8_t *apdu, uint16_t length)
+{
+    if ((uint32_t)readerScriptLength + 2 + length > sizeof(readerScript)) {
+        return false;
+    }
+    readerScript[readerScriptLength++] = length >> 8;
+    readerScript[readerScriptLength++] = length & 0xFF;
+    memcpy(readerScript + readerScriptLength, apdu, length);
+    readerScriptLength += length;
+    return true;
+}
+
+const uint8_t *PN532_SIM::getReaderResponse(uint8_t index, uint16_t *length)
+{
+    uint16_t position = 0;
+    for (uint8_t i = 0; i < readerResponses; i++) {
+        uint16_t replyLength = (readerReplies[position] << 8) | readerReplies[position + 1];
+        if (i == index) {
+            *length = replyLength;
+            return readerReplies + position + 2;
+        }
+        position += 2 + replyLength;
+    }
+    *length = 0;
+    return 0;
+}
+
+int8_t PN532_SIM::writeCommand(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
+{
+    uint8_t command[2 * 0xFF];
+    if (hlen + blen > sizeof(command)) {
+        return PN532_INVALID_FRAME;
+    }
+    memcpy(command, header, hlen);
+    if (blen) {
+        memcpy(command + hlen, body, blen);
+    }
+    uint8_t length = hlen + blen;
+
+    // the command frame (7 bytes around TFI and data) and the 6 byte ACK
+    if (byteMicros) {
+        delayMicroseconds((uint32_t)byteMicros * (length + 1 + 7 + 6));
+    }
+
+    if (pollRunning) {
+        return PN532_INVALID_ACK; // busy polling, no ACK
+    }
+
+    commandCount++;
+    responseLength = 0;
+
+    switch (command[0]) {
+    case PN532_COMMAND_GETFIRMWAREVERSION:
+        response[0] = 0x32;
+        response[1] = 0x01;
+        response[2] = 0x06;
+        response[3] = 0x07;
+        responseLength = 4;
+        break;
+    case PN532_COMMAND_SAMCONFIGURATION:
+    case PN532_COMMAND_RFCONFIGURATION:
+        break;
+    case PN532_COMMAND_INLISTPASSIVETARGET:
+        inListPassiveTarget(command, length);
+        if (endlessPolls && responseLength == 1 && response[0] == 0) {
+            responseLength = PN532_TIMEOUT;
+            pollRunning = true;
+        }
+        break;
+    case PN532_COMMAND_INDATAEXCHANGE:
+        inDataExchange(command, length);
+        break;
+    case PN532_COMMAND_TGINITASTARGET:
+    case PN532_COMMAND_TGGETDATA:
+    case PN532_COMMAND_TGSETDATA:
+    case PN532_COMMAND_TGSETMETADATA:
+    case PN532_COMMAND_TGGETINITIATORCOMMAND:
+    case PN532_COMMAND_TGRESPONSETOINITIATOR:
+        target(command, length);
+        break;
+    case PN532_COMMAND_INRELEASE:
+        authenticatedSector = -1;
+        response[0] = SIM_STATUS_OK;
+        responseLength = 1;
+        break;
+    default:
+        DMSG("PN532_SIM: unsupported command ");
+        DMSG_HEX(command[0]);
+        responseLength = PN532_TIMEOUT;
+        break;
+    }
+
+    return 0;
+}
+
+void PN532_SIM::abortCommand()
+{
+    if (byteMicros) {
+        delayMicroseconds((uint32_t)byteMicros * 6);
+    }
+    pollRunning = false;
+    responseLength = PN532_TIMEOUT;
+    abortCount++;
+}
+
+int16_t PN532_SIM::readResponse(uint8_t buf[], uint8_t len, uint16_t timeout)
+{
+    (void)timeout;
+
+    int16_t length = responseLength;
+    responseLength = PN532_TIMEOUT; // one response per command
+
+    if (length < 0) {
+        return length;
+    }
+    if (length > len) {
+        return PN532_NO_SPACE;
+    }
+    if (byteMicros) {
+        delayMicroseconds((uint32_t)byteMicros * (length + 2 + 7));
+    }
+    memcpy(buf, response, length);
+    return length;
+}
+
+void PN532_SIM::inListPassiveTarget(const uint8_t *command, uint8_t length)
+{
+    if (length >= 8 && command[2] == 1) {
+        // FeliCa 212 kbps polling, answered by a Type 3 tag with a matching system code
+        uint16_t systemCode = (command[4] << 8) | command[5];
+        if (tagType != TAG_TYPE_3 || (systemCode != 0xFFFF && systemCode != FELICA_NDEF_SYSTEM_CODE)) {
+            response[0] = 0;
+            responseLength = 1;
+            return;
+        }
+        response[0] = 1;    // NbTg
+        response[1] = 1;    // Tg
+        response[2] = 18;   // POL_RES length
+        response[3] = 0x01; // response code
+        memcpy(response + 4, uid, 8);
+        memset(response + 12, 0, 8); // PMm
+        responseLength = 20;
+        if (command[6] == 1) {
+            response[2] = 20;
+            response[20] = FELICA_NDEF_SYSTEM_CODE >> 8;
+            response[21] = FELICA_NDEF_SYSTEM_CODE & 0xFF;
+            responseLength = 22;
+        }
+        return;
+    }
+
+    if (length >= 4 && command[2] == PN532_ISO14443B) {
+        // the card is in no application family, only AFI 0x00 requests reach it
+        if (tagType != TAG_TYPE_4 || !typeB || command[3] != 0x00) {
+            response[0] = 0;
+            responseLength = 1;
+            return;
+        }
+        response[0] = 1;    // NbTg
+        response[1] = 1;    // Tg
+        response[2] = 0x50; // ATQB
+        memcpy(response + 3, uid, 4);
+        memset(response + 7, 0, 4); // application data
+        response[11] = 0x00; // bit rates
+        response[12] = (typeBFrameCode << 4) | 0x01; // ISO 14443-4
+        response[13] = 0x71; // FWI, ADC, FO
+        response[14] = 1;    // ATTRIB_RES
+        response[15] = 0x00;
+        responseLength = 16;
+        selectedFile = 0;
+        return;
+    }
+
+    if (length >= 3 && command[2] == PN532_INNOVISION_JEWEL) {
+        if (tagType != TAG_TYPE_1) {
+            response[0] = 0;
+            responseLength = 1;
+            return;
+        }
+        response[0] = 1;    // NbTg
+        response[1] = 1;    // Tg
+        response[2] = 0x0C; // SENS_RES
+        response[3] = 0x00;
+        memcpy(response + 4, uid, 4);
+        responseLength = 8;
+        return;
+    }
+
+    if (length < 3 || command[2] != PN532_MIFARE_ISO14443A || tagType == TAG_NONE ||
+        tagType == TAG_TYPE_1 || tagType == TAG_TYPE_3 || typeB) {
+        response[0] = 0; // no target found
+        responseLength = 1;
+        return;
+    }
+
+    response[0] = 1;    // NbTg
+    response[1] = 1;    // Tg
+    response[2] = 0x00; // SENS_RES
+    if (tagType == TAG_MIFARE_CLASSIC) {
+        response[3] = memory[6];
+        response[4] = memory[5]; // SEL_RES
+    } else if (tagType == TAG_TYPE_4 || tagType == TAG_DESFIRE) {
+        response[2] = 0x03;
+        response[3] = 0x44;
+        response[4] = 0x20; // ISO 14443-4
+        selectedFile = 0;
+    } else {
+        response[3] = 0x44;
+        response[4] = 0x00;
+    }
+    response[5] = uidLength;
+    memcpy(response + 6, uid, uidLength);
+    responseLength = 6 + uidLength;
+    authenticatedSector = -1;
+}
+
+void PN532_SIM::inDataExchange(const uint8_t *command, uint8_t length)
+{
+    response[0] = SIM_STATUS_TIMEOUT;
+    responseLength = 1;
+
+    if (length < 4 || command[1] != 1) {
+        return;
+    }
+
+    if (tagType == TAG_MIFARE_CLASSIC) {
+        mifareClassic(command + 2, length - 2);
+    } else if (tagType == TAG_MIFARE_ULTRALIGHT) {
+        mifareUltralight(command + 2, length - 2);
+    } else if (tagType == TAG_TYPE_1) {
+        jewel(command + 2, length - 2);
+    } else if (tagType == TAG_TYPE_3) {
+        felica(command + 2, length - 2);
+    } else if (tagType == TAG_TYPE_4) {
+        if (typeB && length - 2 + 4 > TYPE_B_FRAME_SIZES[typeBFrameCode]) {
+            return; // would need chaining
+        }
+        type4(command + 2, length - 2);
+    } else if (tagType == TAG_DESFIRE) {
+        desfire(command + 2, length - 2);
+    }
+}
+
+void PN532_SIM::mifareClassic(const uint8_t *command, uint8_t length)
+{
+    uint16_t block = command[1];
+    if (block >= classicBlocks) {
+        return;
+    }
+    uint16_t sector = sectorOfBlock(block);
+    uint8_t *data = memory + block * CLASSIC_BLOCK_SIZE;
+    const uint8_t *trailer = memory + trailerOfSector(sector) * CLASSIC_BLOCK_SIZE;
+
+    switch (command[0]) {
+    case MIFARE_CMD_AUTH_A:
+    case MIFARE_CMD_AUTH_B:
+        if (length < 8 + uidLength) {
+            return;
+        }
+        if (memcmp(command + 2, trailer + (command[0] == MIFARE_CMD_AUTH_A ? 0 : 10), 6) == 0 &&
+            memcmp(command + 8, uid, uidLength) == 0) {
+            authenticatedSector = sector;
+            response[0] = SIM_STATUS_OK;
+        } else {
+            authenticatedSector = -1;
+            response[0] = SIM_STATUS_AUTH_ERROR;
+        }
+        break;
+    case MIFARE_CMD_READ:
+        if (authenticatedSector != sector) {
+            return;
+        }
+        response[0] = SIM_STATUS_OK;
+        memcpy(response + 1, data, CLASSIC_BLOCK_SIZE);
+        if (block == trailerOfSector(sector)) {
+            memset(response + 1, 0, 6); // key A is never readable
+        }
+        responseLength = 1 + CLASSIC_BLOCK_SIZE;
+        break;
+    case MIFARE_CMD_WRITE:
+        if (authenticatedSector != sector || block == 0 || length < 2 + CLASSIC_BLOCK_SIZE || !writeReachesTag()) {
+            return;
+        }
+        memcpy(data, command + 2, CLASSIC_BLOCK_SIZE);
+        response[0] = SIM_STATUS_OK;
+        break;
+    }
+}
+
+void PN532_SIM::mifareUltralight(const uint8_t *command, uint8_t length)
+{
+    uint8_t page = command[1];
+    if (page >= ULTRALIGHT_PAGES) {
+        return; // NAK
+    }
+
+    switch (command[0]) {
+    case MIFARE_CMD_READ:
+        // four pages, rolling over to page 0 past the end
+        response[0] = SIM_STATUS_OK;
+        for (uint8_t i = 0; i < 4; i++) {
+            memcpy(response + 1 + i * ULTRALIGHT_PAGE_SIZE,
+                   memory + ((page + i) % ULTRALIGHT_PAGES) * ULTRALIGHT_PAGE_SIZE,
+                   ULTRALIGHT_PAGE_SIZE);
+        }
+        responseLength = 1 + 4 * ULTRALIGHT_PAGE_SIZE;
+        break;
+    case MIFARE_CMD_WRITE_ULTRALIGHT:
+        if (page < 2 || length < 2 + ULTRALIGHT_PAGE_SIZE || !writeReachesTag()) {
+            return;
+        }
+        if (page < 4) {
+            // lock bytes and capability container are one time programmable,
+            // the first half of page 2 belongs to the UID and is read only
+            for (uint8_t i = page == 2 ? 2 : 0; i < ULTRALIGHT_PAGE_SIZE; i++) {
+                memory[page * ULTRALIGHT_PAGE_SIZE + i] |= command[2 + i];
+            }
+        } else {
+            memcpy(memory + page * ULTRALIGHT_PAGE_SIZE, command + 2, ULTRALIGHT_PAGE_SIZE);
+        }
+        response[0] = SIM_STATUS_OK;
+        break;
+    }
+}
+
+// false once the writes tearAfterWrites allowed are used up
+bool PN532_SIM::writeReachesTag()
+{
+    if (writesLeft < 0) {
+        return true;
+    }
+    if (writesLeft == 0) {
+        return false;
+    }
+    writesLeft--;
+    return true;
+}
+
+// RALL, READ8, WRITE-E and WRITE-E8, each ending with the 4 byte UID.
+// READ8 and WRITE-E8 only work on dynamic memory tags.
+void PN532_SIM::jewel(const uint8_t *command, uint8_t length)
+{
+    bool dynamic = type1Header != 0x11;
+    uint16_t size = dynamic ? TYPE1_DYNAMIC_SIZE : TYPE1_STATIC_SIZE;
+
+    if (length < 7 || memcmp(command + length - 4, uid, 4) != 0) {
+        return;
+    }
+
+    uint16_t address = command[1];
+    switch (command[0]) {
+    case JEWEL_CMD_RALL:
+        response[0] = SIM_STATUS_OK;
+        response[1] = type1Header;
+        response[2] = 0x00; // HR1
+        memcpy(response + 3, memory, TYPE1_STATIC_SIZE);
+        responseLength = 3 + TYPE1_STATIC_SIZE;
+        break;
+    case JEWEL_CMD_READ8:
+        if (!dynamic || length != 14 || (address + 1) * TYPE1_BLOCK_SIZE > size) {
+            return;
+        }
+        response[0] = SIM_STATUS_OK;
+        response[1] = address;
+        memcpy(response + 2, memory + address * TYPE1_BLOCK_SIZE, TYPE1_BLOCK_SIZE);
+        responseLength = 2 + TYPE1_BLOCK_SIZE;
+        break;
+    case JEWEL_CMD_WRITE_E:
+        // blocks 0x00 and 0x0D - 0x0F are not writable this way
+        if (length != 7 || address < TYPE1_BLOCK_SIZE || address >= 0x0D * TYPE1_BLOCK_SIZE) {
+            return;
+        }
+        memory[address] = command[2];
+        response[0] = SIM_STATUS_OK;
+        response[1] = address;
+        response[2] = command[2];
+        responseLength = 3;
+        break;
+    case JEWEL_CMD_WRITE_E8:
+        if (!dynamic || length != 14 || address == 0 || (address + 1) * TYPE1_BLOCK_SIZE > size ||
+            (address >= 0x0D && address <= 0x0F)) {
+            return;
+        }
+        memcpy(memory + address * TYPE1_BLOCK_SIZE, command + 2, TYPE1_BLOCK_SIZE);
+        response[0] = SIM_STATUS_OK;
+        response[1] = address;
+        memcpy(response + 2, command + 2, TYPE1_BLOCK_SIZE);
+        responseLength = 2 + TYPE1_BLOCK_SIZE;
+        break;
+    }
+}
+
+// Read and Write Without Encryption of the NDEF services with 2 byte block
+// list elements. command starts with the length byte felica_SendCommand
+// puts in front, so does the response after the PN532 status.
+void PN532_SIM::felica(const uint8_t *command, uint8_t length)
+{
+    if (length < 12 || command[0] != length || memcmp(command + 2, uid, 8) != 0) {
+        return;
+    }
+
+    uint8_t code = command[1];
+    uint8_t services = command[10];
+    const uint8_t *p = command + 11 + 2 * services;
+    uint8_t blocks = p[0];
+    const uint8_t *blockList = p + 1;
+    uint16_t maxBlocks = (memory[3] << 8) | memory[4];
+    uint8_t status1 = 0x00;
+
+    if (blocks == 0 || blocks > (code == FELICA_CMD_READ_WITHOUT_ENCRYPTION ? memory[1] : memory[2])) {
+        status1 = 0xFF; // too many blocks for one command
+    }
+    for (uint8_t i = 0; i < blocks && status1 == 0; i++) {
+        if (blockList[2 * i] != 0x80 || blockList[2 * i + 1] > maxBlocks) {
+            status1 = 0xFF;
+        }
+    }
+
+    uint8_t n = 0;
+    response[n++] = SIM_STATUS_OK;
+    response[n++] = 0; // length, filled in below
+    response[n++] = code + 1;
+    memcpy(response + n, uid, 8);
+    n += 8;
+    response[n++] = status1;
+    response[n++] = status1 ? 0xA2 : 0x00;
+
+    if (code == FELICA_CMD_READ_WITHOUT_ENCRYPTION) {
+        if (status1 == 0) {
+            response[n++] = blocks;
+            for (uint8_t i = 0; i < blocks; i++) {
+                memcpy(response + n, memory + blockList[2 * i + 1] * FELICA_BLOCK_SIZE, FELICA_BLOCK_SIZE);
+                n += FELICA_BLOCK_SIZE;
+            }
+        }
+    } else if (code == FELICA_CMD_WRITE_WITHOUT_ENCRYPTION) {
+        const uint8_t *data = blockList + 2 * blocks;
+        if (status1 == 0 && data + blocks * FELICA_BLOCK_SIZE <= command + length) {
+            for (uint8_t i = 0; i < blocks; i++) {
+                memcpy(memory + blockList[2 * i + 1] * FELICA_BLOCK_SIZE, data + i * FELICA_BLOCK_SIZE, FELICA_BLOCK_SIZE);
+            }
+        }
+    } else {
+        return;
+    }
+
+    response[1] = n - 1;
+    responseLength = n;
+}
+
+// Answers SELECT, READ BINARY and UPDATE BINARY with short APDUs, the
+// response is the PN532 status, data and SW1 SW2
+void PN532_SIM::type4(const uint8_t *apdu, uint8_t length)
+{
+    static const uint8_t ndefAid[7] = { 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
+    uint16_t sw = 0x6D00; // instruction not supported
+    uint8_t dataLength = 0;
+
+    if (length < 4) {
+        return;
+    }
+
+    uint16_t ccFileSize = (memory[0] << 8) | memory[1];
+    uint16_t ndefFileSize = (memory[11] << 8) | memory[12];
+    uint16_t fileSize = selectedFile == TYPE4_CC_FILE ? ccFileSize : ndefFileSize;
+    uint8_t *file = memory + (selectedFile == TYPE4_CC_FILE ? 0 : TYPE4_NDEF_OFFSET);
+    uint16_t offset = (apdu[2] << 8) | apdu[3];
+    uint8_t lc = length > 5 ? apdu[4] : 0;
+
+    switch (apdu[1]) {
+    case 0xA4: // SELECT
+        if (apdu[2] == 0x04 && lc == sizeof(ndefAid) && memcmp(apdu + 5, ndefAid, lc) == 0) {
+            selectedFile = 0xFFFF; // the application, no file yet
+            sw = 0x9000;
+        } else if (apdu[2] == 0x00 && lc == 2 && selectedFile) {
+            uint16_t id = (apdu[5] << 8) | apdu[6];
+            sw = 0x6A82; // file not found
+            if (id == TYPE4_CC_FILE || id == TYPE4_NDEF_FILE) {
+                selectedFile = id;
+                sw = 0x9000;
+            }
+        } else {
+            sw = 0x6A82;
+        }
+        break;
+    case 0xB0: // READ BINARY, Le is the last byte
+        dataLength = apdu[length - 1];
+        if (selectedFile != TYPE4_CC_FILE && selectedFile != TYPE4_NDEF_FILE) {
+            sw = 0x6986; // no current file
+            dataLength = 0;
+        } else if (dataLength > type4MaxLe || dataLength > sizeof(response) - 3 || offset + dataLength > fileSize) {
+            sw = 0x6700; // wrong length
+            dataLength = 0;
+        } else {
+            memcpy(response + 1, file + offset, dataLength);
+            sw = 0x9000;
+        }
+        break;
+    case 0xD6: // UPDATE BINARY
+        if (selectedFile != TYPE4_NDEF_FILE) {
+            sw = 0x6982; // security status not satisfied
+        } else if (lc > type4MaxLc || length < 5 + lc || offset + lc > fileSize) {
+            sw = 0x6700;
+        } else {
+            memcpy(file + offset, apdu + 5, lc);
+            sw = 0x9000;
+        }
+        break;
+    }
+
+    response[0] = SIM_STATUS_OK;
+    response[1 + dataLength] = sw >> 8;
+    response[2 + dataLength] = sw & 0xFF;
+    responseLength = 3 + dataLength;
+}
+
+// Native DESFire commands wrapped in ISO 7816-4 (CLA 0x90), the response is
+// the PN532 status, data and 0x91 with the DESFire status. Answers longer
+// than a frame are continued with additional frame requests.
+void PN532_SIM::desfire(const uint8_t *apdu, uint8_t length)
+{
+    // type, communication, access rights (LSB first), size (3), for files 0 - 2
+    static const uint8_t fileSettings[3][7] = {
+        { 0x00, 0x00, 0xEE, 0xEE, 200, 0, 0 },
+        { 0x01, 0x00, 0xEE, 0xEE, 32, 0, 0 },
+        { 0x00, 0x03, 0x00, 0x00, 16, 0, 0 }
+    };
+    static const uint16_t fileOffsets[3] = { 0, 256, 512 };
+
+    if (length < 5 || apdu[0] != 0x90) {
+        return;
+    }
+    uint8_t lc = length > 5 ? apdu[4] : 0;
+    const uint8_t *data = apdu + 5;
+    uint8_t status = 0x00;
+    bool inFirstApplication = desfireAid == DESFIRE_FIRST_AID && desfireApplications > 0;
+
+    if (apdu[1] != 0xAF) {
+        desfirePending = desfireReply;
+        desfirePendingLength = 0;
+        desfireFrame = DESFIRE_FRAME;
+    }
+
+    switch (apdu[1]) {
+    case 0x60: // GetVersion: hardware, software, then UID, batch and date
+        {
+            static const uint8_t version[14] = {
+                0x04, 0x01, 0x01, 0x01, 0x00, 0x1A, 0x05,
+                0x04, 0x01, 0x01, 0x01, 0x04, 0x1A, 0x05
+            };
+            memcpy(desfireReply, version, sizeof(version));
+            memcpy(desfireReply + 14, uid, 7);
+            memset(desfireReply + 21, 0xBA, 5);
+            desfireReply[26] = 0x21;
+            desfireReply[27] = 0x19;
+            desfirePending = desfireReply;
+            desfirePendingLength = 28;
+            desfireFrame = 7;
+        }
+        break;
+    case 0x6A: // GetApplicationIDs, 19 per frame
+        if (desfireAid != 0) {
+            status = 0x9D;
+            break;
+        }
+        for (uint8_t i = 0; i < desfireApplications; i++) {
+            uint32_t aid = DESFIRE_FIRST_AID + i;
+            desfireReply[3 * i] = aid;
+            desfireReply[3 * i + 1] = aid >> 8;
+            desfireReply[3 * i + 2] = aid >> 16;
+        }
+        desfirePending = desfireReply;
+        desfirePendingLength = 3 * desfireApplications;
+        desfireFrame = 3 * 19;
+        break;
+    case 0x5A: // SelectApplication
+        {
+            uint32_t aid = lc == 3 ? data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) : 0xFFFFFFFF;
+            if (aid == 0 || (aid >= DESFIRE_FIRST_AID && aid < DESFIRE_FIRST_AID + (uint32_t)desfireApplications)) {
+                desfireAid = aid;
+            } else {
+                status = 0xA0;
+            }
+        }
+        break;
+    case 0x6F: // GetFileIDs
+        if (desfireAid == 0) {
+            status = 0x9D;
+        } else if (inFirstApplication) {
+            desfireReply[0] = 0;
+            desfireReply[1] = 1;
+            desfireReply[2] = 2;
+            desfirePending = desfireReply;
+            desfirePendingLength = 3;
+        }
+        break;
+    case 0xF5: // GetFileSettings
+        if (!inFirstApplication || lc != 1 || data[0] > 2) {
+            status = 0xF0;
+            break;
+        }
+        desfirePending = fileSettings[data[0]];
+        desfirePendingLength = 7;
+        break;
+    case 0xBD: // ReadData: file, offset (3), length (3, 0 for the rest)
+        {
+            if (!inFirstApplication || lc != 7 || data[0] > 2) {
+                status = 0xF0;
+                break;
+            }
+            const uint8_t *settings = fileSettings[data[0]];
+            uint32_t offset = data[1] | ((uint32_t)data[2] << 8) | ((uint32_t)data[3] << 16);
+            uint32_t count = data[4] | ((uint32_t)data[5] << 8) | ((uint32_t)data[6] << 16);
+            if (settings[1] != 0x00) {
+                status = 0xAE; // authentication error
+            } else if (offset >= settings[4] || offset + count > settings[4]) {
+                status = 0xBE;
+            } else {
+                desfirePending = memory + fileOffsets[data[0]] + offset;
+                desfirePendingLength = count ? count : settings[4] - offset;
+            }
+        }
+        break;
+    case 0xAF: // additional frame
+        if (desfirePendingLength == 0) {
+            status = 0x1C; // illegal command
+        }
+        break;
+    default:
+        status = 0x1C;
+        break;
+    }
+
+    uint8_t n = 0;
+    response[n++] = SIM_STATUS_OK;
+    if (status == 0x00) {
+        uint8_t frame = desfirePendingLength < desfireFrame ? desfirePendingLength : desfireFrame;
+        if (desfireFrame == 7 && desfirePendingLength == 14) {
+            frame = 14; // GetVersion sends UID, batch and date together
+        }
+        memcpy(response + n, desfirePending, frame);
+        n += frame;
+        desfirePending += frame;
+        desfirePendingLength -= frame;
+        if (desfirePendingLength) {
+            status = 0xAF;
+        }
+    }
+    response[n++] = 0x91;
+    response[n++] = status;
+    responseLength = n;
+}
+
+// The reader side of card emulation. TgInitAsTarget only succeeds while
+// C-APDUs are queued and no tag is inserted.
+void PN532_SIM::target(const uint8_t *command, uint8_t length)
+{
+    switch (command[0]) {
+    case PN532_COMMAND_TGINITASTARGET:
+        targetActivations++;
+        if (tagType != TAG_NONE || readerPosition >= readerScriptLength) {
+            responseLength = PN532_TIMEOUT;
+            return;
+        }
+        if (readerFelica) {
+            // FeliCaParams: IDm, PMm and the system code in bytes 24 and 25
+            if (length < 26 || (command[24] | command[25]) == 0) {
+                responseLength = PN532_TIMEOUT;
+                return;
+            }
+            response[0] = 0x12; // 212 kbps, FeliCa framing
+            readerNext(response + 1);
+            responseLength += 1;
+            return;
+        }
+        if (rawTarget && length > 7 && !(command[7] & 0x20)) {
+            response[0] = 0x00; // 106 kbps, Mifare framing
+            readerNext(response + 1);
+            responseLength += 1;
+            return;
+        }
+        response[0] = 0x08; // 106 kbps, ISO/IEC 14443-4 PICC
+        response[1] = 0xE0; // RATS
+        response[2] = 0x80;
+        responseLength = 3;
+        break;
+    case PN532_COMMAND_TGGETDATA:
+    case PN532_COMMAND_TGGETINITIATORCOMMAND:
+        if (readerPosition >= readerScriptLength) {
+            response[0] = SIM_STATUS_RELEASED;
+            responseLength = 1;
+            return;
+        }
+        if (command[0] == PN532_COMMAND_TGGETDATA) {
+            // the next block of the C-APDU
+            uint16_t apduLength = (readerScript[readerPosition] << 8) | readerScript[readerPosition + 1];
+            uint16_t block = apduLength - readerBlock;
+            response[0] = SIM_STATUS_OK;
+            if (block > PN532_SIM_READER_BLOCK) {
+                block = PN532_SIM_READER_BLOCK;
+                response[0] = SIM_STATUS_MI;
+            }
+            memcpy(response + 1, readerScript + readerPosition + 2 + readerBlock, block);
+            responseLength = 1 + block;
+            readerBlock += block;
+            if (readerBlock == apduLength) {
+                readerPosition += 2 + apduLength;
+                readerBlock = 0;
+            }
+            readerCommandMicros = micros();
+            return;
+        }
+        response[0] = SIM_STATUS_OK;
+        readerNext(response + 1);
+        responseLength += 1;
+        break;
+    case PN532_COMMAND_TGSETDATA:
+    case PN532_COMMAND_TGSETMETADATA:
+    case PN532_COMMAND_TGRESPONSETOINITIATOR:
+        if (readerTimeoutMicros && micros() - readerCommandMicros > readerTimeoutMicros) {
+            // too late, the reader has left
+            readerPosition = readerScriptLength;
+            response[0] = SIM_STATUS_TIMEOUT;
+            responseLength = 1;
+            return;
+        }
+        // blocks of the R-APDU go behind its length, which is set with the last one
+        if ((size_t)(readerRepliesLength + 2 + readerPending + length - 1) <= sizeof(readerReplies)) {
+            memcpy(readerReplies + readerRepliesLength + 2 + readerPending, command + 1, length - 1);
+            readerPending += length - 1;
+            if (command[0] != PN532_COMMAND_TGSETMETADATA) {
+                readerReplies[readerRepliesLength] = readerPending >> 8;
+                readerReplies[readerRepliesLength + 1] = readerPending & 0xFF;
+                readerRepliesLength += 2 + readerPending;
+                readerPending = 0;
+                readerResponses++;
+            }
+        }
+        response[0] = SIM_STATUS_OK;
+        responseLength = 1;
+        break;
+    }
+}
+
+// the next queued command to buf, responseLength is its length
+void PN532_SIM::readerNext(uint8_t *buf)
+{
+    uint16_t length = (readerScript[readerPosition] << 8) | readerScript[readerPosition + 1];
+    memcpy(buf, readerScript + readerPosition + 2, length);
+    responseLength = length;
+    readerPosition += 2 + length;
+    readerCommandMicros = micros();
+}
@@ -0,0 +1,189 @@
+
+#ifndef __PN532_SIM_H__
+#define __PN532_SIM_H__
+
+#include "PN532Interface.h"
+
+#define PN532_SIM_MEMORY_SIZE   (4096)
+// data of one ISO-DEP block the simulated reader sends, longer C-APDUs are chained
+#define PN532_SIM_READER_BLOCK  (0xF0)
+
+/**
+ * PN532 transport for host builds. Instead of talking to a chip it answers
+ * the commands PN532.cpp sends with a simulated tag in the field: a formatted
+ * Mifare Classic 1K or 4K, a Topaz Type 1 tag, an NTAG213 style Type 2 tag,
+ * a FeliCa Type 3 tag, a Type 4 tag or a DESFire card. Only
+ * the reader side commands the NDEF library uses are handled, anything else
+ * times out. For card emulation it plays the reader instead, see
+ * readerQueue.
+ */
+class PN532_SIM : public PN532Interface {
+public:
+    enum TagType {
+        TAG_NONE,
+        TAG_MIFARE_CLASSIC,
+        TAG_MIFARE_ULTRALIGHT,
+        TAG_TYPE_1,
+        TAG_TYPE_3,
+        TAG_TYPE_4,
+        TAG_DESFIRE
+    };
+
+    PN532_SIM();
+
+    void begin();
+    void wakeup();
+    int8_t writeCommand(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
+    int16_t readResponse(uint8_t buf[], uint8_t len, uint16_t timeout);
+    void abortCommand();
+
+    // Mifare Classic 1K, MAD in sector 0 and empty NDEF in sectors 1-15
+    void insertMifareClassic(const uint8_t uid[4]);
+
+    // Mifare Classic 4K, MAD1 in sector 0, MAD2 in sector 16 and empty NDEF
+    // in the other 38 sectors
+    void insertMifareClassic4K(const uint8_t uid[4]);
+
+    // Topaz Type 1 tag holding an empty NDEF message. Static: 120 bytes, HR0
+    // 0x11. Dynamic: Topaz 512, HR0 0x12, lock and memory control TLVs in
+    // front of the NDEF TLV.
+    void insertType1(const uint8_t uid[4], bool dynamic);
+
+    // NTAG213: 45 pages, 144 bytes of user memory holding an empty NDEF message
+    void insertUltralight(const uint8_t uid[7]);
+
+    // FeliCa Lite style Type 3 tag: system code 12FC, an attribute block for
+    // an empty message and maxBlocks data blocks. readBlocks and writeBlocks
+    // are Nbr and Nbw, the most blocks one command may move.
+    void insertType3(const uint8_t idm[8], uint8_t readBlocks, uint8_t writeBlocks, uint16_t maxBlocks);
+
+    // ISO-DEP tag with the NDEF application: CC file E103 and an empty NDEF
+    // file E104 of fileSize bytes. maxLe and maxLc go into the CC.
+    void insertType4(const uint8_t uid[7], uint16_t maxLe, uint16_t maxLc, uint16_t fileSize);
+
+    // the same as an ISO14443B card with a 4 byte PUPI, frameSizeCode is
+    // the ATQB Max_Frame_Size. Commands longer than one frame of the card
+    // time out, I-block chaining is not simulated.
+    void insertType4B(const uint8_t pupi[4], uint8_t frameSizeCode, uint16_t maxLe, uint16_t maxLc, uint16_t fileSize);
+
+    // MIFARE DESFire EV1 with the given number of applications, AID 0x010000
+    // and up. The first one holds a 200 byte standard and a 32 byte backup
+    // data file (plain, free read) and a 16 byte enciphered file. Long
+    // answers come in frames of up to 59 bytes.
+    void insertDesfire(const uint8_t uid[7], uint8_t applications);
+
+    void removeTag() { tagType = TAG_NONE; }
+
+    // Card emulation: with no tag inserted a reader activates the PN532 as a
+    // target and sends the queued C-APDUs, one per TgGetData; longer ones
+    // come in blocks of PN532_SIM_READER_BLOCK bytes with MI set on all but the
+    // last. The R-APDU of each TgSetData is kept, with the blocks of the
+    // TgSetMetaData before it. Once the queue is empty the reader leaves and
+    // TgGetData fails.
+    void readerReset();
+    bool readerQueue(const uint8_t *apdu, uint16_t length);
+    // R-APDU the emulator sent for the index-th C-APDU, 0 if there is none
+    const uint8_t *getReaderResponse(uint8_t index, uint16_t *length);
+    const uint8_t *getReaderResponse(uint8_t index, uint8_t *length) {
+        uint16_t fullLength;
+        const uint8_t *reply = getReaderResponse(index, &fullLength);
+        *length = fullLength;
+        return reply;
+    }
+    uint8_t getReaderResponseCount() const { return readerResponses; }
+    // TgInitAsTarget commands the emulator sent since readerReset
+    uint32_t getTargetActivations() const { return targetActivations; }
+    // A target without ISO-DEP (SEL_RES bit 5 clear) is activated with the
+    // first queued command, TgGetInitiatorCommand hands out the others and
+    // TgResponseToInitiator answers like TgSetData. false plays a firmware
+    // that activates every target with RATS.
+    void setRawTargetSupport(bool supported) { rawTarget = supported; }
+    // the reader polls FeliCa at 212 kbps and only activates targets with a
+    // system code in their FeliCaParams, handing them raw FeliCa frames
+    void setReaderFelica(bool felica) { readerFelica = felica; }
+    // the reader gives up when an answer takes longer than this from its
+    // command, transport time included; 0 (the default) waits forever
+    void setReaderTimeoutMicros(uint32_t micros) { readerTimeoutMicros = micros; }
+
+    uint8_t *getMemory() { return memory; }
+
+    // the tag leaves the field after this many more Mifare Classic block or
+    // Ultralight page writes, the writes after them are lost; -1 (the
+    // default) never
+    void tearAfterWrites(int16_t writes) { writesLeft = writes; }
+
+    // time one byte takes on the host link, 0 (instant) by default; HSU at
+    // 115200 baud is about 87. Frames and ACKs are delayed by their length.
+    void setByteMicros(uint16_t micros) { byteMicros = micros; }
+
+    // number of commands answered, for counting round trips
+    uint32_t getCommandCount() const { return commandCount; }
+
+    // a poll of an empty field goes on like with MxRtyPassiveActivation
+    // 0xFF: it times out and no other command is taken until the host
+    // aborts it. false (the default) answers it with no target.
+    void setEndlessPolls(bool endless) { endlessPolls = endless; }
+    // ACK frames the host sent to abort a command
+    uint32_t getAbortCount() const { return abortCount; }
+
+private:
+    TagType tagType;
+    uint8_t uid[8];
+    uint8_t uidLength;
+    uint16_t classicBlocks;
+    uint8_t memory[PN532_SIM_MEMORY_SIZE];
+    int16_t authenticatedSector;
+
+    uint8_t type1Header;   // HR0
+
+    uint16_t selectedFile; // Type 4, 0 until the NDEF application is selected
+    uint16_t type4MaxLe;
+    uint16_t type4MaxLc;
+    bool typeB;
+    uint8_t typeBFrameCode;  // ATQB Max_Frame_Size
+
+    uint8_t desfireApplications;
+    uint32_t desfireAid;    // selected application, 0 for the PICC
+    uint8_t desfireReply[84];
+    const uint8_t *desfirePending; // rest of a chained answer
+    uint16_t desfirePendingLength;
+    uint8_t desfireFrame;   // bytes per frame of the pending answer
+
+    uint8_t readerScript[8192];     // C-APDUs, each after its 2 byte length
+    uint16_t readerScriptLength;
+    uint16_t readerPosition;
+    uint16_t readerBlock;           // bytes of the C-APDU at readerPosition sent in blocks
+    uint8_t readerReplies[16384];   // R-APDUs, each after its 2 byte length
+    uint16_t readerRepliesLength;
+    uint16_t readerPending;         // bytes of an R-APDU sent with TgSetMetaData
+    uint8_t readerResponses;
+    uint32_t targetActivations;
+    bool rawTarget;
+    bool readerFelica;
+    uint32_t readerTimeoutMicros;
+    uint32_t readerCommandMicros;   // when the reader sent its last command
+
+    uint8_t response[255];
+    int16_t responseLength;
+    uint32_t commandCount;
+    uint16_t byteMicros;
+    bool endlessPolls;
+    bool pollRunning;
+    uint32_t abortCount;
+    int16_t writesLeft;
+
+    void formatMifareClassic(const uint8_t tagUid[4], uint16_t blocks);
+    void inListPassiveTarget(const uint8_t *command, uint8_t length);
+    void inDataExchange(const uint8_t *command, uint8_t length);
+    void mifareClassic(const uint8_t *command, uint8_t length);
+    void mifareUltralight(const uint8_t *command, uint8_t length);
+    void jewel(const uint8_t *command, uint8_t length);
+    void felica(const uint8_t *command, uint8_t length);
+    void type4(const uint8_t *apdu, uint8_t length);
+    void desfire(const uint8_t *apdu, uint8_t length);
+    void target(const uint8_t *command, uint8_t length);
+    void readerNext(uint8_t *buf);
+    bool writeReachesTag();
+};
+
+#endif
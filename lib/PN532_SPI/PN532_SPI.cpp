@@ -149,6 +149,20 @@ bool PN532_SPI::isReady()
     return status;
 }
 
+void PN532_SPI::abortCommand()
+{
+    const uint8_t PN532_ACK[] = {0, 0, 0xFF, 0, 0xFF, 0};
+    digitalWrite(_ss, LOW);
+    delay(2);               // wake up PN532
+
+    write(DATA_WRITE);
+    for (uint8_t i = 0; i < sizeof(PN532_ACK); i++) {
+        write(PN532_ACK[i]);
+    }
+
+    digitalWrite(_ss, HIGH);
+}
+
 void PN532_SPI::writeFrame(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
 {
     digitalWrite(_ss, LOW);
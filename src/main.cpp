@@ -5,7 +5,9 @@
 // SNEP ve NDEF kütüphanelerini ekliyoruz
 #include <snep.h>
 #include <NdefMessage.h>
+#include <NdefBuilder.h>
 #include <emulatetag.h>
+#include <memprobe.h>
 
 // --- BAĞLANTILAR ---
 // Elechouse V3 PN532 -> ESP32
@@ -17,6 +19,7 @@ PN532_HSU pn532_hsu(Serial2);
 PN532 nfc(pn532_hsu);
 SNEP snep(pn532_hsu);
 EmulateTag emu(pn532_hsu);
+ApduTimings apduTimings; // son emulasyonun APDU sureleri, [T] ile basilir
 
 // --- BELLEK YAPISI ---
 struct CardProfile
@@ -110,7 +113,7 @@ void setup()
 
   delay(1000);
   Serial.println("\n--- TURKISH CYBER NFC TOOL V10.1 (STABLE) ---");
-  Serial.println("Modes: [R] Read/Crack | [W] Clone | [E] Send UID to Phone");
+  Serial.println("Modes: [R] Read/Crack | [W] Clone | [E] Send UID to Phone | [T] APDU timings | [M] Memory stats");
 
   if (!SPIFFS.begin(true))
     Serial.println("SPIFFS Hatasi!");
@@ -148,13 +151,17 @@ void loop()
     int idx = str.length() > 1 ? str.substring(1).toInt() : -1;
 
     if (cmd == 'R')
+    {
+      MEMPROBE_SCOPE("R");
       smartAnalyzeAndSave();
+    }
     else if (cmd == 'L')
       listCards();
     else if (cmd == 'W')
     {
       if (idx >= 0)
       {
+        MEMPROBE_SCOPE("W");
         loadCardFromDisk(idx);
         verifyAndWrite();
       }
@@ -165,12 +172,26 @@ void loop()
     {
       if (idx >= 0)
       {
+        MEMPROBE_SCOPE("E");
         loadCardFromDisk(idx);
         emulateActiveCard();
       }
       else
         Serial.println("Orn: E0");
     }
+    else if (cmd == 'T')
+    {
+      // INS basina APDU sure histogramlari (okuyucunun FWT siniri icin)
+      if (apduTimings.getCount() == 0)
+        Serial.println("Henuz emulasyon yok.");
+      apduTimings.print(Serial);
+    }
+    else if (cmd == 'M')
+    {
+      // Bellek izleme: her islemden sonra heap/stack ozeti basar
+      MemProbe::enable(!MemProbe::isEnabled());
+      Serial.println(MemProbe::isEnabled() ? "Bellek izleme: ACIK" : "Bellek izleme: KAPALI");
+    }
     else if (cmd == 'D')
     {
       if (idx >= 0)
@@ -632,27 +653,35 @@ void emulateActiveCard()
   }
   else
   {
-    String uidStr = "UID: ";
-    for (int i = 0; i < activeCard.uidLen; i++)
+    // NDEF sablonu derleme zamaninda hazir (flash), sadece hex haneleri yamalanir
+    static constexpr auto uidText4 = ndef::message(ndef::text("en", "UID: 00 00 00 00"));
+    static constexpr auto uidText7 = ndef::message(ndef::text("en", "UID: 00 00 00 00 00 00 00"));
+    const char hexDigits[] = "0123456789ABCDEF";
+
+    // sablonlar sadece 4 ve 7 baytlik UID icin var
+    if (activeCard.uidLen != 4 && activeCard.uidLen != 7)
     {
-      if (activeCard.uid[i] < 0x10)
-        uidStr += "0";
-      uidStr += String(activeCard.uid[i], HEX);
-      if (i < activeCard.uidLen - 1)
-        uidStr += " ";
+      Serial.print("Desteklenmeyen UID uzunlugu: ");
+      Serial.println(activeCard.uidLen);
+      return;
+    }
+
+    int hexLen = 4;
+    int totalLen = uidText4.size();
+    memcpy(ndefBuf, uidText4.data(), uidText4.size());
+    if (activeCard.uidLen == 7)
+    {
+      hexLen = 7;
+      totalLen = uidText7.size();
+      memcpy(ndefBuf, uidText7.data(), uidText7.size());
+    }
+
+    int hexStart = totalLen - (hexLen * 3 - 1); // "XX XX .." metin sonunda
+    for (int i = 0; i < hexLen; i++)
+    {
+      ndefBuf[hexStart + i * 3] = hexDigits[activeCard.uid[i] >> 4];
+      ndefBuf[hexStart + i * 3 + 1] = hexDigits[activeCard.uid[i] & 0x0F];
     }
-    uidStr.toUpperCase();
-    int textLen = uidStr.length();
-    int totalLen = 7 + textLen;
-    ndefBuf[0] = 0xD1;
-    ndefBuf[1] = 0x01;
-    ndefBuf[2] = 3 + textLen;
-    ndefBuf[3] = 'T';
-    ndefBuf[4] = 0x02;
-    ndefBuf[5] = 'e';
-    ndefBuf[6] = 'n';
-    for (int i = 0; i < textLen; i++)
-      ndefBuf[7 + i] = uidStr.charAt(i);
 
     emu.setNdefFile(ndefBuf, totalLen);
     if (activeCard.uidLen >= 3)
@@ -662,6 +691,9 @@ void emulateActiveCard()
     bool isSuccess = false;
     unsigned long startTime = millis();
     int errorCount = 0; // Hata sayacı
+    emu.beginSession(); // RF ayari bir kez, her emulate() hemen yeniden kurulur
+    apduTimings.reset();
+    emu.setTimings(&apduTimings);
 
     while (!isSuccess && (millis() - startTime < 30000))
     { // 30 sn süre
@@ -682,13 +714,15 @@ void emulateActiveCard()
       {
         isSuccess = true;
         Serial.println("\n>>> BASARILI! TELEFON ILETISIM KURDU! <<<");
+        Serial.print("Yeniden kurma: ");
+        Serial.print(emu.getRearmMicros());
+        Serial.println(" us");
       }
-      else
-      {
-        delay(50);
-      }
+      yield();
     }
-    yield();
+    emu.endSession();
+    emu.setTimings(0);
+    apduTimings.print(Serial);
   }
   Serial.println("\nIslem bitti. Resetleniyor...");
   nfc.begin();
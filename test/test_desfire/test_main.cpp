@@ -0,0 +1,67 @@
+// DESFire commands against the simulated PN532, run on the host:
+//
+//   pio test -e native -f test_desfire -v
+
+#include <Arduino.h>
+#include <unity.h>
+#include <PN532.h>
+#include <PN532_SIM.h>
+#include <desfire.h>
+
+static uint8_t desfireUid[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+
+static PN532_SIM sim;
+static PN532 nfc(sim);
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+// DESFire answers in frames of up to 59 bytes: 25 AIDs take two, a 200 byte
+// file four after the GetFileSettings that checks it is plain and free
+void test_desfire_read(void)
+{
+    sim.insertDesfire(desfireUid, 25);
+    uint8_t uid[7], uidLength;
+    TEST_ASSERT_TRUE(nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength));
+
+    DesfireReader desfire(nfc);
+    DesfireVersion version;
+    TEST_ASSERT_TRUE(desfire.getVersion(&version));
+    TEST_ASSERT_EQUAL(3, desfire.getExchanges());
+    TEST_ASSERT_EQUAL_MEMORY(desfireUid, version.uid, sizeof(desfireUid));
+
+    uint32_t aids[DESFIRE_MAX_APPLICATIONS];
+    TEST_ASSERT_EQUAL(25, desfire.getApplicationIds(aids, DESFIRE_MAX_APPLICATIONS));
+    TEST_ASSERT_EQUAL(1 + 2, desfire.getExchanges());
+    TEST_ASSERT_EQUAL(0x010018, aids[24]);
+
+    TEST_ASSERT_TRUE(desfire.selectApplication(aids[0]));
+    uint8_t files[DESFIRE_MAX_FILES];
+    TEST_ASSERT_EQUAL(3, desfire.getFileIds(files, sizeof(files)));
+    // the card answers with more than fits, only what was stored counts
+    TEST_ASSERT_EQUAL(2, desfire.getFileIds(files, 2));
+
+    uint8_t data[256];
+    TEST_ASSERT_EQUAL(16, desfire.readData(1, 16, data, sizeof(data)));
+    TEST_ASSERT_EQUAL(0xC0, data[0]);
+    TEST_ASSERT_EQUAL(-1, desfire.readData(2, 0, data, sizeof(data)));
+    TEST_ASSERT_EQUAL(DESFIRE_PERMISSION_DENIED, desfire.getStatus());
+    TEST_ASSERT_EQUAL(0, desfire.readData(0, 0, data, 0));
+
+    int32_t length = desfire.readData(0, 0, data, sizeof(data));
+    TEST_ASSERT_EQUAL(200, length);
+    TEST_ASSERT_EQUAL(1 + (200 + 58) / 59, desfire.getExchanges());
+    TEST_ASSERT_EQUAL(199, data[199]);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_desfire_read);
+    return UNITY_END();
+}
@@ -0,0 +1,943 @@
+// Card emulation against the simulated PN532 playing the reader, run on
+// the host:
+//
+//   pio test -e native -f test_emulate -v
+
+#include <Arduino.h>
+#include <unity.h>
+#include <PN532.h>
+#include <PN532_SIM.h>
+#include <NdefMessage.h>
+#include <emulatetag.h>
+#include <ndef_write_back.h>
+#include <type2_emulator.h>
+#include <type3_emulator.h>
+
+static PN532_SIM sim;
+
+static NdefMessage textMessage;
+static NdefMessage mimeMessage;
+
+static uint8_t encoded[8400];
+static int encodedSize;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+// the C-APDUs a phone sends to read an emulated Type 4 tag, MLe bytes per READ BINARY
+static void queueNdefRead(unsigned int fileSize, unsigned int maxLe)
+{
+    static const uint8_t selectApplication[] = { 0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00 };
+    static const uint8_t selectCc[] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x03 };
+    static const uint8_t readCc[] = { 0x00, 0xB0, 0x00, 0x00, 0x0F };
+    static const uint8_t selectNdef[] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x04 };
+
+    sim.readerReset();
+    sim.readerQueue(selectApplication, sizeof(selectApplication));
+    sim.readerQueue(selectCc, sizeof(selectCc));
+    sim.readerQueue(readCc, sizeof(readCc));
+    sim.readerQueue(selectNdef, sizeof(selectNdef));
+    for (unsigned int offset = 0; offset < fileSize; offset += maxLe)
+    {
+        unsigned int count = fileSize - offset < maxLe ? fileSize - offset : maxLe;
+        uint8_t readBinary[5] = { 0x00, 0xB0, (uint8_t)(offset >> 8), (uint8_t)offset, (uint8_t)count };
+        sim.readerQueue(readBinary, sizeof(readBinary));
+    }
+}
+
+// A 6 KB message served from flash: the CC tells its real size and READ
+// BINARY takes slices of it, the 128 byte RAM file is never used
+void test_emulate_flash_ndef(void)
+{
+    static byte payload[6000];
+    for (unsigned int i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i * 7;
+    }
+    NdefMessage message;
+    message.addMimeMediaRecord("text/vcard", payload, sizeof(payload));
+    encodedSize = message.getEncodedSize();
+    message.encode(encoded);
+    unsigned int fileSize = 2 + encodedSize;
+
+    MemoryNdefFile source(encoded, encodedSize);
+    EmulateTag emulator(sim);
+    emulator.setNdefSource(&source);
+    sim.removeTag();
+
+    queueNdefRead(fileSize, EMULATETAG_MAX_LE);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(4 + (fileSize + EMULATETAG_MAX_LE - 1) / EMULATETAG_MAX_LE, sim.getReaderResponseCount());
+
+    uint8_t length;
+    const uint8_t *cc = sim.getReaderResponse(2, &length);
+    TEST_ASSERT_EQUAL(15 + 2, length);
+    TEST_ASSERT_EQUAL(EMULATETAG_MAX_LE, cc[4]);    // MLe
+    TEST_ASSERT_EQUAL(fileSize >> 8, cc[11]);       // maximum NDEF file size
+    TEST_ASSERT_EQUAL(fileSize & 0xFF, cc[12]);
+    TEST_ASSERT_EQUAL(0xFF, cc[14]);                // read only
+
+    static uint8_t file[sizeof(payload) + 64];
+    unsigned int read = 0;
+    for (uint8_t i = 4; i < sim.getReaderResponseCount(); i++)
+    {
+        const uint8_t *reply = sim.getReaderResponse(i, &length);
+        TEST_ASSERT_EQUAL(0x90, reply[length - 2]);
+        memcpy(file + read, reply, length - 2);
+        read += length - 2;
+    }
+    TEST_ASSERT_EQUAL(fileSize, read);
+    TEST_ASSERT_EQUAL(encodedSize, (file[0] << 8) | file[1]);
+    TEST_ASSERT_EQUAL_MEMORY(encoded, file + 2, encodedSize);
+}
+
+// In a session only the first emulate() sets the RF up, later ones send
+// TgInitAsTarget right away
+void test_emulate_session(void)
+{
+    encodedSize = textMessage.getEncodedSize();
+    textMessage.encode(encoded);
+    unsigned int fileSize = 2 + encodedSize;
+
+    EmulateTag emulator(sim);
+    emulator.setNdefFile(encoded, encodedSize);
+    emulator.beginSession();
+    sim.removeTag();
+
+    // TgInitAsTarget, two per APDU, the failing TgGetData and InRelease
+    unsigned int apdus = 4 + (fileSize + 127) / 128;
+    uint32_t commands = sim.getCommandCount();
+    queueNdefRead(fileSize, 128);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(2 + 1 + 2 * apdus + 2, sim.getCommandCount() - commands);
+
+    commands = sim.getCommandCount();
+    queueNdefRead(fileSize, 128);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(1 + 2 * apdus + 2, sim.getCommandCount() - commands);
+    TEST_ASSERT_TRUE(emulator.getRearmMicros() < 100000);
+    uint8_t length;
+    TEST_ASSERT_EQUAL(0x90, sim.getReaderResponse(apdus - 1, &length)[length - 2]);
+
+    emulator.endSession();
+}
+
+// a stored value application next to the NDEF one: GET BALANCE answers
+// 4 bytes, everything else it does not know
+static const uint8_t loyaltyAid[] = { 0xF0, 0x01, 0x02, 0x03, 0x04, 0x05 };
+
+static uint16_t getBalance(void *context, const uint8_t *apdu, uint16_t apduLength, ApduResponse *response)
+{
+    uint32_t balance = *(uint32_t *)context;
+    response->data[0] = balance >> 24;
+    response->data[1] = balance >> 16;
+    response->data[2] = balance >> 8;
+    response->data[3] = balance;
+    response->length = 4;
+    return APDU_SW_OK;
+}
+
+// One activation reads the NDEF file, switches to the loyalty AID and back
+void test_emulate_multi_aid(void)
+{
+    static const uint8_t selectLoyalty[] = { 0x00, 0xA4, 0x04, 0x00, 0x06, 0xF0, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00 };
+    static const uint8_t selectUnknown[] = { 0x00, 0xA4, 0x04, 0x00, 0x06, 0xF0, 0x01, 0x02, 0x03, 0x04, 0x06, 0x00 };
+    static const uint8_t balance[] = { 0x80, 0x5C, 0x00, 0x00, 0x04 };
+    static const uint8_t readCc[] = { 0x00, 0xB0, 0x00, 0x00, 0x0F };
+
+    encodedSize = textMessage.getEncodedSize();
+    textMessage.encode(encoded);
+    unsigned int fileSize = 2 + encodedSize;
+
+    uint32_t points = 0x00012345;
+    EmulateTag emulator(sim);
+    emulator.setNdefFile(encoded, encodedSize);
+    TEST_ASSERT_TRUE(emulator.getRouter().addApplication(loyaltyAid, sizeof(loyaltyAid)));
+    TEST_ASSERT_TRUE(emulator.getRouter().addHandler(loyaltyAid, sizeof(loyaltyAid), 0x5C, getBalance, &points));
+    TEST_ASSERT_FALSE(emulator.getRouter().addApplication(loyaltyAid, sizeof(loyaltyAid)));
+    sim.removeTag();
+
+    queueNdefRead(fileSize, 128);
+    unsigned int ndefApdus = 4 + (fileSize + 127) / 128;
+    sim.readerQueue(selectLoyalty, sizeof(selectLoyalty));
+    sim.readerQueue(balance, sizeof(balance));
+    sim.readerQueue(readCc, sizeof(readCc));
+    sim.readerQueue(selectUnknown, sizeof(selectUnknown));
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(ndefApdus + 4, sim.getReaderResponseCount());
+
+    uint8_t length;
+    const uint8_t *reply = sim.getReaderResponse(ndefApdus - 1, &length);
+    TEST_ASSERT_EQUAL(fileSize + 2, length);
+    TEST_ASSERT_EQUAL_MEMORY(encoded, reply + 2, encodedSize);
+    reply = sim.getReaderResponse(ndefApdus, &length);
+    TEST_ASSERT_EQUAL(2, length);
+    TEST_ASSERT_EQUAL(0x90, reply[0]);
+    reply = sim.getReaderResponse(ndefApdus + 1, &length);
+    TEST_ASSERT_EQUAL(6, length);
+    TEST_ASSERT_EQUAL(0x45, reply[3]);
+    TEST_ASSERT_EQUAL(0x90, reply[4]);
+    reply = sim.getReaderResponse(ndefApdus + 2, &length);  // READ BINARY is not the loyalty app's
+    TEST_ASSERT_EQUAL(2, length);
+    TEST_ASSERT_EQUAL(0x6A, reply[0]);
+    TEST_ASSERT_EQUAL(0x81, reply[1]);
+    reply = sim.getReaderResponse(ndefApdus + 3, &length);
+    TEST_ASSERT_EQUAL(0x6A, reply[0]);
+    TEST_ASSERT_EQUAL(0x82, reply[1]);
+}
+
+// With HSU byte times simulated the histograms show where an APDU's time
+// goes; the turnaround must stay far below the reader's frame waiting time
+void test_emulate_timings(void)
+{
+    encodedSize = textMessage.getEncodedSize();
+    textMessage.encode(encoded);
+    unsigned int fileSize = 2 + encodedSize;
+
+    ApduTimings timings;
+    EmulateTag emulator(sim);
+    emulator.setNdefFile(encoded, encodedSize);
+    emulator.setTimings(&timings);
+    emulator.beginSession();
+    sim.removeTag();
+    sim.setByteMicros(87);
+
+    queueNdefRead(fileSize, 128);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    sim.setByteMicros(0);
+    timings.print(Serial);
+
+    TEST_ASSERT_EQUAL(2, timings.getCount());
+    const ApduHistogram *select = timings.find(0xA4);
+    const ApduHistogram *read = timings.find(0xB0);
+    TEST_ASSERT_TRUE(select != 0);
+    TEST_ASSERT_TRUE(read != 0);
+    TEST_ASSERT_EQUAL(3, select->count);
+    TEST_ASSERT_EQUAL(1 + (fileSize + 127) / 128, read->count);
+    // TgSetData of the NDEF file: frame and ACK out, status frame back
+    TEST_ASSERT_TRUE(read->maxMicros[APDU_STAGE_SEND] >= 87u * (fileSize + 2 + 1 + 1 + 7 + 6 + 1 + 2 + 7));
+    TEST_ASSERT_TRUE(read->maxMicros[APDU_STAGE_TURNAROUND] < 77000);   // FWI 8
+    unsigned int counted = 0;
+    for (uint8_t b = 0; b < APDU_TIMING_BUCKETS; b++)
+    {
+        counted += read->buckets[APDU_STAGE_TURNAROUND][b];
+    }
+    TEST_ASSERT_EQUAL(read->count, counted);
+    TEST_ASSERT_EQUAL(0, ApduTimings::bucket(127));
+    TEST_ASSERT_EQUAL(1, ApduTimings::bucket(128));
+    TEST_ASSERT_EQUAL(APDU_TIMING_BUCKETS - 1, ApduTimings::bucket(1000000));
+
+    emulator.endSession();
+}
+
+// flash stand-in: keeps the committed message and the last dirty range
+class RamNdefSink : public NdefFileSink
+{
+public:
+    uint8_t stored[256];
+    uint16_t length = 0;
+    uint16_t dirtyStart = 0;
+    uint16_t dirtyEnd = 0;
+
+    bool commit(const uint8_t *message, uint16_t messageLength, uint16_t start, uint16_t end)
+    {
+        memcpy(stored + start, message + start, end - start);
+        length = messageLength;
+        dirtyStart = start;
+        dirtyEnd = end;
+        return true;
+    }
+};
+
+// UPDATE BINARY C-APDU of length bytes of data at offset
+static void queueUpdateBinary(uint16_t offset, const uint8_t *data, uint8_t length)
+{
+    uint8_t apdu[5 + 128] = { 0x00, 0xD6, (uint8_t)(offset >> 8), (uint8_t)offset, length };
+    memcpy(apdu + 5, data, length);
+    sim.readerQueue(apdu, 5 + length);
+}
+
+// the way a phone writes: NLEN 0, the message, then NLEN
+static void queueNdefWrite(const uint8_t *message, uint8_t length)
+{
+    static const uint8_t selectApplication[] = { 0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00 };
+    static const uint8_t selectNdef[] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x04 };
+    static const uint8_t zero[2] = { 0, 0 };
+    uint8_t nlen[2] = { 0, length };
+
+    sim.readerReset();
+    sim.readerQueue(selectApplication, sizeof(selectApplication));
+    sim.readerQueue(selectNdef, sizeof(selectNdef));
+    queueUpdateBinary(0, zero, 2);
+    queueUpdateBinary(2, message, length);
+    queueUpdateBinary(0, nlen, 2);
+}
+
+// Writes stay in RAM during the activation and go to the sink once the
+// reader has left, a later small edit commits only its bytes
+void test_emulate_write_back(void)
+{
+    encodedSize = textMessage.getEncodedSize();
+    textMessage.encode(encoded);
+
+    EmulateTag emulator(sim);
+    emulator.setNdefFile(encoded, encodedSize);
+    RamNdefSink sink;
+    static uint8_t file[NDEF_MAX_LENGTH];
+    NdefWriteBack writeBack(emulator, sink, file);
+    sim.removeTag();
+    TEST_ASSERT_FALSE(writeBack.poll());
+
+    NdefMessage written;
+    written.addUriRecord("https://example.com/written");
+    uint8_t message[64];
+    uint8_t length = written.getEncodedSize();
+    written.encode(message);
+
+    queueNdefWrite(message, length);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_TRUE(emulator.writeOccured());
+    uint16_t start, end;
+    uint32_t writes;
+    TEST_ASSERT_TRUE(emulator.getDirtyRange(&start, &end, &writes));
+    TEST_ASSERT_EQUAL(0, start);
+    TEST_ASSERT_EQUAL(2 + length, end);
+    TEST_ASSERT_EQUAL(0, sink.length);  // nothing stored before the poll
+
+    TEST_ASSERT_TRUE(writeBack.poll());
+    TEST_ASSERT_EQUAL(1, writeBack.getCommits());
+    TEST_ASSERT_EQUAL(length, sink.length);
+    TEST_ASSERT_EQUAL_MEMORY(message, sink.stored, length);
+    TEST_ASSERT_FALSE(emulator.getDirtyRange(&start, &end, &writes));
+    TEST_ASSERT_FALSE(writeBack.poll());
+
+    // an edit of 4 bytes commits only those
+    static const uint8_t selectApplication[] = { 0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00 };
+    static const uint8_t selectNdef[] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x04 };
+    const uint8_t edit[4] = { 'h', 'a', 'p', 'p' };
+    sim.readerReset();
+    sim.readerQueue(selectApplication, sizeof(selectApplication));
+    sim.readerQueue(selectNdef, sizeof(selectNdef));
+    queueUpdateBinary(2 + length - 4, edit, sizeof(edit));
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_TRUE(writeBack.poll());
+    TEST_ASSERT_EQUAL(length - 4, sink.dirtyStart);
+    TEST_ASSERT_EQUAL(length, sink.dirtyEnd);
+    TEST_ASSERT_EQUAL_MEMORY(edit, sink.stored + length - 4, sizeof(edit));
+    TEST_ASSERT_EQUAL_MEMORY(message, sink.stored, length - 4);
+
+    // a reader that leaves with NLEN 0 has not finished, nothing to commit
+    static const uint8_t zero[2] = { 0, 0 };
+    sim.readerReset();
+    sim.readerQueue(selectApplication, sizeof(selectApplication));
+    sim.readerQueue(selectNdef, sizeof(selectNdef));
+    queueUpdateBinary(0, zero, 2);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_FALSE(writeBack.poll());
+    TEST_ASSERT_EQUAL(2, writeBack.getCommits());
+}
+
+static void writeFile(fs::FS &flash, const char *path, const uint8_t *data, uint16_t length)
+{
+    fs::File file = flash.open(path, "w");
+    file.write(data, length);
+    file.close();
+}
+
+static void checkFile(fs::FS &flash, const char *path, const uint8_t *data, uint16_t length)
+{
+    fs::File file = flash.open(path, "r");
+    TEST_ASSERT_TRUE(file);
+    FsNdefFile stored(file);
+    TEST_ASSERT_EQUAL(length, stored.size());
+    uint8_t read[64];
+    TEST_ASSERT_TRUE(stored.read(0, read, length));
+    TEST_ASSERT_EQUAL_MEMORY(data, read, length);
+}
+
+// A commit replaces the file through the temp file, on LittleFS with one
+// rename and on SPIFFS by removing the file first. recover() finishes a
+// commit a reset cut short between the two and drops a partial temp file.
+void test_fs_ndef_file_sink(void)
+{
+    const uint8_t first[] = { 0xD1, 0x01, 0x04, 'T', 0x02, 'e', 'n', '1' };
+    const uint8_t second[] = { 0xD1, 0x01, 0x05, 'T', 0x02, 'e', 'n', '2', '2' };
+
+    fs::FS flash;
+    FsNdefFileSink sink(flash, "/ndef", "/ndef.tmp");
+    TEST_ASSERT_FALSE(sink.recover());
+
+    TEST_ASSERT_TRUE(sink.commit(first, sizeof(first), 0, sizeof(first)));
+    TEST_ASSERT_FALSE(flash.exists("/ndef.tmp"));
+    checkFile(flash, "/ndef", first, sizeof(first));
+
+    // only the dirty byte changed, the file still gets all of the message
+    flash.renameOver = false;
+    TEST_ASSERT_TRUE(sink.commit(second, sizeof(second), 7, 9));
+    TEST_ASSERT_FALSE(flash.exists("/ndef.tmp"));
+    checkFile(flash, "/ndef", second, sizeof(second));
+
+    // reset after SPIFFS removed the file for the complete temp file
+    writeFile(flash, "/ndef.tmp", first, sizeof(first));
+    flash.remove("/ndef");
+    TEST_ASSERT_TRUE(sink.recover());
+    TEST_ASSERT_FALSE(flash.exists("/ndef.tmp"));
+    checkFile(flash, "/ndef", first, sizeof(first));
+
+    // reset while the temp file was written, the old message stays
+    writeFile(flash, "/ndef.tmp", second, 3);
+    TEST_ASSERT_TRUE(sink.recover());
+    TEST_ASSERT_FALSE(flash.exists("/ndef.tmp"));
+    checkFile(flash, "/ndef", first, sizeof(first));
+}
+
+// the way a phone reads: NLEN first, then the message in MLe slices behind it
+static void queuePhoneRead(unsigned int nlen, unsigned int maxLe)
+{
+    queueNdefRead(0, maxLe);
+    uint8_t readNlen[5] = { 0x00, 0xB0, 0x00, 0x00, 0x02 };
+    sim.readerQueue(readNlen, sizeof(readNlen));
+    for (unsigned int offset = 2; offset < 2 + nlen; offset += maxLe)
+    {
+        unsigned int count = 2 + nlen - offset < maxLe ? 2 + nlen - offset : maxLe;
+        uint8_t readBinary[5] = { 0x00, 0xB0, (uint8_t)(offset >> 8), (uint8_t)offset, (uint8_t)count };
+        sim.readerQueue(readBinary, sizeof(readBinary));
+    }
+}
+
+// A phone's reads are answered from the prepared responses, reads at other
+// offsets from the file; a write replaces both
+void test_emulate_templates(void)
+{
+    static byte payload[500];
+    for (unsigned int i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i * 3;
+    }
+    NdefMessage message;
+    message.addMimeMediaRecord("text/plain", payload, sizeof(payload));
+    encodedSize = message.getEncodedSize();
+    message.encode(encoded);
+
+    static BasicEmulateTag<600, 128> emulator(sim);
+    emulator.setNdefFile(encoded, encodedSize);
+    emulator.beginSession();
+    sim.removeTag();
+
+    const unsigned int maxLe = EMULATETAG_MLE(600);
+    unsigned int slices = (encodedSize + maxLe - 1) / maxLe;
+    queuePhoneRead(encodedSize, maxLe);
+    uint8_t odd[5] = { 0x00, 0xB0, 0x00, 0x05, 0x10 };
+    sim.readerQueue(odd, sizeof(odd));
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(4 + 1 + slices + 1, sim.getReaderResponseCount());
+
+    uint8_t length;
+    const uint8_t *reply = sim.getReaderResponse(4, &length);
+    TEST_ASSERT_EQUAL(4, length);
+    TEST_ASSERT_EQUAL(encodedSize, (reply[0] << 8) | reply[1]);
+    static uint8_t file[600];
+    unsigned int read = 0;
+    for (unsigned int i = 0; i < slices; i++)
+    {
+        reply = sim.getReaderResponse(5 + i, &length);
+        TEST_ASSERT_EQUAL(0x90, reply[length - 2]);
+        TEST_ASSERT_EQUAL(0x00, reply[length - 1]);
+        memcpy(file + read, reply, length - 2);
+        read += length - 2;
+    }
+    TEST_ASSERT_EQUAL(encodedSize, read);
+    TEST_ASSERT_EQUAL_MEMORY(encoded, file, encodedSize);
+    reply = sim.getReaderResponse(5 + slices, &length);
+    TEST_ASSERT_EQUAL(0x10 + 2, length);
+    TEST_ASSERT_EQUAL_MEMORY(encoded + 3, reply, 0x10);
+
+    // the write goes into the file and the next activation serves it
+    static const uint8_t patch[4] = { 0xCA, 0xFE, 0xBA, 0xBE };
+    queueNdefRead(0, maxLe);
+    queueUpdateBinary(2 + maxLe, patch, sizeof(patch));
+    TEST_ASSERT_TRUE(emulator.emulate());
+    queuePhoneRead(encodedSize, maxLe);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    reply = sim.getReaderResponse(5 + 1, &length);
+    TEST_ASSERT_EQUAL_MEMORY(patch, reply, sizeof(patch));
+    TEST_ASSERT_EQUAL_MEMORY(encoded + maxLe + 4, reply + 4, 16);
+
+    emulator.endSession();
+}
+
+// One extended READ BINARY takes the whole file in chained frames, an
+// extended UPDATE BINARY longer than a block and a command chain are put
+// together before they are written
+void test_emulate_extended(void)
+{
+    static byte payload[500];
+    for (unsigned int i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i * 5;
+    }
+    NdefMessage message;
+    message.addMimeMediaRecord("text/plain", payload, sizeof(payload));
+    encodedSize = message.getEncodedSize();
+    message.encode(encoded);
+
+    static BasicEmulateTag<600> emulator(sim);
+    emulator.setNdefFile(encoded, encodedSize);
+    sim.removeTag();
+
+    uint8_t readAll[7] = { 0x00, 0xB0, 0x00, 0x02, 0x00, (uint8_t)(encodedSize >> 8), (uint8_t)encodedSize };
+    uint8_t chainedRead[5] = { 0x10, 0xB0, 0x00, 0x02, 0x10 };
+    queueNdefRead(0, 0);
+    sim.readerQueue(readAll, sizeof(readAll));
+    sim.readerQueue(chainedRead, sizeof(chainedRead));
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(4 + 2, sim.getReaderResponseCount());
+
+    uint16_t length;
+    const uint8_t *cc = sim.getReaderResponse(2, &length);
+    TEST_ASSERT_EQUAL(15 + 2, length);
+    TEST_ASSERT_EQUAL(600, ((cc[3] << 8) | cc[4]));   // MLe, the whole file
+    TEST_ASSERT_EQUAL(EMULATETAG_MAX_LC, ((cc[5] << 8) | cc[6]));
+    const uint8_t *reply = sim.getReaderResponse(4, &length);
+    TEST_ASSERT_EQUAL(encodedSize + 2, length);
+    TEST_ASSERT_EQUAL_MEMORY(encoded, reply, encodedSize);
+    TEST_ASSERT_EQUAL(0x90, reply[encodedSize]);
+    reply = sim.getReaderResponse(5, &length);
+    TEST_ASSERT_EQUAL(0x68, reply[0]);
+    TEST_ASSERT_EQUAL(0x84, reply[1]);
+
+    // 300 bytes in one extended UPDATE BINARY, then 3 x 90 chained
+    static uint8_t apdu[7 + 300];
+    uint8_t header[7] = { 0x00, 0xD6, 0x00, 0x02, 0x00, 0x01, 0x2C };
+    memcpy(apdu, header, sizeof(header));
+    for (unsigned int i = 0; i < 300; i++)
+    {
+        apdu[7 + i] = 0xA0 ^ i;
+    }
+    queueNdefRead(0, 0);
+    sim.readerQueue(apdu, sizeof(apdu));
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        uint8_t piece[5 + 90] = { (uint8_t)(i < 2 ? 0x10 : 0x00), 0xD6, 0x01, 0x2E, 90 };
+        memset(piece + 5, 0x30 + i, 90);
+        sim.readerQueue(piece, sizeof(piece));
+    }
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(4 + 4, sim.getReaderResponseCount());
+    for (uint8_t i = 4; i < 8; i++)
+    {
+        reply = sim.getReaderResponse(i, &length);
+        TEST_ASSERT_EQUAL(2, length);
+        TEST_ASSERT_EQUAL(0x90, reply[0]);
+    }
+    uint8_t *file = emulator.getNdefFilePtr();
+    TEST_ASSERT_EQUAL_MEMORY(apdu + 7, file + 2, 300);
+    TEST_ASSERT_EQUAL(0x30, file[302]);
+    TEST_ASSERT_EQUAL(0x31, file[392]);
+    TEST_ASSERT_EQUAL(0x32, file[571]);
+    TEST_ASSERT_TRUE(emulator.writeOccured());
+
+    emulator.setNdefFile(encoded, encodedSize);
+    emulator.beginSession();
+    emulator.endSession();
+}
+
+// Reads off the slices longer than a frame are chained from the file
+void test_emulate_unaligned_read(void)
+{
+    static byte payload[500];
+    for (unsigned int i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i * 11;
+    }
+    NdefMessage message;
+    message.addMimeMediaRecord("text/plain", payload, sizeof(payload));
+    encodedSize = message.getEncodedSize();
+    message.encode(encoded);
+    static uint8_t file[2 + sizeof(encoded)];
+    file[0] = encodedSize >> 8;
+    file[1] = encodedSize & 0xFF;
+    memcpy(file + 2, encoded, encodedSize);
+
+    static BasicEmulateTag<600> emulator(sim);
+    emulator.setNdefFile(encoded, encodedSize);
+    emulator.beginSession();
+    sim.removeTag();
+
+    // short Le 0xFD to 0x00 (256) at offset 3, extended from 0 and from 3
+    const uint16_t rest = 2 + encodedSize - 3;
+    const uint8_t reads[][7] = {
+        { 0x00, 0xB0, 0x00, 0x03, 0xFD },
+        { 0x00, 0xB0, 0x00, 0x03, 0xFE },
+        { 0x00, 0xB0, 0x00, 0x03, 0xFF },
+        { 0x00, 0xB0, 0x00, 0x03, 0x00 },
+        { 0x00, 0xB0, 0x00, 0x00, 0x00, 0x01, 0xF6 },
+        { 0x00, 0xB0, 0x00, 0x03, 0x00, (uint8_t)(rest >> 8), (uint8_t)rest },
+    };
+    const uint16_t offsets[] = { 3, 3, 3, 3, 0, 3 };
+    const uint16_t lengths[] = { 0xFD, 0xFE, 0xFF, 0x100, 0x1F6, rest };
+    queueNdefRead(0, 0);
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        sim.readerQueue(reads[i], i < 4 ? 5 : 7);
+    }
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(4 + 6, sim.getReaderResponseCount());
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        uint16_t length;
+        const uint8_t *reply = sim.getReaderResponse(4 + i, &length);
+        TEST_ASSERT_EQUAL(lengths[i] + 2, length);
+        TEST_ASSERT_EQUAL_MEMORY(file + offsets[i], reply, lengths[i]);
+        TEST_ASSERT_EQUAL(0x90, reply[lengths[i]]);
+    }
+
+    emulator.endSession();
+}
+
+// per tap state of a generated NDEF file: an 8 digit counter in the URI
+struct TapCounter
+{
+    uint32_t taps;
+    uint16_t offset;    // of the digits in the message
+};
+
+static void countTap(void *context, NdefFileUpdate &update)
+{
+    TapCounter *counter = (TapCounter *)context;
+    counter->taps++;
+    char digits[9];
+    snprintf(digits, sizeof(digits), "%08lu", (unsigned long)(counter->taps % 100000000UL));
+    update.patch(counter->offset, (const uint8_t *)digits, 8);
+}
+
+// The first SELECT of the NDEF file in an activation patches the counter
+// into the second buffer and serves it, the prepared responses follow
+void test_emulate_generator(void)
+{
+    NdefMessage message;
+    message.addUriRecord("https://example.com/tap?n=00000000");
+    encodedSize = message.getEncodedSize();
+    message.encode(encoded);
+    const uint8_t *digits = (const uint8_t *)memchr(encoded, '=', encodedSize) + 1;
+
+    static uint8_t backFile[NDEF_MAX_LENGTH];
+    TapCounter counter = { 0, (uint16_t)(digits - encoded) };
+    EmulateTag emulator(sim);
+    emulator.setNdefFile(encoded, encodedSize);
+    emulator.setNdefGenerator(countTap, &counter, backFile);
+    emulator.beginSession();
+    sim.removeTag();
+    const uint8_t *file = emulator.getNdefFilePtr();
+
+    uint16_t length;
+    for (uint32_t tap = 1; tap <= 2; tap++)
+    {
+        queuePhoneRead(encodedSize, EMULATETAG_MLE(NDEF_MAX_LENGTH));
+        TEST_ASSERT_TRUE(emulator.emulate());
+        const uint8_t *reply = sim.getReaderResponse(5, &length);
+        TEST_ASSERT_EQUAL(encodedSize + 2, length);
+        TEST_ASSERT_EQUAL_MEMORY(encoded, reply, counter.offset);
+        TEST_ASSERT_EQUAL_MEMORY(tap == 1 ? "00000001" : "00000002", reply + counter.offset, 8);
+    }
+    TEST_ASSERT_EQUAL(2, counter.taps);
+
+    // a read at an odd offset comes from the file, which has the counter
+    // too; selecting the file again in the same activation keeps it
+    static const uint8_t selectNdef[] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x04 };
+    uint8_t readDigits[5] = { 0x00, 0xB0, 0x00, (uint8_t)(2 + counter.offset), 8 };
+    queueNdefRead(0, 0);
+    sim.readerQueue(readDigits, sizeof(readDigits));
+    sim.readerQueue(selectNdef, sizeof(selectNdef));
+    sim.readerQueue(readDigits, sizeof(readDigits));
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL_MEMORY("00000003", sim.getReaderResponse(4, &length), 8);
+    TEST_ASSERT_EQUAL_MEMORY("00000003", sim.getReaderResponse(6, &length), 8);
+    TEST_ASSERT_EQUAL(3, counter.taps);
+    uint8_t *content;
+    uint16_t contentLength;
+    emulator.getContent(&content, &contentLength);
+    TEST_ASSERT_EQUAL(encodedSize, contentLength);
+    TEST_ASSERT_EQUAL_MEMORY("00000003", content + counter.offset, 8);
+    TEST_ASSERT_TRUE(file == emulator.getNdefFilePtr());
+
+    emulator.endSession();
+}
+
+// what a reader sends to read the NDEF area of an NTAG213
+static void queueType2Read(void)
+{
+    static const uint8_t getVersion[] = { TYPE2_CMD_GET_VERSION };
+    sim.readerReset();
+    sim.readerQueue(getVersion, sizeof(getVersion));
+    for (uint8_t page = 3; page < TYPE2_EMULATOR_FIRST_DATA + TYPE2_EMULATOR_DATA_PAGES; page += 4)
+    {
+        uint8_t read[2] = { TYPE2_CMD_READ, page };
+        sim.readerQueue(read, sizeof(read));
+    }
+}
+
+// Raw Type 2 commands answered from the page image, and the ISO-DEP
+// fallback when the PN532 can't keep up
+void test_type2_emulate(void)
+{
+    static const uint8_t uid3[3] = { 0x12, 0x34, 0x56 };
+    encodedSize = textMessage.getEncodedSize();
+    textMessage.encode(encoded);
+
+    Type2TagEmulator emulator(sim);
+    emulator.setUid(uid3);
+    TEST_ASSERT_FALSE(emulator.setNdefMessage(encoded, TYPE2_EMULATOR_MAX_MESSAGE + 1));
+    TEST_ASSERT_TRUE(emulator.setNdefMessage(encoded, encodedSize));
+    sim.removeTag();
+
+    static const uint8_t write[] = { TYPE2_CMD_WRITE, 6, 'a', 'b', 'c', 'd' };
+    static const uint8_t writeLock[] = { TYPE2_CMD_WRITE, 2, 0xFF, 0xFF, 0xFF, 0xFF };
+    static const uint8_t rollOver[] = { TYPE2_CMD_READ, TYPE2_EMULATOR_PAGES - 2 };
+    static const uint8_t halt[] = { TYPE2_CMD_HALT, 0x00 };
+    queueType2Read();
+    sim.readerQueue(write, sizeof(write));
+    sim.readerQueue(writeLock, sizeof(writeLock));
+    sim.readerQueue(rollOver, sizeof(rollOver));
+    sim.readerQueue(halt, sizeof(halt));
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(TYPE2_OK, emulator.getStatus());
+    TEST_ASSERT_EQUAL(1, sim.getTargetActivations());
+    unsigned int reads = 1 + (TYPE2_EMULATOR_DATA_PAGES + 4) / 4;   // GET_VERSION, CC to the last data page
+    TEST_ASSERT_EQUAL(reads + 3, sim.getReaderResponseCount());
+
+    uint8_t length;
+    const uint8_t *reply = sim.getReaderResponse(0, &length);
+    TEST_ASSERT_EQUAL(8, length);
+    TEST_ASSERT_EQUAL(0x0F, reply[6]);              // NTAG213 storage size
+    reply = sim.getReaderResponse(1, &length);
+    TEST_ASSERT_EQUAL(16, length);
+    TEST_ASSERT_EQUAL(0xE1, reply[0]);              // CC
+    TEST_ASSERT_EQUAL(0x12, reply[2]);
+    TEST_ASSERT_EQUAL(0x03, reply[4]);              // NDEF TLV
+    TEST_ASSERT_EQUAL(encodedSize, reply[5]);
+    TEST_ASSERT_EQUAL_MEMORY(encoded, reply + 6, 10);
+    TEST_ASSERT_EQUAL(TYPE2_ACK, sim.getReaderResponse(reads, &length)[0]);
+    TEST_ASSERT_EQUAL(TYPE2_NAK, sim.getReaderResponse(reads + 1, &length)[0]);
+    reply = sim.getReaderResponse(reads + 2, &length);
+    TEST_ASSERT_EQUAL(16, length);
+    TEST_ASSERT_EQUAL_MEMORY(emulator.getPages(), reply + 8, 8);   // pages 0 and 1
+    TEST_ASSERT_EQUAL(0x12, reply[9]);
+    TEST_ASSERT_TRUE(emulator.writeOccured());
+    TEST_ASSERT_EQUAL_MEMORY("abcd", emulator.getPages() + 6 * 4, 4);
+
+    // a reader that can't wait for the host round trip
+    sim.setByteMicros(87);
+    sim.setReaderTimeoutMicros(2000);
+    queueType2Read();
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(TYPE2_TOO_SLOW, emulator.getStatus());
+    sim.setByteMicros(0);
+    sim.setReaderTimeoutMicros(0);
+
+    // a firmware that only activates ISO-DEP: the Type 4 tag takes over
+    EmulateTag type4(sim);
+    type4.setNdefFile(encoded, encodedSize);
+    emulator.setFallback(&type4);
+    sim.setRawTargetSupport(false);
+    queueNdefRead(2 + encodedSize, 128);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    sim.setRawTargetSupport(true);
+    TEST_ASSERT_EQUAL(TYPE2_UNSUPPORTED, emulator.getStatus());
+    TEST_ASSERT_TRUE(emulator.isUsingFallback());
+    reply = sim.getReaderResponse(4, &length);
+    TEST_ASSERT_EQUAL(2 + encodedSize + 2, length);
+    TEST_ASSERT_EQUAL_MEMORY(encoded, reply + 2, encodedSize);
+}
+
+static const uint8_t type3Idm[8] = { 0x02, 0xFE, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+
+// Check (or Update with data) of count blocks from first, through the NDEF service
+static void queueType3Blocks(uint8_t code, uint16_t first, uint8_t count, const uint8_t *data = 0)
+{
+    uint8_t frame[0xFF];
+    uint8_t n = 1;
+    frame[n++] = code;
+    memcpy(frame + n, type3Idm, 8);
+    n += 8;
+    frame[n++] = 1;
+    frame[n++] = code == FELICA_CMD_READ_WITHOUT_ENCRYPTION ? 0x0B : 0x09;
+    frame[n++] = 0x00;
+    frame[n++] = count;
+    for (uint16_t block = first; block < first + count; block++)
+    {
+        if (block < 0x100)
+        {
+            frame[n++] = 0x80;
+            frame[n++] = block;
+        }
+        else
+        {
+            frame[n++] = 0x00;
+            frame[n++] = block & 0xFF;
+            frame[n++] = block >> 8;
+        }
+    }
+    if (data)
+    {
+        memcpy(frame + n, data, count * 16);
+        n += count * 16;
+    }
+    frame[0] = n;
+    sim.readerQueue(frame, n);
+}
+
+// a reader that follows Nbr: the attribute block, then Nbr blocks per Check
+static void queueType3Read(uint16_t blocks, uint8_t readBlocks)
+{
+    static const uint8_t polling[] = { 0x06, FELICA_CMD_POLLING, 0x12, 0xFC, 0x01, 0x00 };
+    sim.readerReset();
+    sim.readerQueue(polling, sizeof(polling));
+    queueType3Blocks(FELICA_CMD_READ_WITHOUT_ENCRYPTION, 0, 1);
+    for (uint16_t block = 1; block <= blocks; block += readBlocks)
+    {
+        uint16_t count = blocks - block + 1 < readBlocks ? blocks - block + 1 : readBlocks;
+        queueType3Blocks(FELICA_CMD_READ_WITHOUT_ENCRYPTION, block, count);
+    }
+}
+
+// FeliCa Type 3 tag: an 8 KB message from flash read with as many blocks
+// per Check as a frame holds, and a reader writing the RAM message
+void test_type3_emulate(void)
+{
+    encodedSize = mimeMessage.getEncodedSize();
+    mimeMessage.encode(encoded);
+    uint16_t blocks = (encodedSize + 15) / 16;
+
+    MemoryNdefFile source(encoded, encodedSize);
+    Type3TagEmulator emulator(sim);
+    emulator.setIdm(type3Idm);
+    emulator.setNdefSource(&source);
+    sim.removeTag();
+    sim.setReaderFelica(true);
+
+    queueType3Read(blocks, TYPE3_EMULATOR_READ_BLOCKS);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    TEST_ASSERT_EQUAL(TYPE3_OK, emulator.getStatus());
+    unsigned int checks = (blocks + TYPE3_EMULATOR_READ_BLOCKS - 1) / TYPE3_EMULATOR_READ_BLOCKS;
+    TEST_ASSERT_EQUAL(2 + checks, sim.getReaderResponseCount());
+
+    uint8_t length;
+    const uint8_t *reply = sim.getReaderResponse(0, &length);
+    TEST_ASSERT_EQUAL(20, length);                  // Polling with the system code
+    TEST_ASSERT_EQUAL_MEMORY(type3Idm, reply + 2, 8);
+    TEST_ASSERT_EQUAL(0xFC, reply[19]);
+    uint8_t attribute[16];
+    memcpy(attribute, sim.getReaderResponse(1, &length) + 13, sizeof(attribute));
+    TEST_ASSERT_EQUAL(TYPE3_EMULATOR_READ_BLOCKS, attribute[1]);   // Nbr
+    TEST_ASSERT_EQUAL(0, attribute[10]);            // read only
+    TEST_ASSERT_EQUAL(encodedSize, (attribute[11] << 16) | (attribute[12] << 8) | attribute[13]);
+
+    static uint8_t message[sizeof(encoded)];
+    unsigned int read = 0;
+    for (unsigned int i = 2; i < sim.getReaderResponseCount(); i++)
+    {
+        reply = sim.getReaderResponse(i, &length);
+        TEST_ASSERT_EQUAL(0, reply[10]);            // status flag 1
+        TEST_ASSERT_EQUAL(13 + reply[12] * 16, length);
+        memcpy(message + read, reply + 13, reply[12] * 16);
+        read += reply[12] * 16;
+    }
+    TEST_ASSERT_EQUAL(blocks * 16, read);
+    TEST_ASSERT_EQUAL_MEMORY(encoded, message, encodedSize);
+
+    // Check past Nbr or the message is refused
+    sim.readerReset();
+    queueType3Blocks(FELICA_CMD_READ_WITHOUT_ENCRYPTION, 1, TYPE3_EMULATOR_READ_BLOCKS + 1);
+    queueType3Blocks(FELICA_CMD_READ_WITHOUT_ENCRYPTION, blocks + 1, 1);
+    emulator.emulate();
+    TEST_ASSERT_EQUAL(0xA2, sim.getReaderResponse(0, &length)[11]);
+    TEST_ASSERT_EQUAL(0xA8, sim.getReaderResponse(1, &length)[11]);
+
+    // a reader writes the RAM message: WriteF on, the data, WriteF off and Ln
+    unsigned int textSize = textMessage.getEncodedSize();
+    uint8_t text[32] = { 0 };
+    textMessage.encode(text);
+    emulator.setNdefSource(0);
+    TEST_ASSERT_TRUE(emulator.setNdefMessage(encoded, 40));
+    uint8_t writing[16];
+    memcpy(writing, attribute, 16);
+    writing[1] = 1;     // Nbr is not the reader's to change
+    writing[9] = 0x0F;
+    writing[10] = 0x01;
+    writing[11] = 0;
+    writing[12] = 0;
+    writing[13] = textSize;
+    uint16_t sum = 0;
+    for (int i = 0; i < 14; i++)
+    {
+        sum += writing[i];
+    }
+    writing[14] = sum >> 8;
+    writing[15] = sum;
+    uint8_t done[16];
+    memcpy(done, writing, 16);
+    done[9] = 0x00;
+    done[14] = (sum - 0x0F) >> 8;
+    done[15] = sum - 0x0F;
+
+    sim.readerReset();
+    queueType3Blocks(FELICA_CMD_WRITE_WITHOUT_ENCRYPTION, 0, 1, writing);
+    queueType3Blocks(FELICA_CMD_WRITE_WITHOUT_ENCRYPTION, 1, 2, text);
+    queueType3Blocks(FELICA_CMD_WRITE_WITHOUT_ENCRYPTION, 0, 1, done);
+    queueType3Blocks(FELICA_CMD_READ_WITHOUT_ENCRYPTION, 0, 1);
+    TEST_ASSERT_TRUE(emulator.emulate());
+    sim.setReaderFelica(false);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL(0, sim.getReaderResponse(i, &length)[10]);
+    }
+    memcpy(attribute, sim.getReaderResponse(3, &length) + 13, sizeof(attribute));
+    TEST_ASSERT_EQUAL(TYPE3_EMULATOR_READ_BLOCKS, attribute[1]);
+    TEST_ASSERT_EQUAL(0, attribute[9]);
+    TEST_ASSERT_EQUAL(textSize, attribute[13]);
+    sum = 0;
+    for (int i = 0; i < 14; i++)
+    {
+        sum += attribute[i];
+    }
+    TEST_ASSERT_EQUAL(sum, (attribute[14] << 8) | attribute[15]);
+    TEST_ASSERT_TRUE(emulator.writeOccured());
+    const uint8_t *stored;
+    uint16_t storedLength;
+    emulator.getNdefMessage(&stored, &storedLength);
+    TEST_ASSERT_EQUAL(textSize, storedLength);
+    TEST_ASSERT_EQUAL_MEMORY(text, stored, textSize);
+}
+
+int main(int argc, char **argv)
+{
+    textMessage.addTextRecord("Hello, world!");
+
+    static byte mimePayload[8192];
+    for (unsigned int i = 0; i < sizeof(mimePayload); i++)
+    {
+        mimePayload[i] = i;
+    }
+    mimeMessage.addMimeMediaRecord("application/octet-stream", mimePayload, sizeof(mimePayload));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_emulate_flash_ndef);
+    RUN_TEST(test_emulate_session);
+    RUN_TEST(test_emulate_multi_aid);
+    RUN_TEST(test_emulate_timings);
+    RUN_TEST(test_emulate_write_back);
+    RUN_TEST(test_fs_ndef_file_sink);
+    RUN_TEST(test_emulate_templates);
+    RUN_TEST(test_emulate_extended);
+    RUN_TEST(test_emulate_unaligned_read);
+    RUN_TEST(test_emulate_generator);
+    RUN_TEST(test_type2_emulate);
+    RUN_TEST(test_type3_emulate);
+    return UNITY_END();
+}
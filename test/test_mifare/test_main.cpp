@@ -0,0 +1,390 @@
+// Mifare Classic and Ultralight reads and writes against the simulated
+// PN532, run on the host:
+//
+//   pio test -e native -f test_mifare -v
+
+#include <Arduino.h>
+#include <unity.h>
+#include <PN532.h>
+#include <PN532_SIM.h>
+#include <NdefMessage.h>
+#include <NfcTag.h>
+#include <MifareClassic.h>
+#include <MifareUltralight.h>
+#include <NfcAdapter.h>
+
+static uint8_t classicUid[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+static uint8_t ultralightUid[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+
+static PN532_SIM sim;
+static PN532 nfc(sim);
+
+static NdefMessage fourRecordMessage;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void buildCounterMessage(NdefMessage &message, const char *json)
+{
+    message.addTextRecord("Hello, world!");
+    message.addUriRecord("https://www.example.com/ndef");
+    message.addMimeMediaRecord("application/json", json);
+    message.addTextRecord("Merhaba", "tr");
+}
+
+template <typename Operation>
+static uint32_t countCommands(Operation operation)
+{
+    uint32_t before = sim.getCommandCount();
+    operation();
+    return sim.getCommandCount() - before;
+}
+
+// A short text record in front of a 3000 byte payload on a 4K tag, the
+// access control path only looks at the first record and should not read
+// the rest.
+void test_classic_peek_first_record(void)
+{
+    static byte payload[3000];
+    memset(payload, 0x5A, sizeof(payload));
+    NdefMessage message;
+    message.addTextRecord("door-7");
+    message.addMimeMediaRecord("application/octet-stream", payload, sizeof(payload));
+
+    sim.insertMifareClassic4K(classicUid);
+    MifareClassic classic(nfc);
+    TEST_ASSERT_TRUE(classic.write(message, classicUid, sizeof(classicUid)));
+    NfcAdapter adapter(sim);
+
+    unsigned int records = 0;
+    uint32_t fullCommands = countCommands([&]() {
+        adapter.tagPresent();
+        NfcTag tag = adapter.read();
+        records = tag.getNdefMessage().getRecordCount();
+    });
+    TEST_ASSERT_EQUAL(2, records);
+
+    String type;
+    auto peek = [&]() {
+        adapter.tagPresent();
+        NfcTag tag = adapter.read();
+        type = tag.getNdefRecord(0).getType();
+    };
+    uint32_t peekCommands = countCommands(peek);
+    TEST_ASSERT_EQUAL_STRING("T", type.c_str());
+
+    char line[96];
+    snprintf(line, sizeof(line), "PN532 commands: %u to peek, %u for the whole message", peekCommands, fullCommands);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(peekCommands * 10 <= fullCommands);
+}
+
+// The MAD gives sectors 1 and 2 to another application, so NDEF starts at
+// block 12. A NULL TLV, a lock control TLV and a proprietary TLV that runs
+// into the next block come before the NDEF TLV.
+void test_classic_read_mad(void)
+{
+    sim.insertMifareClassic(classicUid);
+    uint8_t *memory = sim.getMemory();
+    memory[18] = 0x00; memory[19] = 0x05; // sector 1: card holder application
+    memory[20] = 0x00; memory[21] = 0x05; // sector 2
+    memset(&memory[4 * 16], 0xAA, 16);    // not NDEF, must not be read as such
+
+    int encodedSize = fourRecordMessage.getEncodedSize();
+    byte tlvs[] = {
+        0x00,                               // NULL
+        0x01, 0x03, 0xA0, 0x10, 0x44,       // lock control
+        0xFD, 0x0C, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, // proprietary
+        0x03, (byte)encodedSize             // NDEF, at data byte 20
+    };
+    byte data[9 * 16] = { 0 };
+    TEST_ASSERT_TRUE(sizeof(tlvs) + encodedSize + 1 <= sizeof(data));
+    memcpy(data, tlvs, sizeof(tlvs));
+    fourRecordMessage.encode(&data[sizeof(tlvs)]);
+    data[sizeof(tlvs) + encodedSize] = 0xFE;
+    for (int i = 0; i < 9; i++)
+    {
+        int block = 12 + i + i / 3; // sectors 3 - 5, trailers skipped
+        memcpy(&memory[block * 16], &data[i * 16], 16);
+    }
+
+    NfcAdapter adapter(sim);
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    NfcTag lazy = adapter.read();
+    TEST_ASSERT_EQUAL_STRING("T", lazy.getNdefRecord(0).getType().c_str());
+
+    MifareClassic classic(nfc);
+    NfcTag tag = classic.read(classicUid, sizeof(classicUid));
+    TEST_ASSERT_EQUAL(fourRecordMessage.getRecordCount(), tag.getNdefMessage().getRecordCount());
+
+    // writes keep the TLVs in front of the NDEF TLV
+    NdefMessage replacements[2];
+    buildCounterMessage(replacements[0], "{\"id\":42}");
+    buildCounterMessage(replacements[1], "{\"id\":43}");
+    TEST_ASSERT_TRUE(classic.write(replacements[0], classicUid, sizeof(classicUid)));
+    TEST_ASSERT_TRUE(classic.writeChanged(replacements[1], classicUid, sizeof(classicUid)));
+    TEST_ASSERT_EQUAL_MEMORY(tlvs, &memory[12 * 16], 16);
+    TEST_ASSERT_EQUAL_MEMORY(&tlvs[16], &memory[13 * 16], 4);
+    tag = classic.read(classicUid, sizeof(classicUid));
+    TEST_ASSERT_EQUAL(replacements[1].getRecordCount(), tag.getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(20, tag.getUsedBytes() - replacements[1].getEncodedSize() - 3);
+
+    // another tag in front of the same reader reads its own MAD and blocks
+    uint8_t otherUid[4] = { 0xCA, 0xFE, 0xF0, 0x0D };
+    sim.insertMifareClassic(otherUid);
+    NdefMessage other;
+    other.addTextRecord("other tag");
+    TEST_ASSERT_TRUE(MifareClassic(nfc).write(other, otherUid, sizeof(otherUid)));
+    tag = classic.read(otherUid, sizeof(otherUid));
+    TEST_ASSERT_EQUAL(1, tag.getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(0xFFFE, (unsigned long)classic.getNdefSectors());
+}
+
+void test_ultralight_peek_first_record(void)
+{
+    sim.insertUltralight(ultralightUid);
+    MifareUltralight ultralight(nfc);
+    TEST_ASSERT_TRUE(ultralight.write(fourRecordMessage, ultralightUid, sizeof(ultralightUid)));
+    NfcAdapter adapter(sim);
+
+    unsigned int records = 0;
+    uint32_t fullCommands = countCommands([&]() {
+        adapter.tagPresent();
+        NfcTag tag = adapter.read();
+        records = tag.getNdefMessage().getRecordCount();
+    });
+    TEST_ASSERT_EQUAL(fourRecordMessage.getRecordCount(), records);
+
+    String type;
+    auto peek = [&]() {
+        adapter.tagPresent();
+        NfcTag tag = adapter.read();
+        type = tag.getNdefRecord(0).getType();
+    };
+    uint32_t peekCommands = countCommands(peek);
+    TEST_ASSERT_EQUAL_STRING("T", type.c_str());
+
+    char line[96];
+    snprintf(line, sizeof(line), "PN532 commands: %u to peek, %u for the whole message", peekCommands, fullCommands);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(peekCommands < fullCommands);
+}
+
+// Capacity, lock and access state come with the tag, and writers refuse a
+// message that can't be written before the first block or page is touched.
+void test_tag_layout(void)
+{
+    NfcAdapter adapter(sim);
+
+    sim.insertMifareClassic(classicUid);
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    NfcTag classicTag = adapter.read();
+    TEST_ASSERT_TRUE(classicTag.isFormatted());
+    TEST_ASSERT_EQUAL(15 * 3 * 16, classicTag.getCapacity());
+    TEST_ASSERT_EQUAL(3, classicTag.getUsedBytes());
+    TEST_ASSERT_TRUE(!classicTag.isReadOnly());
+
+    // NFC Forum read only sector: access bits 07 8F 0F, GPB 0x43
+    uint8_t *memory = sim.getMemory();
+    memcpy(&memory[7 * 16 + 6], "\x07\x8F\x0F\x43", 4);
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    classicTag = adapter.read();
+    TEST_ASSERT_TRUE(classicTag.isReadOnly());
+    TEST_ASSERT_TRUE(classicTag.isLocked());
+    byte before[4 * 16];
+    memcpy(before, &memory[4 * 16], sizeof(before));
+    TEST_ASSERT_TRUE(!adapter.write(fourRecordMessage));
+    TEST_ASSERT_TRUE(memcmp(before, &memory[4 * 16], sizeof(before)) == 0);
+
+    sim.insertUltralight(ultralightUid);
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    NfcTag ultralightTag = adapter.read();
+    TEST_ASSERT_EQUAL(144, ultralightTag.getCapacity());
+    TEST_ASSERT_TRUE(!ultralightTag.isReadOnly());
+    TEST_ASSERT_TRUE(!ultralightTag.isLocked());
+
+    // pages 4 - 7 locked
+    memory = sim.getMemory();
+    memory[10] = 0xF0;
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    ultralightTag = adapter.read();
+    TEST_ASSERT_TRUE(ultralightTag.isReadOnly());
+    TEST_ASSERT_TRUE(ultralightTag.isLocked());
+
+    // too large for the tag, refused with reads only
+    static byte payload[200];
+    NdefMessage large;
+    large.addMimeMediaRecord("application/octet-stream", payload, sizeof(payload));
+    memory[10] = 0x00;
+    MifareUltralight ultralight(nfc);
+    memcpy(before, &memory[16], sizeof(before));
+    TEST_ASSERT_TRUE(!ultralight.write(large, ultralightUid, sizeof(ultralightUid)));
+    TEST_ASSERT_TRUE(memcmp(before, &memory[16], sizeof(before)) == 0);
+}
+
+// Two messages that differ in one character, like a counter update. Only
+// the block or page holding it is rewritten, the rest is compared against
+// what the tag holds. The first one holds the TLV length and is written
+// twice, with a zero length before the data and the new one after it.
+void test_classic_write_changed(void)
+{
+    NdefMessage messages[2];
+    buildCounterMessage(messages[0], "{\"id\":42}");
+    buildCounterMessage(messages[1], "{\"id\":43}");
+
+    sim.insertMifareClassic(classicUid);
+    MifareClassic classic(nfc);
+    TEST_ASSERT_TRUE(classic.write(messages[0], classicUid, sizeof(classicUid)));
+
+    TEST_ASSERT_TRUE(classic.writeChanged(messages[1], classicUid, sizeof(classicUid)));
+    int blocks = (getNdefTlvSize(messages[0].getEncodedSize()) + 15) / 16;
+    TEST_ASSERT_EQUAL(blocks - 2, classic.getSkippedBlocks());
+
+    NfcTag tag = classic.read(classicUid, sizeof(classicUid));
+    TEST_ASSERT_TRUE(tag.hasNdefMessage());
+}
+
+void test_ultralight_write_changed(void)
+{
+    NdefMessage messages[2];
+    buildCounterMessage(messages[0], "{\"id\":42}");
+    buildCounterMessage(messages[1], "{\"id\":43}");
+
+    sim.insertUltralight(ultralightUid);
+    MifareUltralight ultralight(nfc);
+    TEST_ASSERT_TRUE(ultralight.write(messages[0], ultralightUid, sizeof(ultralightUid)));
+
+    TEST_ASSERT_TRUE(ultralight.writeChanged(messages[1], ultralightUid, sizeof(ultralightUid)));
+    int pages = (getNdefTlvSize(messages[0].getEncodedSize()) + 3) / 4;
+    TEST_ASSERT_EQUAL(pages - 2, ultralight.getSkippedPages());
+}
+
+// The tag leaves the field after the data block or page is written, before
+// the final length: it reads as an empty message, not as the old length in
+// front of the new data. The PN532 status of the lost write is not checked,
+// so only the tag content tells.
+void test_torn_write_changed(void)
+{
+    NdefMessage messages[2];
+    buildCounterMessage(messages[0], "{\"id\":42}");
+    buildCounterMessage(messages[1], "{\"id\":43}");
+
+    sim.insertMifareClassic(classicUid);
+    MifareClassic classic(nfc);
+    TEST_ASSERT_TRUE(classic.write(messages[0], classicUid, sizeof(classicUid)));
+    sim.tearAfterWrites(2);
+    classic.writeChanged(messages[1], classicUid, sizeof(classicUid));
+    sim.tearAfterWrites(-1);
+    NfcTag tag = classic.read(classicUid, sizeof(classicUid));
+    TEST_ASSERT_EQUAL(1, tag.getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(TNF_EMPTY, tag.getNdefRecord(0).getTnf());
+    TEST_ASSERT_TRUE(classic.writeChanged(messages[1], classicUid, sizeof(classicUid)));
+    tag = classic.read(classicUid, sizeof(classicUid));
+    TEST_ASSERT_EQUAL(messages[1].getRecordCount(), tag.getNdefMessage().getRecordCount());
+
+    sim.insertUltralight(ultralightUid);
+    MifareUltralight ultralight(nfc);
+    TEST_ASSERT_TRUE(ultralight.write(messages[0], ultralightUid, sizeof(ultralightUid)));
+    sim.tearAfterWrites(2);
+    ultralight.writeChanged(messages[1], ultralightUid, sizeof(ultralightUid));
+    sim.tearAfterWrites(-1);
+    tag = ultralight.read(ultralightUid, sizeof(ultralightUid));
+    TEST_ASSERT_EQUAL(1, tag.getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(TNF_EMPTY, tag.getNdefRecord(0).getTnf());
+}
+
+// Replaces the JSON record of a message on the tag, then appends a record.
+// The replaced record keeps its size, so only the block holding the changed
+// character is written.
+void test_classic_replace_record(void)
+{
+    sim.insertMifareClassic(classicUid);
+    MifareClassic classic(nfc);
+    TEST_ASSERT_TRUE(classic.write(fourRecordMessage, classicUid, sizeof(classicUid)));
+    NfcAdapter adapter(sim);
+
+    NdefMessage counters[2];
+    counters[0].addMimeMediaRecord("application/json", "{\"id\":42}");
+    counters[1].addMimeMediaRecord("application/json", "{\"id\":43}");
+    NdefRecord records[2] = { counters[0].getRecord(0), counters[1].getRecord(0) };
+
+    adapter.tagPresent();
+    TEST_ASSERT_TRUE(adapter.replaceRecord(2, records[1]));
+    int blocks = (getNdefTlvSize(fourRecordMessage.getEncodedSize()) + 15) / 16;
+    TEST_ASSERT_EQUAL(blocks - 2, adapter.getSkippedBlocks());
+
+    adapter.tagPresent();
+    TEST_ASSERT_TRUE(adapter.replaceRecord(2, records[0]));
+    NfcTag tag = classic.read(classicUid, sizeof(classicUid));
+    NdefMessage message = tag.getNdefMessage();
+    TEST_ASSERT_EQUAL(fourRecordMessage.getEncodedSize(), message.getEncodedSize());
+    byte expected[256], actual[256];
+    TEST_ASSERT_TRUE(message.getEncodedSize() <= sizeof(actual));
+    message.encode(actual);
+    fourRecordMessage.encode(expected);
+    TEST_ASSERT_EQUAL_MEMORY(expected, actual, message.getEncodedSize());
+
+    NdefMessage extra;
+    extra.addTextRecord("appended");
+    NdefRecord appended = extra.getRecord(0);
+    adapter.tagPresent();
+    TEST_ASSERT_FALSE(adapter.replaceRecord(4, appended));
+    adapter.tagPresent();
+    TEST_ASSERT_TRUE(adapter.appendRecord(appended));
+    TEST_ASSERT_TRUE(adapter.getSkippedBlocks() > 0);
+
+    // five records are more than an NdefMessage holds, look at them one by one
+    adapter.tagPresent();
+    tag = adapter.read();
+    TEST_ASSERT_EQUAL_STRING("T", tag.getNdefRecord(3).getType().c_str());
+    TEST_ASSERT_EQUAL(appended.getPayloadLength(), tag.getNdefRecord(4).getPayloadLength());
+    TEST_ASSERT_EQUAL(0, tag.getNdefRecord(5).getTnf());
+}
+
+void test_ultralight_append_record(void)
+{
+    sim.insertUltralight(ultralightUid);
+    NfcAdapter adapter(sim);
+    NdefMessage extra;
+    extra.addTextRecord("appended");
+    NdefRecord appended = extra.getRecord(0);
+
+    // an empty tag takes the record as its whole message
+    adapter.tagPresent();
+    TEST_ASSERT_TRUE(adapter.appendRecord(appended));
+    adapter.tagPresent();
+    TEST_ASSERT_EQUAL(1, adapter.read().getNdefMessage().getRecordCount());
+
+    MifareUltralight ultralight(nfc);
+    ultralight.write(fourRecordMessage, ultralightUid, sizeof(ultralightUid));
+    adapter.tagPresent();
+    adapter.appendRecord(appended);
+
+    adapter.tagPresent();
+    NfcTag tag = adapter.read();
+    TEST_ASSERT_EQUAL_STRING("T", tag.getNdefRecord(3).getType().c_str());
+    TEST_ASSERT_EQUAL_STRING("T", tag.getNdefRecord(4).getType().c_str());
+    TEST_ASSERT_EQUAL(appended.getPayloadLength(), tag.getNdefRecord(4).getPayloadLength());
+}
+
+int main(int argc, char **argv)
+{
+    buildCounterMessage(fourRecordMessage, "{\"id\":42}");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_classic_peek_first_record);
+    RUN_TEST(test_classic_read_mad);
+    RUN_TEST(test_ultralight_peek_first_record);
+    RUN_TEST(test_tag_layout);
+    RUN_TEST(test_classic_write_changed);
+    RUN_TEST(test_ultralight_write_changed);
+    RUN_TEST(test_torn_write_changed);
+    RUN_TEST(test_classic_replace_record);
+    RUN_TEST(test_ultralight_append_record);
+    return UNITY_END();
+}
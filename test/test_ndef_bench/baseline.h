@@ -0,0 +1,32 @@
+#ifndef NDEF_BENCH_BASELINE_H
+#define NDEF_BENCH_BASELINE_H
+
+// Reference results for test_ndef_bench. Allocations per operation are exact
+// and checked; operations per second were measured on an x86-64 Linux host
+// (gcc 12, -O2) and are only reported as a percentage. After an intended
+// change, replace the table with the BASELINE lines the benchmark prints.
+
+struct BenchBaseline
+{
+    const char *name;
+    double opsPerSec;
+    double allocsPerOp;
+};
+
+static const BenchBaseline BENCH_BASELINE[] = {
+    { "encode text", 13565155, 0.00 },
+    { "decode text", 4940035, 4.00 },
+    { "encode 4 records", 10706550, 0.00 },
+    { "decode 4 records", 1963180, 16.00 },
+    { "encode 8K mime", 6200360, 0.00 },
+    { "decode 8K mime", 2411085, 4.00 },
+    { "decode chunked", 1681605, 13.00 },
+    { "classic write TLV", 1985595, 0.00 },
+    { "classic read TLV", 675322, 20.00 },
+    { "ultralight write TLV", 1000210, 0.00 },
+    { "ultralight read TLV", 274980, 36.00 },
+    { "tag construct", 1647085, 20.00 },
+    { "tag copy", 2655035, 11.00 },
+};
+
+#endif
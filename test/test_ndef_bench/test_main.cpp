@@ -0,0 +1,314 @@
+// NDEF encode/decode micro-benchmarks, run on the host:
+//
+//   pio test -e native -f test_ndef_bench -v
+//
+// Every case reports records/s, bytes/s and heap allocations per operation.
+// Allocation counts are deterministic and fail the test when they grow past
+// baseline.h; throughput depends on the machine and is only compared.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <native_alloc.h>
+#include <PN532.h>
+#include <PN532_SIM.h>
+#include <NdefMessage.h>
+#include <NfcTag.h>
+#include <MifareClassic.h>
+#include <MifareUltralight.h>
+
+#include "baseline.h"
+
+#define BENCH_MIN_MICROS 200000UL // run every case for at least 200 ms
+
+struct BenchResult
+{
+    double opsPerSec;
+    double allocsPerOp;
+    double peakBytes;
+};
+
+static uint8_t classicUid[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+static uint8_t ultralightUid[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+
+static PN532_SIM sim;
+static PN532 nfc(sim);
+
+static NdefMessage textMessage;
+static NdefMessage fourRecordMessage;
+static NdefMessage mimeMessage;
+
+static uint8_t encoded[8400];
+static int encodedSize;
+
+static const BenchBaseline *findBaseline(const char *name)
+{
+    for (unsigned int i = 0; i < sizeof(BENCH_BASELINE) / sizeof(BENCH_BASELINE[0]); i++)
+    {
+        if (strcmp(BENCH_BASELINE[i].name, name) == 0)
+        {
+            return &BENCH_BASELINE[i];
+        }
+    }
+    return 0;
+}
+
+template <typename Operation>
+static BenchResult measure(Operation operation)
+{
+    operation(); // warm up, and the first call may allocate lazily
+
+    nativeAllocReset();
+    uint32_t ops = 0;
+    unsigned long start = micros();
+    unsigned long elapsed;
+    do
+    {
+        operation();
+        ops++;
+        elapsed = micros() - start;
+    } while (elapsed < BENCH_MIN_MICROS);
+
+    NativeAllocStats stats = nativeAllocStats();
+    BenchResult result;
+    result.opsPerSec = ops * 1e6 / elapsed;
+    result.allocsPerOp = (double)stats.allocations / ops;
+    result.peakBytes = stats.peakBytesInUse - stats.bytesInUse;
+    return result;
+}
+
+static void report(const char *name, unsigned int records, unsigned int bytes, const BenchResult &result)
+{
+    char line[160];
+    snprintf(line, sizeof(line), "%-22s %12.0f rec/s %14.0f B/s %6.2f allocs/op %6.0f B peak",
+             name, result.opsPerSec * records, result.opsPerSec * bytes, result.allocsPerOp, result.peakBytes);
+    TEST_MESSAGE(line);
+
+    // in baseline.h format, to refresh the baseline after an intended change
+    printf("BASELINE    { \"%s\", %.0f, %.2f },\n", name, result.opsPerSec, result.allocsPerOp);
+
+    const BenchBaseline *baseline = findBaseline(name);
+    if (!baseline)
+    {
+        TEST_MESSAGE("no baseline for this case");
+        return;
+    }
+
+    snprintf(line, sizeof(line), "%-22s %5.0f%% of baseline throughput", name, 100.0 * result.opsPerSec / baseline->opsPerSec);
+    TEST_MESSAGE(line);
+
+    snprintf(line, sizeof(line), "%s: %.2f allocations per operation, baseline %.2f", name, result.allocsPerOp, baseline->allocsPerOp);
+    TEST_ASSERT_TRUE_MESSAGE(result.allocsPerOp <= baseline->allocsPerOp + 0.005, line);
+}
+
+static void encodeBench(const char *name, NdefMessage &message)
+{
+    unsigned int size = message.getEncodedSize();
+    TEST_ASSERT_TRUE(size <= sizeof(encoded));
+
+    BenchResult result = measure([&]() {
+        message.encode(encoded);
+    });
+    report(name, message.getRecordCount(), size, result);
+}
+
+static void decodeBench(const char *name, NdefMessage &message)
+{
+    encodedSize = message.getEncodedSize();
+    message.encode(encoded);
+
+    unsigned int records = 0;
+    BenchResult result = measure([&]() {
+        NdefMessage decoded(encoded, encodedSize);
+        records = decoded.getRecordCount();
+    });
+    TEST_ASSERT_EQUAL(message.getRecordCount(), records);
+    report(name, records, encodedSize, result);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_encode_text(void)
+{
+    encodeBench("encode text", textMessage);
+}
+
+void test_decode_text(void)
+{
+    decodeBench("decode text", textMessage);
+}
+
+void test_encode_four_records(void)
+{
+    encodeBench("encode 4 records", fourRecordMessage);
+}
+
+void test_decode_four_records(void)
+{
+    decodeBench("decode 4 records", fourRecordMessage);
+}
+
+void test_encode_8k_mime(void)
+{
+    encodeBench("encode 8K mime", mimeMessage);
+}
+
+void test_decode_8k_mime(void)
+{
+    decodeBench("decode 8K mime", mimeMessage);
+}
+
+// A 256 byte MIME payload split into four chunks. The decoder does not
+// reassemble chunks (CF is ignored), every chunk comes back as a record.
+void test_decode_chunked(void)
+{
+    const unsigned int chunkSize = 64;
+    const char type[] = "application/octet-stream";
+    int index = 0;
+
+    for (unsigned int chunk = 0; chunk < 4; chunk++)
+    {
+        byte header = 0x10; // SR
+        if (chunk == 0) header |= 0x80 | TNF_MIME_MEDIA; // MB
+        else header |= TNF_UNCHANGED;
+        if (chunk < 3) header |= 0x20; // CF
+        else header |= 0x40; // ME
+
+        encoded[index++] = header;
+        encoded[index++] = chunk == 0 ? sizeof(type) - 1 : 0;
+        encoded[index++] = chunkSize;
+        if (chunk == 0)
+        {
+            memcpy(&encoded[index], type, sizeof(type) - 1);
+            index += sizeof(type) - 1;
+        }
+        memset(&encoded[index], chunk, chunkSize);
+        index += chunkSize;
+    }
+    encodedSize = index;
+
+    unsigned int records = 0;
+    BenchResult result = measure([&]() {
+        NdefMessage decoded(encoded, encodedSize);
+        records = decoded.getRecordCount();
+    });
+    TEST_ASSERT_EQUAL(4, records);
+    report("decode chunked", records, encodedSize, result);
+}
+
+void test_classic_write(void)
+{
+    sim.insertMifareClassic(classicUid);
+    MifareClassic classic(nfc);
+
+    bool success = true;
+    BenchResult result = measure([&]() {
+        success &= classic.write(fourRecordMessage, classicUid, sizeof(classicUid));
+    });
+    TEST_ASSERT_TRUE(success);
+    report("classic write TLV", fourRecordMessage.getRecordCount(), fourRecordMessage.getEncodedSize(), result);
+}
+
+void test_classic_read(void)
+{
+    sim.insertMifareClassic(classicUid);
+    MifareClassic classic(nfc);
+    TEST_ASSERT_TRUE(classic.write(fourRecordMessage, classicUid, sizeof(classicUid)));
+
+    bool success = true;
+    BenchResult result = measure([&]() {
+        NfcTag tag = classic.read(classicUid, sizeof(classicUid));
+        success &= tag.hasNdefMessage();
+    });
+    TEST_ASSERT_TRUE(success);
+    report("classic read TLV", fourRecordMessage.getRecordCount(), fourRecordMessage.getEncodedSize(), result);
+}
+
+void test_ultralight_write(void)
+{
+    sim.insertUltralight(ultralightUid);
+    MifareUltralight ultralight(nfc);
+
+    bool success = true;
+    BenchResult result = measure([&]() {
+        success &= ultralight.write(fourRecordMessage, ultralightUid, sizeof(ultralightUid));
+    });
+    TEST_ASSERT_TRUE(success);
+    report("ultralight write TLV", fourRecordMessage.getRecordCount(), fourRecordMessage.getEncodedSize(), result);
+}
+
+void test_ultralight_read(void)
+{
+    sim.insertUltralight(ultralightUid);
+    MifareUltralight ultralight(nfc);
+    TEST_ASSERT_TRUE(ultralight.write(fourRecordMessage, ultralightUid, sizeof(ultralightUid)));
+
+    unsigned int records = 0;
+    BenchResult result = measure([&]() {
+        NfcTag tag = ultralight.read(ultralightUid, sizeof(ultralightUid));
+        records = tag.getNdefMessage().getRecordCount();
+    });
+    TEST_ASSERT_EQUAL(fourRecordMessage.getRecordCount(), records);
+    report("ultralight read TLV", records, fourRecordMessage.getEncodedSize(), result);
+}
+
+void test_tag_construct(void)
+{
+    encodedSize = fourRecordMessage.getEncodedSize();
+    fourRecordMessage.encode(encoded);
+
+    BenchResult result = measure([&]() {
+        NfcTag tag(classicUid, sizeof(classicUid), "Mifare Classic", encoded, encodedSize);
+    });
+    report("tag construct", fourRecordMessage.getRecordCount(), encodedSize, result);
+}
+
+void test_tag_copy(void)
+{
+    encodedSize = fourRecordMessage.getEncodedSize();
+    fourRecordMessage.encode(encoded);
+    NfcTag tag(classicUid, sizeof(classicUid), "Mifare Classic", encoded, encodedSize);
+
+    BenchResult result = measure([&]() {
+        NfcTag copy(tag);
+    });
+    report("tag copy", fourRecordMessage.getRecordCount(), encodedSize, result);
+}
+
+int main(int argc, char **argv)
+{
+    textMessage.addTextRecord("Hello, world!");
+
+    fourRecordMessage.addTextRecord("Hello, world!");
+    fourRecordMessage.addUriRecord("https://www.example.com/ndef");
+    fourRecordMessage.addMimeMediaRecord("application/json", "{\"id\":42}");
+    fourRecordMessage.addTextRecord("Merhaba", "tr");
+
+    static byte mimePayload[8192];
+    for (unsigned int i = 0; i < sizeof(mimePayload); i++)
+    {
+        mimePayload[i] = i;
+    }
+    mimeMessage.addMimeMediaRecord("application/octet-stream", mimePayload, sizeof(mimePayload));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_encode_text);
+    RUN_TEST(test_decode_text);
+    RUN_TEST(test_encode_four_records);
+    RUN_TEST(test_decode_four_records);
+    RUN_TEST(test_encode_8k_mime);
+    RUN_TEST(test_decode_8k_mime);
+    RUN_TEST(test_decode_chunked);
+    RUN_TEST(test_classic_write);
+    RUN_TEST(test_classic_read);
+    RUN_TEST(test_ultralight_write);
+    RUN_TEST(test_ultralight_read);
+    RUN_TEST(test_tag_construct);
+    RUN_TEST(test_tag_copy);
+    return UNITY_END();
+}
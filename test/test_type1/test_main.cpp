@@ -0,0 +1,96 @@
+// NFC Forum Type 1 (Topaz) reads and writes against the simulated PN532,
+// run on the host:
+//
+//   pio test -e native -f test_type1 -v
+
+#include <Arduino.h>
+#include <unity.h>
+#include <PN532.h>
+#include <PN532_SIM.h>
+#include <NdefMessage.h>
+#include <Type1Tag.h>
+#include <NfcAdapter.h>
+
+static uint8_t classicUid[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+
+static PN532_SIM sim;
+static PN532 nfc(sim);
+
+static NdefMessage textMessage;
+static NdefMessage fourRecordMessage;
+static NdefMessage mimeMessage;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void buildCounterMessage(NdefMessage &message, const char *json)
+{
+    message.addTextRecord("Hello, world!");
+    message.addUriRecord("https://www.example.com/ndef");
+    message.addMimeMediaRecord("application/json", json);
+    message.addTextRecord("Merhaba", "tr");
+}
+
+// Topaz: one RALL reads a static tag, a dynamic one reads the blocks past
+// the static memory with a READ8 each
+void test_type1_read_write(void)
+{
+    sim.insertType1(classicUid, false);
+    NfcAdapter adapter(sim);
+    adapter.begin(false, NFC_POLL_ISO14443A | NFC_POLL_JEWEL);
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    TEST_ASSERT_EQUAL_STRING(NFC_FORUM_TAG_TYPE_1, adapter.read().getTagType().c_str());
+    TEST_ASSERT_TRUE(adapter.write(textMessage));
+
+    Type1Tag type1(nfc);
+    TEST_ASSERT_TRUE(type1.write(fourRecordMessage, classicUid, sizeof(classicUid)));
+    NfcTag tag = type1.read(classicUid, sizeof(classicUid));
+    TEST_ASSERT_EQUAL(1, type1.getExchanges());
+    TEST_ASSERT_EQUAL(fourRecordMessage.getRecordCount(), tag.getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(104 - 12, tag.getCapacity());
+    TEST_ASSERT_FALSE(type1.write(mimeMessage, classicUid, sizeof(classicUid)));
+
+    // the lock and memory control TLVs take 10 bytes before the NDEF TLV, the
+    // message starts after its 4 byte header at 26 and goes on at 128
+    static byte payload[300];
+    memset(payload, 0x5A, sizeof(payload));
+    NdefMessage message;
+    message.addMimeMediaRecord("application/octet-stream", payload, sizeof(payload));
+    unsigned int size = message.getEncodedSize();
+
+    sim.insertType1(classicUid, true);
+    TEST_ASSERT_TRUE(type1.write(message, classicUid, sizeof(classicUid)));
+    TEST_ASSERT_EQUAL(0xE1, sim.getMemory()[8]);
+
+    tag = type1.read(classicUid, sizeof(classicUid));
+    TEST_ASSERT_EQUAL(1, tag.getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(1 + (size - (104 - 26) + 7) / 8, type1.getExchanges());
+    TEST_ASSERT_EQUAL(104 - 12 + 512 - 128, tag.getCapacity());
+    TEST_ASSERT_EQUAL(26 - 12 + size + 1, tag.getUsedBytes());
+    byte read[sizeof(payload)];
+    tag.getNdefRecord(0).getPayload(read);
+    TEST_ASSERT_EQUAL_MEMORY(payload, read, sizeof(payload));
+}
+
+int main(int argc, char **argv)
+{
+    textMessage.addTextRecord("Hello, world!");
+
+    buildCounterMessage(fourRecordMessage, "{\"id\":42}");
+
+    static byte mimePayload[8192];
+    for (unsigned int i = 0; i < sizeof(mimePayload); i++)
+    {
+        mimePayload[i] = i;
+    }
+    mimeMessage.addMimeMediaRecord("application/octet-stream", mimePayload, sizeof(mimePayload));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_type1_read_write);
+    return UNITY_END();
+}
@@ -0,0 +1,90 @@
+// NFC Forum Type 3 (FeliCa) reads and writes against the simulated PN532,
+// run on the host:
+//
+//   pio test -e native -f test_type3 -v
+
+#include <Arduino.h>
+#include <unity.h>
+#include <PN532.h>
+#include <PN532_SIM.h>
+#include <NdefMessage.h>
+#include <Type3Tag.h>
+#include <NfcAdapter.h>
+
+static PN532_SIM sim;
+static PN532 nfc(sim);
+
+static NdefMessage fourRecordMessage;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void buildCounterMessage(NdefMessage &message, const char *json)
+{
+    message.addTextRecord("Hello, world!");
+    message.addUriRecord("https://www.example.com/ndef");
+    message.addMimeMediaRecord("application/json", json);
+    message.addTextRecord("Merhaba", "tr");
+}
+
+// FeliCa with Nbr 8 and Nbw 4: writes move 4 blocks per command with WriteF
+// set in the first one, reads move as many as the PN532 frame buffer holds
+void test_type3_read_write(void)
+{
+    static const uint8_t idm[8] = { 0x01, 0x2E, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF };
+    sim.insertType3(idm, 8, 4, 64);
+    NfcAdapter typeAOnly(sim);
+    TEST_ASSERT_TRUE(!typeAOnly.tagPresent());
+    NfcAdapter adapter(sim);
+    adapter.begin(false, NFC_POLL_ALL);
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+
+    // polls that find nothing time out and are aborted, or the PN532 would
+    // still be busy with them when the FeliCa poll comes
+    sim.setEndlessPolls(true);
+    uint32_t aborts = sim.getAbortCount();
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    TEST_ASSERT_EQUAL(aborts + 3, sim.getAbortCount());
+    sim.setEndlessPolls(false);
+    TEST_ASSERT_EQUAL_STRING(NFC_FORUM_TAG_TYPE_3, adapter.read().getTagType().c_str());
+    TEST_ASSERT_TRUE(adapter.write(fourRecordMessage));
+
+    // the PN532 addresses FeliCa commands to the IDm it polled last
+    uint8_t polledIdm[8], pmm[8];
+    uint16_t systemCode;
+    TEST_ASSERT_EQUAL(1, nfc.felica_Polling(FELICA_NDEF_SYSTEM_CODE, 0, polledIdm, pmm, &systemCode));
+
+    unsigned int size = fourRecordMessage.getEncodedSize();
+    unsigned int blocks = (size + 15) / 16;
+    Type3Tag type3(nfc);
+    TEST_ASSERT_TRUE(type3.write(fourRecordMessage, (byte*)idm, sizeof(idm)));
+    TEST_ASSERT_EQUAL(1 + (1 + blocks + 3) / 4 + 1, type3.getExchanges());
+    TEST_ASSERT_EQUAL(0x00, sim.getMemory()[9]); // WriteF
+
+    // 64 byte frames hold 3 blocks, 255 byte frames the 8 of Nbr
+    BasicPN532<255> largeFrames(sim);
+    TEST_ASSERT_EQUAL(1, largeFrames.felica_Polling(FELICA_NDEF_SYSTEM_CODE, 0, polledIdm, pmm, &systemCode));
+    Type3Tag type3Large(largeFrames);
+    TEST_ASSERT_EQUAL(4, type3Large.read((byte*)idm, sizeof(idm)).getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(1 + (blocks + 7) / 8, type3Large.getExchanges());
+
+    NfcTag tag = type3.read((byte*)idm, sizeof(idm));
+    TEST_ASSERT_EQUAL(fourRecordMessage.getRecordCount(), tag.getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(1 + (blocks + 2) / 3, type3.getExchanges());
+    TEST_ASSERT_EQUAL(64 * 16, tag.getCapacity());
+    TEST_ASSERT_EQUAL(size, tag.getUsedBytes());
+}
+
+int main(int argc, char **argv)
+{
+    buildCounterMessage(fourRecordMessage, "{\"id\":42}");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_type3_read_write);
+    return UNITY_END();
+}
@@ -0,0 +1,87 @@
+// NFC Forum Type 4 reads and writes against the simulated PN532, run on
+// the host:
+//
+//   pio test -e native -f test_type4 -v
+
+#include <Arduino.h>
+#include <unity.h>
+#include <PN532.h>
+#include <PN532_SIM.h>
+#include <NdefMessage.h>
+#include <Type4Tag.h>
+#include <NfcAdapter.h>
+
+static uint8_t ultralightUid[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+
+static PN532_SIM sim;
+static PN532 nfc(sim);
+
+static NdefMessage textMessage;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+// A Type 4 tag with MLe 0xFF and MLc 0x80: a 1 KB message is read in 246
+// byte READ BINARY chunks, the first one carrying NLEN, and written in 128
+// byte UPDATE BINARY chunks with NLEN set last.
+void test_type4_read_write(void)
+{
+    sim.insertType4(ultralightUid, 0xFF, 0x80, 2048);
+    NfcAdapter adapter(sim);
+    adapter.begin(false, NFC_POLL_ISO14443A | NFC_POLL_ISO14443B);
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    TEST_ASSERT_EQUAL_STRING(NFC_FORUM_TAG_TYPE_4, adapter.read().getTagType().c_str());
+
+    static byte payload[1000];
+    for (unsigned int i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i;
+    }
+    NdefMessage message;
+    message.addMimeMediaRecord("application/octet-stream", payload, sizeof(payload));
+    unsigned int size = 2 + message.getEncodedSize();
+
+    Type4Tag type4(nfc);
+    TEST_ASSERT_TRUE(type4.write(message, ultralightUid, sizeof(ultralightUid)));
+    // SELECT application, SELECT CC, READ CC, SELECT NDEF, chunks, NLEN
+    TEST_ASSERT_EQUAL(4 + (size + 0x7F) / 0x80 + 1, type4.getExchanges());
+
+    NfcTag tag = type4.read(ultralightUid, sizeof(ultralightUid));
+    TEST_ASSERT_EQUAL(1, tag.getNdefMessage().getRecordCount());
+    TEST_ASSERT_EQUAL(4 + (size + TYPE4_MAX_READ - 1) / TYPE4_MAX_READ, type4.getExchanges());
+    TEST_ASSERT_EQUAL(2048, tag.getCapacity());
+    TEST_ASSERT_EQUAL(size, tag.getUsedBytes());
+    TEST_ASSERT_EQUAL(sizeof(payload), tag.getNdefRecord(0).getPayloadLength());
+    byte read[sizeof(payload)];
+    tag.getNdefRecord(0).getPayload(read);
+    TEST_ASSERT_EQUAL_MEMORY(payload, read, sizeof(payload));
+
+    // small enough for one UPDATE BINARY with NLEN
+    TEST_ASSERT_TRUE(type4.write(textMessage, ultralightUid, sizeof(ultralightUid)));
+    TEST_ASSERT_EQUAL(5, type4.getExchanges());
+
+    // ISO14443B with 40 byte frames: UPDATE BINARY carries 40 - 4 - 5 bytes
+    static const uint8_t pupi[4] = { 0x1B, 0x2C, 0x3D, 0x4E };
+    sim.insertType4B(pupi, 3, 0xFF, 0x80, 2048);
+    TEST_ASSERT_TRUE(nfc.readTypeBTargetID(0x00, (uint8_t*)read));
+    TEST_ASSERT_EQUAL_MEMORY(pupi, nfc.getAtqb(), sizeof(pupi));
+    TEST_ASSERT_EQUAL(40, nfc.getTargetFrameSize());
+    TEST_ASSERT_TRUE(type4.write(message, (byte*)pupi, sizeof(pupi)));
+    TEST_ASSERT_EQUAL(4 + (size + 30) / 31 + 1, type4.getExchanges());
+    TEST_ASSERT_TRUE(adapter.tagPresent());
+    TEST_ASSERT_EQUAL_STRING(NFC_FORUM_TAG_TYPE_4, adapter.read().getTagType().c_str());
+}
+
+int main(int argc, char **argv)
+{
+    textMessage.addTextRecord("Hello, world!");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_type4_read_write);
+    return UNITY_END();
+}